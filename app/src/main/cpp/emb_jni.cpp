@@ -5,6 +5,7 @@
 extern "C" {
 #include "embroidery.h"
 }
+#include "pattern_pool.h"
 
 #define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, "EMB_JNI", __VA_ARGS__)
 #define LOGI(...) __android_log_print(ANDROID_LOG_INFO,  "EMB_JNI", __VA_ARGS__)
@@ -21,23 +22,23 @@ Java_com_example_embviewer_nativebridge_EmbBridge_convertEmbToDst(
     const char* inPath = env->GetStringUTFChars(inPath_, nullptr);
     const char* outPath = env->GetStringUTFChars(outPath_, nullptr);
 
-    EmbPattern* p = emb_pattern_create();
+    EmbPattern* p = acquire_pattern();
     if (!p) { LOGE("Failed to create pattern"); goto error; }
 
     // some builds require 3 args, some 2. Use 3 with NULL.
     if (!emb_pattern_read(p, inPath, NULL)) {
         LOGE("Failed to read: %s", inPath);
-        emb_pattern_free(p);
+        release_pattern(p);
         goto error;
     }
 
     if (!emb_pattern_write(p, outPath, NULL)) {
         LOGE("Failed to write: %s", outPath);
-        emb_pattern_free(p);
+        release_pattern(p);
         goto error;
     }
 
-    emb_pattern_free(p);
+    release_pattern(p);
     env->ReleaseStringUTFChars(inPath_, inPath);
     env->ReleaseStringUTFChars(outPath_, outPath);
     return 0;
@@ -57,40 +58,25 @@ Java_com_example_embviewer_nativebridge_EmbBridge_readMetadata(
         JNIEnv* env, jobject /*thiz*/, jstring inPath_) {
 
     const char* inPath = env->GetStringUTFChars(inPath_, nullptr);
-    EmbPattern* p = emb_pattern_create();
-    if (!p) {
-        env->ReleaseStringUTFChars(inPath_, inPath);
-        return nullptr;
-    }
 
-    if (!emb_pattern_read(p, inPath, NULL)) {
-        emb_pattern_free(p);
+    // Only the header is read where the format has the counts in it,
+    // so no pattern is needed.
+    EmbProbe probe;
+    if (!emb_pattern_probe(inPath, &probe)) {
         env->ReleaseStringUTFChars(inPath_, inPath);
         return nullptr;
     }
+    env->ReleaseStringUTFChars(inPath_, inPath);
 
-    // stitch & color counts
-    int stitchCount = 0;
-    int colorCount = 0;
-#ifdef HAVE_EMB_STITCH_COUNT
-    stitchCount = emb_stitch_count(p);
-#endif
-#ifdef HAVE_EMB_THREAD_COUNT
-    colorCount = emb_thread_count(p);
-#endif
-
-    // bounding box (x, y, w, h in your version)
-    EmbRect bounds = emb_pattern_bounds(p);
-    double minX = bounds.x;
-    double minY = bounds.y;
-    double maxX = bounds.w;
-    double maxY = bounds.h;
+    int stitchCount = probe.stitches;
+    int colorCount = probe.colors;
+    double minX = probe.min_x;
+    double minY = probe.min_y;
+    double maxX = probe.max_x;
+    double maxY = probe.max_y;
     double width  = maxX - minX;
     double height = maxY - minY;
 
-    emb_pattern_free(p);
-    env->ReleaseStringUTFChars(inPath_, inPath);
-
     // Build EmbMetadata object
     jclass metaCls = env->FindClass("com/example/embviewer/nativebridge/EmbMetadata");
     if (!metaCls) return nullptr;
@@ -121,16 +107,16 @@ Java_com_example_embviewer_nativebridge_EmbBridge_renderEmbToPng(
     const char* inPath = env->GetStringUTFChars(inPath_, nullptr);
     const char* outPng = env->GetStringUTFChars(outPngPath_, nullptr);
 
-    EmbPattern* p = emb_pattern_create();
+    EmbPattern* p = acquire_pattern();
     if (!p) goto error;
 
     if (!emb_pattern_read(p, inPath, NULL)) {
-        emb_pattern_free(p);
+        release_pattern(p);
         goto error;
     }
 
     LOGE("PNG export not supported in this version of libembroidery.");
-    emb_pattern_free(p);
+    release_pattern(p);
 
     env->ReleaseStringUTFChars(inPath_, inPath);
     env->ReleaseStringUTFChars(outPngPath_, outPng);
@@ -70,49 +70,34 @@ Java_com_example_embviewer_NativeBridge_getDesignMetadata(
 
     const char* inputPath = env->GetStringUTFChars(jInputPath, nullptr);
 
-    EmbPattern* pattern = emb_pattern_create();
-    if (!pattern) {
-        env->ReleaseStringUTFChars(jInputPath, inputPath);
-        return nullptr;
-    }
-
-    if (!emb_pattern_read(pattern, inputPath, -1)) {
-        LOGE("Failed to read pattern for metadata");
-        emb_pattern_free(pattern);
+    // Only the header is read where the format has the counts in it.
+    EmbProbe probe;
+    if (!emb_pattern_probe(inputPath, &probe)) {
+        LOGE("Failed to probe pattern for metadata");
         env->ReleaseStringUTFChars(jInputPath, inputPath);
         return nullptr;
     }
+    env->ReleaseStringUTFChars(jInputPath, inputPath);
 
-    // Stitch count from EmbArray
-    int stitchCount = pattern->stitch_list ? pattern->stitch_list->count : 0;
-
-    // Bounds
-    EmbRect bounds = emb_pattern_bounds(pattern);
-    double width_mm  = bounds.w;
-    double height_mm = bounds.h;
+    int stitchCount = probe.stitches;
+    double width_mm  = probe.max_x - probe.min_x;
+    double height_mm = probe.max_y - probe.min_y;
 
     LOGI("Metadata: stitches=%d width=%.2f height=%.2f",
          stitchCount, width_mm, height_mm);
 
     jclass metaClass = env->FindClass("com/example/embviewer/DesignMetadata");
     if (!metaClass) {
-        emb_pattern_free(pattern);
-        env->ReleaseStringUTFChars(jInputPath, inputPath);
         return nullptr;
     }
 
     jmethodID ctor = env->GetMethodID(metaClass, "<init>", "(IDD)V");
     if (!ctor) {
-        emb_pattern_free(pattern);
-        env->ReleaseStringUTFChars(jInputPath, inputPath);
         return nullptr;
     }
 
     jobject metaObj = env->NewObject(metaClass, ctor,
                                      stitchCount, width_mm, height_mm);
 
-    emb_pattern_free(pattern);
-    env->ReleaseStringUTFChars(jInputPath, inputPath);
-
     return metaObj;
 }
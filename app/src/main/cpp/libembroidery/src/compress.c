@@ -47,8 +47,6 @@
 
 #include "embroidery.h"
 
-int huffman_lookup_data[2];
-
 /*!
  * Compress data "data" of length "length" to "output" with length "output_length".
  * Returns whether it was successful as an int.
@@ -99,20 +97,20 @@ huffman_build_table(huffman *h)
     }
 }
 
-/* Lookup a byte_lookup in huffman table a h return result
- * as two bytes using the memory huffman_lookup_data.
+/* Lookup a byte_lookup in huffman table a h, writing the symbol and
+ * its length in bits to a out, which the caller owns so that tables
+ * can be read from several threads.
  */
-int *huffman_lookup(huffman h, int byte_lookup)
+void
+huffman_lookup(const huffman *h, int byte_lookup, int out[2])
 {
-    int *out = huffman_lookup_data;
-    if (h.table_width == 0) {
-        out[0] = h.default_value;
+    if (h->table_width == 0) {
+        out[0] = h->default_value;
         out[1] = 0;
-        return out;
+        return;
     }
-    out[0] = h.table[byte_lookup >> (16-h.table_width)];
-    out[1] = h.lengths[out[0]];
-    return out;
+    out[0] = h->table[byte_lookup >> (16-h->table_width)];
+    out[1] = h->lengths[out[0]];
 }
 
 /* These functions represent the EmbCompress class. */
@@ -226,8 +224,9 @@ compress_load_character_huffman(compress *c)
     else {
         int i = 0;
         while (i < count) {
-            int *h = huffman_lookup(c->character_length_huffman,
-                compress_peek(c, 16));
+            int h[2];
+            huffman_lookup(&c->character_length_huffman,
+                compress_peek(c, 16), h);
             c->bit_position += h[1];
             if (h[0]==0) {
                 i += h[0];
@@ -282,12 +281,12 @@ compress_load_block(compress *c)
 int
 compress_get_token(compress *c)
 {
-    int *h;
+    int h[2];
     if (c->block_elements <= 0) {
         compress_load_block(c);
     }
     c->block_elements--;
-    h = huffman_lookup(c->character_huffman, compress_peek(c, 16));
+    huffman_lookup(&c->character_huffman, compress_peek(c, 16), h);
     c->bit_position += h[1];
     return h[0];
 }
@@ -297,8 +296,8 @@ compress_get_token(compress *c)
 int
 compress_get_position(compress *c)
 {
-    int *h, v;
-    h = huffman_lookup(c->distance_huffman, compress_peek(c, 16));
+    int h[2], v;
+    huffman_lookup(&c->distance_huffman, compress_peek(c, 16), h);
     c->bit_position += h[1];
     if (h[0] == 0) {
         return 0;
@@ -46,7 +46,13 @@
 #define FLAG_COMBINE                  15
 #define FLAG_REPORT                   16
 #define FLAG_REPORT_SHORT             17
-#define NUM_FLAGS                     18
+#define FLAG_JOBS                     18
+#define FLAG_JOBS_SHORT               19
+#define FLAG_SHARD                    20
+#define FLAG_STAGE_JOBS               21
+#define FLAG_QUEUE                    22
+#define FLAG_LOADER                   23
+#define NUM_FLAGS                     24
 
 const char *help_msg[] = {
     "Usage: emb_convert [OPTIONS] fileToRead... ",
@@ -61,6 +67,21 @@ const char *help_msg[] = {
     "                    The accepted input formats are (TO BE DETERMINED).",
     "                    The accepted output formats are (TO BE DETERMINED).",
     "",
+    "                    A directory stands for the files in it that can be read,",
+    "                    and every file and directory after the format is converted:",
+    "                        $ embroider --jobs 8 --to dst designs/ extra.pes",
+    "    -j, --jobs      Convert the files given to --to on this many threads, by",
+    "                    default one per processor. Give it before --to.",
+    "    --shard         Takes i/n and converts only the ith of n even parts of the",
+    "                    sorted file list, so several machines can split a corpus:",
+    "                        $ embroider --shard 0/4 --to dst designs/",
+    "    --stage-jobs    Takes the most threads that may prefetch, decode, transform,",
+    "                    encode and write at once, for example 2,8,8,8,2.",
+    "    --queue         The most files that wait between two stages.",
+    "    --loader        How the files are read: map (the default), pread or",
+    "                    io_uring, which reads many files at once on Linux and",
+    "                    falls back to pread elsewhere.",
+    "",
     "Analysis:",
     "    -R, --report    Report various statistics on the loaded pattern.",
     "",
@@ -72,9 +93,9 @@ const char *help_msg[] = {
     "    -v, --version    Print the version.",
     "",
     "Modify patterns:",
-    "    --combine        takes 3 arguments and combines the first",
-    "                     two by placing them atop each other and",
-    "                     outputs to the third",
+    "    --combine        takes 3 or more arguments and combines all but",
+    "                     the last by placing them atop each other and",
+    "                     outputs to the last, sharing matching threads",
     "                        $ embroider --combine a.dst b.dst output.dst",
     "EOF"
 };
@@ -106,14 +127,15 @@ const EmbString flag_list[] = {
     "--simulate",
     "--combine",
     "--report",
-    "-R"
+    "-R",
+    "--jobs",
+    "-j",
+    "--shard",
+    "--stage-jobs",
+    "--queue",
+    "--loader"
 };
 
-/*! TODO: Add capability for converting multiple files of various types to a
- * single format.
- * Currently, we only convert a single file to multiple formats.
- */
-
 /*! Construct from tables above somehow, like how getopt_long works,
  * but we're avoiding that for compatibility
  * (C90, standard libraries only).
@@ -128,14 +150,36 @@ usage(void)
     }
 }
 
-/*! TODO: Add capability for converting multiple files of various types to a
- * single format. Currently, we only convert a single file to multiple formats.
+/* Converts the files and directories after the format in argv[i+1] to
+ * that format, see emb_convert_batch_options().
  */
+int
+to_batch(char **argv, int argc, int i, EmbBatchOptions *options)
+{
+    EmbString output_fname;
+    int format;
+    if (i + 2 >= argc) {
+        puts("Usage of the to flag is:");
+        puts("    embroider [--jobs N] [--shard i/n] -t FORMAT FILE(S)");
+        puts("but it appears you entered less than 3 arguments to embroider.");
+        return 0;
+    }
+    sprintf(output_fname, "example.%s", argv[i+1]);
+    format = emb_identify_format(output_fname);
+    if (format < 0) {
+        puts("Error: format unrecognised.");
+        return 0;
+    }
+    return emb_convert_batch_options(argv + i + 2, argc - i - 2, format,
+        options, 0);
+}
+
 int
 main(int argc, char *argv[])
 {
     EmbPattern *current_pattern = emb_pattern_create();
     int i, j, result;
+    EmbBatchOptions options;
     /* If no argument is given, drop into the postscript interpreter. */
     if (argc == 1) {
         usage();
@@ -144,6 +188,7 @@ main(int argc, char *argv[])
 
     char *script = (char *)malloc(argc*100);
     int flags = argc - 1;
+    emb_batch_options_init(&options);
     for (i=1; i < argc; i++) {
         result = -1;
         /* identify what flag index the user may have entered */
@@ -157,7 +202,77 @@ main(int argc, char *argv[])
         switch (result) {
         case FLAG_TO:
         case FLAG_TO_SHORT: {
-            to_flag(argv, argc, i);
+            /* Everything after the format is a file to convert. */
+            to_batch(argv, argc, i, &options);
+            i = argc;
+            break;
+        }
+        case FLAG_JOBS:
+        case FLAG_JOBS_SHORT: {
+            if (i + 1 < argc) {
+                i++;
+                options.jobs = atoi(argv[i]);
+            }
+            else {
+                puts("--jobs takes the number of threads to convert on.");
+            }
+            break;
+        }
+        case FLAG_SHARD: {
+            if (i + 1 < argc && sscanf(argv[i+1], "%d/%d", &options.shard,
+                    &options.shards) == 2
+                && options.shards > 0 && options.shard >= 0
+                && options.shard < options.shards) {
+                i++;
+            }
+            else {
+                puts("--shard takes i/n, with i from 0 to n-1.");
+                options.shard = 0;
+                options.shards = 1;
+            }
+            break;
+        }
+        case FLAG_STAGE_JOBS: {
+            int *s = options.stage_jobs;
+            if (i + 1 < argc && sscanf(argv[i+1], "%d,%d,%d,%d,%d",
+                    s, s+1, s+2, s+3, s+4) == EMB_STAGES) {
+                i++;
+            }
+            else {
+                puts("--stage-jobs takes five counts separated by commas.");
+                for (j = 0; j < EMB_STAGES; j++) {
+                    s[j] = 0;
+                }
+            }
+            break;
+        }
+        case FLAG_LOADER: {
+            const char *loaders[3] = {"map", "pread", "io_uring"};
+            int found = 0;
+            if (i + 1 < argc) {
+                for (j = 0; j < 3; j++) {
+                    if (!strcmp(argv[i+1], loaders[j])) {
+                        options.loader = j;
+                        found = 1;
+                    }
+                }
+            }
+            if (found) {
+                i++;
+            }
+            else {
+                puts("--loader takes map, pread or io_uring.");
+            }
+            break;
+        }
+        case FLAG_QUEUE: {
+            if (i + 1 < argc) {
+                i++;
+                options.queue_size = atoi(argv[i]);
+            }
+            else {
+                puts("--queue takes the number of files to wait between stages.");
+            }
             break;
         }
         case FLAG_HELP:
@@ -231,18 +346,26 @@ main(int argc, char *argv[])
         case FLAG_COMBINE: {
             if (i + 3 < argc) {
                 EmbPattern *out;
-                EmbPattern *p1 = emb_pattern_create();
-                EmbPattern *p2 = emb_pattern_create();
-                emb_pattern_readAuto(p1, argv[i+1]);
-                emb_pattern_readAuto(p2, argv[i+2]);
-                out = emb_pattern_combine(p1, p2);
-                emb_pattern_writeAuto(out, argv[i+3]);
-                emb_pattern_free(p1);
-                emb_pattern_free(p2);
-                emb_pattern_free(out);
+                int n = argc - i - 2;
+                EmbPattern **inputs = (EmbPattern **)malloc(n*sizeof(EmbPattern*));
+                for (j = 0; j < n; j++) {
+                    inputs[j] = emb_pattern_create();
+                    emb_pattern_readAuto(inputs[j], argv[i+1+j]);
+                }
+                out = emb_pattern_combine_n(inputs, n,
+                    EMB_COMBINE_MERGE_THREADS | EMB_COMBINE_STRIP_ENDS);
+                if (out) {
+                    emb_pattern_writeAuto(out, argv[argc-1]);
+                    emb_pattern_free(out);
+                }
+                for (j = 0; j < n; j++) {
+                    emb_pattern_free(inputs[j]);
+                }
+                safe_free(inputs);
+                i = argc;
             }
             else {
-                puts("--combine takes 3 arguments and you have supplied <3.");
+                puts("--combine takes 3 or more arguments and you have supplied <3.");
             }
             break;
         }
@@ -38,6 +38,7 @@ extern "C" {
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdarg.h>
+#include <string.h>
 #include <inttypes.h>
 #endif
 
@@ -51,6 +52,7 @@ extern "C" {
 #define MAX_ARGS                      10
 #define MAX_TABLE_LENGTH             500
 #define CHUNK_SIZE                   128
+#define EMB_ARENA_BLOCK_SIZE         (64*1024)
 #define MAX_PATTERN_VARIABLES         20
 
 /* MACROS
@@ -69,6 +71,10 @@ extern "C" {
 #define SEQUIN                      0x08    /*!< Add a sequin at the current co-ordinates. */
 #define END                         0x10    /*!< End of program. */
 
+/* Flags for emb_pattern_combine_n(). */
+#define EMB_COMBINE_MERGE_THREADS   0x01    /*!< Share threads of equal color and catalog number. */
+#define EMB_COMBINE_STRIP_ENDS      0x02    /*!< Drop the END stitch of all but the last pattern. */
+
 /* Format identifiers */
 #define EMB_FORMAT_100                 0
 #define EMB_FORMAT_10O                 1
@@ -453,6 +459,67 @@ typedef void *EmbMem;
 
 /*! The basic array type. */
 typedef struct EmbArray_ EmbArray;
+typedef struct EmbArena_ EmbArena;
+typedef struct EmbStringPool_ EmbStringPool;
+typedef struct EmbPatternPool_ EmbPatternPool;
+typedef struct EmbContext_ EmbContext;
+typedef struct EmbWork_ EmbWork;
+
+/*! A byte stream that the format readers and writers work through.
+ *
+ * It is backed either by a stdio file or by a block of memory, so every
+ * format can be read from a caller's buffer as well as from disk. Files
+ * opened for reading are mapped, or loaded whole where mapping is not
+ * available, so readers always decode straight out of memory. Files
+ * opened only for writing gather their output in a block of memory that
+ * is handed to stdio whole, see emb_stream_flush().
+ */
+typedef struct EmbStream_
+{
+    FILE *file;          /*! stdio backing, null for memory */
+    unsigned char *data; /*! memory backing, or the write buffer of a file */
+    size_t length;       /*! bytes of valid data */
+    size_t capacity;     /*! allocated bytes, 0 for a read-only view */
+    size_t position;
+    long offset;         /*! file position of data[0] for a buffered file */
+    int flags;
+    int fd;              /*! descriptor a memory stream is written to on close, or -1 */
+    /*! the read or write of the stream, while there is one */
+    EmbWork *work;
+    int stopped;         /*! the EMB_LIMIT that stopped the stream, if one did */
+    /*! holds records taken from a stdio stream, see emb_stream_take() */
+    unsigned char scratch[16];
+} EmbStream;
+
+#define EMB_STREAM_EOF                 0x01
+#define EMB_STREAM_ERROR               0x02
+#define EMB_STREAM_OWNED               0x04
+#define EMB_STREAM_MAPPED              0x08
+#define EMB_STREAM_BUFFERED            0x10
+
+/*! Results of an EmbLineParser, see emb_stream_parse_lines(). */
+#define EMB_LINE_ERROR                  -1
+#define EMB_LINE_SKIP                    0
+#define EMB_LINE_RECORD                  1
+#define EMB_LINE_STOP                    2
+
+/*! Parses one line of text of a length bytes into a record. */
+typedef int (*EmbLineParser)(const char *line, size_t length, void *record);
+
+/*! A unit of work for emb_parallel_for(). */
+typedef void (*EmbTask)(void *data, int index);
+
+/*! Room needed for a number written by emb_format_real() and friends. */
+#define EMB_NUMBER_LENGTH               32
+
+/*! Size of the write buffer of a file opened for writing. */
+#define EMB_STREAM_WRITE_SIZE     (64*1024)
+
+/*! Stitches handed from reader to writer at a time when transcoding. */
+#define EMB_STITCH_BATCH              4096
+
+/*! Stitches a reader gathers before adding them to the pattern. */
+#define EMB_STITCH_BATCH_SIZE          256
 
 /*! . */
 typedef struct EmbTime_
@@ -560,11 +627,29 @@ typedef struct EmbLine_
     EmbColor color;
 } EmbLine;
 
-/*! . */
+/*! A dense, growable list of vertices. */
+typedef struct EmbVectorList_ {
+    EmbVector *data;
+    int count;
+    int size;
+    EmbArena *arena; /*! owner of the storage, null for the heap */
+} EmbVectorList;
+
+/*! A dense, growable list of integer identifiers, such as path flags. */
+typedef struct EmbIdList_ {
+    int32_t *data;
+    int count;
+    int size;
+    EmbArena *arena; /*! owner of the storage, null for the heap */
+} EmbIdList;
+
+/*! The flagList is optional and when present has one entry per point,
+ * using the path flag codes above.
+ */
 typedef struct EmbPath_
 {
-    EmbArray* pointList;
-    EmbArray* flagList;
+    EmbVectorList* pointList;
+    EmbIdList* flagList;
     int lineType;
     EmbColor color;
 } EmbPath;
@@ -578,12 +663,25 @@ typedef struct EmbStitch_
     int color; /*! color number for this stitch */
 } EmbStitch;
 
-/*! . */
+/*! Columnar copy of a stitch list, see emb_stitch_columns_load(). */
+typedef struct EmbStitchColumns_
+{
+    float *x;
+    float *y;
+    int32_t *attr; /*! flags in the low 8 bits, color index above them */
+    int count;
+    int size;
+} EmbStitchColumns;
+
+/*! The strings are never null. Threads in a pattern point into its
+ * string pool, see emb_pattern_addThread(), and the brand tables point
+ * to string literals.
+ */
 typedef struct EmbThread_
 {
     EmbColor color;
-    EmbString description;
-    EmbString catalogNumber;
+    const char *description;
+    const char *catalogNumber;
 } EmbThread;
 
 /*! . */
@@ -632,8 +730,8 @@ typedef int EmbFlag;
 typedef struct EmbSatinOutline_
 {
     int length;
-    EmbArray* side1;
-    EmbArray* side2;
+    EmbVectorList* side1;
+    EmbVectorList* side2;
 } EmbSatinOutline;
 
 /*! . */
@@ -709,20 +807,6 @@ typedef struct IntMap_ {
     int value;
 } IntMap;
 
-/*! . */
-typedef struct EmbVectorList_ {
-    EmbVector *data;
-    int count;
-    int size;
-} EmbVectorList;
-
-/*! . */
-typedef struct EmbIdList_ {
-    int32_t *data;
-    int count;
-    int size;
-} EmbIdList;
-
 /*! . */
 struct EmbArray_ {
     EmbGeometry *geometry;
@@ -731,6 +815,9 @@ struct EmbArray_ {
     int count;
     int length;
     int type;
+    EmbArena *arena; /*! owner of the storage, null for the heap */
+    int heap_lists; /*! geometry holds lists from outside the arena */
+    int *refs; /*! arrays sharing the storage, null if it is not shared */
 };
 
 /*! . */
@@ -757,6 +844,20 @@ typedef struct Design_ {
 
 #define END_SYMBOL            "__END__"
 
+/*! Parts of a design that the readers fill in, see the read_options of
+ * EmbPattern. Sections of a file for parts left out are seeked over
+ * rather than parsed where the format allows.
+ */
+#define EMB_READ_STITCHES             0x01
+#define EMB_READ_THREADS              0x02
+#define EMB_READ_GEOMETRY             0x04
+#define EMB_READ_METADATA             0x08
+#define EMB_READ_SIDECAR_COLORS       0x10 /*! an .edr, .rgb, .col or .inf beside the file */
+#define EMB_READ_ALL                  0x1F
+
+/*! A mask of the EMB_READ parts. */
+typedef int EmbReadOptions;
+
 /*! The pattern type variable denotes the type that was read in and uses the
  * EMB_FORMAT contants. Changing this type directly would break how data is
  * interpreted,
@@ -771,16 +872,94 @@ typedef struct EmbPattern_
     EmbArray *thread_list;
     EmbArray *stitch_list;
     EmbArray *geometry;
+    EmbArena *arena;
     EmbLayer layer[EMB_MAX_LAYERS];
     int currentColorIndex;
 
-    EmbString design_name;
-    EmbString category;
-    EmbString author;
-    EmbString keywords;
-    EmbString comments;
+    EmbStringPool *strings;
+
+    /*! The design metadata, interned with emb_pattern_intern(). */
+    const char *design_name;
+    const char *category;
+    const char *author;
+    const char *keywords;
+    const char *comments;
+
+    /*! The library state this pattern is read and written with. */
+    EmbContext *context;
+
+    /*! The parts of a design reading into this pattern fills in,
+     * EMB_READ_ALL unless set. */
+    EmbReadOptions read_options;
+
+    /*! The read or write of this pattern, while there is one. */
+    EmbWork *work;
+    int stopped;           /*! the EMB_LIMIT that stopped the last one */
 } EmbPattern;
 
+/*! Stitches gathered by a reader to be added to a pattern together,
+ * see emb_stitch_batch_rel().
+ */
+typedef struct EmbStitchBatch_
+{
+    EmbPattern *pattern;
+    int relative;          /*! whether the stitches are moves */
+    int count;
+    EmbStitch stitch[EMB_STITCH_BATCH_SIZE];
+} EmbStitchBatch;
+
+/*! Decodes a stitch only file a batch of stitches at a time, see
+ * emb_stitch_reader_open().
+ */
+typedef struct EmbStitchReader_
+{
+    EmbStream *file;
+    int format;
+    /*! the threads and header fields read so far, with the stitches
+     * decoded but not yet handed out */
+    EmbPattern *pattern;
+    int done;
+} EmbStitchReader;
+
+/*! Where the fields of an EmbProbe came from, see emb_pattern_probe(). */
+#define EMB_PROBE_HEADER                 0
+#define EMB_PROBE_SCAN                   1
+#define EMB_PROBE_DECODE                 2
+
+/*! What a design holds, found without loading it, see
+ * emb_pattern_probe().
+ */
+typedef struct EmbProbe_
+{
+    int format;
+    int source;            /*! one of the EMB_PROBE sources */
+    int stitches;          /*! as the header counts them, if it does */
+    int colors;
+    /*! the extents of the stitches in mm */
+    EmbReal min_x;
+    EmbReal min_y;
+    EmbReal max_x;
+    EmbReal max_y;
+} EmbProbe;
+
+/*! Encodes stitches to a stitch only file as they arrive, see
+ * emb_stitch_writer_open().
+ */
+typedef struct EmbStitchWriter_
+{
+    EmbStream *file;
+    int format;
+    long start;            /*! file position of the header */
+    int count;             /*! stitches encoded so far */
+    int started;
+    EmbStitch last;        /*! the last stitch received */
+    EmbVector position;    /*! where the encoded stitches have reached */
+    EmbReal maxX, maxY, minX, minY;
+    /*! holds a stitch split into moves the format can encode */
+    EmbArray *split;
+    EmbContext *context;
+} EmbStitchWriter;
+
 /*! . */
 typedef struct EmbFormatList_
 {
@@ -1018,6 +1197,130 @@ typedef struct SvgAttribute_
     char* value;
 } SvgAttribute;
 
+/*! Where the SVG reader is between one token and the next. */
+typedef struct EmbSvgParser_
+{
+    int creator;
+    int expect;
+    int multi_value;
+    int element;
+    int n_attributes;
+    SvgAttribute attributes[1000];
+    char attribute[1000];
+    char value[1000];
+} EmbSvgParser;
+
+/*! Why a read or write stopped early, see EmbLimits. */
+#define EMB_LIMIT_NONE                   0
+#define EMB_LIMIT_STITCHES               1
+#define EMB_LIMIT_BYTES                  2
+#define EMB_LIMIT_TIME                   3
+#define EMB_LIMIT_CANCELLED              4
+
+/*! Stitches added between looks at the clock, memory and cancel flag. */
+#define EMB_LIMIT_CHECK_EVERY         4096
+
+/*! What a single read or write may use before it is stopped, for files
+ * that cannot be trusted. Set with emb_limits_init() then changed as
+ * needed; zero bytes or seconds leave them unlimited.
+ */
+typedef struct EmbLimits_
+{
+    int max_stitches;      /*! in the pattern, 0 for MAX_STITCHES */
+    size_t max_bytes;      /*! held by the pattern and the buffers of the work */
+    double max_seconds;    /*! since the work started */
+    /*! stops the work once set to non-zero, from any thread */
+    int *cancel;
+    int check_every;       /*! stitches between looks at the others */
+} EmbLimits;
+
+/*! A read or write in progress and the limits it is held to, kept by
+ * its caller for as long as it runs, see emb_work_begin().
+ */
+struct EmbWork_
+{
+    EmbLimits limits;      /*! of the context, when it started */
+    EmbPattern *pattern;   /*! read or written, or null */
+    EmbStream *stream;
+    double started;        /*! see emb_wall_clock() */
+    size_t held;           /*! bytes held by the pattern when it started */
+    int stopped;           /*! the EMB_LIMIT that stopped it, if one did */
+};
+
+#define EMB_CSD_SUB_MASK_SIZE        479
+#define EMB_CSD_XOR_MASK_SIZE        501
+
+/*! Everything the library changes as it works, so that threads with
+ * their own context can convert files at the same time. The functions
+ * that take no context use the one from emb_context_default().
+ */
+struct EmbContext_
+{
+    int verbose;
+    unsigned int seed;     /*! for emb_context_random_thread() */
+    int pes_version;       /*! of the last PES file read */
+    long stitches;         /*! moved by the last conversion */
+    EmbLimits limits;      /*! of each read and write */
+    char csd_sub_mask[EMB_CSD_SUB_MASK_SIZE];
+    char csd_xor_mask[EMB_CSD_XOR_MASK_SIZE];
+    EmbSvgParser svg;
+};
+
+/*! Stages of a batch conversion, see emb_convert_batch(). */
+#define EMB_STAGE_PREFETCH               0
+#define EMB_STAGE_DECODE                 1
+#define EMB_STAGE_TRANSFORM              2
+#define EMB_STAGE_ENCODE                 3
+#define EMB_STAGE_WRITE                  4
+#define EMB_STAGES                       5
+
+/*! How the batch converter reads its input, see emb_loader_create(). */
+#define EMB_LOADER_MAP                   0
+#define EMB_LOADER_PREAD                 1
+#define EMB_LOADER_IO_URING              2
+
+/*! Files an io_uring loader reads at once. */
+#define EMB_LOADER_DEPTH                32
+
+/*! Size of each buffer an io_uring loader reads into; larger files are
+ * finished with pread(). */
+#define EMB_LOADER_BUFFER_SIZE   (64*1024)
+
+/*! Loads many input files into memory at once, see loader.c. */
+typedef struct EmbLoader_ EmbLoader;
+
+/*! Settings of a batch conversion, see emb_batch_options_init(). */
+typedef struct EmbBatchOptions_
+{
+    int jobs;              /*! workers, 0 for one per processor */
+    int shard;             /*! which of the shards to convert */
+    int shards;
+    /*! most workers in each stage at once, 0 for no limit */
+    int stage_jobs[EMB_STAGES];
+    int queue_size;        /*! files waiting between stages, 0 for two per worker */
+    int loader;            /*! one of the EMB_LOADER kinds */
+} EmbBatchOptions;
+
+/*! Where the time of a batch conversion went, for one stage. */
+typedef struct EmbStageReport_
+{
+    int files;             /*! worked on by the stage */
+    double seconds;        /*! spent in it, summed over the workers */
+    int max_depth;         /*! most files waiting for it at once */
+    double mean_depth;     /*! files waiting, seen as each one arrived */
+} EmbStageReport;
+
+/*! Totals of a batch conversion, see emb_convert_batch(). */
+typedef struct EmbBatchReport_
+{
+    int files;             /*! given, after sharding */
+    int failed;
+    long stitches;         /*! moved by the files that converted */
+    double seconds;        /*! wall clock time of the whole batch */
+    int loader;            /*! the kind of loader used, after any fallback */
+    EmbStageReport stage[EMB_STAGES];
+} EmbBatchReport;
+
 /* . */
 typedef struct Huffman {
     int default_value;
@@ -1046,10 +1349,22 @@ EMB_PUBLIC void to_flag(char **argv, int argc, int i);
 EMB_PUBLIC void formats(void);
 EMB_PUBLIC int emb_identify_format(const char *ending);
 EMB_PUBLIC int convert(const char *inf, const char *outf);
+EMB_PUBLIC int convert_context(EmbContext *ctx, const char *inf,
+    const char *outf);
+EMB_PUBLIC int emb_convert_batch(char **paths, int count, int format,
+    int jobs, int shard, int shards, EmbBatchReport *report);
+EMB_PUBLIC void emb_batch_options_init(EmbBatchOptions *options);
+EMB_PUBLIC EmbLoader* emb_loader_create(int kind);
+EMB_PUBLIC int emb_loader_kind(const EmbLoader *loader);
+EMB_PUBLIC int emb_loader_load(EmbLoader *loader, char **files, int count,
+    EmbStream **streams);
+EMB_PUBLIC void emb_loader_free(EmbLoader *loader);
+EMB_PUBLIC int emb_convert_batch_options(char **paths, int count, int format,
+    const EmbBatchOptions *options, EmbBatchReport *report);
 
 EMB_PUBLIC EmbVector emb_vector(EmbReal x, EmbReal y);
 
-EMB_PUBLIC char read_n_bytes(FILE *file, unsigned char *data, unsigned int length);
+EMB_PUBLIC char read_n_bytes(EmbStream *file, unsigned char *data, unsigned int length);
 EMB_PUBLIC bool string_equal(char *a, const char *b);
 EMB_PUBLIC int parse_floats(const char *line, float result[], int n);
 EMB_PUBLIC int parse_vector(const char *line, EmbVector *v);
@@ -1076,9 +1391,57 @@ EMB_PUBLIC EmbColor embColor_fromHexStr(char* val);
 EMB_PUBLIC int embColor_distance(EmbColor a, EmbColor b);
 
 /* Arrays */
+EMB_PUBLIC EmbArena* emb_arena_create(size_t block_size);
+EMB_PUBLIC void* emb_arena_alloc(EmbArena* arena, size_t size);
+EMB_PUBLIC void* emb_arena_realloc(EmbArena* arena, void* ptr,
+    size_t old_size, size_t size);
+EMB_PUBLIC void emb_arena_release(EmbArena* arena, void* ptr, size_t size);
+EMB_PUBLIC EmbArena* emb_arena_share(EmbArena* arena);
+EMB_PUBLIC void emb_arena_reset(EmbArena* arena);
+EMB_PUBLIC void emb_arena_free(EmbArena* arena);
+
+EMB_PUBLIC EmbStringPool* emb_string_pool_create(EmbArena* arena);
+EMB_PUBLIC const char* emb_string_pool_intern(EmbStringPool* pool,
+    const char* s);
+
+EMB_PUBLIC EmbStream* emb_stream_open(const char *fileName, const char *mode);
+EMB_PUBLIC EmbStream* emb_stream_memory(const void *data, size_t length);
+EMB_PUBLIC EmbStream* emb_stream_buffer(size_t capacity);
+EMB_PUBLIC EmbStream* emb_stream_fd(int fd, const char *mode);
+EMB_PUBLIC int emb_stream_close(EmbStream *stream);
+EMB_PUBLIC size_t emb_fread(void *ptr, size_t size, size_t n, EmbStream *stream);
+EMB_PUBLIC size_t emb_stream_write_slow(const void *ptr, size_t size, size_t n,
+    EmbStream *stream);
+EMB_PUBLIC int emb_stream_flush(EmbStream *stream);
+EMB_PUBLIC const unsigned char* emb_stream_take_slow(EmbStream *stream, size_t n);
+EMB_PUBLIC int emb_stream_getc_slow(EmbStream *stream);
+EMB_PUBLIC void emb_stream_read_error(const char *type);
+EMB_PUBLIC int emb_fseek(EmbStream *stream, long offset, int whence);
+EMB_PUBLIC long emb_ftell(EmbStream *stream);
+EMB_PUBLIC int emb_feof(EmbStream *stream);
+EMB_PUBLIC int emb_fprintf(EmbStream *stream, const char *format, ...);
+EMB_PUBLIC int emb_fputs(const char *s, EmbStream *stream);
+EMB_PUBLIC const char* emb_stream_line(EmbStream *stream, char *buffer, int size,
+    size_t *length);
+EMB_PUBLIC int emb_stream_parse_lines(EmbStream *stream, EmbLineParser parse,
+    size_t record_size, int separator, void **records, int *count);
+EMB_PUBLIC const char* emb_parse_real(const char *s, const char *end,
+    EmbReal *value);
+EMB_PUBLIC const char* emb_parse_int(const char *s, const char *end, int *value);
+EMB_PUBLIC int emb_cpu_count(void);
+EMB_PUBLIC void emb_parallel_for(EmbTask task, void *data, int count, int threads);
+EMB_PUBLIC void emb_write_int(EmbStream *stream, long value);
+EMB_PUBLIC void emb_write_fixed(EmbStream *stream, double value, int places);
+EMB_PUBLIC void emb_write_real(EmbStream *stream, EmbReal value);
+
 EMB_PUBLIC EmbArray* emb_array_create(int type);
+EMB_PUBLIC EmbArray* emb_array_create_in(EmbArena* arena, int type);
 EMB_PUBLIC int emb_array_resize(EmbArray *g);
-EMB_PUBLIC void emb_array_copy(EmbArray *dst, EmbArray *src);
+EMB_PUBLIC int emb_array_reserve(EmbArray *g, int n);
+EMB_PUBLIC int emb_array_copy(EmbArray *dst, EmbArray *src);
+EMB_PUBLIC EmbArray* emb_array_share(EmbArray *a);
+EMB_PUBLIC int emb_array_writable(EmbArray *a);
+EMB_PUBLIC int emb_array_truncate(EmbArray *a, int count);
 EMB_PUBLIC int emb_array_add_geometry(EmbArray *a, EmbGeometry g);
 EMB_PUBLIC int emb_array_add_arc(EmbArray* g, EmbArc arc);
 EMB_PUBLIC int emb_array_add_circle(EmbArray* g, EmbCircle circle);
@@ -1096,6 +1459,15 @@ EMB_PUBLIC int emb_array_addThread(EmbArray* g, EmbThread p);
 EMB_PUBLIC int emb_array_addVector(EmbArray* g, EmbVector);
 EMB_PUBLIC void emb_array_free(EmbArray* p);
 
+EMB_PUBLIC EmbVectorList* emb_vector_list_create(int size);
+EMB_PUBLIC EmbVectorList* emb_vector_list_create_in(EmbArena* arena, int size);
+EMB_PUBLIC int emb_vector_list_add(EmbVectorList* list, EmbVector v);
+EMB_PUBLIC void emb_vector_list_free(EmbVectorList* list);
+EMB_PUBLIC EmbIdList* emb_id_list_create(int size);
+EMB_PUBLIC EmbIdList* emb_id_list_create_in(EmbArena* arena, int size);
+EMB_PUBLIC int emb_id_list_add(EmbIdList* list, int32_t id);
+EMB_PUBLIC void emb_id_list_free(EmbIdList* list);
+
 EMB_PUBLIC EmbLine emb_line_make(EmbReal x1, EmbReal y1, EmbReal x2, EmbReal y2);
 
 EMB_PUBLIC EmbVector emb_line_normalVector(EmbLine line, int clockwise);
@@ -1151,9 +1523,9 @@ EMB_PUBLIC const char* threadColorName(unsigned int color, int brand);
 EMB_PUBLIC void embTime_initNow(EmbTime* t);
 EMB_PUBLIC EmbTime embTime_time(EmbTime* t);
 
-EMB_PUBLIC int emb_generate_satin_outline(EmbArray* lines,
+EMB_PUBLIC int emb_generate_satin_outline(EmbVectorList* lines,
     EmbReal thickness, EmbSatinOutline* result);
-EMB_PUBLIC EmbArray* emb_satin_outline_render(EmbSatinOutline* result,
+EMB_PUBLIC EmbVectorList* emb_satin_outline_render(EmbSatinOutline* result,
     EmbReal density);
 
 EMB_PUBLIC EmbGeometry *emb_geometry_init(int type_in);
@@ -1162,13 +1534,43 @@ EMB_PUBLIC void emb_geometry_move(EmbGeometry *obj, EmbVector delta);
 EMB_PUBLIC EmbRect embGeometry_boundingRect(EmbGeometry *obj);
 EMB_PUBLIC void emb_vulcanize(EmbGeometry *obj);
 
+EMB_PUBLIC EmbContext* emb_context_create(void);
+EMB_PUBLIC void emb_context_free(EmbContext* ctx);
+EMB_PUBLIC EmbContext* emb_context_default(void);
+EMB_PUBLIC EmbThread emb_context_random_thread(EmbContext* ctx);
+EMB_PUBLIC void emb_limits_init(EmbLimits* limits);
+EMB_PUBLIC int emb_work_begin(EmbWork* work, EmbContext* ctx,
+    EmbPattern* p, EmbStream* stream);
+EMB_PUBLIC int emb_work_end(EmbWork* work, const char* function);
+EMB_PUBLIC int emb_work_stop(EmbWork* work, int reason);
+EMB_PUBLIC int emb_work_limit(EmbWork* work, long stitches, size_t bytes);
+
+/*! The verbosity of the default context, as older callers set it. */
+#define emb_verbose (emb_context_default()->verbose)
+
 EMB_PUBLIC EmbPattern* emb_pattern_create(void);
+EMB_PUBLIC EmbPattern* emb_pattern_create_context(EmbContext* ctx);
+EMB_PUBLIC int emb_pattern_reset(EmbPattern* p);
+EMB_PUBLIC EmbPattern* emb_pattern_clone(EmbPattern* p);
+EMB_PUBLIC int emb_pattern_reserve_stitches(EmbPattern* p, int n);
+EMB_PUBLIC int emb_pattern_limit(EmbPattern* p, int n, size_t bytes);
+EMB_PUBLIC EmbPatternPool* emb_pattern_pool_create(int size);
+EMB_PUBLIC EmbPattern* emb_pattern_pool_get(EmbPatternPool* pool);
+EMB_PUBLIC void emb_pattern_pool_put(EmbPatternPool* pool, EmbPattern* p);
+EMB_PUBLIC void emb_pattern_pool_free(EmbPatternPool* pool);
 EMB_PUBLIC void emb_pattern_hideStitchesOverLength(EmbPattern* p, int length);
 EMB_PUBLIC void emb_pattern_fixColorCount(EmbPattern* p);
+EMB_PUBLIC const char* emb_pattern_intern(EmbPattern* p, const char* s);
 EMB_PUBLIC int emb_pattern_addThread(EmbPattern* p, EmbThread thread);
 EMB_PUBLIC void emb_pattern_addStitchAbs(EmbPattern* p, EmbReal x, EmbReal y,
     int flags, int isAutoColorIndex);
 EMB_PUBLIC void emb_pattern_addStitchRel(EmbPattern* p, EmbReal dx, EmbReal dy, int flags, int isAutoColorIndex);
+EMB_PUBLIC void emb_pattern_append_stitches_abs(EmbPattern* p,
+    const EmbStitch *stitches, int n);
+EMB_PUBLIC void emb_pattern_append_stitches_rel(EmbPattern* p,
+    const EmbStitch *stitches, int n);
+EMB_PUBLIC void emb_stitch_batch_init(EmbStitchBatch *batch, EmbPattern *p);
+EMB_PUBLIC void emb_stitch_batch_flush(EmbStitchBatch *batch);
 EMB_PUBLIC void emb_pattern_changeColor(EmbPattern* p, int index);
 EMB_PUBLIC void emb_pattern_free(EmbPattern* p);
 EMB_PUBLIC void emb_pattern_print(EmbPattern *pattern);
@@ -1185,11 +1587,15 @@ EMB_PUBLIC void emb_pattern_flipVertical(EmbPattern* p);
 EMB_PUBLIC void emb_pattern_flip(EmbPattern* p, int horz, int vert);
 EMB_PUBLIC void emb_pattern_combineJumpStitches(EmbPattern* p);
 EMB_PUBLIC void emb_pattern_correctForMaxStitchLength(EmbPattern* p, EmbReal maxStitchLength, EmbReal maxJumpLength);
+EMB_PUBLIC int emb_stitch_split(EmbArray *out, EmbStitch prev, EmbStitch st,
+    EmbReal maxStitchLength, EmbReal maxJumpLength);
 EMB_PUBLIC void emb_pattern_center(EmbPattern* p);
 EMB_PUBLIC void emb_pattern_loadExternalColorFile(EmbPattern* p, const char* fileName);
 EMB_PUBLIC void emb_pattern_convertGeometry(EmbPattern* p);
 EMB_PUBLIC void emb_pattern_details(EmbPattern *p);
 EMB_PUBLIC EmbPattern *emb_pattern_combine(EmbPattern *p1, EmbPattern *p2);
+EMB_PUBLIC EmbPattern *emb_pattern_combine_n(EmbPattern **patterns, int n,
+    int flags);
 EMB_PUBLIC int emb_pattern_color_count(EmbPattern *pattern, EmbColor startColor);
 EMB_PUBLIC void emb_pattern_end(EmbPattern* p);
 EMB_PUBLIC void emb_pattern_crossstitch(EmbPattern *pattern, EmbImage *, int threshhold);
@@ -1213,6 +1619,35 @@ EMB_PUBLIC void emb_move_polylines_to_stitches(EmbPattern* pattern);
 
 EMB_PUBLIC char emb_pattern_read(EmbPattern *pattern, const char* fileName, int format);
 EMB_PUBLIC char emb_pattern_write(EmbPattern *pattern, const char* fileName, int format);
+EMB_PUBLIC char emb_pattern_read_stream(EmbPattern *pattern, EmbStream *stream,
+    const char* fileName, int format);
+EMB_PUBLIC char emb_pattern_write_stream(EmbPattern *pattern, EmbStream *stream,
+    const char* fileName, int format);
+EMB_PUBLIC char emb_pattern_read_memory(EmbPattern *pattern, const void* buf,
+    size_t len, int format);
+EMB_PUBLIC char emb_pattern_read_fd(EmbPattern *pattern, int fd, int format);
+EMB_PUBLIC char emb_pattern_write_fd(EmbPattern *pattern, int fd, int format);
+
+EMB_PUBLIC int emb_stitch_stream_supported(int format);
+EMB_PUBLIC EmbStitchReader* emb_stitch_reader_open(EmbStream *file,
+    const char *fileName, int format);
+EMB_PUBLIC int emb_stitch_reader_next(EmbStitchReader *reader, EmbStitch *batch,
+    int max);
+EMB_PUBLIC void emb_stitch_reader_close(EmbStitchReader *reader);
+EMB_PUBLIC int emb_pattern_probe(const char *fileName, EmbProbe *probe);
+EMB_PUBLIC int emb_pattern_probe_memory(const void *buf, size_t len,
+    int format, EmbProbe *probe);
+EMB_PUBLIC int emb_pattern_probe_fd(int fd, int format, EmbProbe *probe);
+EMB_PUBLIC int emb_pattern_probe_stream(EmbStream *file, const char *fileName,
+    int format, EmbProbe *probe);
+EMB_PUBLIC EmbStitchWriter* emb_stitch_writer_open(EmbStream *file, int format);
+EMB_PUBLIC int emb_stitch_writer_put(EmbStitchWriter *writer,
+    const EmbStitch *batch, int count);
+EMB_PUBLIC int emb_stitch_writer_close(EmbStitchWriter *writer, int threads);
+EMB_PUBLIC int emb_transcode_stitches(EmbStream *in, const char *fileName,
+    int from, EmbStream *out, int to);
+EMB_PUBLIC int emb_transcode_stitches_context(EmbContext *ctx, EmbStream *in,
+    const char *fileName, int from, EmbStream *out, int to);
 
 EMB_PUBLIC char emb_pattern_readAuto(EmbPattern *pattern, const char* fileName);
 EMB_PUBLIC char emb_pattern_writeAuto(EmbPattern *pattern, const char* fileName);
@@ -1228,6 +1663,19 @@ EMB_PUBLIC int emb_pattern_count_type(EmbPattern *pattern, int flags);
 EMB_PUBLIC void emb_color_histogram(EmbPattern *pattern, int **bins);
 EMB_PUBLIC void emb_length_histogram(EmbPattern *pattern, int *bins);
 EMB_PUBLIC double emb_total_thread_length(EmbPattern *pattern);
+
+EMB_PUBLIC int emb_stitch_columns_load(EmbStitchColumns *c,
+    const EmbArray *stitch_list);
+EMB_PUBLIC int emb_stitch_columns_store(const EmbStitchColumns *c,
+    EmbArray *stitch_list);
+EMB_PUBLIC EmbStitch emb_stitch_columns_get(const EmbStitchColumns *c, int i);
+EMB_PUBLIC void emb_stitch_columns_free(EmbStitchColumns *c);
+EMB_PUBLIC EmbRect emb_stitch_columns_bounds(const EmbStitchColumns *c);
+EMB_PUBLIC double emb_stitch_columns_length(const EmbStitchColumns *c);
+EMB_PUBLIC EmbReal emb_stitch_columns_longest(const EmbStitchColumns *c);
+EMB_PUBLIC int emb_stitch_columns_count(const EmbStitchColumns *c, int flag);
+EMB_PUBLIC void emb_stitch_columns_transform(EmbStitchColumns *c,
+    EmbReal scale_x, EmbReal scale_y, EmbReal dx, EmbReal dy);
 EMB_PUBLIC double emb_total_thread_of_color(EmbPattern *pattern, int thread_index);
 
 EMB_PUBLIC int emb_approx(EmbVector point1, EmbVector point2);
@@ -1289,42 +1737,349 @@ EMB_PUBLIC void char_ptr_to_string(char *dst, char *src);
 EMB_PUBLIC int stringInArray(const char *s, const char **array);
 EMB_PUBLIC char *copy_trim(char const *s);
 EMB_PUBLIC char* emb_optOut(EmbReal num, char* str);
+EMB_PUBLIC int emb_format_int(char *buf, long value);
+EMB_PUBLIC int emb_format_fixed(char *buf, double value, int places);
+EMB_PUBLIC int emb_format_real(char *buf, EmbReal value);
 EMB_PUBLIC void safe_free(void *data);
 
 /* DIFAT functions */
 EMB_PUBLIC unsigned int entriesInDifatSector(bcf_file_difat* fat);
 EMB_PUBLIC bcf_file_fat* bcfFileFat_create(const unsigned int sectorSize);
-EMB_PUBLIC void loadFatFromSector(bcf_file_fat* fat, FILE* file);
+EMB_PUBLIC void loadFatFromSector(bcf_file_fat* fat, EmbStream* file);
 EMB_PUBLIC void bcf_file_fat_free(bcf_file_fat** fat);
 EMB_PUBLIC bcf_directory* CompoundFileDirectory(const unsigned int maxNumberOfDirectoryEntries);
 EMB_PUBLIC void bcf_directory_free(bcf_directory** dir);
 EMB_PUBLIC unsigned int numberOfEntriesInDifatSector(bcf_file_difat* fat);
 void bcf_file_difat_free(bcf_file_difat* difat);
-bcf_file_header bcfFileHeader_read(FILE* file);
+bcf_file_header bcfFileHeader_read(EmbStream* file);
 int bcfFileHeader_isValid(bcf_file_header header);
 void bcf_file_free(bcf_file* bcfFile);
 
 double emb_stitch_length(EmbStitch prev_st, EmbStitch st);
 
-int emb_readline(FILE* file, char *line, int maxLength);
-
-int16_t emb_read_i16(FILE* f);
-uint16_t emb_read_u16(FILE* f);
-int32_t emb_read_i32(FILE* f);
-uint32_t emb_read_u32(FILE* f);
-int16_t emb_read_i16be(FILE* f);
-uint16_t emb_read_u16be(FILE* f);
-int32_t emb_read_i32be(FILE* f);
-uint32_t emb_read_u32be(FILE* f);
-
-void emb_write_i16(FILE* f, int16_t data);
-void emb_write_u16(FILE* f, uint16_t data);
-void emb_write_i32(FILE* f, int32_t data);
-void emb_write_u32(FILE* f, uint32_t data);
-void emb_write_i16be(FILE* f, int16_t data);
-void emb_write_u16be(FILE* f, uint16_t data);
-void emb_write_i32be(FILE* f, int32_t data);
-void emb_write_u32be(FILE* f, uint32_t data);
+int emb_readline(EmbStream* file, char *line, int maxLength);
+
+/*! Cursor reads.
+ *
+ * The hot readers decode records straight out of the stream's memory:
+ * emb_stream_take() returns a pointer to the next a n bytes and steps
+ * over them, or 0 at the end of the stream. Only the rare cases, a
+ * stdio stream or a short read, leave the inline path.
+ */
+static inline const unsigned char *
+emb_stream_take(EmbStream *stream, size_t n)
+{
+    if (!stream->file && stream->position <= stream->length
+        && n <= stream->length - stream->position) {
+        const unsigned char *p = stream->data + stream->position;
+        stream->position += n;
+        return p;
+    }
+    return emb_stream_take_slow(stream, n);
+}
+
+/*! Reads one byte, returning EOF at the end of the stream. */
+static inline int
+emb_fgetc(EmbStream *stream)
+{
+    if (!stream->file && stream->position < stream->length) {
+        return stream->data[stream->position++];
+    }
+    return emb_stream_getc_slow(stream);
+}
+
+static inline uint16_t
+emb_get_u16(const unsigned char *b)
+{
+    return (uint16_t)(b[0] | (b[1] << 8));
+}
+
+static inline uint16_t
+emb_get_u16be(const unsigned char *b)
+{
+    return (uint16_t)((b[0] << 8) | b[1]);
+}
+
+static inline uint32_t
+emb_get_u32(const unsigned char *b)
+{
+    return (uint32_t)b[0] | ((uint32_t)b[1] << 8)
+        | ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+static inline uint32_t
+emb_get_u32be(const unsigned char *b)
+{
+    return ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16)
+        | ((uint32_t)b[2] << 8) | (uint32_t)b[3];
+}
+
+/*! Read a little-endian unsigned 16-bit integer. */
+static inline uint16_t
+emb_read_u16(EmbStream* f)
+{
+    const unsigned char *b = emb_stream_take(f, 2);
+    if (!b) {
+        emb_stream_read_error("uint16_t");
+        return 0;
+    }
+    return emb_get_u16(b);
+}
+
+/*! Read a little-endian signed 16-bit integer. */
+static inline int16_t
+emb_read_i16(EmbStream* f)
+{
+    const unsigned char *b = emb_stream_take(f, 2);
+    if (!b) {
+        emb_stream_read_error("int16_t");
+        return 0;
+    }
+    return (int16_t)emb_get_u16(b);
+}
+
+/*! Read a little-endian unsigned 32-bit integer. */
+static inline uint32_t
+emb_read_u32(EmbStream* f)
+{
+    const unsigned char *b = emb_stream_take(f, 4);
+    if (!b) {
+        emb_stream_read_error("uint32_t");
+        return 0;
+    }
+    return emb_get_u32(b);
+}
+
+/*! Read a little-endian signed 32-bit integer. */
+static inline int32_t
+emb_read_i32(EmbStream* f)
+{
+    const unsigned char *b = emb_stream_take(f, 4);
+    if (!b) {
+        emb_stream_read_error("int32_t");
+        return 0;
+    }
+    return (int32_t)emb_get_u32(b);
+}
+
+/*! Read a big-endian unsigned 16-bit integer. */
+static inline uint16_t
+emb_read_u16be(EmbStream* f)
+{
+    const unsigned char *b = emb_stream_take(f, 2);
+    if (!b) {
+        emb_stream_read_error("uint16_t");
+        return 0;
+    }
+    return emb_get_u16be(b);
+}
+
+/*! Read a big-endian signed 16-bit integer. */
+static inline int16_t
+emb_read_i16be(EmbStream* f)
+{
+    const unsigned char *b = emb_stream_take(f, 2);
+    if (!b) {
+        emb_stream_read_error("int16_t");
+        return 0;
+    }
+    return (int16_t)emb_get_u16be(b);
+}
+
+/*! Read a big-endian unsigned 32-bit integer. */
+static inline uint32_t
+emb_read_u32be(EmbStream* f)
+{
+    const unsigned char *b = emb_stream_take(f, 4);
+    if (!b) {
+        emb_stream_read_error("uint32_t");
+        return 0;
+    }
+    return emb_get_u32be(b);
+}
+
+/*! Read a big-endian signed 32-bit integer. */
+static inline int32_t
+emb_read_i32be(EmbStream* f)
+{
+    const unsigned char *b = emb_stream_take(f, 4);
+    if (!b) {
+        emb_stream_read_error("int32_t");
+        return 0;
+    }
+    return (int32_t)emb_get_u32be(b);
+}
+
+/*! Buffered writes.
+ *
+ * The writers append to the stream's memory, which for a file is the
+ * write buffer that emb_stream_flush() hands to stdio in one block, so
+ * encoding a stitch costs a copy rather than a library call. Only a full
+ * buffer, an unbuffered stdio stream or a memory stream that has to grow
+ * leave the inline path.
+ */
+
+/*! Writes a n items of a size bytes, as fwrite() does. */
+static inline size_t
+emb_fwrite(const void *ptr, size_t size, size_t n, EmbStream *stream)
+{
+    size_t count = size * n;
+    if (count > 0 && stream->position <= stream->length
+        && stream->position <= stream->capacity
+        && count <= stream->capacity - stream->position) {
+        memcpy(stream->data + stream->position, ptr, count);
+        stream->position += count;
+        if (stream->position > stream->length) {
+            stream->length = stream->position;
+        }
+        return n;
+    }
+    return emb_stream_write_slow(ptr, size, n, stream);
+}
+
+/*! Writes the byte a c, returning it or EOF on failure. */
+static inline int
+emb_fputc(int c, EmbStream *stream)
+{
+    unsigned char b = (unsigned char)c;
+    if (emb_fwrite(&b, 1, 1, stream) != 1) {
+        return EOF;
+    }
+    return b;
+}
+
+static inline void
+emb_put_u16(unsigned char *b, uint16_t data)
+{
+    b[0] = (unsigned char)(data & 0xFF);
+    b[1] = (unsigned char)(data >> 8);
+}
+
+static inline void
+emb_put_u16be(unsigned char *b, uint16_t data)
+{
+    b[0] = (unsigned char)(data >> 8);
+    b[1] = (unsigned char)(data & 0xFF);
+}
+
+static inline void
+emb_put_u32(unsigned char *b, uint32_t data)
+{
+    b[0] = (unsigned char)(data & 0xFF);
+    b[1] = (unsigned char)((data >> 8) & 0xFF);
+    b[2] = (unsigned char)((data >> 16) & 0xFF);
+    b[3] = (unsigned char)(data >> 24);
+}
+
+static inline void
+emb_put_u32be(unsigned char *b, uint32_t data)
+{
+    b[0] = (unsigned char)(data >> 24);
+    b[1] = (unsigned char)((data >> 16) & 0xFF);
+    b[2] = (unsigned char)((data >> 8) & 0xFF);
+    b[3] = (unsigned char)(data & 0xFF);
+}
+
+/*! Write a little-endian unsigned 16-bit integer. */
+static inline void
+emb_write_u16(EmbStream* f, uint16_t data)
+{
+    unsigned char b[2];
+    emb_put_u16(b, data);
+    emb_fwrite(b, 1, 2, f);
+}
+
+/*! Write a little-endian signed 16-bit integer. */
+static inline void
+emb_write_i16(EmbStream* f, int16_t data)
+{
+    emb_write_u16(f, (uint16_t)data);
+}
+
+/*! Write a little-endian unsigned 32-bit integer. */
+static inline void
+emb_write_u32(EmbStream* f, uint32_t data)
+{
+    unsigned char b[4];
+    emb_put_u32(b, data);
+    emb_fwrite(b, 1, 4, f);
+}
+
+/*! Write a little-endian signed 32-bit integer. */
+static inline void
+emb_write_i32(EmbStream* f, int32_t data)
+{
+    emb_write_u32(f, (uint32_t)data);
+}
+
+/*! Write a big-endian unsigned 16-bit integer. */
+static inline void
+emb_write_u16be(EmbStream* f, uint16_t data)
+{
+    unsigned char b[2];
+    emb_put_u16be(b, data);
+    emb_fwrite(b, 1, 2, f);
+}
+
+/*! Write a big-endian signed 16-bit integer. */
+static inline void
+emb_write_i16be(EmbStream* f, int16_t data)
+{
+    emb_write_u16be(f, (uint16_t)data);
+}
+
+/*! Write a big-endian unsigned 32-bit integer. */
+static inline void
+emb_write_u32be(EmbStream* f, uint32_t data)
+{
+    unsigned char b[4];
+    emb_put_u32be(b, data);
+    emb_fwrite(b, 1, 4, f);
+}
+
+/*! Write a big-endian signed 32-bit integer. */
+static inline void
+emb_write_i32be(EmbStream* f, int32_t data)
+{
+    emb_write_u32be(f, (uint32_t)data);
+}
+
+/*! Adds a stitch to a batch, flushing it first if it is full or holds
+ * stitches of the other kind. An END goes to the pattern at once.
+ */
+static inline void
+emb_stitch_batch_add(EmbStitchBatch *batch, EmbReal x, EmbReal y, int flags,
+    int relative)
+{
+    EmbStitch *st;
+    if (batch->count == EMB_STITCH_BATCH_SIZE
+        || (batch->count > 0 && batch->relative != relative)) {
+        emb_stitch_batch_flush(batch);
+    }
+    batch->relative = relative;
+    st = batch->stitch + batch->count++;
+    st->x = x;
+    st->y = y;
+    st->flags = flags;
+    st->color = 0;
+    if (flags & END) {
+        emb_stitch_batch_flush(batch);
+    }
+}
+
+/*! Batched emb_pattern_addStitchRel() with automatic color changes. */
+static inline void
+emb_stitch_batch_rel(EmbStitchBatch *batch, EmbReal dx, EmbReal dy, int flags)
+{
+    emb_stitch_batch_add(batch, dx, dy, flags, 1);
+}
+
+/*! Batched emb_pattern_addStitchAbs() with automatic color changes. */
+static inline void
+emb_stitch_batch_abs(EmbStitchBatch *batch, EmbReal x, EmbReal y, int flags)
+{
+    emb_stitch_batch_add(batch, x, y, flags, 0);
+}
 
 void embColor_read(void *f, EmbColor *c, int toRead);
 void embColor_write(void *f, EmbColor c, int toWrite);
@@ -1347,31 +2102,31 @@ int compress_get_token(compress *c);
 int compress_get_position(compress *c);
 
 /* Function Declarations */
-void readPecStitches(EmbPattern* pattern, FILE* file);
-void writePecStitches(EmbPattern* pattern, FILE* file, const char* filename);
+void readPecStitches(EmbPattern* pattern, EmbStream* file);
+void writePecStitches(EmbPattern* pattern, EmbStream* file, const char* filename);
 
-void pfaffEncode(FILE* file, int x, int y, int flags);
+void pfaffEncode(EmbStream* file, int x, int y, int flags);
 
-int read_bytes(FILE *file, int n, char *str);
-int write_bytes(FILE *file, int n, char *str);
+int read_bytes(EmbStream *file, int n, char *str);
+int write_bytes(EmbStream *file, int n, char *str);
 
-int bcfFile_read(FILE* file, bcf_file* bcfFile);
-void* GetFile(bcf_file* bcfFile, FILE* file, char* fileToFind);
+int bcfFile_read(EmbStream* file, bcf_file* bcfFile);
+void* GetFile(bcf_file* bcfFile, EmbStream* file, char* fileToFind);
 
-void binaryReadString(FILE* file, char *buffer, int maxLength);
-void binaryReadUnicodeString(FILE* file, char *buffer, const int stringLength);
+void binaryReadString(EmbStream* file, char *buffer, int maxLength);
+void binaryReadUnicodeString(EmbStream* file, char *buffer, const int stringLength);
 
-void fpad(FILE* f, char c, int n);
+void fpad(EmbStream* f, char c, int n);
 
-void write_24bit(FILE* file, int);
-int check_header_present(FILE* file, int minimum_header_length);
+void write_24bit(EmbStream* file, int);
+int check_header_present(EmbStream* file, int minimum_header_length);
 
-bcf_file_difat* bcf_difat_create(FILE* file, unsigned int fatSectors, const unsigned int sectorSize);
-unsigned int readFullSector(FILE* file, bcf_file_difat* bcfFile, unsigned int* numberOfDifatEntriesStillToRead);
-bcf_directory_entry* CompoundFileDirectoryEntry(FILE* file);
-void readNextSector(FILE* file, bcf_directory* dir);
+bcf_file_difat* bcf_difat_create(EmbStream* file, unsigned int fatSectors, const unsigned int sectorSize);
+unsigned int readFullSector(EmbStream* file, bcf_file_difat* bcfFile, unsigned int* numberOfDifatEntriesStillToRead);
+bcf_directory_entry* CompoundFileDirectoryEntry(EmbStream* file);
+void readNextSector(EmbStream* file, bcf_directory* dir);
 
-void write_24bit(FILE* file, int);
+void write_24bit(EmbStream* file, int);
 
 EmbReal pfaffDecode(unsigned char a1, unsigned char a2, unsigned char a3);
 
@@ -1381,10 +2136,24 @@ unsigned char mitEncodeStitch(EmbReal value);
 int mitDecodeStitch(unsigned char value);
 
 void encode_t01_record(unsigned char b[3], int x, int y, int flags);
-int decode_t01_record(unsigned char b[3], int *x, int *y, int *flags);
+int decode_t01_record(const unsigned char b[3], int *x, int *y, int *flags);
 
 int encode_tajima_ternary(unsigned char b[3], int x, int y);
-void decode_tajima_ternary(unsigned char b[3], int *x, int *y);
+void decode_tajima_ternary(const unsigned char b[3], int *x, int *y);
+void decode_tajima_records(const unsigned char *b, int n, int16_t *x, int16_t *y);
+
+int dstReadHeader(EmbPattern* pattern, EmbStream* file);
+int dstProbeHeader(EmbStream* file, EmbProbe* probe);
+int dstReadRecord(EmbPattern* pattern, EmbStream* file);
+int dstReadParallel(EmbPattern* pattern, EmbStream* file);
+void dstWriteHeader(EmbStream* file, int stitches, int threads, EmbRect bounds);
+void dstWriteStitch(EmbStream* file, EmbStitch st, EmbVector *pos,
+    int verbose);
+int expReadRecord(EmbPattern* pattern, EmbStream* file);
+void expWriteStitch(EmbStream* file, EmbStitch st, EmbVector *pos);
+int husProbeHeader(EmbStream* file, EmbProbe* probe);
+int jefProbeHeader(EmbStream* file, EmbProbe* probe);
+int pecProbe(EmbStream* file, EmbProbe* probe);
 
 /* NON-MACRO CONSTANTS
  ******************************************************************************/
@@ -1393,7 +2162,6 @@ extern EmbFormatList formatTable[numberOfFormats];
 extern const EmbReal embConstantPi;
 extern EmbBrand brand_codes[100];
 extern EmbThread black_thread;
-extern int emb_verbose;
 extern const char *version_string;
 extern const EmbThread dxf_colors[];
 extern const EmbThread jef_colors[];
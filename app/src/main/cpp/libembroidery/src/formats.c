@@ -30,9 +30,16 @@
 
 #include "embroidery.h"
 
-/* For debugging purposes. */
+#if defined(__unix__) || defined(__APPLE__)
+#include <pthread.h>
+#define EMB_THREADS
+#endif
+
+/* For debugging purposes, as verbose as the context of the pattern
+ * being read or written.
+ */
 #define REPORT_VALUE(X, TYPE) \
-    if (emb_verbose>1) { \
+    if (pattern->context->verbose>1) { \
         printf(#X ": %" #TYPE "\n", X); \
     }
 #define REPORT_INT(X)          REPORT_VALUE(X, d)
@@ -46,7 +53,7 @@
  * seperate all declarations to the start of the scope they sit in.
  */
 #define LOAD_U8(FILE, X) \
-    if (fread(&X, 1, 1, FILE) != 1) { \
+    if (emb_fread(&X, 1, 1, FILE) != 1) { \
         puts("ERROR: failed to read single byte from file."); \
     } \
     REPORT_INT(X)
@@ -78,143 +85,144 @@
     X = emb_read_i32be(FILE); \
     REPORT_INT(X)
 
-char read100(EmbPattern *pattern, FILE* file);
-char write100(EmbPattern *pattern, FILE* file);
-char read10o(EmbPattern *pattern, FILE* file);
-char write10o(EmbPattern *pattern, FILE* file);
-char readArt(EmbPattern *pattern, FILE* file);
-char writeArt(EmbPattern *pattern, FILE* file);
-char readBmc(EmbPattern *pattern, FILE* file);
-char writeBmc(EmbPattern *pattern, FILE* file);
-char readBro(EmbPattern *pattern, FILE* file);
-char writeBro(EmbPattern *pattern, FILE* file);
-char readCnd(EmbPattern *pattern, FILE* file);
-char writeCnd(EmbPattern *pattern, FILE* file);
-char readCol(EmbPattern *pattern, FILE* file);
-char writeCol(EmbPattern *pattern, FILE* file);
-char readCsd(EmbPattern *pattern, FILE* file);
-char writeCsd(EmbPattern *pattern, FILE* file);
-char readCsv(EmbPattern *pattern, FILE* file);
-char writeCsv(EmbPattern *pattern, FILE* file);
-char readDat(EmbPattern *pattern, FILE* file);
-char writeDat(EmbPattern *pattern, FILE* file);
-char readDem(EmbPattern *pattern, FILE* file);
-char writeDem(EmbPattern *pattern, FILE* file);
-char readDsb(EmbPattern *pattern, FILE* file);
-char writeDsb(EmbPattern *pattern, FILE* file);
-char readDst(EmbPattern *pattern, FILE* file);
-char writeDst(EmbPattern *pattern, FILE* file);
-char readDsz(EmbPattern *pattern, FILE* file);
-char writeDsz(EmbPattern *pattern, FILE* file);
-char readDxf(EmbPattern *pattern, FILE* file);
-char writeDxf(EmbPattern *pattern, FILE* file);
-char readEdr(EmbPattern *pattern, FILE* file);
-char writeEdr(EmbPattern *pattern, FILE* file);
-char readEmd(EmbPattern *pattern, FILE* file);
-char writeEmd(EmbPattern *pattern, FILE* file);
-char readExp(EmbPattern *pattern, FILE* file);
-char writeExp(EmbPattern *pattern, FILE* file);
-char readExy(EmbPattern *pattern, FILE* file);
-char writeExy(EmbPattern *pattern, FILE* file);
-char readEys(EmbPattern *pattern, FILE* file);
-char writeEys(EmbPattern *pattern, FILE* file);
-char readFxy(EmbPattern *pattern, FILE* file);
-char writeFxy(EmbPattern *pattern, FILE* file);
-char readGc(EmbPattern *pattern, FILE* file);
-char writeGc(EmbPattern *pattern, FILE* file);
-char readGnc(EmbPattern *pattern, FILE* file);
-char writeGnc(EmbPattern *pattern, FILE* file);
-char readGt(EmbPattern *pattern, FILE* file);
-char writeGt(EmbPattern *pattern, FILE* file);
-char readHus(EmbPattern *pattern, FILE* file);
-char writeHus(EmbPattern *pattern, FILE* file);
-char readInb(EmbPattern *pattern, FILE* file);
-char writeInb(EmbPattern *pattern, FILE* file);
-char readInf(EmbPattern *pattern, FILE* file);
-char writeInf(EmbPattern *pattern, FILE* file);
-char readJef(EmbPattern *pattern, FILE* file);
-char writeJef(EmbPattern *pattern, FILE* file);
-char readKsm(EmbPattern *pattern, FILE* file);
-char writeKsm(EmbPattern *pattern, FILE* file);
-char readMax(EmbPattern *pattern, FILE* file);
-char writeMax(EmbPattern *pattern, FILE* file);
-char readMit(EmbPattern *pattern, FILE* file);
-char writeMit(EmbPattern *pattern, FILE* file);
-char readNew(EmbPattern *pattern, FILE* file);
-char writeNew(EmbPattern *pattern, FILE* file);
-char readOfm(EmbPattern *pattern, FILE* file);
-char writeOfm(EmbPattern *pattern, FILE* file);
-char readPcd(EmbPattern *pattern, const char *fileName, FILE* file);
-char writePcd(EmbPattern *pattern, FILE* file);
-char readPcm(EmbPattern *pattern, FILE* file);
-char writePcm(EmbPattern *pattern, FILE* file);
-char readPcq(EmbPattern *pattern, const char *fileName, FILE* file);
-char writePcq(EmbPattern *pattern, FILE* file);
-char readPcs(EmbPattern *pattern, const char *fileName, FILE* file);
-char writePcs(EmbPattern *pattern, FILE* file);
-char readPec(EmbPattern *pattern, const char *fileName, FILE* file);
-char writePec(EmbPattern *pattern, const char *fileName,  FILE* file);
-char readPel(EmbPattern *pattern, FILE* file);
-char writePel(EmbPattern *pattern, FILE* file);
-char readPem(EmbPattern *pattern, FILE* file);
-char writePem(EmbPattern *pattern, FILE* file);
-char readPes(EmbPattern *pattern, const char *fileName, FILE* file);
-char writePes(EmbPattern *pattern, const char *fileName, FILE* file);
-char readPhb(EmbPattern *pattern, FILE* file);
-char writePhb(EmbPattern *pattern, FILE* file);
-char readPhc(EmbPattern *pattern, FILE* file);
-char writePhc(EmbPattern *pattern, FILE* file);
-char readPlt(EmbPattern *pattern, FILE* file);
-char writePlt(EmbPattern *pattern, FILE* file);
-char readRgb(EmbPattern *pattern, FILE* file);
-char writeRgb(EmbPattern *pattern, FILE* file);
-char readSew(EmbPattern *pattern, FILE* file);
-char writeSew(EmbPattern *pattern, FILE* file);
-char readShv(EmbPattern *pattern, FILE* file);
-char writeShv(EmbPattern *pattern, FILE* file);
-char readSst(EmbPattern *pattern, FILE* file);
-char writeSst(EmbPattern *pattern, FILE* file);
-char readStx(EmbPattern *pattern, FILE* file);
-char writeStx(EmbPattern *pattern, FILE* file);
-char readSvg(EmbPattern *pattern, FILE* file);
-char writeSvg(EmbPattern *pattern, FILE* file);
-char readT01(EmbPattern *pattern, FILE* file);
-char writeT01(EmbPattern *pattern, FILE* file);
-char readT09(EmbPattern *pattern, FILE* file);
-char writeT09(EmbPattern *pattern, FILE* file);
-char readTap(EmbPattern *pattern, FILE* file);
-char writeTap(EmbPattern *pattern, FILE* file);
-char readThr(EmbPattern *pattern, FILE* file);
-char writeThr(EmbPattern *pattern, FILE* file);
-char readTxt(EmbPattern *pattern, FILE* file);
-char writeTxt(EmbPattern *pattern, FILE* file);
-char readU00(EmbPattern *pattern, FILE* file);
-char writeU00(EmbPattern *pattern, FILE* file);
-char readU01(EmbPattern *pattern, FILE* file);
-char writeU01(EmbPattern *pattern, FILE* file);
-char readVip(EmbPattern *pattern, FILE* file);
-char writeVip(EmbPattern *pattern, FILE* file);
-char readVp3(EmbPattern *pattern, FILE* file);
-char writeVp3(EmbPattern *pattern, FILE* file);
-char readXxx(EmbPattern *pattern, FILE* file);
-char writeXxx(EmbPattern *pattern, FILE* file);
-char readZsk(EmbPattern *pattern, FILE* file);
-char writeZsk(EmbPattern *pattern, FILE* file);
-
-int read_descriptions(FILE* file, EmbPattern* pattern);
-void readHoopName(FILE* file, EmbPattern* pattern);
-void readImageString(FILE* file, EmbPattern* pattern);
-void readProgrammableFills(FILE* file, EmbPattern* pattern);
-void readMotifPatterns(FILE* file, EmbPattern* pattern);
-void readFeatherPatterns(FILE* file, EmbPattern* pattern);
-void readThreads(FILE* file, EmbPattern* pattern);
-
-void readPESHeaderV5(FILE* file, EmbPattern* pattern);
-void readPESHeaderV6(FILE* file, EmbPattern* pattern);
-void readPESHeaderV7(FILE* file, EmbPattern* pattern);
-void readPESHeaderV8(FILE* file, EmbPattern* pattern);
-void readPESHeaderV9(FILE* file, EmbPattern* pattern);
-void readPESHeaderV10(FILE* file, EmbPattern* pattern);
+char read100(EmbPattern *pattern, EmbStream* file);
+char write100(EmbPattern *pattern, EmbStream* file);
+char read10o(EmbPattern *pattern, EmbStream* file);
+char write10o(EmbPattern *pattern, EmbStream* file);
+char readArt(EmbPattern *pattern, EmbStream* file);
+char writeArt(EmbPattern *pattern, EmbStream* file);
+char readBmc(EmbPattern *pattern, EmbStream* file);
+char writeBmc(EmbPattern *pattern, EmbStream* file);
+char readBro(EmbPattern *pattern, EmbStream* file);
+char writeBro(EmbPattern *pattern, EmbStream* file);
+char readCnd(EmbPattern *pattern, EmbStream* file);
+char writeCnd(EmbPattern *pattern, EmbStream* file);
+char readCol(EmbPattern *pattern, EmbStream* file);
+char writeCol(EmbPattern *pattern, EmbStream* file);
+char readCsd(EmbPattern *pattern, EmbStream* file);
+char writeCsd(EmbPattern *pattern, EmbStream* file);
+char readCsv(EmbPattern *pattern, EmbStream* file);
+char writeCsv(EmbPattern *pattern, EmbStream* file);
+char readDat(EmbPattern *pattern, EmbStream* file);
+char writeDat(EmbPattern *pattern, EmbStream* file);
+char readDem(EmbPattern *pattern, EmbStream* file);
+char writeDem(EmbPattern *pattern, EmbStream* file);
+char readDsb(EmbPattern *pattern, EmbStream* file);
+char writeDsb(EmbPattern *pattern, EmbStream* file);
+char readDst(EmbPattern *pattern, EmbStream* file);
+char writeDst(EmbPattern *pattern, EmbStream* file);
+char readDsz(EmbPattern *pattern, EmbStream* file);
+char writeDsz(EmbPattern *pattern, EmbStream* file);
+char readDxf(EmbPattern *pattern, EmbStream* file);
+char writeDxf(EmbPattern *pattern, EmbStream* file);
+char readEdr(EmbPattern *pattern, EmbStream* file);
+char writeEdr(EmbPattern *pattern, EmbStream* file);
+char readEmd(EmbPattern *pattern, EmbStream* file);
+char writeEmd(EmbPattern *pattern, EmbStream* file);
+char readExp(EmbPattern *pattern, EmbStream* file);
+char writeExp(EmbPattern *pattern, EmbStream* file);
+char readExy(EmbPattern *pattern, EmbStream* file);
+char writeExy(EmbPattern *pattern, EmbStream* file);
+char readEys(EmbPattern *pattern, EmbStream* file);
+char writeEys(EmbPattern *pattern, EmbStream* file);
+char readFxy(EmbPattern *pattern, EmbStream* file);
+char writeFxy(EmbPattern *pattern, EmbStream* file);
+char readGc(EmbPattern *pattern, EmbStream* file);
+char writeGc(EmbPattern *pattern, EmbStream* file);
+char readGnc(EmbPattern *pattern, EmbStream* file);
+char writeGnc(EmbPattern *pattern, EmbStream* file);
+char readGt(EmbPattern *pattern, EmbStream* file);
+char writeGt(EmbPattern *pattern, EmbStream* file);
+char readHus(EmbPattern *pattern, EmbStream* file);
+char writeHus(EmbPattern *pattern, EmbStream* file);
+char readInb(EmbPattern *pattern, EmbStream* file);
+char writeInb(EmbPattern *pattern, EmbStream* file);
+char readInf(EmbPattern *pattern, EmbStream* file);
+char writeInf(EmbPattern *pattern, EmbStream* file);
+char readJef(EmbPattern *pattern, EmbStream* file);
+char writeJef(EmbPattern *pattern, EmbStream* file);
+char readKsm(EmbPattern *pattern, EmbStream* file);
+char writeKsm(EmbPattern *pattern, EmbStream* file);
+char readMax(EmbPattern *pattern, EmbStream* file);
+char writeMax(EmbPattern *pattern, EmbStream* file);
+char readMit(EmbPattern *pattern, EmbStream* file);
+char writeMit(EmbPattern *pattern, EmbStream* file);
+char readNew(EmbPattern *pattern, EmbStream* file);
+char writeNew(EmbPattern *pattern, EmbStream* file);
+char readOfm(EmbPattern *pattern, EmbStream* file);
+char writeOfm(EmbPattern *pattern, EmbStream* file);
+char readPcd(EmbPattern *pattern, const char *fileName, EmbStream* file);
+char writePcd(EmbPattern *pattern, EmbStream* file);
+char readPcm(EmbPattern *pattern, EmbStream* file);
+char writePcm(EmbPattern *pattern, EmbStream* file);
+char readPcq(EmbPattern *pattern, const char *fileName, EmbStream* file);
+char writePcq(EmbPattern *pattern, EmbStream* file);
+char readPcs(EmbPattern *pattern, const char *fileName, EmbStream* file);
+char writePcs(EmbPattern *pattern, EmbStream* file);
+char readPec(EmbPattern *pattern, const char *fileName, EmbStream* file);
+char writePec(EmbPattern *pattern, const char *fileName,  EmbStream* file);
+char readPel(EmbPattern *pattern, EmbStream* file);
+char writePel(EmbPattern *pattern, EmbStream* file);
+char readPem(EmbPattern *pattern, EmbStream* file);
+char writePem(EmbPattern *pattern, EmbStream* file);
+char readPes(EmbPattern *pattern, const char *fileName, EmbStream* file);
+char writePes(EmbPattern *pattern, const char *fileName, EmbStream* file);
+char readPhb(EmbPattern *pattern, EmbStream* file);
+char writePhb(EmbPattern *pattern, EmbStream* file);
+char readPhc(EmbPattern *pattern, EmbStream* file);
+char writePhc(EmbPattern *pattern, EmbStream* file);
+char readPlt(EmbPattern *pattern, EmbStream* file);
+char writePlt(EmbPattern *pattern, EmbStream* file);
+char readRgb(EmbPattern *pattern, EmbStream* file);
+char writeRgb(EmbPattern *pattern, EmbStream* file);
+char readSew(EmbPattern *pattern, EmbStream* file);
+char writeSew(EmbPattern *pattern, EmbStream* file);
+char readShv(EmbPattern *pattern, EmbStream* file);
+char writeShv(EmbPattern *pattern, EmbStream* file);
+char readSst(EmbPattern *pattern, EmbStream* file);
+char writeSst(EmbPattern *pattern, EmbStream* file);
+char readStx(EmbPattern *pattern, EmbStream* file);
+char writeStx(EmbPattern *pattern, EmbStream* file);
+char readSvg(EmbPattern *pattern, EmbStream* file);
+char writeSvg(EmbPattern *pattern, EmbStream* file);
+char readT01(EmbPattern *pattern, EmbStream* file);
+char writeT01(EmbPattern *pattern, EmbStream* file);
+char readT09(EmbPattern *pattern, EmbStream* file);
+char writeT09(EmbPattern *pattern, EmbStream* file);
+char readTap(EmbPattern *pattern, EmbStream* file);
+char writeTap(EmbPattern *pattern, EmbStream* file);
+char readThr(EmbPattern *pattern, EmbStream* file);
+char writeThr(EmbPattern *pattern, EmbStream* file);
+char readTxt(EmbPattern *pattern, EmbStream* file);
+char writeTxt(EmbPattern *pattern, EmbStream* file);
+char readU00(EmbPattern *pattern, EmbStream* file);
+char writeU00(EmbPattern *pattern, EmbStream* file);
+char readU01(EmbPattern *pattern, EmbStream* file);
+char writeU01(EmbPattern *pattern, EmbStream* file);
+char readVip(EmbPattern *pattern, EmbStream* file);
+char writeVip(EmbPattern *pattern, EmbStream* file);
+char readVp3(EmbPattern *pattern, EmbStream* file);
+char writeVp3(EmbPattern *pattern, EmbStream* file);
+char readXxx(EmbPattern *pattern, EmbStream* file);
+char writeXxx(EmbPattern *pattern, EmbStream* file);
+char readZsk(EmbPattern *pattern, EmbStream* file);
+char writeZsk(EmbPattern *pattern, EmbStream* file);
+
+int read_descriptions(EmbStream* file, EmbPattern* pattern);
+int skip_descriptions(EmbStream* file);
+void readHoopName(EmbStream* file, EmbPattern* pattern);
+void readImageString(EmbStream* file, EmbPattern* pattern);
+void readProgrammableFills(EmbStream* file, EmbPattern* pattern);
+void readMotifPatterns(EmbStream* file, EmbPattern* pattern);
+void readFeatherPatterns(EmbStream* file, EmbPattern* pattern);
+void readThreads(EmbStream* file, EmbPattern* pattern);
+
+void readPESHeaderV5(EmbStream* file, EmbPattern* pattern);
+void readPESHeaderV6(EmbStream* file, EmbPattern* pattern);
+void readPESHeaderV7(EmbStream* file, EmbPattern* pattern);
+void readPESHeaderV8(EmbStream* file, EmbPattern* pattern);
+void readPESHeaderV9(EmbStream* file, EmbPattern* pattern);
+void readPESHeaderV10(EmbStream* file, EmbPattern* pattern);
 
 unsigned char toyota_position_encode(EmbReal a);
 EmbReal toyota_position_decode(unsigned char a);
@@ -276,43 +284,57 @@ emb_identify_format(const char *fileName)
 
 /* . */
 char
-read_n_bytes(FILE *file, unsigned char *data, unsigned int length)
+read_n_bytes(EmbStream *file, unsigned char *data, unsigned int length)
 {
-    if (fread(data, 1, length, file) != length) {
+    if (emb_fread(data, 1, length, file) != length) {
         printf("ERROR: failed to read %d bytes from file.", length);
         return 0;
     }
     return 1;
 }
 
-/* . */
+/* Reads a pattern in the given format from a stream.
+ *
+ * a fileName is only used to look for an external color file and to
+ * report progress, so it may be null when the data did not come from
+ * disk. Only the parts of the design in the read_options of a pattern
+ * are added to it.
+ */
 char
-emb_pattern_read(EmbPattern* pattern, const char *fileName, int format)
+emb_pattern_read_stream(EmbPattern* pattern, EmbStream *file,
+    const char *fileName, int format)
 {
-    int result;
-    FILE *file;
-    result = 0;
+    int result = 0, options, stitches, threads, geometry;
+    const char *metadata[5];
+    EmbWork work;
     if (!pattern) {
-        printf("ERROR: emb_pattern_read(), pattern argument is null.\n");
+        printf("ERROR: emb_pattern_read_stream(), pattern argument is null.\n");
         return 0;
     }
-    if (!fileName) {
-        printf("ERROR: emb_pattern_read(), fileName argument is null.\n");
+    if (!file) {
+        printf("ERROR: emb_pattern_read_stream(), file argument is null.\n");
         return 0;
     }
-    file = fopen(fileName, "rb");
-    if (!file) {
-        if ((format != EMB_FORMAT_EDR) &&
-            (format != EMB_FORMAT_RGB) &&
-            (format != EMB_FORMAT_COL) &&
-            (format != EMB_FORMAT_INF)) {
-            printf("ERROR: Failed to open file with name: %s.\n", fileName);
-        }
+    if ((format < 0) || (format >= numberOfFormats)) {
+        printf("ERROR: emb_pattern_read_stream(), unknown format %d.\n", format);
         return 0;
     }
-    if (formatTable[format].check_for_color_file) {
+    options = pattern->read_options;
+    stitches = pattern->stitch_list->count;
+    threads = pattern->thread_list->count;
+    geometry = pattern->geometry->count;
+    metadata[0] = pattern->design_name;
+    metadata[1] = pattern->category;
+    metadata[2] = pattern->author;
+    metadata[3] = pattern->keywords;
+    metadata[4] = pattern->comments;
+    if (formatTable[format].check_for_color_file && fileName
+        && (options & EMB_READ_SIDECAR_COLORS)) {
         emb_pattern_loadExternalColorFile(pattern, fileName);
     }
+    if (!emb_work_begin(&work, pattern->context, pattern, file)) {
+        return emb_work_end(&work, "emb_pattern_read_stream");
+    }
     switch (format) {
     case EMB_FORMAT_100:
         result = read100(pattern, file);
@@ -500,40 +522,130 @@ emb_pattern_read(EmbPattern* pattern, const char *fileName, int format)
     default:
         break;
     }
-    fclose(file);
-    if (!formatTable[format].color_only) {
+    if (!emb_work_end(&work, "emb_pattern_read_stream")) {
+        result = 0;
+    }
+    /* Readers skip what they can of the parts left out, anything they
+     * still read is dropped here. */
+    if (!(options & EMB_READ_STITCHES)) {
+        emb_array_truncate(pattern->stitch_list, stitches);
+    }
+    else if (!formatTable[format].color_only) {
         emb_pattern_end(pattern);
     }
+    if (!(options & EMB_READ_THREADS)) {
+        emb_array_truncate(pattern->thread_list, threads);
+    }
+    if (!(options & EMB_READ_GEOMETRY)) {
+        emb_array_truncate(pattern->geometry, geometry);
+    }
+    if (!(options & EMB_READ_METADATA)) {
+        pattern->design_name = metadata[0];
+        pattern->category = metadata[1];
+        pattern->author = metadata[2];
+        pattern->keywords = metadata[3];
+        pattern->comments = metadata[4];
+    }
     return result;
 }
 
 /* . */
 char
-emb_pattern_write(EmbPattern* pattern, const char *fileName, int format)
+emb_pattern_read(EmbPattern* pattern, const char *fileName, int format)
 {
-    FILE *file;
-    int result = 0;
+    int result;
+    EmbStream *file;
     if (!pattern) {
-        printf("ERROR: emb_pattern_write(), pattern argument is null\n");
+        printf("ERROR: emb_pattern_read(), pattern argument is null.\n");
         return 0;
     }
     if (!fileName) {
-        printf("ERROR: emb_pattern_write(), fileName argument is null\n");
+        printf("ERROR: emb_pattern_read(), fileName argument is null.\n");
         return 0;
     }
-    if (pattern->stitch_list->count == 0) {
-        printf("ERROR: emb_pattern_write(), pattern contains no stitches\n");
+    file = emb_stream_open(fileName, "rb");
+    if (!file) {
+        if ((format != EMB_FORMAT_EDR) &&
+            (format != EMB_FORMAT_RGB) &&
+            (format != EMB_FORMAT_COL) &&
+            (format != EMB_FORMAT_INF)) {
+            printf("ERROR: Failed to open file with name: %s.\n", fileName);
+        }
         return 0;
     }
-    if (!formatTable[format].color_only) {
-        emb_pattern_end(pattern);
+    result = emb_pattern_read_stream(pattern, file, fileName, format);
+    emb_stream_close(file);
+    return result;
+}
+
+/* Reads a pattern in the given format from the a len bytes at a buf.
+ *
+ * The buffer is read in place, so nothing is copied or written to disk.
+ * No external color file is looked for, since there is no file name to
+ * derive one from.
+ */
+char
+emb_pattern_read_memory(EmbPattern* pattern, const void *buf, size_t len,
+    int format)
+{
+    int result;
+    EmbStream *file;
+    if (!buf) {
+        printf("ERROR: emb_pattern_read_memory(), buf argument is null.\n");
+        return 0;
+    }
+    file = emb_stream_memory(buf, len);
+    if (!file) {
+        return 0;
     }
+    result = emb_pattern_read_stream(pattern, file, 0, format);
+    emb_stream_close(file);
+    return result;
+}
 
-    file = fopen(fileName, "wb");
+/* Writes a pattern in the given format to a stream. The pattern itself
+ * is not changed.
+ *
+ * a fileName is only used to name the design inside formats that store
+ * a label, so it may be null.
+ */
+char
+emb_pattern_write_stream(EmbPattern* pattern, EmbStream *file,
+    const char *fileName, int format)
+{
+    int result = 0;
+    EmbWork work;
+    if (!pattern) {
+        printf("ERROR: emb_pattern_write_stream(), pattern argument is null\n");
+        return 0;
+    }
     if (!file) {
-        printf("Failed to open file with name: %s.", fileName);
+        printf("ERROR: emb_pattern_write_stream(), file argument is null\n");
+        return 0;
+    }
+    if ((format < 0) || (format >= numberOfFormats)) {
+        printf("ERROR: emb_pattern_write_stream(), unknown format %d.\n", format);
+        return 0;
+    }
+    if (pattern->stitch_list->count == 0) {
+        printf("ERROR: emb_pattern_write_stream(), pattern contains no stitches\n");
         return 0;
     }
+    if (!emb_work_begin(&work, pattern->context, pattern, file)) {
+        return emb_work_end(&work, "emb_pattern_write_stream");
+    }
+    /* The writers add the END stitch, split long stitches and flip the
+     * design as their format needs, so they are given a clone and the
+     * caller's pattern is left as it was. */
+    pattern = emb_pattern_clone(pattern);
+    if (!pattern) {
+        emb_work_end(&work, "emb_pattern_write_stream");
+        return 0;
+    }
+    if (!formatTable[format].color_only) {
+        emb_pattern_end(pattern);
+    }
+
     switch (format) {
     case EMB_FORMAT_100:
         result = write100(pattern, file);
@@ -721,16 +833,775 @@ emb_pattern_write(EmbPattern* pattern, const char *fileName, int format)
     default:
         break;
     }
-    if (formatTable[format].write_external_color_file) {
-        char externalFileName[1000];
-        int stub_length;
-        strncpy(externalFileName, fileName, 200);
-        stub_length = strlen(fileName) - strlen(formatTable[format].extension);
-        externalFileName[stub_length] = 0;
-        strcat(externalFileName, ".rgb");
-        emb_pattern_write(pattern, externalFileName, EMB_FORMAT_RGB);
+    if (!emb_work_end(&work, "emb_pattern_write_stream")) {
+        result = 0;
+    }
+    emb_pattern_free(pattern);
+    return result;
+}
+
+/* . */
+char
+emb_pattern_write(EmbPattern* pattern, const char *fileName, int format)
+{
+    EmbStream *file;
+    int result;
+    if (!pattern) {
+        printf("ERROR: emb_pattern_write(), pattern argument is null\n");
+        return 0;
+    }
+    if (!fileName) {
+        printf("ERROR: emb_pattern_write(), fileName argument is null\n");
+        return 0;
+    }
+    if (pattern->stitch_list->count == 0) {
+        printf("ERROR: emb_pattern_write(), pattern contains no stitches\n");
+        return 0;
+    }
+
+    file = emb_stream_open(fileName, "wb");
+    if (!file) {
+        printf("Failed to open file with name: %s.", fileName);
+        return 0;
+    }
+    result = emb_pattern_write_stream(pattern, file, fileName, format);
+    if (formatTable[format].write_external_color_file) {
+        char externalFileName[1000];
+        int stub_length;
+        strncpy(externalFileName, fileName, 200);
+        stub_length = strlen(fileName) - strlen(formatTable[format].extension);
+        externalFileName[stub_length] = 0;
+        strcat(externalFileName, ".rgb");
+        emb_pattern_write(pattern, externalFileName, EMB_FORMAT_RGB);
+    }
+    if (emb_stream_close(file)) {
+        printf("ERROR: emb_pattern_write(), failed to write to %s.\n", fileName);
+        result = 0;
+    }
+    return result;
+}
+
+/* Reads a pattern in the given format from the open file descriptor a fd.
+ *
+ * The descriptor is left open. A regular file is read from its start,
+ * anything else, such as a pipe, from its current position to its end.
+ */
+char
+emb_pattern_read_fd(EmbPattern* pattern, int fd, int format)
+{
+    int result;
+    EmbStream *file = emb_stream_fd(fd, "rb");
+    if (!file) {
+        return 0;
+    }
+    result = emb_pattern_read_stream(pattern, file, 0, format);
+    emb_stream_close(file);
+    return result;
+}
+
+/* Writes a pattern in the given format to the open file descriptor a fd.
+ *
+ * The design is encoded in memory and written out in one go, so a fd
+ * can be a pipe even for formats whose headers are patched after the
+ * stitches. The descriptor is left open and no external color file is
+ * written.
+ */
+char
+emb_pattern_write_fd(EmbPattern* pattern, int fd, int format)
+{
+    int result;
+    EmbStream *file = emb_stream_fd(fd, "wb");
+    if (!file) {
+        return 0;
+    }
+    result = emb_pattern_write_stream(pattern, file, 0, format);
+    if (emb_stream_close(file)) {
+        printf("ERROR: emb_pattern_write_fd(), failed to write to %d.\n", fd);
+        result = 0;
+    }
+    return result;
+}
+
+/* Stitch streams
+ * -----------------------------------------------------------------------------
+ *
+ * For the stitch only formats below a design can be transcoded without
+ * holding all of it in memory. An EmbStitchReader decodes records a
+ * batch at a time and an EmbStitchWriter encodes them as they arrive,
+ * patching any totals its header needs when it is closed. The stitches
+ * passing between them are the ones emb_pattern_read() would have put
+ * in the pattern, home stitch and END included, and the writer treats
+ * them just as emb_pattern_write() would, so the output is the same.
+ */
+
+/* Returns whether the format a format has a stitch reader and writer. */
+int
+emb_stitch_stream_supported(int format)
+{
+    switch (format) {
+    case EMB_FORMAT_DST:
+    case EMB_FORMAT_EXP:
+        return 1;
+    default:
+        break;
+    }
+    return 0;
+}
+
+/* Opens a reader as emb_stitch_reader_open() does, with the state in
+ * a ctx.
+ */
+static EmbStitchReader*
+emb_stitch_reader_open_context(EmbContext *ctx, EmbStream *file,
+    const char *fileName, int format)
+{
+    EmbStitchReader *reader;
+    if (!file) {
+        printf("ERROR: emb_stitch_reader_open(), file argument is null.\n");
+        return 0;
+    }
+    if (!emb_stitch_stream_supported(format)) {
+        printf("ERROR: emb_stitch_reader_open(), unsupported format %d.\n", format);
+        return 0;
+    }
+    reader = (EmbStitchReader*)malloc(sizeof(EmbStitchReader));
+    if (!reader) {
+        printf("ERROR: emb_stitch_reader_open(), cannot allocate reader.\n");
+        return 0;
+    }
+    reader->file = file;
+    reader->format = format;
+    reader->done = 0;
+    reader->pattern = emb_pattern_create_context(ctx);
+    if (!reader->pattern) {
+        safe_free(reader);
+        return 0;
+    }
+    if (formatTable[format].check_for_color_file && fileName) {
+        emb_pattern_loadExternalColorFile(reader->pattern, fileName);
+    }
+    if (format == EMB_FORMAT_DST && !dstReadHeader(reader->pattern, file)) {
+        emb_stitch_reader_close(reader);
+        return 0;
+    }
+    return reader;
+}
+
+/* Starts decoding a file in the format a format from a file.
+ *
+ * As with emb_pattern_read_stream(), a fileName is only used to look for
+ * an external color file and may be null. The stream stays open after
+ * emb_stitch_reader_close().
+ */
+EmbStitchReader*
+emb_stitch_reader_open(EmbStream *file, const char *fileName, int format)
+{
+    return emb_stitch_reader_open_context(emb_context_default(), file,
+        fileName, format);
+}
+
+/* Decodes up to a max stitches into a batch, returning how many.
+ * Returns 0 once the design is over. a max should be at least 2.
+ */
+int
+emb_stitch_reader_next(EmbStitchReader *reader, EmbStitch *batch, int max)
+{
+    int first = 0, n;
+    EmbArray *list = reader->pattern->stitch_list;
+    /* Stitches are decoded relative to the last one, so it is kept. */
+    if (list->count > 0) {
+        list->stitch[0] = list->stitch[list->count - 1];
+        list->count = 1;
+        first = 1;
+    }
+    /* A record adds at most two stitches, counting the home stitch. */
+    while (!reader->done && list->count - first < max - 1) {
+        int more = 0;
+        switch (reader->format) {
+        case EMB_FORMAT_DST:
+            more = dstReadRecord(reader->pattern, reader->file);
+            break;
+        case EMB_FORMAT_EXP:
+            more = expReadRecord(reader->pattern, reader->file);
+            break;
+        default:
+            break;
+        }
+        if (!more) {
+            reader->done = 1;
+            emb_pattern_end(reader->pattern);
+        }
+    }
+    n = list->count - first;
+    memcpy(batch, list->stitch + first, n * sizeof(EmbStitch));
+    return n;
+}
+
+/* Frees a reader, the threads it found go with it. */
+void
+emb_stitch_reader_close(EmbStitchReader *reader)
+{
+    if (!reader) {
+        return;
+    }
+    emb_pattern_free(reader->pattern);
+    safe_free(reader);
+}
+
+/* Opens a writer as emb_stitch_writer_open() does, with the state in
+ * a ctx.
+ */
+static EmbStitchWriter*
+emb_stitch_writer_open_context(EmbContext *ctx, EmbStream *file, int format)
+{
+    EmbStitchWriter *writer;
+    if (!file) {
+        printf("ERROR: emb_stitch_writer_open(), file argument is null.\n");
+        return 0;
+    }
+    if (!emb_stitch_stream_supported(format)) {
+        printf("ERROR: emb_stitch_writer_open(), unsupported format %d.\n", format);
+        return 0;
+    }
+    writer = (EmbStitchWriter*)malloc(sizeof(EmbStitchWriter));
+    if (!writer) {
+        printf("ERROR: emb_stitch_writer_open(), cannot allocate writer.\n");
+        return 0;
+    }
+    writer->split = emb_array_create(EMB_STITCH);
+    if (!writer->split) {
+        safe_free(writer);
+        return 0;
+    }
+    writer->file = file;
+    writer->format = format;
+    writer->context = ctx;
+    writer->start = emb_ftell(file);
+    writer->count = 0;
+    writer->started = 0;
+    writer->position.x = 0.0;
+    writer->position.y = 0.0;
+    /* The same starting values as emb_pattern_bounds(). */
+    writer->maxX = -99999.0;
+    writer->maxY = -99999.0;
+    writer->minX = 99999.0;
+    writer->minY = 99999.0;
+    if (format == EMB_FORMAT_DST) {
+        /* Room for the header, written once the totals are known. */
+        fpad(file, ' ', 512);
+    }
+    return writer;
+}
+
+/* Starts encoding a file in the format a format to a file, which must
+ * be able to seek back if the header records totals.
+ */
+EmbStitchWriter*
+emb_stitch_writer_open(EmbStream *file, int format)
+{
+    return emb_stitch_writer_open_context(emb_context_default(), file,
+        format);
+}
+
+/* Encodes a stitch that the format can take as it is. */
+static void
+emb_stitch_writer_encode(EmbStitchWriter *writer, EmbStitch st)
+{
+    switch (writer->format) {
+    case EMB_FORMAT_DST:
+        if (!(st.flags & TRIM)) {
+            writer->maxX = EMB_MAX(writer->maxX, st.x);
+            writer->maxY = EMB_MAX(writer->maxY, st.y);
+            writer->minX = EMB_MIN(writer->minX, st.x);
+            writer->minY = EMB_MIN(writer->minY, st.y);
+        }
+        dstWriteStitch(writer->file, st, &writer->position,
+            writer->context->verbose);
+        break;
+    case EMB_FORMAT_EXP:
+        expWriteStitch(writer->file, st, &writer->position);
+        break;
+    default:
+        break;
+    }
+    writer->count++;
+}
+
+/* Encodes the a count stitches of a batch. Returns 0 on failure. */
+int
+emb_stitch_writer_put(EmbStitchWriter *writer, const EmbStitch *batch,
+    int count)
+{
+    int i, j;
+    for (i = 0; i < count; i++) {
+        EmbStitch st = batch[i];
+        if (writer->format == EMB_FORMAT_DST) {
+            /* As emb_pattern_correctForMaxStitchLength() does, the first
+             * stitch only sets where the next one starts from. */
+            if (writer->started) {
+                writer->split->count = 0;
+                if (!emb_stitch_split(writer->split, writer->last, st,
+                    12.1f, 12.1f)) {
+                    return 0;
+                }
+                for (j = 0; j < writer->split->count; j++) {
+                    emb_stitch_writer_encode(writer, writer->split->stitch[j]);
+                }
+            }
+        }
+        else {
+            emb_stitch_writer_encode(writer, st);
+        }
+        writer->started = 1;
+        writer->last = st;
+    }
+    return 1;
+}
+
+/* Ends the design and writes the trailer, then goes back to fill in the
+ * header. a threads is the number of threads in the design, as the
+ * reader's pattern has it once the stitches are over. Frees a writer
+ * and returns 0 on failure.
+ */
+int
+emb_stitch_writer_close(EmbStitchWriter *writer, int threads)
+{
+    int result = 1;
+    if (!writer) {
+        return 0;
+    }
+    if (!writer->started) {
+        printf("ERROR: emb_stitch_writer_close(), the design has no stitches\n");
+        emb_array_free(writer->split);
+        safe_free(writer);
+        return 0;
+    }
+    if (writer->last.flags != END) {
+        EmbStitch end = writer->last;
+        end.flags = END;
+        result = emb_stitch_writer_put(writer, &end, 1);
+    }
+    switch (writer->format) {
+    case EMB_FORMAT_DST: {
+        EmbRect bounds;
+        long end;
+        /* Laid out as emb_pattern_bounds() gives them. */
+        bounds.x = writer->maxX;
+        bounds.y = writer->maxY;
+        bounds.w = writer->minX - writer->maxX;
+        bounds.h = writer->minY - writer->maxY;
+        emb_fwrite("\xa1\0\0", 1, 3, writer->file);
+        end = emb_ftell(writer->file);
+        if (emb_fseek(writer->file, writer->start, SEEK_SET)) {
+            printf("ERROR: emb_stitch_writer_close(), cannot seek back to the header\n");
+            result = 0;
+            break;
+        }
+        dstWriteHeader(writer->file, writer->count, threads, bounds);
+        emb_fseek(writer->file, end, SEEK_SET);
+        break;
+    }
+    case EMB_FORMAT_EXP:
+        emb_fprintf(writer->file, "\x1a");
+        break;
+    default:
+        break;
+    }
+    emb_array_free(writer->split);
+    safe_free(writer);
+    return result;
+}
+
+typedef struct EmbTranscode_ {
+    EmbStitchReader *reader;
+    EmbStitch *batch[2];
+    int count[2];
+    int ready[2];          /* decoded and not yet encoded */
+    int stop;              /* set by the encoder to end the decoder early */
+#if defined(EMB_THREADS)
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+#endif
+} EmbTranscode;
+
+#if defined(EMB_THREADS)
+/* The decoder of emb_transcode_stitches(), which runs on its own thread
+ * for the whole transcode. It fills each batch once the encoder has
+ * finished with it and stops after the last, empty, batch.
+ */
+static void *
+emb_transcode_decoder(void *data)
+{
+    EmbTranscode *t = (EmbTranscode*)data;
+    int i = 0;
+    int count;
+    do {
+        pthread_mutex_lock(&t->lock);
+        while (t->ready[i] && !t->stop) {
+            pthread_cond_wait(&t->changed, &t->lock);
+        }
+        if (t->stop) {
+            pthread_mutex_unlock(&t->lock);
+            break;
+        }
+        pthread_mutex_unlock(&t->lock);
+        count = emb_stitch_reader_next(t->reader, t->batch[i],
+            EMB_STITCH_BATCH);
+        pthread_mutex_lock(&t->lock);
+        t->count[i] = count;
+        t->ready[i] = 1;
+        pthread_cond_broadcast(&t->changed);
+        pthread_mutex_unlock(&t->lock);
+        i = !i;
+    } while (count > 0);
+    return 0;
+}
+#endif
+
+/* Transcodes the stitches of a in, in the format a from, to a out in the
+ * format a to, holding no more than two batches of stitches at a time.
+ * Both formats must pass emb_stitch_stream_supported(). a fileName is
+ * used as in emb_stitch_reader_open(). Returns 1 on success.
+ */
+int
+emb_transcode_stitches(EmbStream *in, const char *fileName, int from,
+    EmbStream *out, int to)
+{
+    return emb_transcode_stitches_context(emb_context_default(), in,
+        fileName, from, out, to);
+}
+
+/* Transcodes as emb_transcode_stitches() does, with the state in a ctx. */
+int
+emb_transcode_stitches_context(EmbContext *ctx, EmbStream *in,
+    const char *fileName, int from, EmbStream *out, int to)
+{
+    EmbTranscode t;
+    EmbWork work;
+    EmbStitchWriter *writer;
+    EmbStitch *batches;
+    int result, i, threaded = 0;
+#if defined(EMB_THREADS)
+    pthread_t decoder;
+#endif
+
+    batches = (EmbStitch*)malloc(2 * EMB_STITCH_BATCH * sizeof(EmbStitch));
+    if (!batches) {
+        printf("ERROR: emb_transcode_stitches(), cannot allocate batches\n");
+        return 0;
+    }
+    t.reader = emb_stitch_reader_open_context(ctx, in, fileName, from);
+    if (!t.reader) {
+        safe_free(batches);
+        return 0;
+    }
+    writer = emb_stitch_writer_open_context(ctx, out, to);
+    if (!writer) {
+        emb_stitch_reader_close(t.reader);
+        safe_free(batches);
+        return 0;
+    }
+    t.batch[0] = batches;
+    t.batch[1] = batches + EMB_STITCH_BATCH;
+    t.ready[0] = 0;
+    t.ready[1] = 0;
+    t.stop = 0;
+    /* The limits are those of a read of the whole design. Only the
+     * decoder works on the input, so it alone may stop it. */
+    result = emb_work_begin(&work, ctx, t.reader->pattern, in);
+    ctx->stitches = 0;
+#if defined(EMB_THREADS)
+    /* One decoder thread fills a batch while this one encodes the other. */
+    if (result) {
+        pthread_mutex_init(&t.lock, 0);
+        pthread_cond_init(&t.changed, 0);
+        threaded = pthread_create(&decoder, 0, emb_transcode_decoder, &t) == 0;
+        if (!threaded) {
+            pthread_cond_destroy(&t.changed);
+            pthread_mutex_destroy(&t.lock);
+        }
+    }
+#endif
+    for (i = 0; result; i = !i) {
+#if defined(EMB_THREADS)
+        if (threaded) {
+            pthread_mutex_lock(&t.lock);
+            while (!t.ready[i]) {
+                pthread_cond_wait(&t.changed, &t.lock);
+            }
+            pthread_mutex_unlock(&t.lock);
+        }
+#endif
+        if (!threaded) {
+            t.count[i] = emb_stitch_reader_next(t.reader, t.batch[i],
+                EMB_STITCH_BATCH);
+        }
+        if (t.count[i] <= 0) {
+            break;
+        }
+        ctx->stitches += t.count[i];
+        if (!emb_work_limit(&work, ctx->stitches, 0)) {
+            result = 0;
+            break;
+        }
+        result = emb_stitch_writer_put(writer, t.batch[i], t.count[i]);
+#if defined(EMB_THREADS)
+        if (threaded) {
+            pthread_mutex_lock(&t.lock);
+            t.ready[i] = 0;
+            pthread_cond_broadcast(&t.changed);
+            pthread_mutex_unlock(&t.lock);
+        }
+#endif
+    }
+#if defined(EMB_THREADS)
+    if (threaded) {
+        pthread_mutex_lock(&t.lock);
+        t.stop = 1;
+        pthread_cond_broadcast(&t.changed);
+        pthread_mutex_unlock(&t.lock);
+        pthread_join(decoder, 0);
+        pthread_cond_destroy(&t.changed);
+        pthread_mutex_destroy(&t.lock);
+    }
+#endif
+    if (!emb_work_end(&work, "emb_transcode_stitches")) {
+        result = 0;
+    }
+    if (result) {
+        result = emb_stitch_writer_close(writer,
+            t.reader->pattern->thread_list->count);
+    }
+    else {
+        emb_stitch_writer_close(writer, 0);
+    }
+    emb_stitch_reader_close(t.reader);
+    safe_free(batches);
+    return result;
+}
+
+/* Probing
+ * -----------------------------------------------------------------------------
+ *
+ * A file browser only needs the counts and extents of a design, which
+ * many formats store in their header. Where the header has them the rest
+ * of the file is never read; a stitch only format is otherwise counted a
+ * batch of stitches at a time, and anything else is decoded in full.
+ */
+
+/* Starts a probe of a design in the format a format from a source. */
+static void
+emb_probe_start(EmbProbe *probe, int format, int source)
+{
+    probe->format = format;
+    probe->source = source;
+    probe->stitches = 0;
+    probe->colors = 0;
+    probe->min_x = 0.0;
+    probe->min_y = 0.0;
+    probe->max_x = 0.0;
+    probe->max_y = 0.0;
+}
+
+/* Counts the a n stitches at a st into a probe, and the colors they
+ * change through.
+ */
+static void
+emb_probe_stitches(EmbProbe *probe, const EmbStitch *st, int n)
+{
+    int i;
+    for (i = 0; i < n; i++) {
+        if (probe->stitches == 0) {
+            probe->min_x = probe->max_x = st[i].x;
+            probe->min_y = probe->max_y = st[i].y;
+        }
+        probe->min_x = EMB_MIN(probe->min_x, st[i].x);
+        probe->min_y = EMB_MIN(probe->min_y, st[i].y);
+        probe->max_x = EMB_MAX(probe->max_x, st[i].x);
+        probe->max_y = EMB_MAX(probe->max_y, st[i].y);
+        probe->colors = EMB_MAX(probe->colors, st[i].color + 1);
+        probe->stitches++;
+    }
+}
+
+/* Returns whether the extents a probe found can be those of a design. */
+static int
+emb_probe_valid(const EmbProbe *probe)
+{
+    return probe->stitches >= 0 && probe->colors >= 0
+        && probe->min_x <= probe->max_x && probe->min_y <= probe->max_y;
+}
+
+/* Counts the stitches of a stitch only design a batch at a time. */
+static int
+emb_probe_scan(EmbStream *file, const char *fileName, int format,
+    EmbProbe *probe)
+{
+    EmbStitchReader *reader;
+    EmbStitch *batch;
+    int n;
+
+    batch = (EmbStitch*)malloc(EMB_STITCH_BATCH * sizeof(EmbStitch));
+    if (!batch) {
+        printf("ERROR: emb_pattern_probe(), cannot allocate batch\n");
+        return 0;
+    }
+    reader = emb_stitch_reader_open(file, fileName, format);
+    if (!reader) {
+        safe_free(batch);
+        return 0;
+    }
+    emb_probe_start(probe, format, EMB_PROBE_SCAN);
+    while ((n = emb_stitch_reader_next(reader, batch, EMB_STITCH_BATCH)) > 0) {
+        emb_probe_stitches(probe, batch, n);
+    }
+    probe->colors = EMB_MAX(probe->colors,
+        reader->pattern->thread_list->count);
+    emb_stitch_reader_close(reader);
+    safe_free(batch);
+    return 1;
+}
+
+/* Loads the whole design to probe it, for formats with nothing faster. */
+static int
+emb_probe_decode(EmbStream *file, const char *fileName, int format,
+    EmbProbe *probe)
+{
+    EmbPattern *pattern = emb_pattern_create();
+    if (!pattern) {
+        return 0;
+    }
+    pattern->read_options = EMB_READ_STITCHES | EMB_READ_THREADS
+        | EMB_READ_SIDECAR_COLORS;
+    if (!emb_pattern_read_stream(pattern, file, fileName, format)) {
+        emb_pattern_free(pattern);
+        return 0;
+    }
+    emb_probe_start(probe, format, EMB_PROBE_DECODE);
+    emb_probe_stitches(probe, pattern->stitch_list->stitch,
+        pattern->stitch_list->count);
+    probe->colors = EMB_MAX(probe->colors, pattern->thread_list->count);
+    emb_pattern_free(pattern);
+    return 1;
+}
+
+/* Finds the stitch and color counts and the extents of the design in
+ * the format a format read from a file, from its header where it has
+ * them. a fileName is used as in emb_pattern_read_stream() and may be
+ * null. Returns 1 on success.
+ *
+ * Header counts are as the file states them, so they can differ a little
+ * from those of a decoded pattern: DST counts records, JEF counts the
+ * padding stitches of its first colors.
+ */
+int
+emb_pattern_probe_stream(EmbStream *file, const char *fileName, int format,
+    EmbProbe *probe)
+{
+    int result = 0;
+    if (!file) {
+        printf("ERROR: emb_pattern_probe(), file argument is null.\n");
+        return 0;
+    }
+    if (!probe) {
+        printf("ERROR: emb_pattern_probe(), probe argument is null.\n");
+        return 0;
+    }
+    if ((format < 0) || (format >= numberOfFormats)) {
+        printf("ERROR: emb_pattern_probe(), unknown format %d.\n", format);
+        return 0;
+    }
+    emb_probe_start(probe, format, EMB_PROBE_HEADER);
+    emb_fseek(file, 0, SEEK_SET);
+    switch (format) {
+    case EMB_FORMAT_DST:
+        result = dstProbeHeader(file, probe);
+        break;
+    case EMB_FORMAT_HUS:
+    case EMB_FORMAT_VIP:
+        result = husProbeHeader(file, probe);
+        break;
+    case EMB_FORMAT_JEF:
+        result = jefProbeHeader(file, probe);
+        break;
+    case EMB_FORMAT_PEC:
+    case EMB_FORMAT_PES:
+        result = pecProbe(file, probe);
+        break;
+    default:
+        break;
+    }
+    if (result && emb_probe_valid(probe)) {
+        return 1;
+    }
+    emb_fseek(file, 0, SEEK_SET);
+    if (emb_stitch_stream_supported(format)) {
+        return emb_probe_scan(file, fileName, format, probe);
+    }
+    return emb_probe_decode(file, fileName, format, probe);
+}
+
+/* Probes the file a fileName as emb_pattern_probe_stream() does, taking
+ * the format from its extension.
+ */
+int
+emb_pattern_probe(const char *fileName, EmbProbe *probe)
+{
+    int format, result;
+    EmbStream *file;
+    if (!fileName) {
+        printf("ERROR: emb_pattern_probe(), fileName argument is null.\n");
+        return 0;
+    }
+    format = emb_identify_format(fileName);
+    if (format < 0) {
+        printf("ERROR: emb_pattern_probe(), unsupported file type: %s\n",
+            fileName);
+        return 0;
+    }
+    file = emb_stream_open(fileName, "rb");
+    if (!file) {
+        printf("ERROR: Failed to open file with name: %s.\n", fileName);
+        return 0;
+    }
+    result = emb_pattern_probe_stream(file, fileName, format, probe);
+    emb_stream_close(file);
+    return result;
+}
+
+/* Probes the a len bytes at a buf as emb_pattern_probe_stream() does. */
+int
+emb_pattern_probe_memory(const void *buf, size_t len, int format,
+    EmbProbe *probe)
+{
+    int result;
+    EmbStream *file;
+    if (!buf) {
+        printf("ERROR: emb_pattern_probe_memory(), buf argument is null.\n");
+        return 0;
+    }
+    file = emb_stream_memory(buf, len);
+    if (!file) {
+        return 0;
+    }
+    result = emb_pattern_probe_stream(file, 0, format, probe);
+    emb_stream_close(file);
+    return result;
+}
+
+/* Probes the design in the format a format on the open file descriptor
+ * a fd as emb_pattern_probe_stream() does. The descriptor is left open.
+ */
+int
+emb_pattern_probe_fd(int fd, int format, EmbProbe *probe)
+{
+    int result;
+    EmbStream *file = emb_stream_fd(fd, "rb");
+    if (!file) {
+        return 0;
     }
-    fclose(file);
+    result = emb_pattern_probe_stream(file, 0, format, probe);
+    emb_stream_close(file);
     return result;
 }
 
@@ -791,10 +1662,12 @@ toyota_position_decode(unsigned char a)
  * The stitch encoding is in 4 byte chunks.
  */
 char
-read100(EmbPattern *pattern, FILE* file)
+read100(EmbPattern *pattern, EmbStream* file)
 {
-    unsigned char b[10];
-    while (fread(b, 1, 3, file) == 3) {
+    EmbStitchBatch batch;
+    const unsigned char *b;
+    emb_stitch_batch_init(&batch, pattern);
+    while ((b = emb_stream_take(file, 4))) {
         EmbStitch st;
         st.x = toyota_position_decode(b[2]);
         st.y = toyota_position_decode(b[3]);
@@ -812,13 +1685,14 @@ read100(EmbPattern *pattern, FILE* file)
             st.flags = END;
         }
 
-        emb_pattern_addStitchRel(pattern, st.x, st.y, st.flags, 1);
+        emb_stitch_batch_rel(&batch, st.x, st.y, st.flags);
     }
+    emb_stitch_batch_flush(&batch);
     return 1;
 }
 
 char
-write100(EmbPattern *pattern, FILE* file)
+write100(EmbPattern *pattern, EmbStream* file)
 {
     int i;
     EmbVector position;
@@ -843,7 +1717,7 @@ write100(EmbPattern *pattern, FILE* file)
             b[0] = 0x1F;
         }
 
-        if (fwrite(b, 1, 4, file) != 4) {
+        if (emb_fwrite(b, 1, 4, file) != 4) {
             return 0;
         }
     }
@@ -856,10 +1730,12 @@ write100(EmbPattern *pattern, FILE* file)
  * The stitch encoding is in 3 byte chunks.
  */
 char
-read10o(EmbPattern *pattern, FILE* file)
+read10o(EmbPattern *pattern, EmbStream* file)
 {
-    unsigned char b[10];
-    while (fread(b, 1, 3, file) == 3) {
+    EmbStitchBatch batch;
+    const unsigned char *b;
+    emb_stitch_batch_init(&batch, pattern);
+    while ((b = emb_stream_take(file, 3))) {
         EmbStitch st;
 
         unsigned char ctrl = b[0];
@@ -883,14 +1759,15 @@ read10o(EmbPattern *pattern, FILE* file)
             st.flags = END;
         }
 
-        emb_pattern_addStitchRel(pattern, st.x, st.y, st.flags, 1);
+        emb_stitch_batch_rel(&batch, st.x, st.y, st.flags);
     }
+    emb_stitch_batch_flush(&batch);
     return 1;
 }
 
 /* . */
 char
-write10o(EmbPattern *pattern, FILE* file)
+write10o(EmbPattern *pattern, EmbStream* file)
 {
     int i;
     for (i=0; i<pattern->stitch_list->count; i++) {
@@ -924,7 +1801,7 @@ write10o(EmbPattern *pattern, FILE* file)
             b[2] = 0xF8;
         }
 
-        if (fwrite(b, 1, 3, file) != 3) {
+        if (emb_fwrite(b, 1, 3, file) != 3) {
             return 0;
         }
     }
@@ -936,7 +1813,7 @@ write10o(EmbPattern *pattern, FILE* file)
  * We don't know much about this format. \todo Find a source.
  */
 char
-readArt(EmbPattern *pattern, FILE* file)
+readArt(EmbPattern *pattern, EmbStream* file)
 {
     puts("ERROR: readArt is not supported yet.");
     printf("Cannot read %p %p\n", pattern, file);
@@ -944,7 +1821,7 @@ readArt(EmbPattern *pattern, FILE* file)
 }
 
 char
-writeArt(EmbPattern * pattern, FILE* file)
+writeArt(EmbPattern * pattern, EmbStream* file)
 {
     puts("ERROR: writeArt is not supported yet.");
     printf("Cannot write %p %p\n", pattern, file);
@@ -956,7 +1833,7 @@ writeArt(EmbPattern * pattern, FILE* file)
  * We don't know much about this format. \todo Find a source.
  */
 char
-readBmc(EmbPattern* pattern , FILE* file)
+readBmc(EmbPattern* pattern , EmbStream* file)
 {
     puts("ERROR: readBmc is not supported.");
     printf("Cannot read %p %p\n", pattern, file);
@@ -964,7 +1841,7 @@ readBmc(EmbPattern* pattern , FILE* file)
 }
 
 char
-writeBmc(EmbPattern* pattern , FILE* file)
+writeBmc(EmbPattern* pattern , EmbStream* file)
 {
     puts("writeBmc is not implemented");
     printf("Cannot write %p %p\n", pattern, file);
@@ -983,11 +1860,12 @@ writeBmc(EmbPattern* pattern , FILE* file)
  * 2 bytes for any stitch.
  */
 char
-readBro(EmbPattern* pattern, FILE* file)
+readBro(EmbPattern* pattern, EmbStream* file)
 {
+    EmbStitchBatch batch;
     unsigned char header[19];
     unsigned char *ptr = header;
-    if (fread(header, 1, 19, file) != 19) {
+    if (emb_fread(header, 1, 19, file) != 19) {
         return 0;
     }
     /* TODO: determine what this unknown data is.
@@ -997,21 +1875,24 @@ readBro(EmbPattern* pattern, FILE* file)
     char *name = (char*)ptr; /* 8 chars long */
     printf("readBro: %s\n", name);
 
-    fseek(file, 0x100, SEEK_SET);
+    emb_fseek(file, 0x100, SEEK_SET);
 
-    while (!feof(file)) {
+    emb_stitch_batch_init(&batch, pattern);
+    while (!emb_feof(file)) {
         short b1, b2;
         int stitchType = NORMAL;
-        b1 = (unsigned char)fgetc(file);
-        b2 = (unsigned char)fgetc(file);
+        b1 = (unsigned char)emb_fgetc(file);
+        b2 = (unsigned char)emb_fgetc(file);
         if (b1 == -128) {
-            unsigned char bCode = (unsigned char)fgetc(file);
-            if (fread(&b1, 2, 1, file) != 1) {
+            unsigned char bCode = (unsigned char)emb_fgetc(file);
+            if (emb_fread(&b1, 2, 1, file) != 1) {
                 puts("ERROR");
+                emb_stitch_batch_flush(&batch);
                 return 0;
             }
-            if (fread(&b2, 2, 1, file) != 1) {
+            if (emb_fread(&b2, 2, 1, file) != 1) {
                 puts("ERROR");
+                emb_stitch_batch_flush(&batch);
                 return 0;
             }
             /* Embird uses 0x02 and Wilcom uses 0xE1 */
@@ -1020,17 +1901,18 @@ readBro(EmbPattern* pattern, FILE* file)
             } else if (bCode == 3) {
                 stitchType = TRIM;
             } else if (bCode == 0x7E) {
-                emb_pattern_addStitchRel(pattern, 0, 0, END, 1);
+                emb_stitch_batch_rel(&batch, 0, 0, END);
                 break;
             }
         }
-        emb_pattern_addStitchRel(pattern, b1 / 10.0, b2 / 10.0, stitchType, 1);
+        emb_stitch_batch_rel(&batch, b1 / 10.0, b2 / 10.0, stitchType);
     }
+    emb_stitch_batch_flush(&batch);
     return 1;
 }
 
 char
-writeBro(EmbPattern* pattern , FILE* file)
+writeBro(EmbPattern* pattern , EmbStream* file)
 {
     puts("writeBro is not implemented");
     printf("Cannot write %p %p\n", pattern, file);
@@ -1046,7 +1928,7 @@ writeBro(EmbPattern* pattern , FILE* file)
  * \todo Find a source.
  */
 char
-readCnd(EmbPattern* pattern , FILE* file)
+readCnd(EmbPattern* pattern , EmbStream* file)
 {
     puts("readCnd is not implemented");
     printf("Cannot read %p %p\n", pattern, file);
@@ -1054,7 +1936,7 @@ readCnd(EmbPattern* pattern , FILE* file)
 }
 
 char
-writeCnd(EmbPattern* pattern , FILE* file)
+writeCnd(EmbPattern* pattern , EmbStream* file)
 {
     puts("writeCnd is not implemented");
     printf("Cannot write %p %p\n", pattern, file);
@@ -1089,7 +1971,7 @@ writeCnd(EmbPattern* pattern , FILE* file)
  *    3,0,0,255\r\n
  */
 char
-readCol(EmbPattern* pattern, FILE* file)
+readCol(EmbPattern* pattern, EmbStream* file)
 {
     int numberOfColors, i;
     int num, blue, green, red;
@@ -1117,23 +1999,23 @@ readCol(EmbPattern* pattern, FILE* file)
         t.color.r = (unsigned char)red;
         t.color.g = (unsigned char)green;
         t.color.b = (unsigned char)blue;
-        strcpy(t.catalogNumber, "");
-        strcpy(t.description, "");
+        t.catalogNumber = "";
+        t.description = "";
         emb_pattern_addThread(pattern, t);
     }
     return 1;
 }
 
 char
-writeCol(EmbPattern* pattern, FILE* file)
+writeCol(EmbPattern* pattern, EmbStream* file)
 {
     int i;
 
-    fprintf(file, "%d\r\n", pattern->thread_list->count);
+    emb_fprintf(file, "%d\r\n", pattern->thread_list->count);
     for (i = 0; i < pattern->thread_list->count; i++) {
         EmbColor c;
         c = pattern->thread_list->thread[i].color;
-        fprintf(file, "%d,%d,%d,%d\r\n", i, (int)c.r, (int)c.g, (int)c.b);
+        emb_fprintf(file, "%d,%d,%d,%d\r\n", i, (int)c.r, (int)c.g, (int)c.b);
     }
     return 1;
 }
@@ -1142,12 +2024,6 @@ writeCol(EmbPattern* pattern, FILE* file)
  *
  * Stitch Only Format.
  */
-#define CsdSubMaskSize  479
-#define CsdXorMaskSize  501
-
-char _subMask[CsdSubMaskSize];
-char _xorMask[CsdXorMaskSize];
-
 const unsigned char csd_decryptArray[] = {
     0x43, 0x6E, 0x72, 0x7A, 0x76, 0x6C, 0x61, 0x6F, 0x7C, 0x29, 0x5D, 0x62, 0x60, 0x6E, 0x61, 0x62,
     0x20, 0x41, 0x66, 0x6A, 0x3A, 0x35, 0x5A, 0x63, 0x7C, 0x37, 0x3A, 0x2A, 0x25, 0x24, 0x2A, 0x33,
@@ -1169,25 +2045,25 @@ const unsigned char csd_decryptArray[] = {
 
 
 void
-BuildDecryptionTable(int seed) {
+BuildDecryptionTable(EmbContext *ctx, int seed) {
     int i;
     const int mul1 = 0x41C64E6D;
     const int add1 = 0x3039;
 
-    for (i = 0; i < CsdSubMaskSize; i++) {
+    for (i = 0; i < EMB_CSD_SUB_MASK_SIZE; i++) {
         seed *= mul1;
         seed += add1;
-        _subMask[i] = (char) ((seed >> 16) & 0xFF);
+        ctx->csd_sub_mask[i] = (char) ((seed >> 16) & 0xFF);
     }
-    for (i = 0; i < CsdXorMaskSize; i++) {
+    for (i = 0; i < EMB_CSD_XOR_MASK_SIZE; i++) {
         seed *= mul1;
         seed += add1;
-        _xorMask[i] = (char) ((seed >> 16) & 0xFF);
+        ctx->csd_xor_mask[i] = (char) ((seed >> 16) & 0xFF);
     }
 }
 
 unsigned char
-DecodeCsdByte(long fileOffset, unsigned char val, int type)
+DecodeCsdByte(EmbContext *ctx, long fileOffset, unsigned char val, int type)
 {
     int newOffset;
 
@@ -1218,13 +2094,15 @@ DecodeCsdByte(long fileOffset, unsigned char val, int type)
         newOffset = (int) fileOffset;
     }
     return ((unsigned char) ((unsigned char)
-        (val ^ _xorMask[newOffset%CsdXorMaskSize]) -
-            _subMask[newOffset%CsdSubMaskSize]));
+        (val ^ ctx->csd_xor_mask[newOffset%EMB_CSD_XOR_MASK_SIZE]) -
+            ctx->csd_sub_mask[newOffset%EMB_CSD_SUB_MASK_SIZE]));
 }
 
 char
-readCsd(EmbPattern* pattern, FILE* file)
+readCsd(EmbPattern* pattern, EmbStream* file)
 {
+    EmbStitchBatch batch;
+    EmbContext *ctx = pattern->context;
     int i, type = 0;
     unsigned char identifier[8];
     unsigned char unknown1, unknown2;
@@ -1233,7 +2111,7 @@ readCsd(EmbPattern* pattern, FILE* file)
     int flags;
     unsigned char colorOrder[14];
 
-    if (fread(identifier, 1, 8, file) != 8) {
+    if (emb_fread(identifier, 1, 8, file) != 8) {
         puts("ERROR");
         return 0;
     }
@@ -1243,35 +2121,36 @@ readCsd(EmbPattern* pattern, FILE* file)
         type = 1;
     }
     if (type == 0) {
-        BuildDecryptionTable(0xC);
+        BuildDecryptionTable(ctx, 0xC);
     }
     else {
-        BuildDecryptionTable(identifier[0]);
+        BuildDecryptionTable(ctx, identifier[0]);
     }
 
     for (i = 0; i < 16; i++) {
         EmbThread thread;
-        thread.color.r = DecodeCsdByte(ftell(file), (unsigned char)fgetc(file), type);
-        thread.color.g = DecodeCsdByte(ftell(file), (unsigned char)fgetc(file), type);
-        thread.color.b = DecodeCsdByte(ftell(file), (unsigned char)fgetc(file), type);
-        strcpy(thread.catalogNumber, "");
-        strcpy(thread.description, "");
+        thread.color.r = DecodeCsdByte(ctx, emb_ftell(file), (unsigned char)emb_fgetc(file), type);
+        thread.color.g = DecodeCsdByte(ctx, emb_ftell(file), (unsigned char)emb_fgetc(file), type);
+        thread.color.b = DecodeCsdByte(ctx, emb_ftell(file), (unsigned char)emb_fgetc(file), type);
+        thread.catalogNumber = "";
+        thread.description = "";
         emb_pattern_addThread(pattern, thread);
     }
-    unknown1 = DecodeCsdByte(ftell(file), (unsigned char)fgetc(file), type);
-    unknown2 = DecodeCsdByte(ftell(file), (unsigned char)fgetc(file), type);
-    if (emb_verbose>1) {
+    unknown1 = DecodeCsdByte(ctx, emb_ftell(file), (unsigned char)emb_fgetc(file), type);
+    unknown2 = DecodeCsdByte(ctx, emb_ftell(file), (unsigned char)emb_fgetc(file), type);
+    if (pattern->context->verbose>1) {
         printf("unknown bytes to decode: %c %c", unknown1, unknown2);
     }
 
     for (i = 0; i < 14; i++) {
-        colorOrder[i] = (unsigned char) DecodeCsdByte(ftell(file), (unsigned char)fgetc(file), type);
+        colorOrder[i] = (unsigned char) DecodeCsdByte(ctx, emb_ftell(file), (unsigned char)emb_fgetc(file), type);
     }
-    for (i = 0; !feof(file); i++) {
+    emb_stitch_batch_init(&batch, pattern);
+    for (i = 0; !emb_feof(file); i++) {
         char negativeX, negativeY;
-        unsigned char b0 = DecodeCsdByte(ftell(file), (unsigned char)fgetc(file), type);
-        unsigned char b1 = DecodeCsdByte(ftell(file), (unsigned char)fgetc(file), type);
-        unsigned char b2 = DecodeCsdByte(ftell(file), (unsigned char)fgetc(file), type);
+        unsigned char b0 = DecodeCsdByte(ctx, emb_ftell(file), (unsigned char)emb_fgetc(file), type);
+        unsigned char b1 = DecodeCsdByte(ctx, emb_ftell(file), (unsigned char)emb_fgetc(file), type);
+        unsigned char b2 = DecodeCsdByte(ctx, emb_ftell(file), (unsigned char)emb_fgetc(file), type);
 
         if (b0 == 0xF8 || b0 == 0x87 || b0 == 0x91) {
             break;
@@ -1287,6 +2166,7 @@ readCsd(EmbPattern* pattern, FILE* file)
             if (colorChange >= 14) {
                 printf("Invalid color change detected\n");
             }
+            emb_stitch_batch_flush(&batch);
             emb_pattern_changeColor(pattern, colorOrder[colorChange  % 14]);
             colorChange += 1;
         } else if ((b0 & 0x1F) > 0) {
@@ -1303,16 +2183,17 @@ readCsd(EmbPattern* pattern, FILE* file)
             dy = (char) -dy;
         }
         if (flags == STOP) {
-            emb_pattern_addStitchRel(pattern, 0, 0, flags, 1);
+            emb_stitch_batch_rel(&batch, 0, 0, flags);
         } else {
-            emb_pattern_addStitchRel(pattern, dx / 10.0, dy / 10.0, flags, 1);
+            emb_stitch_batch_rel(&batch, dx / 10.0, dy / 10.0, flags);
         }
     }
+    emb_stitch_batch_flush(&batch);
     return 1;
 }
 
 char
-writeCsd(EmbPattern* pattern, FILE* file) {
+writeCsd(EmbPattern* pattern, EmbStream* file) {
     puts("writeCsd is not implemented.");
     puts("Overridden, defaulting to dst.");
     writeDst(pattern, file);
@@ -1396,184 +2277,197 @@ csvStrToStitchFlag(const char* str)
     return -1;
 }
 
-char
-readCsv(EmbPattern* pattern, FILE* file)
+/* A row of a CSV file, either a thread or a stitch. */
+typedef struct CsvRecord_ {
+    int isThread;
+    EmbColor color;
+    EmbStitch stitch;
+} CsvRecord;
+
+/* Takes the next quoted cell from a *p, stopping at a end.
+ * Returns 0 when there are no more cells and -1 for an unclosed quote.
+ */
+static int
+csvNextCell(const char **p, const char *end, const char **cell, size_t *length)
 {
-    int numColorChanges = 0;
-    int pos = 0;
-    int c = 0;
-    int cellNum = 0;
-    int process = 0;
-    int csvMode = CSV_MODE_NULL;
-    int expect = CSV_EXPECT_QUOTE1;
-    int flags = 0;
-    EmbReal xx = 0.0;
-    EmbReal yy = 0.0;
-    unsigned char r = 0, g = 0, b = 0;
-    EmbString buff;
+    const char *open = (const char*)memchr(*p, '"', (size_t)(end - *p));
+    const char *close;
+    if (!open) {
+        return 0;
+    }
+    close = (const char*)memchr(open + 1, '"', (size_t)(end - open - 1));
+    if (!close) {
+        return -1;
+    }
+    *cell = open + 1;
+    *length = (size_t)(close - open - 1);
+    *p = close + 1;
+    return 1;
+}
 
-    pos = 0;
-    while (!feof(file)) {
-        c = fgetc(file);
-        switch(c) {
-            case '"':
-                if (expect == CSV_EXPECT_QUOTE1) {
-                    expect = CSV_EXPECT_QUOTE2;
-                } else if (expect == CSV_EXPECT_QUOTE2) {
-                    expect = CSV_EXPECT_COMMA;
-                }
-                break;
-            case ',':
-                if (expect == CSV_EXPECT_COMMA) {
-                    process = 1;
-                }
-                break;
-            case '\n':
-                if (expect == CSV_EXPECT_COMMA) {
-                    process = 1;
-                } else if (expect == CSV_EXPECT_QUOTE1) {
-                        /* Do Nothing. We encountered a blank line. */
-                } else {
-                    printf("ERROR: format-csv.c readCsv(), premature newline\n");
-                    return 0;
-                }
-                break;
-            default:
-                break;
-        }
+/* Parses a row of a CSV file into a CsvRecord, see emb_stream_parse_lines(). */
+static int
+csvParseLine(const char *line, size_t length, void *record)
+{
+    CsvRecord *r = (CsvRecord*)record;
+    const char *p = line, *end = line + length;
+    const char *cell[8];
+    size_t cellLength[8];
+    int n = 0, result = 0, value;
 
-        if (process) {
-            buff[pos] = 0;
-            pos = 0;
-            process = 0;
-            cellNum++;
-            expect = CSV_EXPECT_QUOTE1;
-                if (csvMode == CSV_MODE_NULL) {
-                    if     (!strcmp(buff, "#")) {
-                        csvMode = CSV_MODE_COMMENT;
-                    } else if (!strcmp(buff, ">")) {
-                        csvMode = CSV_MODE_VARIABLE;
-                    } else if (!strcmp(buff, "$")) {
-                        csvMode = CSV_MODE_THREAD;
-                    } else if (!strcmp(buff, "*")) {
-                        csvMode = CSV_MODE_STITCH;
-                    } else {/* TODO: error */
-                        return 0;
-                    }
-                } else if (csvMode == CSV_MODE_COMMENT) {
-                    /* Do Nothing */
-                } else if (csvMode == CSV_MODE_VARIABLE) {
-                    /* Do Nothing */
-                } else if (csvMode == CSV_MODE_THREAD) {
-                    if (cellNum == 2) {
-                        /* Do Nothing. Ignore Thread Number */
-                    } else if (cellNum == 3) {
-                        r = (unsigned char)atoi(buff);
-                    } else if (cellNum == 4) {
-                        g = (unsigned char)atoi(buff);
-                    } else if (cellNum == 5) {
-                        b = (unsigned char)atoi(buff);
-                    } else if (cellNum == 6) {
-                        /* TODO: Thread Description */
-                    } else if (cellNum == 7) {
-                        /* TODO: Thread Catalog Number */
-                        EmbThread t;
-                        t.color.r = r;
-                        t.color.g = g;
-                        t.color.b = b;
-                        strcpy(t.description, "TODO:DESCRIPTION");
-                        strcpy(t.catalogNumber, "TODO:CATALOG_NUMBER");
-                        emb_pattern_addThread(pattern, t);
-                        csvMode = CSV_MODE_NULL;
-                        cellNum = 0;
-                    } else {
-                        /* TODO: error */
-                        return 0;
-                    }
-                } else if (csvMode == CSV_MODE_STITCH) {
-                    /* printf("%s\n", buff); */
-                    if (cellNum == 2) {
-                        flags = csvStrToStitchFlag(buff);
-                        if (flags == STOP) {
-                            numColorChanges++;
-                        }
-                    } else if (cellNum == 3) {
-                        xx = atof(buff);
-                    } else if (cellNum == 4) {
-                        yy = atof(buff);
-                        /* printf("%d %d %f %f\n",
-                            pattern->stitch_list->count, flags, xx, yy); */
-                        emb_pattern_addStitchAbs(pattern, xx, yy, flags, 1);
-                        csvMode = CSV_MODE_NULL;
-                        cellNum = 0;
-                    } else {
-                        /* TODO: error */
-                        return 0;
-                    }
-                }
-                if (c == '\n') {
-                    csvMode = CSV_MODE_NULL;
-                    cellNum = 0;
-                }
-            } else {
-                if (expect == CSV_EXPECT_QUOTE2 && c != '"') {
-                    buff[pos++] = (char)c;
-                }
-            }
+    while (n < 8) {
+        result = csvNextCell(&p, end, &cell[n], &cellLength[n]);
+        if (result <= 0) {
+            break;
+        }
+        n++;
+    }
+    if (result < 0) {
+        printf("ERROR: format-csv.c readCsv(), premature newline\n");
+        return EMB_LINE_ERROR;
+    }
+    if (n == 0) {
+        /* A blank line. */
+        return EMB_LINE_SKIP;
+    }
+    if (cellLength[0] != 1) {
+        return EMB_LINE_ERROR;
+    }
+    switch (cell[0][0]) {
+    case '#':
+    case '>':
+        /* Comments and variables. */
+        return EMB_LINE_SKIP;
+    case '$':
+        if (n > 7) {
+            return EMB_LINE_ERROR;
+        }
+        if (n < 7) {
+            return EMB_LINE_SKIP;
+        }
+        /* The thread number, description and catalog number are ignored. */
+        r->isThread = 1;
+        value = 0;
+        emb_parse_int(cell[2], cell[2] + cellLength[2], &value);
+        r->color.r = (unsigned char)value;
+        value = 0;
+        emb_parse_int(cell[3], cell[3] + cellLength[3], &value);
+        r->color.g = (unsigned char)value;
+        value = 0;
+        emb_parse_int(cell[4], cell[4] + cellLength[4], &value);
+        r->color.b = (unsigned char)value;
+        return EMB_LINE_RECORD;
+    case '*': {
+        EmbString flag;
+        if (n > 4) {
+            return EMB_LINE_ERROR;
+        }
+        if (n < 4) {
+            return EMB_LINE_SKIP;
+        }
+        r->isThread = 0;
+        memcpy(flag, cell[1], EMB_MIN(cellLength[1], 15));
+        flag[EMB_MIN(cellLength[1], 15)] = 0;
+        r->stitch.flags = csvStrToStitchFlag(flag);
+        r->stitch.x = 0.0f;
+        r->stitch.y = 0.0f;
+        emb_parse_real(cell[2], cell[2] + cellLength[2], &r->stitch.x);
+        emb_parse_real(cell[3], cell[3] + cellLength[3], &r->stitch.y);
+        return EMB_LINE_RECORD;
+    }
+    default:
+        return EMB_LINE_ERROR;
     }
+}
+
+char
+readCsv(EmbPattern* pattern, EmbStream* file)
+{
+    CsvRecord *records;
+    int i, count;
 
+    if (!emb_stream_parse_lines(file, csvParseLine, sizeof(CsvRecord), 0,
+        (void**)&records, &count)) {
+        return 0;
+    }
+    emb_pattern_reserve_stitches(pattern, count);
+    for (i = 0; i < count; i++) {
+        CsvRecord r = records[i];
+        if (r.isThread) {
+            EmbThread t;
+            t.color = r.color;
+            t.description = "TODO:DESCRIPTION";
+            t.catalogNumber = "TODO:CATALOG_NUMBER";
+            emb_pattern_addThread(pattern, t);
+        }
+        else {
+            emb_pattern_addStitchAbs(pattern, r.stitch.x, r.stitch.y,
+                r.stitch.flags, 1);
+        }
+    }
+    safe_free(records);
     return 1;
 }
 
 char
-writeCsv(EmbPattern* pattern, FILE* file)
+writeCsv(EmbPattern* pattern, EmbStream* file)
 {
+    const char *extent_names[] = {
+        "EXTENTS_LEFT:", "EXTENTS_TOP:", "EXTENTS_RIGHT:",
+        "EXTENTS_BOTTOM:", "EXTENTS_WIDTH:", "EXTENTS_HEIGHT:"
+    };
+    EmbReal extents[6];
     EmbRect boundingRect;
     int i;
 
     boundingRect = emb_pattern_bounds(pattern);
 
-    fprintf(file, "\"#\",\"Embroidermodder 2 CSV Embroidery File\"\n");
-    fprintf(file, "\"#\",\"http://embroidermodder.github.io\"\n");
-    fprintf(file, "\"#\",\" \"\n");
-    fprintf(file, "\"#\",\"General Notes:\"\n");
-    fprintf(file, "\"#\",\"This file can be read by Excel or LibreOffice as CSV (Comma Separated Value) or with a text editor.\"\n");
-    fprintf(file, "\"#\",\"Lines beginning with # are comments.\"\n");
-    fprintf(file, "\"#\",\"Lines beginning with > are variables: [VAR_NAME], [VAR_VALUE]\"\n");
-    fprintf(file, "\"#\",\"Lines beginning with $ are threads: [THREAD_NUMBER], [RED], [GREEN], [BLUE], [DESCRIPTION], [CATALOG_NUMBER]\"\n");
-    fprintf(file, "\"#\",\"Lines beginning with * are stitch entries: [STITCH_TYPE], [X], [Y]\"\n");
-    fprintf(file, "\"#\",\" \"\n");
-    fprintf(file, "\"#\",\"Stitch Entry Notes:\"\n");
-    fprintf(file, "\"#\",\"STITCH instructs the machine to move to the position [X][Y] and then make a stitch.\"\n");
-    fprintf(file, "\"#\",\"JUMP instructs the machine to move to the position [X][Y] without making a stitch.\"\n");
-    fprintf(file, "\"#\",\"TRIM instructs the machine to cut the thread before moving to the position [X][Y] without making a stitch.\"\n");
-    fprintf(file, "\"#\",\"COLOR instructs the machine to stop temporarily so that the user can change to a different color thread before resuming.\"\n");
-    fprintf(file, "\"#\",\"END instructs the machine that the design is completed and there are no further instructions.\"\n");
-    fprintf(file, "\"#\",\"UNKNOWN encompasses instructions that may not be supported currently.\"\n");
-    fprintf(file, "\"#\",\"[X] and [Y] are absolute coordinates in millimeters (mm).\"\n");
-    fprintf(file, "\"#\",\" \"\n");
+    emb_fprintf(file, "\"#\",\"Embroidermodder 2 CSV Embroidery File\"\n");
+    emb_fprintf(file, "\"#\",\"http://embroidermodder.github.io\"\n");
+    emb_fprintf(file, "\"#\",\" \"\n");
+    emb_fprintf(file, "\"#\",\"General Notes:\"\n");
+    emb_fprintf(file, "\"#\",\"This file can be read by Excel or LibreOffice as CSV (Comma Separated Value) or with a text editor.\"\n");
+    emb_fprintf(file, "\"#\",\"Lines beginning with # are comments.\"\n");
+    emb_fprintf(file, "\"#\",\"Lines beginning with > are variables: [VAR_NAME], [VAR_VALUE]\"\n");
+    emb_fprintf(file, "\"#\",\"Lines beginning with $ are threads: [THREAD_NUMBER], [RED], [GREEN], [BLUE], [DESCRIPTION], [CATALOG_NUMBER]\"\n");
+    emb_fprintf(file, "\"#\",\"Lines beginning with * are stitch entries: [STITCH_TYPE], [X], [Y]\"\n");
+    emb_fprintf(file, "\"#\",\" \"\n");
+    emb_fprintf(file, "\"#\",\"Stitch Entry Notes:\"\n");
+    emb_fprintf(file, "\"#\",\"STITCH instructs the machine to move to the position [X][Y] and then make a stitch.\"\n");
+    emb_fprintf(file, "\"#\",\"JUMP instructs the machine to move to the position [X][Y] without making a stitch.\"\n");
+    emb_fprintf(file, "\"#\",\"TRIM instructs the machine to cut the thread before moving to the position [X][Y] without making a stitch.\"\n");
+    emb_fprintf(file, "\"#\",\"COLOR instructs the machine to stop temporarily so that the user can change to a different color thread before resuming.\"\n");
+    emb_fprintf(file, "\"#\",\"END instructs the machine that the design is completed and there are no further instructions.\"\n");
+    emb_fprintf(file, "\"#\",\"UNKNOWN encompasses instructions that may not be supported currently.\"\n");
+    emb_fprintf(file, "\"#\",\"[X] and [Y] are absolute coordinates in millimeters (mm).\"\n");
+    emb_fprintf(file, "\"#\",\" \"\n");
 
     /* write variables */
-    fprintf(file,"\"#\",\"[VAR_NAME]\",\"[VAR_VALUE]\"\n");
-    fprintf(file, "\">\",\"STITCH_COUNT:\",\"%u\"\n", (unsigned int)pattern->stitch_list->count);
-    fprintf(file, "\">\",\"THREAD_COUNT:\",\"%u\"\n", (unsigned int)pattern->thread_list->count);
-    fprintf(file, "\">\",\"EXTENTS_LEFT:\",\"%f\"\n", boundingRect.x);
-    fprintf(file, "\">\",\"EXTENTS_TOP:\",\"%f\"\n", boundingRect.y);
-    fprintf(file, "\">\",\"EXTENTS_RIGHT:\",\"%f\"\n", boundingRect.x + boundingRect.w);
-    fprintf(file, "\">\",\"EXTENTS_BOTTOM:\",\"%f\"\n", boundingRect.y + boundingRect.h);
-    fprintf(file, "\">\",\"EXTENTS_WIDTH:\",\"%f\"\n", boundingRect.w);
-    fprintf(file, "\">\",\"EXTENTS_HEIGHT:\",\"%f\"\n", boundingRect.h);
-    fprintf(file,"\n");
+    emb_fprintf(file,"\"#\",\"[VAR_NAME]\",\"[VAR_VALUE]\"\n");
+    emb_fprintf(file, "\">\",\"STITCH_COUNT:\",\"%u\"\n", (unsigned int)pattern->stitch_list->count);
+    emb_fprintf(file, "\">\",\"THREAD_COUNT:\",\"%u\"\n", (unsigned int)pattern->thread_list->count);
+    extents[0] = boundingRect.x;
+    extents[1] = boundingRect.y;
+    extents[2] = boundingRect.x + boundingRect.w;
+    extents[3] = boundingRect.y + boundingRect.h;
+    extents[4] = boundingRect.w;
+    extents[5] = boundingRect.h;
+    for (i = 0; i < 6; i++) {
+        emb_fprintf(file, "\">\",\"%s\",\"", extent_names[i]);
+        emb_write_real(file, extents[i]);
+        emb_fputs("\"\n", file);
+    }
+    emb_fprintf(file,"\n");
 
     /* write colors */
-    fprintf(file, "\"#\",\"[THREAD_NUMBER]\",\"[RED]\",\"[GREEN]\",");
-    fprintf(file, "\"[BLUE]\",\"[DESCRIPTION]\",\"[CATALOG_NUMBER]\"\n");
+    emb_fprintf(file, "\"#\",\"[THREAD_NUMBER]\",\"[RED]\",\"[GREEN]\",");
+    emb_fprintf(file, "\"[BLUE]\",\"[DESCRIPTION]\",\"[CATALOG_NUMBER]\"\n");
 
     for (i = 0; i < pattern->thread_list->count; i++) {
         EmbThread thr = pattern->thread_list->thread[i];
         /* TODO: fix segfault that backtraces here when
             libembroidery-convert from dst to csv. */
-        fprintf(file, "\"$\",\"%d\",\"%d\",\"%d\",\"%d\",\"%s\",\"%s\"\n",
+        emb_fprintf(file, "\"$\",\"%d\",\"%d\",\"%d\",\"%d\",\"%s\",\"%s\"\n",
             i+1,
             (int)thr.color.r,
             (int)thr.color.g,
@@ -1581,14 +2475,19 @@ writeCsv(EmbPattern* pattern, FILE* file)
             thr.description,
             thr.catalogNumber);
     }
-    fprintf(file, "\n");
+    emb_fprintf(file, "\n");
 
     /* write stitches */
-    fprintf(file, "\"#\",\"[STITCH_TYPE]\",\"[X]\",\"[Y]\"\n");
+    emb_fprintf(file, "\"#\",\"[STITCH_TYPE]\",\"[X]\",\"[Y]\"\n");
     for (i = 0; i < pattern->stitch_list->count; i++) {
         EmbStitch s = pattern->stitch_list->stitch[i];
-        fprintf(file, "\"*\",\"%s\",\"%f\",\"%f\"\n",
-            csvStitchFlagToStr(s.flags), s.x, s.y);
+        emb_fputs("\"*\",\"", file);
+        emb_fputs(csvStitchFlagToStr(s.flags), file);
+        emb_fputs("\",\"", file);
+        emb_write_real(file, s.x);
+        emb_fputs("\",\"", file);
+        emb_write_real(file, s.y);
+        emb_fputs("\"\n", file);
     }
     return 1;
 }
@@ -1598,25 +2497,27 @@ writeCsv(EmbPattern* pattern, FILE* file)
  * Stitch Only Format.
  */
 char
-readDat(EmbPattern* pattern, FILE* file)
+readDat(EmbPattern* pattern, EmbStream* file)
 {
+    EmbStitchBatch batch;
     unsigned char b0;
     int fileLength, stitchesRemaining, b1, b2, stitchType;
 
-    fseek(file, 0x00, SEEK_END);
-    fileLength = ftell(file);
+    emb_fseek(file, 0x00, SEEK_END);
+    fileLength = emb_ftell(file);
     if (fileLength < 0x100) {
         puts("ERROR: dat file too short to contain header.");
         return 0;
     }
-    fseek(file, 0x02, SEEK_SET);
+    emb_fseek(file, 0x02, SEEK_SET);
     LOAD_U16(file, stitchesRemaining)
-    fseek(file, 0x100, SEEK_SET);
+    emb_fseek(file, 0x100, SEEK_SET);
 
-    while (!feof(file)) {
-        b1 = (int)fgetc(file);
-        b2 = (int)fgetc(file);
-        b0 = fgetc(file);
+    emb_stitch_batch_init(&batch, pattern);
+    while (!emb_feof(file)) {
+        b1 = (int)emb_fgetc(file);
+        b2 = (int)emb_fgetc(file);
+        b0 = emb_fgetc(file);
 
         stitchType = NORMAL;
 
@@ -1634,14 +2535,15 @@ readDat(EmbPattern* pattern, FILE* file)
         if (b2 >= 0x80) {
             b2 = -(b2 & 0x7F);
         }
-        emb_pattern_addStitchRel(pattern, b1 / 10.0, b2 / 10.0, stitchType, 1);
+        emb_stitch_batch_rel(&batch, b1 / 10.0, b2 / 10.0, stitchType);
     }
 
+    emb_stitch_batch_flush(&batch);
     return 1;
 }
 
 char
-writeDat(EmbPattern* pattern, FILE* file)
+writeDat(EmbPattern* pattern, EmbStream* file)
 {
     int i;
     fpad(file, 0x00, 0x100);
@@ -1669,7 +2571,7 @@ writeDat(EmbPattern* pattern, FILE* file)
         if (st.y < 0) {
             b[1] = st.y+0xFF;
         }
-        fwrite(b, 1, 3, file);
+        emb_fwrite(b, 1, 3, file);
     }
     return 1; /*TODO: finish writeDat */
 }
@@ -1679,7 +2581,7 @@ writeDat(EmbPattern* pattern, FILE* file)
  * Stitch Only Format
  */
 char
-readDem(EmbPattern* pattern, FILE* file)
+readDem(EmbPattern* pattern, EmbStream* file)
 {
     puts("readDem is not implemented.");
     puts("Overridden, defaulting to dst.");
@@ -1687,7 +2589,7 @@ readDem(EmbPattern* pattern, FILE* file)
 }
 
 char
-writeDem(EmbPattern* pattern, FILE* file)
+writeDem(EmbPattern* pattern, EmbStream* file)
 {
     puts("writeDem is not implemented.");
     puts("Overridden, defaulting to dst.");
@@ -1703,17 +2605,19 @@ writeDem(EmbPattern* pattern, FILE* file)
  * [o] Well Tested Write
  */
 char
-readDsb(EmbPattern* pattern, FILE* file)
+readDsb(EmbPattern* pattern, EmbStream* file)
 {
+    EmbStitchBatch batch;
     char header[512+1];
     unsigned char buffer[3];
 
-    if (fread(header, 1, 512, file) != 512) {
+    if (emb_fread(header, 1, 512, file) != 512) {
         puts("ERROR");
         return 0;
     }
 
-    while (fread(buffer, 1, 3, file) == 3) {
+    emb_stitch_batch_init(&batch, pattern);
+    while (emb_fread(buffer, 1, 3, file) == 3) {
         int x, y;
         unsigned char ctrl;
         int stitchType = NORMAL;
@@ -1730,16 +2634,17 @@ readDsb(EmbPattern* pattern, FILE* file)
             stitchType = STOP;
         }
         if (ctrl == 0xF8 || ctrl == 0x91 || ctrl == 0x87) {
-            emb_pattern_addStitchRel(pattern, 0, 0, END, 1);
+            emb_stitch_batch_rel(&batch, 0, 0, END);
             break;
         }
-        emb_pattern_addStitchRel(pattern, x / 10.0, y / 10.0, stitchType, 1);
+        emb_stitch_batch_rel(&batch, x / 10.0, y / 10.0, stitchType);
     }
+    emb_stitch_batch_flush(&batch);
     return 1;
 }
 
 char
-writeDsb(EmbPattern* pattern, FILE* file)
+writeDsb(EmbPattern* pattern, EmbStream* file)
 {
     puts("writeDsb is not implemented");
     puts("Overridden, defaulting to dst.");
@@ -1882,7 +2787,7 @@ combine_jump_stitches(EmbPattern* p, int jumpsPerTrim)
 */
 
 void
-encode_record(FILE* file, int x, int y, int flags)
+encode_record(EmbStream* file, int x, int y, int flags)
 {
     unsigned char b[3];
     encode_tajima_ternary(b, x, y);
@@ -1914,7 +2819,7 @@ encode_record(FILE* file, int x, int y, int flags)
         b[2] = (char) (b[2] | 0xC3);
     }
 
-    fwrite(b, 1, 3, file);
+    emb_fwrite(b, 1, 3, file);
 }
 
 /*convert 2 characters into 1 int for case statement */
@@ -1938,6 +2843,9 @@ set_dst_variable(EmbPattern* pattern, char* var, char* val) {
         /*pattern->set_variable("Design_Name",val); TODO: review this line. */
         break;
     case cci('S','T'): /* Stitch count, 7 digits padded by leading 0's */
+        /* Not stored either, but it sizes the stitch list up front. */
+        emb_pattern_reserve_stitches(pattern, atoi(val));
+        break;
     case cci('C','O'): /* Color change count, 3 digits padded by leading 0's */
     case cci('+','X'): /* Design extents (+/-X,+/-Y), 5 digits padded by leading 0's */
     case cci('-','X'):
@@ -1973,8 +2881,8 @@ set_dst_variable(EmbPattern* pattern, char* var, char* val) {
         catalog_number=split_cell_str(val,3);
         */
         t.color = embColor_fromHexStr(val);
-        strcpy(t.description, "");
-        strcpy(t.catalogNumber, "");
+        t.description = "";
+        t.catalogNumber = "";
         emb_pattern_addThread(pattern, t);
         break;
     default:
@@ -2029,21 +2937,22 @@ set_dst_variable(EmbPattern* pattern, char* var, char* val) {
  *
  * char PD[9+1];   PD is also storing some information for multi-volume design.
  */
-char
-readDst(EmbPattern* pattern, FILE* file) {
+/* Reads the 512 byte header of a DST file into a pattern. */
+int
+dstReadHeader(EmbPattern* pattern, EmbStream* file)
+{
     char var[3];   /* temporary storage variable name */
     char val[512]; /* temporary storage variable value */
     int valpos;
-    unsigned char b[3];
     char header[512 + 1];
-    int i = 0, flags;
+    int i = 0;
 
     /* TODO: review commented code below
     pattern->clear();
     pattern->set_variable("file_name",filename);
     */
 
-    if (fread(header, 1, 512, file) != 512) {
+    if (emb_fread(header, 1, 512, file) != 512) {
         puts("ERROR: Failed to read header bytes.");
         return 0;
     }
@@ -2074,56 +2983,324 @@ readDst(EmbPattern* pattern, FILE* file) {
             }
         }
     }
+    return 1;
+}
+
+/* Reads the stitch and color counts and the extents of a DST design from
+ * its header into a probe. Returns 0 if any of them is missing.
+ */
+int
+dstProbeHeader(EmbStream* file, EmbProbe* probe)
+{
+    char header[512 + 1];
+    long st = -1, co = -1, px = -1, nx = -1, py = -1, ny = -1;
+    int i;
+
+    if (emb_fread(header, 1, 512, file) != 512) {
+        return 0;
+    }
+    header[512] = 0;
+    /* Only the start of a field names it, labels can hold colons. */
+    for (i = 2; i < 512; i++) {
+        long value;
+        if (header[i] != ':' || (i > 2 && header[i - 3] != 13)) {
+            continue;
+        }
+        value = strtol(header + i + 1, 0, 10);
+        if (!strncmp(header + i - 2, "ST", 2)) {
+            st = value;
+        }
+        else if (!strncmp(header + i - 2, "CO", 2)) {
+            co = value;
+        }
+        else if (!strncmp(header + i - 2, "+X", 2)) {
+            px = value;
+        }
+        else if (!strncmp(header + i - 2, "-X", 2)) {
+            nx = value;
+        }
+        else if (!strncmp(header + i - 2, "+Y", 2)) {
+            py = value;
+        }
+        else if (!strncmp(header + i - 2, "-Y", 2)) {
+            ny = value;
+        }
+    }
+    if (st < 0 || co < 0 || px < 0 || nx < 0 || py < 0 || ny < 0) {
+        return 0;
+    }
+    probe->stitches = (int)st;
+    /* CO counts the color changes. */
+    probe->colors = (int)co + 1;
+    probe->min_x = -nx / 10.0;
+    probe->max_x = px / 10.0;
+    probe->min_y = -ny / 10.0;
+    probe->max_y = py / 10.0;
+    return 1;
+}
 
-    while (fread(b, 1, 3, file) == 3) {
-        int x, y;
-        decode_tajima_ternary(b, &x, &y);
-        flags = decode_record_flags(b[2]);
-        if (flags == END) {
+/* Decodes the next DST record into a pattern, returns 0 once the
+ * stitches are over.
+ */
+int
+dstReadRecord(EmbPattern* pattern, EmbStream* file)
+{
+    int x, y, flags;
+    const unsigned char *b = emb_stream_take(file, 3);
+    if (!b) {
+        return 0;
+    }
+    decode_tajima_ternary(b, &x, &y);
+    flags = decode_record_flags(b[2]);
+    if (flags == END) {
+        return 0;
+    }
+    emb_pattern_addStitchRel(pattern, x / 10.0, y / 10.0, flags, 1);
+    return 1;
+}
+
+/* DST files with at least this many records are decoded in parallel. */
+#define DST_PARALLEL_RECORDS    (64*1024)
+
+/* The fewest records a thread of the parallel decode takes at a time. */
+#define DST_CHUNK_RECORDS       (16*1024)
+
+typedef struct DstChunk_ {
+    const unsigned char *records;
+    int count;      /* records up to the end of the chunk or an END */
+    int end;        /* whether an END cut the chunk short */
+    long x;         /* the moves of the chunk, then of those before it */
+    long y;
+    int stops;
+    int first;      /* index of the chunk's first stitch */
+} DstChunk;
+
+typedef struct DstDecode_ {
+    DstChunk *chunks;
+    EmbStitch *stitches;
+    EmbVector base;
+    int color;
+    int phase;
+} DstDecode;
+
+/* Decodes a chunk of DST records: in the first phase to total its moves,
+ * in the second to write its stitches at their absolute positions.
+ */
+static void
+dstDecodeChunk(void *data, int index)
+{
+    DstDecode *d = (DstDecode*)data;
+    DstChunk *c = d->chunks + index;
+    int16_t dx[256], dy[256];
+    long x = c->x, y = c->y;
+    int i, j, stops = c->stops;
+
+    if (d->phase == 0) {
+        for (i = 0; i < c->count; i++) {
+            if (c->records[3*i + 2] == 0xF3) {
+                c->count = i;
+                c->end = 1;
+                break;
+            }
+        }
+    }
+    for (i = 0; i < c->count; i += 256) {
+        const unsigned char *b = c->records + 3*i;
+        int n = EMB_MIN(256, c->count - i);
+        decode_tajima_records(b, n, dx, dy);
+        for (j = 0; j < n; j++) {
+            int flags = decode_record_flags(b[3*j + 2]);
+            x += dx[j];
+            y += dy[j];
+            if (flags & STOP) {
+                stops++;
+            }
+            if (d->phase == 1) {
+                EmbStitch *st = d->stitches + c->first + i + j;
+                st->x = (EmbReal)(d->base.x + x / 10.0);
+                st->y = (EmbReal)(d->base.y + y / 10.0);
+                st->flags = flags;
+                st->color = d->color + stops;
+            }
+        }
+    }
+    if (d->phase == 0) {
+        c->x = x;
+        c->y = y;
+        c->stops = stops;
+    }
+}
+
+/* Decodes the stitches of a DST file held in memory all at once: chunks
+ * of records are totalled in parallel, the totals are summed so each
+ * chunk knows where it starts, then the chunks write their stitches
+ * straight into the pattern. Positions come from whole 0.1mm sums
+ * rather than adding up each move in floating point.
+ *
+ * Returns 0, having read nothing, if the file is too small to gain from
+ * this or is not in memory. A design past the limits of the pattern
+ * stops the read, having read nothing either.
+ */
+int
+dstReadParallel(EmbPattern* pattern, EmbStream* file)
+{
+    EmbArray *list = pattern->stitch_list;
+    const unsigned char *records;
+    DstChunk *chunks;
+    DstDecode d;
+    long x, y;
+    int n, i, count, size, total, stops, home;
+
+    if (file->file || file->position > file->length) {
+        return 0;
+    }
+    records = file->data + file->position;
+    n = (int)((file->length - file->position) / 3);
+    if (n < DST_PARALLEL_RECORDS) {
+        return 0;
+    }
+    /* As emb_pattern_addStitchAbs() does, a STOP ahead of any stitch is
+     * dropped along with its move, and the first stitch is preceded by
+     * one at the home position. */
+    home = (list->count == 0);
+    if (home) {
+        while (n > 0 && records[2] != 0xF3
+            && (decode_record_flags(records[2]) & STOP)) {
+            records += 3;
+            n--;
+        }
+        if (n == 0 || records[2] == 0xF3) {
+            emb_fseek(file, (long)(records - file->data), SEEK_SET);
+            return 1;
+        }
+    }
+
+    count = EMB_MAX(1, EMB_MIN(4 * emb_cpu_count(), n / DST_CHUNK_RECORDS));
+    size = (n + count - 1) / count;
+    chunks = (DstChunk*)malloc(count * sizeof(DstChunk));
+    if (!chunks) {
+        printf("ERROR: dstReadParallel(), cannot allocate chunks\n");
+        return 0;
+    }
+    for (i = 0; i < count; i++) {
+        chunks[i].records = records + 3 * (size_t)i * size;
+        chunks[i].count = EMB_MAX(0, EMB_MIN(size, n - i * size));
+        chunks[i].end = 0;
+        chunks[i].x = 0;
+        chunks[i].y = 0;
+        chunks[i].stops = 0;
+    }
+    d.chunks = chunks;
+    d.phase = 0;
+    emb_parallel_for(dstDecodeChunk, &d, count, 0);
+
+    /* Only the chunks up to the first END count, each starting where the
+     * ones before it left off. */
+    x = 0;
+    y = 0;
+    stops = 0;
+    total = 0;
+    for (i = 0; i < count; i++) {
+        long cx = chunks[i].x, cy = chunks[i].y;
+        int cs = chunks[i].stops;
+        chunks[i].x = x;
+        chunks[i].y = y;
+        chunks[i].stops = stops;
+        chunks[i].first = total;
+        x += cx;
+        y += cy;
+        stops += cs;
+        total += chunks[i].count;
+        if (chunks[i].end) {
+            count = i + 1;
             break;
         }
-        emb_pattern_addStitchRel(pattern, x / 10.0, y / 10.0, flags, 1);
     }
 
-    /* combine_jump_stitches(pattern, 5); */
+    if (!emb_pattern_limit(pattern, home + total, 0)) {
+        safe_free(chunks);
+        return 1;
+    }
+    if (!emb_array_writable(list)
+        || !emb_array_reserve(list, list->count + home + total)) {
+        safe_free(chunks);
+        return 0;
+    }
+    if (home) {
+        EmbStitch h;
+        h.x = pattern->home.x;
+        h.y = pattern->home.y;
+        h.flags = JUMP;
+        h.color = pattern->currentColorIndex;
+        list->stitch[list->count++] = h;
+    }
+    d.stitches = list->stitch + list->count;
+    d.base.x = list->stitch[list->count - 1].x;
+    d.base.y = list->stitch[list->count - 1].y;
+    d.color = pattern->currentColorIndex;
+    d.phase = 1;
+    emb_parallel_for(dstDecodeChunk, &d, count, 0);
+    list->count += total;
+    pattern->currentColorIndex += stops;
+
+    /* Leave the stream after the END, as the serial decode does. */
+    if (chunks[count - 1].end) {
+        total++;
+    }
+    emb_fseek(file, (long)(records - file->data) + 3L * total, SEEK_SET);
+    safe_free(chunks);
     return 1;
 }
 
 char
-writeDst(EmbPattern* pattern, FILE* file)
+readDst(EmbPattern* pattern, EmbStream* file) {
+    if (!dstReadHeader(pattern, file)) {
+        return 0;
+    }
+    if (!(pattern->read_options & EMB_READ_STITCHES)) {
+        return 1;
+    }
+    if (!dstReadParallel(pattern, file)) {
+        while (dstReadRecord(pattern, file)) {
+        }
+    }
+
+    /* combine_jump_stitches(pattern, 5); */
+    return 1;
+}
+
+/* Writes the DST header for a design of a stitches stitches and a threads
+ * threads spanning a bounds, padded out to 512 bytes.
+ */
+void
+dstWriteHeader(EmbStream* file, int stitches, int threads, EmbRect bounds)
 {
-    EmbRect boundingRect;
-    int i, ax, ay, mx, my;
-    EmbVector pos;
+    int ax, ay, mx, my;
+    long start = emb_ftell(file);
     EmbString pd;
 
-    emb_pattern_correctForMaxStitchLength(pattern, 12.1f, 12.1f);
-
-    /* TODO: make sure that pattern->thread_list->count
-     * defaults to 1 in new patterns */
-    boundingRect = emb_pattern_bounds(pattern);
     /* TODO: review the code below
     if (pattern->get_variable("design_name") != NULL) {
         char *la = stralloccopy(pattern->get_variable("design_name"));
         if (strlen(la)>16) la[16]='\0';
 
-        fprintf(file,"LA:%-16s\x0d",la);
+        emb_fprintf(file,"LA:%-16s\x0d",la);
         safe_free(la);
     }
     */
-    fprintf(file, "LA:%-16s\x0d", "Untitled");
-    fprintf(file, "ST:%7d\x0d", pattern->stitch_list->count);
+    emb_fprintf(file, "LA:%-16s\x0d", "Untitled");
+    emb_fprintf(file, "ST:%7d\x0d", stitches);
     /* number of color changes, not number of colors! */
-    fprintf(file, "CO:%3d\x0d", pattern->thread_list->count - 1);
-    fprintf(file,
+    emb_fprintf(file, "CO:%3d\x0d", threads - 1);
+    emb_fprintf(file,
         "+X:%5d\x0d"
         "-X:%5d\x0d"
         "+Y:%5d\x0d"
         "-Y:%5d\x0d",
-        (int)((boundingRect.x + boundingRect.w) * 10.0),
-        (int)(fabs(boundingRect.x) * 10.0),
-        (int)((boundingRect.y + boundingRect.h) * 10.0),
-        (int)(fabs(boundingRect.y) * 10.0));
+        (int)((bounds.x + bounds.w) * 10.0),
+        (int)(fabs(bounds.x) * 10.0),
+        (int)((bounds.y + bounds.h) * 10.0),
+        (int)(fabs(bounds.y) * 10.0));
 
     ax = ay = mx = my = 0;
     /* TODO: review the code below */
@@ -2138,7 +3315,7 @@ writeDst(EmbPattern* pattern, FILE* file)
         /* pd is not valid, so fill in a default consisting of "******" */
         strcpy(pd, "******");
     /*}*/
-    fprintf(file,
+    emb_fprintf(file,
         "AX:+%5d\x0d"
         "AY:+%5d\x0d"
         "MX:+%5d\x0d"
@@ -2146,31 +3323,55 @@ writeDst(EmbPattern* pattern, FILE* file)
         "PD:%6s\x0d\x1a",
         ax, ay, mx, my, pd);
 
-    /* pad out header to proper length */
-    fpad(file, ' ', 512-125);
+    /* pad out header to proper length, which is usually 125 bytes
+     * of fields and 387 of padding */
+    fpad(file, ' ', 512 - (int)(emb_ftell(file) - start));
+}
+
+/* Encodes the stitch a st as a DST record, a pos tracks where the
+ * encoded stitches have reached. Each record is printed if a verbose
+ * is set.
+ */
+void
+dstWriteStitch(EmbStream* file, EmbStitch st, EmbVector *pos, int verbose)
+{
+    int dx, dy;
+    /* convert from mm to 0.1mm for file format */
+    dx = (int)emb_round(10.0f * (st.x - pos->x));
+    dy = (int)emb_round(10.0f * (st.y - pos->y));
+    pos->x += 0.1f * dx;
+    pos->y += 0.1f * dy;
+    if (verbose > 0) {
+        printf("%f %f %d %d %f %f %d\n", st.x, st.y, dx, dy, pos->x, pos->y, st.flags);
+    }
+    encode_record(file, dx, dy, st.flags);
+}
+
+char
+writeDst(EmbPattern* pattern, EmbStream* file)
+{
+    int i;
+    EmbVector pos;
+
+    emb_pattern_correctForMaxStitchLength(pattern, 12.1f, 12.1f);
+
+    /* TODO: make sure that pattern->thread_list->count
+     * defaults to 1 in new patterns */
+    dstWriteHeader(file, pattern->stitch_list->count,
+        pattern->thread_list->count, emb_pattern_bounds(pattern));
 
     /* write stitches */
     pos.x = 0.0;
     pos.y = 0.0;
     for (i = 0; i < pattern->stitch_list->count; i++) {
-        EmbStitch st;
-        int dx, dy;
-        st = pattern->stitch_list->stitch[i];
-        /* convert from mm to 0.1mm for file format */
-        dx = (int)emb_round(10.0f * (st.x - pos.x));
-        dy = (int)emb_round(10.0f * (st.y - pos.y));
-        pos.x += 0.1f * dx;
-        pos.y += 0.1f * dy;
-        if (emb_verbose > 0) {
-            printf("%d %f %f %d %d %f %f %d\n", i, st.x, st.y, dx, dy, pos.x, pos.y, st.flags);
-        }
-        encode_record(file, dx, dy, st.flags);
+        dstWriteStitch(file, pattern->stitch_list->stitch[i], &pos,
+            pattern->context->verbose);
     }
 
     /* Finish file with a terminator character and two zeros to
      * keep the post header part a multiple of three.
      */
-    fwrite("\xa1\0\0", 1, 3, file);
+    emb_fwrite("\xa1\0\0", 1, 3, file);
     return 1;
 }
 
@@ -2180,12 +3381,14 @@ writeDst(EmbPattern* pattern, FILE* file)
  */
 
 char
-readDsz(EmbPattern* pattern, FILE* file)
+readDsz(EmbPattern* pattern, EmbStream* file)
 {
-    unsigned char b[3];
+    EmbStitchBatch batch;
+    const unsigned char *b;
 
-    fseek(file, 0x200, SEEK_SET);
-    while (fread(b, 1, 3, file) == 3) {
+    emb_fseek(file, 0x200, SEEK_SET);
+    emb_stitch_batch_init(&batch, pattern);
+    while ((b = emb_stream_take(file, 3))) {
         int x, y;
         unsigned char ctrl;
         int stitchType = NORMAL;
@@ -2210,11 +3413,12 @@ readDsz(EmbPattern* pattern, FILE* file)
             stitchType = STOP;
         }
         if (ctrl & 0x10) {
-            emb_pattern_addStitchRel(pattern, 0, 0, END, 1);
+            emb_stitch_batch_rel(&batch, 0, 0, END);
             break;
         }
-        emb_pattern_addStitchRel(pattern, x  / 10.0f, y  / 10.0f, stitchType, 1);
+        emb_stitch_batch_rel(&batch, x  / 10.0f, y  / 10.0f, stitchType);
     }
+    emb_stitch_batch_flush(&batch);
     return 1;
 }
 
@@ -2222,7 +3426,7 @@ readDsz(EmbPattern* pattern, FILE* file)
  * This is based on the readDsz function.
  */
 char
-writeDsz(EmbPattern* pattern, FILE* file)
+writeDsz(EmbPattern* pattern, EmbStream* file)
 {
     int i;
     EmbVector delta;
@@ -2256,7 +3460,7 @@ writeDsz(EmbPattern* pattern, FILE* file)
         }
         b[0] = emb_round(10.0*delta.x);
         b[1] = emb_round(10.0*delta.y);
-        fwrite(b, 1, 3, file);
+        emb_fwrite(b, 1, 3, file);
     }
     return 1;
 }
@@ -2265,37 +3469,28 @@ writeDsz(EmbPattern* pattern, FILE* file)
  * Graphics format for drawing files designed and used by AudoDesk for their AutoCAD program. \cite{dxf_reference}
  */
 void
-readLine(FILE* file, char *str)
-{
-    int i;
-    int past_leading_spaces;
-
-    /* Remove leading spaces. */
-    past_leading_spaces = 0;
-    for (i=0; i<254; i++) {
-        if (feof(file)) {
-            str[i] = 0;
-            break;
-        }
-        str[i] = fgetc(file);
-        if (str[i] == '\n' || str[i] == '\r') {
-            str[i] = 0;
-            break;
-        }
-        if (str[i] == ' ') {
-            if (!past_leading_spaces) {
-                i--;
+readLine(EmbStream* file, char *str)
+{
+    char buffer[255];
+    const char *line;
+    size_t length, i;
+    int n = 0;
+
+    /* Spaces are dropped and the line is cut to 254 characters. */
+    line = emb_stream_line(file, buffer, sizeof(buffer), &length);
+    if (line) {
+        for (i = 0; i < length && n < 254; i++) {
+            if (line[i] != ' ') {
+                str[n++] = line[i];
             }
         }
-        else {
-            past_leading_spaces = 0;
-        }
     }
+    str[n] = 0;
 }
 
 /* Use parsing library here. Write down full DXF grammar. */
 char
-readDxf(EmbPattern* pattern, FILE* file)
+readDxf(EmbPattern* pattern, EmbStream* file)
 {
     EmbString dxfVersion;
     EmbString section;
@@ -2324,12 +3519,12 @@ readDxf(EmbPattern* pattern, FILE* file)
     prev.y = 0.0f;
     printf("%f %f %f\n", prev.x, pos.x, first.x);
 
-    fseek(file, 0L, SEEK_END);
+    emb_fseek(file, 0L, SEEK_END);
 
-    fileLength = ftell(file);
-    fseek(file, 0L, SEEK_SET);
+    fileLength = emb_ftell(file);
+    emb_fseek(file, 0L, SEEK_SET);
 
-    while (ftell(file) < fileLength) {
+    while (emb_ftell(file) < fileLength) {
         readLine(file, buff);
         /*printf("%s\n", buff);*/
         if ((!strcmp(buff, "HEADER"))   ||
@@ -2580,10 +3775,10 @@ readDxf(EmbPattern* pattern, FILE* file)
 }
 
 char
-writeDxf(EmbPattern* pattern, FILE* file)
+writeDxf(EmbPattern* pattern, EmbStream* file)
 {
     puts("ERROR: writeDxf not implemented.");
-    if (emb_verbose > 1) {
+    if (pattern->context->verbose > 1) {
         printf("Called with %p %p\n", (void*)pattern, (void*)file);
     }
     return 0; /*TODO: finish writeDxf */
@@ -2593,14 +3788,14 @@ writeDxf(EmbPattern* pattern, FILE* file)
  * Stitch Only Format
  */
 char
-readEdr(EmbPattern* pattern, FILE* file)
+readEdr(EmbPattern* pattern, EmbStream* file)
 {
     /* appears identical to readRgb, so backends to that */
     return readRgb(pattern, file);
 }
 
 char
-writeEdr(EmbPattern* pattern, FILE* file)
+writeEdr(EmbPattern* pattern, EmbStream* file)
 {
     /* appears identical to writeRgb, so backends to that */
     return writeRgb(pattern, file);
@@ -2621,21 +3816,22 @@ emdDecode(unsigned char inputByte)
 
 /* . */
 char
-readEmd(EmbPattern* pattern, FILE* file)
+readEmd(EmbPattern* pattern, EmbStream* file)
 {
-    unsigned char b[2];
+    EmbStitchBatch batch;
+    const unsigned char *b;
     unsigned char jemd0[6]; /* TODO: more descriptive name */
     int width, height, colors, length;
 
-    fseek(file, 0, SEEK_END);
-    length = ftell(file);
+    emb_fseek(file, 0, SEEK_END);
+    length = emb_ftell(file);
     if (length < 0x30) {
         puts("File invalid: shorter than the header.");
         return 0;
     }
-    fseek(file, 0, SEEK_SET);
+    emb_fseek(file, 0, SEEK_SET);
 
-    if (fread(jemd0, 1, 6, file) != 6) {
+    if (emb_fread(jemd0, 1, 6, file) != 6) {
         puts("ERROR: Failed to read 6 bytes for jemd0");
         return 0;
     }
@@ -2644,100 +3840,162 @@ readEmd(EmbPattern* pattern, FILE* file)
     colors = emb_read_i16(file);
     printf("%d %d %d\n", width, height, colors);
 
-    fseek(file, 0x30, SEEK_SET);
+    emb_fseek(file, 0x30, SEEK_SET);
 
-    while (!feof(file)) {
+    emb_stitch_batch_init(&batch, pattern);
+    while (!emb_feof(file)) {
         char dx, dy;
         int flags = NORMAL;
-        if (fread(b, 1, 2, file) != 2) {
+        if (!(b = emb_stream_take(file, 2))) {
             puts("ERROR: Failed to read 2 bytes for stitch.");
+            emb_stitch_batch_flush(&batch);
             return 0;
         }
         
         if (b[0] == 0x80) {
             if (b[1] == 0x2A) {
-                emb_pattern_addStitchRel(pattern, 0, 0, STOP, 1);
+                emb_stitch_batch_rel(&batch, 0, 0, STOP);
                 continue;
             }
             else if (b[1] == 0x80) {
-                if (fread(b, 1, 2, file) != 2) {
+                if (!(b = emb_stream_take(file, 2))) {
                     puts("ERROR: Failed to read 2 bytes for stitch.");
+                    emb_stitch_batch_flush(&batch);
                     return 0;
                 }
                 flags = TRIM;
             }
             else if (b[1] == 0xFD) {
-                emb_pattern_addStitchRel(pattern, 0, 0, END, 1);
+                emb_stitch_batch_rel(&batch, 0, 0, END);
                 break;
             }
-            else {
-                continue;
+            else {
+                continue;
+            }
+        }
+        dx = emdDecode(b[0]);
+        dy = emdDecode(b[1]);
+        emb_stitch_batch_rel(&batch, dx / 10.0f, dy / 10.0f, flags);
+    }
+    emb_stitch_batch_flush(&batch);
+    return 1;
+}
+
+char
+writeEmd(EmbPattern* pattern, EmbStream* file)
+{
+    puts("writeEmd not implemented.");
+    if (pattern->context->verbose > 1) {
+        printf("Called with %p %p\n", (void*)pattern, (void*)file);
+    }
+    return 0; /*TODO: finish writeEmd */
+}
+
+/* Melco Embroidery Format (.exp)
+ * Stitch Only Format.
+ */
+
+char
+expDecode(unsigned char a1)
+{
+    return (a1 > 0x80) ? ((-~a1) - 1) : a1;
+}
+
+/* Decodes the next EXP record into a pattern, returns 0 once the
+ * stitches are over.
+ */
+int
+expReadRecord(EmbPattern* pattern, EmbStream* file)
+{
+    char dx = 0, dy = 0;
+    int flags = NORMAL;
+    const unsigned char *b = emb_stream_take(file, 2);
+    if (!b) {
+        return 0;
+    }
+    if (b[0] == 0x80) {
+        if (b[1] == 0x01) {
+            if (!(b = emb_stream_take(file, 2))) {
+                return 0;
+            }
+            /* b0=0x00 and b1=0x00, but accept any,
+            not worth crashing over. */
+            flags = STOP;
+        } else if (b[1] == 0x04) {
+            if (!(b = emb_stream_take(file, 2))) {
+                return 0;
+            }
+            flags = JUMP;
+        } else if (b[1] == 0x80) {
+            if (!(b = emb_stream_take(file, 2))) {
+                return 0;
             }
+            /* b0=0x07 and b1=0x00, but accept any,
+            not worth crashing over. */
+            flags = TRIM;
         }
-        dx = emdDecode(b[0]);
-        dy = emdDecode(b[1]);
-        emb_pattern_addStitchRel(pattern, dx / 10.0f, dy / 10.0f, flags, 1);
     }
+    dx = expDecode(b[0]);
+    dy = expDecode(b[1]);
+    emb_pattern_addStitchRel(pattern, dx / 10.0, dy / 10.0, flags, 1);
     return 1;
 }
 
 char
-writeEmd(EmbPattern* pattern, FILE* file)
+readExp(EmbPattern* pattern, EmbStream* file)
 {
-    puts("writeEmd not implemented.");
-    if (emb_verbose > 1) {
-        printf("Called with %p %p\n", (void*)pattern, (void*)file);
+    if (!(pattern->read_options & EMB_READ_STITCHES)) {
+        return 1;
     }
-    return 0; /*TODO: finish writeEmd */
+    while (expReadRecord(pattern, file)) {
+    }
+    return 1;
 }
 
-/* Melco Embroidery Format (.exp)
- * Stitch Only Format.
+/* Encodes the stitch a st as an EXP record, a pos tracks where the
+ * encoded stitches have reached.
  */
-
-char
-expDecode(unsigned char a1)
-{
-    return (a1 > 0x80) ? ((-~a1) - 1) : a1;
-}
-
-char
-readExp(EmbPattern* pattern, FILE* file)
+void
+expWriteStitch(EmbStream* file, EmbStitch st, EmbVector *pos)
 {
-    unsigned char b[2];
-
-    while (fread(b, 1, 2, file) == 2) {
-        char dx = 0, dy = 0;
-        int flags = NORMAL;
-        if (b[0] == 0x80) {
-            if (b[1] == 0x01) {
-                if (fread(b, 1, 2, file) != 2) break;
-                /* b0=0x00 and b1=0x00, but accept any,
-                not worth crashing over. */
-                flags = STOP;
-            } else if (b[1] == 0x04) {
-                if (fread(b, 1, 2, file) != 2) {
-                    break;
-                }
-                flags = JUMP;
-            } else if (b[1] == 0x80) {
-                if (fread(b, 1, 2, file) != 2) {
-                    break;
-                }
-                /* b0=0x07 and b1=0x00, but accept any,
-                not worth crashing over. */
-                flags = TRIM;
-            }
-        }
-        dx = expDecode(b[0]);
-        dy = expDecode(b[1]);
-        emb_pattern_addStitchRel(pattern, dx / 10.0, dy / 10.0, flags, 1);
+    char b[4];
+    char dx, dy;
+    dx = (char)emb_round(10.0*(st.x - pos->x));
+    dy = (char)emb_round(10.0*(st.y - pos->y));
+    pos->x += 0.1*dx;
+    pos->y += 0.1*dy;
+    switch (st.flags) {
+    case STOP:
+        b[0] = (char)(0x80);
+        b[1] = 0x01;
+        b[2] = 0x00;
+        b[3] = 0x00;
+        emb_fwrite(b, 1, 4, file);
+        break;
+    case JUMP:
+        b[0] = (char)(0x80);
+        b[1] = 0x04;
+        b[2] = dx;
+        b[3] = dy;
+        emb_fwrite(b, 1, 4, file);
+        break;
+    case TRIM:
+        b[0] = (char)(0x80);
+        b[1] = (char)(0x80);
+        b[2] = 0x07;
+        b[3] = 0x00;
+        emb_fwrite(b, 1, 4, file);
+        break;
+    default: /* STITCH */
+        b[0] = dx;
+        b[1] = dy;
+        emb_fwrite(b, 1, 2, file);
+        break;
     }
-    return 1;
 }
 
 char
-writeExp(EmbPattern* pattern, FILE* file)
+writeExp(EmbPattern* pattern, EmbStream* file)
 {
     EmbVector pos;
     int i;
@@ -2746,43 +4004,9 @@ writeExp(EmbPattern* pattern, FILE* file)
     pos.x = 0.0;
     pos.y = 0.0;
     for (i = 0; i < pattern->stitch_list->count; i++) {
-        char b[4];
-        char dx, dy;
-        EmbStitch st = pattern->stitch_list->stitch[i];
-        dx = (char)emb_round(10.0*(st.x - pos.x));
-        dy = (char)emb_round(10.0*(st.y - pos.y));
-        pos.x += 0.1*dx;
-        pos.y += 0.1*dy;
-        switch (st.flags) {
-        case STOP:
-            b[0] = (char)(0x80);
-            b[1] = 0x01;
-            b[2] = 0x00;
-            b[3] = 0x00;
-            fwrite(b, 1, 4, file);
-            break;
-        case JUMP:
-            b[0] = (char)(0x80);
-            b[1] = 0x04;
-            b[2] = dx;
-            b[3] = dy;
-            fwrite(b, 1, 4, file);
-            break;
-        case TRIM:
-            b[0] = (char)(0x80);
-            b[1] = (char)(0x80);
-            b[2] = 0x07;
-            b[3] = 0x00;
-            fwrite(b, 1, 4, file);
-            break;
-        default: /* STITCH */
-            b[0] = dx;
-            b[1] = dy;
-            fwrite(b, 1, 2, file);
-            break;
-        }
+        expWriteStitch(file, pattern->stitch_list->stitch[i], &pos);
     }
-    fprintf(file, "\x1a");
+    emb_fprintf(file, "\x1a");
     return 1;
 }
 
@@ -2809,26 +4033,29 @@ decode_exy_flags(unsigned char b2)
 }
 
 char
-readExy(EmbPattern* pattern, FILE* file)
+readExy(EmbPattern* pattern, EmbStream* file)
 {
-    unsigned char b[3];
+    EmbStitchBatch batch;
+    const unsigned char *b;
 
-    fseek(file, 0x100, SEEK_SET);
-    while (fread(b, 1, 3, file) == 3) {
+    emb_fseek(file, 0x100, SEEK_SET);
+    emb_stitch_batch_init(&batch, pattern);
+    while ((b = emb_stream_take(file, 3))) {
         int flags, x, y;
         decode_tajima_ternary(b, &x, &y);
         flags = decode_exy_flags(b[2]);
         if (flags & END) {
-            emb_pattern_addStitchRel(pattern, 0, 0, END, 1);
+            emb_stitch_batch_rel(&batch, 0, 0, END);
             break;
         }
-        emb_pattern_addStitchRel(pattern, x / 10.0, y / 10.0, flags, 1);
+        emb_stitch_batch_rel(&batch, x / 10.0, y / 10.0, flags);
     }
+    emb_stitch_batch_flush(&batch);
     return 1;
 }
 
 char
-writeExy(EmbPattern* pattern, FILE* file)
+writeExy(EmbPattern* pattern, EmbStream* file)
 {
     puts("ERROR: writeExy has not been finished.");
     REPORT_PTR(pattern);
@@ -2841,7 +4068,7 @@ writeExy(EmbPattern* pattern, FILE* file)
  * Smoothie G-Code Embroidery Format (.fxy)?
  */
 char
-readEys(EmbPattern* pattern , FILE* file)
+readEys(EmbPattern* pattern , EmbStream* file)
 {
     puts("ERROR: readEys and not been finished.");
     REPORT_PTR(pattern);
@@ -2850,7 +4077,7 @@ readEys(EmbPattern* pattern , FILE* file)
 }
 
 char
-writeEys(EmbPattern* pattern , FILE* file)
+writeEys(EmbPattern* pattern , EmbStream* file)
 {
     puts("ERROR: writeEys and not been finished.");
     REPORT_PTR(pattern);
@@ -2862,20 +4089,22 @@ writeEys(EmbPattern* pattern , FILE* file)
  * Stitch Only Format.
  */
 char
-readFxy(EmbPattern* pattern, FILE* file)
+readFxy(EmbPattern* pattern, EmbStream* file)
 {
+    EmbStitchBatch batch;
     /* TODO: review for combining code. This line appears
         to be the only difference from the GT format. */
-    fseek(file, 0x100, SEEK_SET);
+    emb_fseek(file, 0x100, SEEK_SET);
 
-    while (!feof(file)) {
+    emb_stitch_batch_init(&batch, pattern);
+    while (!emb_feof(file)) {
         int stitchType = NORMAL;
-        int b1 = fgetc(file);
-        int b2 = fgetc(file);
-        unsigned char commandByte = (unsigned char)fgetc(file);
+        int b1 = emb_fgetc(file);
+        int b2 = emb_fgetc(file);
+        unsigned char commandByte = (unsigned char)emb_fgetc(file);
 
         if (commandByte == 0x91) {
-            emb_pattern_addStitchRel(pattern, 0, 0, END, 1);
+            emb_stitch_batch_rel(&batch, 0, 0, END);
             break;
         }
         if ((commandByte & 0x01) == 0x01)
@@ -2886,13 +4115,14 @@ readFxy(EmbPattern* pattern, FILE* file)
             b1 = -b1;
         if ((commandByte & 0x40) == 0x40)
             b2 = -b2;
-        emb_pattern_addStitchRel(pattern, b2 / 10.0, b1 / 10.0, stitchType, 1);
+        emb_stitch_batch_rel(&batch, b2 / 10.0, b1 / 10.0, stitchType);
     }
+    emb_stitch_batch_flush(&batch);
     return 1;
 }
 
 char
-writeFxy(EmbPattern* pattern, FILE* file)
+writeFxy(EmbPattern* pattern, EmbStream* file)
 {
     puts("Overridden, defaulting to dst.");
     printf("%p %p\n", pattern, file);
@@ -2908,7 +4138,7 @@ writeFxy(EmbPattern* pattern, FILE* file)
  *     by John Milton Amiss, Franklin D. Jones and Henry Ryffel
  */
 char
-readGc(EmbPattern* pattern , FILE* file)
+readGc(EmbPattern* pattern , EmbStream* file)
 {
     puts("ERROR: readGc and not been finished.");
     printf("%p %p\n", pattern, file);
@@ -2916,7 +4146,7 @@ readGc(EmbPattern* pattern , FILE* file)
 }
 
 char
-writeGc(EmbPattern* pattern , FILE* file)
+writeGc(EmbPattern* pattern , EmbStream* file)
 {
     puts("ERROR: writeGc and not been finished.");
     printf("%p %p\n", pattern, file);
@@ -2929,7 +4159,7 @@ writeGc(EmbPattern* pattern , FILE* file)
  */
 /* TODO: finish readGnc */
 char
-readGnc(EmbPattern* pattern , FILE* file)
+readGnc(EmbPattern* pattern , EmbStream* file)
 {
     puts("ERROR: readGnc and not been finished.");
     printf("%p %p\n", pattern, file);
@@ -2938,7 +4168,7 @@ readGnc(EmbPattern* pattern , FILE* file)
 
 /* TODO: finish writeGnc */
 char
-writeGnc(EmbPattern* pattern , FILE* file)
+writeGnc(EmbPattern* pattern , EmbStream* file)
 {
     puts("ERROR: writeGnc and not been finished.");
     printf("%p %p\n", pattern, file);
@@ -2950,20 +4180,22 @@ writeGnc(EmbPattern* pattern , FILE* file)
  * Stitch Only Format.
  */
 char
-readGt(EmbPattern* pattern, FILE* file)
+readGt(EmbPattern* pattern, EmbStream* file)
 {
+    EmbStitchBatch batch;
     /* TODO: review for combining code. This line appears
         to be the only difference from the FXY format. */
-    fseek(file, 0x200, SEEK_SET);
+    emb_fseek(file, 0x200, SEEK_SET);
 
-    while (!feof(file)) {
+    emb_stitch_batch_init(&batch, pattern);
+    while (!emb_feof(file)) {
         int stitchType = NORMAL;
-        int b1 = fgetc(file);
-        int b2 = fgetc(file);
-        unsigned char commandByte = (unsigned char)fgetc(file);
+        int b1 = emb_fgetc(file);
+        int b2 = emb_fgetc(file);
+        unsigned char commandByte = (unsigned char)emb_fgetc(file);
 
         if (commandByte == 0x91) {
-            emb_pattern_addStitchRel(pattern, 0, 0, END, 1);
+            emb_stitch_batch_rel(&batch, 0, 0, END);
             break;
         }
         if ((commandByte & 0x01) == 0x01) {
@@ -2978,13 +4210,14 @@ readGt(EmbPattern* pattern, FILE* file)
         if ((commandByte & 0x40) == 0x40) {
             b2 = -b2;
         }
-        emb_pattern_addStitchRel(pattern, b2 / 10.0, b1 / 10.0, stitchType, 1);
+        emb_stitch_batch_rel(&batch, b2 / 10.0, b1 / 10.0, stitchType);
     }
+    emb_stitch_batch_flush(&batch);
     return 1;
 }
 
 char
-writeGt(EmbPattern* pattern, FILE* file)
+writeGt(EmbPattern* pattern, EmbStream* file)
 {
     puts("ERROR: gt not supported in write mode.");
     printf("%p %p\n", pattern, file);
@@ -3067,8 +4300,9 @@ husEncodeStitchType(int st)
 }
 
 char
-readHus(EmbPattern* pattern, FILE* file)
+readHus(EmbPattern* pattern, EmbStream* file)
 {
+    EmbStitchBatch batch;
     int fileLength;
     int magicCode, numberOfStitches, numberOfColors;
     int positiveXHoopSize, positiveYHoopSize, negativeXHoopSize, negativeYHoopSize;
@@ -3081,9 +4315,9 @@ readHus(EmbPattern* pattern, FILE* file)
 
     int unknown, i = 0;
 
-    fseek(file, 0x00, SEEK_END);
-    fileLength = ftell(file);
-    fseek(file, 0x00, SEEK_SET);
+    emb_fseek(file, 0x00, SEEK_END);
+    fileLength = emb_ftell(file);
+    emb_fseek(file, 0x00, SEEK_SET);
 
     magicCode = emb_read_i32(file);
     numberOfStitches = emb_read_i32(file);
@@ -3116,16 +4350,32 @@ readHus(EmbPattern* pattern, FILE* file)
         return 0;
     }
     size_t size = 8;
-    if (fread(stringVal, 1, size, file) != size) {
+    if (emb_fread(stringVal, 1, size, file) != size) {
         puts("Ran out of bytes before full file read.");
         return 0;
     }
 
     unknown = emb_read_i16(file);
     printf("unknown: %d\n", unknown);
-    for (i = 0; i < numberOfColors; i++) {
-        short pos = emb_read_i16(file);
-        emb_pattern_addThread(pattern, hus_colors[pos]);
+    if (pattern->read_options & EMB_READ_THREADS) {
+        for (i = 0; i < numberOfColors; i++) {
+            short pos = emb_read_i16(file);
+            emb_pattern_addThread(pattern, hus_colors[pos]);
+        }
+    }
+    else {
+        emb_fseek(file, 2 * numberOfColors, SEEK_CUR);
+    }
+    if (!(pattern->read_options & EMB_READ_STITCHES)) {
+        safe_free(stringVal);
+        return 1;
+    }
+    /* Each stitch is decompressed into three buffers before it is added,
+     * so a count too large for the limits is refused up front. */
+    if (!emb_pattern_limit(pattern, numberOfStitches,
+            3 * (size_t)EMB_MAX(numberOfStitches, 0))) {
+        safe_free(stringVal);
+        return 0;
     }
 
     attributeData = (unsigned char*)malloc(sizeof(unsigned char)*(xOffset - attributeOffset + 1));
@@ -3134,7 +4384,7 @@ readHus(EmbPattern* pattern, FILE* file)
         return 0;
     }
     size = xOffset - attributeOffset;
-    if (fread(attributeData, 1, size, file) != size) {
+    if (emb_fread(attributeData, 1, size, file) != size) {
         puts("Ran out of bytes before full file read.");
         return 0;
     }
@@ -3146,7 +4396,7 @@ readHus(EmbPattern* pattern, FILE* file)
         return 0;
     }
     size = yOffset - xOffset;
-    if (fread(xData, 1, size, file) != size) {
+    if (emb_fread(xData, 1, size, file) != size) {
         puts("Ran out of bytes before full file read.");
         return 0;
     }
@@ -3158,20 +4408,23 @@ readHus(EmbPattern* pattern, FILE* file)
         return 0;
     }
     size = fileLength - yOffset;
-    if (fread(yData, 1, size, file) != size) {
+    if (emb_fread(yData, 1, size, file) != size) {
         puts("Ran out of bytes before full file read.");
         return 0;
     }
     yDecompressed = husDecompressData(yData, size, numberOfStitches);
 
-    for (i = 0; i < numberOfStitches; i++) {
+    emb_pattern_reserve_stitches(pattern, numberOfStitches);
+    emb_stitch_batch_init(&batch, pattern);
+    for (i = 0; i < numberOfStitches && !file->stopped; i++) {
         int flag;
         EmbVector v;
         v.x = husDecodeByte(xDecompressed[i]) / 10.0;
         v.y = husDecodeByte(yDecompressed[i]) / 10.0;
         flag = husDecodeStitchType(attributeDataDecompressed[i]);
-        emb_pattern_addStitchRel(pattern, v.x, v.y, flag, 1);
+        emb_stitch_batch_rel(&batch, v.x, v.y, flag);
     }
+    emb_stitch_batch_flush(&batch);
 
     safe_free(stringVal);
     safe_free(xData);
@@ -3184,8 +4437,34 @@ readHus(EmbPattern* pattern, FILE* file)
     return 1;
 }
 
+/* Reads the stitch and color counts and the hoop extents of a HUS or VIP
+ * design, which share the start of their header, into a probe. The hoop
+ * sizes are taken in the order writeHus() gives them: right, up, left and
+ * down, in 0.1 mm with left and down signed.
+ */
+int
+husProbeHeader(EmbStream* file, EmbProbe* probe)
+{
+    const unsigned char *b = emb_stream_take(file, 20);
+    uint32_t magic;
+    if (!b) {
+        return 0;
+    }
+    magic = (probe->format == EMB_FORMAT_VIP) ? 0x0190FC5D : 0x00C8AF5B;
+    if (emb_get_u32(b) != magic) {
+        return 0;
+    }
+    probe->stitches = (int32_t)emb_get_u32(b + 4);
+    probe->colors = (int32_t)emb_get_u32(b + 8);
+    probe->max_x = (int16_t)emb_get_u16(b + 12) / 10.0;
+    probe->min_y = -(int16_t)emb_get_u16(b + 14) / 10.0;
+    probe->min_x = (int16_t)emb_get_u16(b + 16) / 10.0;
+    probe->max_y = -(int16_t)emb_get_u16(b + 18) / 10.0;
+    return 1;
+}
+
 char
-writeHus(EmbPattern* pattern, FILE* file)
+writeHus(EmbPattern* pattern, EmbStream* file)
 {
     EmbRect boundingRect;
     int stitchCount, minColors, patternColor, attributeSize, xCompressedSize, yCompressedSize, i;
@@ -3261,9 +4540,9 @@ writeHus(EmbPattern* pattern, FILE* file)
         emb_write_i16(file, color_index);
     }
 
-    fwrite(attributeCompressed, 1, attributeSize, file);
-    fwrite(xCompressed, 1, xCompressedSize, file);
-    fwrite(yCompressed, 1, yCompressedSize, file);
+    emb_fwrite(attributeCompressed, 1, attributeSize, file);
+    emb_fwrite(xCompressed, 1, xCompressedSize, file);
+    emb_fwrite(yCompressed, 1, yCompressedSize, file);
 
     safe_free(xValues);
     safe_free(xCompressed);
@@ -3280,20 +4559,21 @@ writeHus(EmbPattern* pattern, FILE* file)
  * Stitch Only Format.
  */
 char
-readInb(EmbPattern* pattern, FILE* file)
+readInb(EmbPattern* pattern, EmbStream* file)
 {
+    EmbStitchBatch batch;
     /* TODO: determine what this represents */
     unsigned char fileDescription[8], nullVal, bytesUnknown[300];
     int stitchCount, x, y, i, fileLength;
     short width, height, colorCount, unknown3, unknown2,
         nullbyte, left, right, top, bottom, imageWidth, imageHeight;
 
-    fseek(file, 0, SEEK_END);
-    fileLength = ftell(file);
-    fread(fileDescription, 1, 8, file); /* TODO: check return value */
+    emb_fseek(file, 0, SEEK_END);
+    fileLength = emb_ftell(file);
+    emb_fread(fileDescription, 1, 8, file); /* TODO: check return value */
     LOAD_U8(file, nullVal)
-    fgetc(file);
-    fgetc(file);
+    emb_fgetc(file);
+    emb_fgetc(file);
     LOAD_I32(file, stitchCount)
     LOAD_I16(file, width)
     LOAD_I16(file, height)
@@ -3302,22 +4582,23 @@ readInb(EmbPattern* pattern, FILE* file)
     LOAD_I16(file, unknown2)
     LOAD_I16(file, imageWidth)
     LOAD_I16(file, imageHeight)
-    fread(bytesUnknown, 1, 300, file); /* TODO: check return value */
+    emb_fread(bytesUnknown, 1, 300, file); /* TODO: check return value */
     LOAD_I16(file, nullbyte)
     LOAD_I16(file, left)
     LOAD_I16(file, right)
     LOAD_I16(file, top)
     LOAD_I16(file, bottom)
 
-    fseek(file, 0x2000, SEEK_SET);
+    emb_fseek(file, 0x2000, SEEK_SET);
     /* Calculate stitch count since header has been seen to be blank */
     stitchCount = (int)((fileLength - 0x2000) / 3);
+    emb_stitch_batch_init(&batch, pattern);
     for (i = 0; i < stitchCount; i++) {
         unsigned char type;
         int stitch = NORMAL;
-        x = (char)fgetc(file);
-        y = (char)fgetc(file);
-        type = (char)fgetc(file);
+        x = (char)emb_fgetc(file);
+        y = (char)emb_fgetc(file);
+        type = (char)emb_fgetc(file);
         if ((type & 0x40) > 0)
             x = -x;
         if ((type & 0x10) > 0)
@@ -3326,15 +4607,16 @@ readInb(EmbPattern* pattern, FILE* file)
             stitch = STOP;
         if ((type & 2) > 0)
             stitch = TRIM;
-        emb_pattern_addStitchRel(pattern, x / 10.0, y / 10.0, stitch, 1);
+        emb_stitch_batch_rel(&batch, x / 10.0, y / 10.0, stitch);
     }
+    emb_stitch_batch_flush(&batch);
     emb_pattern_flipVertical(pattern);
 
     return 1;
 }
 
 char
-writeInb(EmbPattern* pattern, FILE* file)
+writeInb(EmbPattern* pattern, EmbStream* file)
 {
     puts("ERROR: writeInb not implemented.");
     REPORT_PTR(pattern)
@@ -3349,25 +4631,25 @@ writeInb(EmbPattern* pattern, FILE* file)
  */
 
 char
-readInf(EmbPattern* pattern, FILE* file)
+readInf(EmbPattern* pattern, EmbStream* file)
 {
     int nColors, i;
     char colorType[50];
     char colorDescription[50];
     EmbThread t;
 
-    fseek(file, 12, SEEK_CUR);
+    emb_fseek(file, 12, SEEK_CUR);
     nColors = emb_read_i32be(file);
 
     pattern->thread_list->count = 0;
 
     for (i = 0; i < nColors; i++) {
-        fseek(file, 4, SEEK_CUR);
+        emb_fseek(file, 4, SEEK_CUR);
         embColor_read(file, &(t.color), 3);
-        strcpy(t.catalogNumber, "");
-        strcpy(t.description, "");
+        t.catalogNumber = "";
+        t.description = "";
         emb_pattern_addThread(pattern, t);
-        fseek(file, 2, SEEK_CUR);
+        emb_fseek(file, 2, SEEK_CUR);
         binaryReadString(file, colorType, 50);
         binaryReadString(file, colorDescription, 50);
     }
@@ -3375,7 +4657,7 @@ readInf(EmbPattern* pattern, FILE* file)
 }
 
 char
-writeInf(EmbPattern* pattern, FILE* file)
+writeInf(EmbPattern* pattern, EmbStream* file)
 {
     int i, bytesRemaining;
 
@@ -3398,16 +4680,16 @@ writeInf(EmbPattern* pattern, FILE* file)
         emb_write_i16be(file, record_number);
         embColor_write(file, c, 3);
         emb_write_i16be(file, needle_number);
-        fwrite("RGB\0", 1, 4, file);
-        fprintf(file, "%s", buffer);
-        fwrite("\0", 1, 1, file);
+        emb_fwrite("RGB\0", 1, 4, file);
+        emb_fprintf(file, "%s", buffer);
+        emb_fwrite("\0", 1, 1, file);
     }
     /* It appears that there should be a pad here otherwise it clips into
      * the color description. */
     fpad(file, 0, 8);
-    fseek(file, -8, SEEK_END);
-    bytesRemaining = ftell(file);
-    fseek(file, 8, SEEK_SET);
+    emb_fseek(file, -8, SEEK_END);
+    bytesRemaining = emb_ftell(file);
+    emb_fseek(file, 8, SEEK_SET);
     emb_write_u32be(file, bytesRemaining);
     return 1;
 }
@@ -3480,9 +4762,9 @@ struct hoop_padding
 };
 
 void
-read_hoop(FILE* file, struct hoop_padding *hoop, char *label)
+read_hoop(EmbStream* file, struct hoop_padding *hoop, char *label, int verbose)
 {
-    if (emb_verbose>1) {
+    if (verbose>1) {
         printf("%s\n", label);
     }
     hoop->left = emb_read_i32(file);
@@ -3492,8 +4774,9 @@ read_hoop(FILE* file, struct hoop_padding *hoop, char *label)
 }
 
 char
-readJef(EmbPattern* pattern, FILE* file)
+readJef(EmbPattern* pattern, EmbStream* file)
 {
+    EmbStitchBatch batch;
     int stitchOffset, formatFlags, numberOfColors, numberOfStitchs;
     int hoopSize, i, stitchCount;
     struct hoop_padding bounds, rectFrom110x110;
@@ -3504,8 +4787,8 @@ readJef(EmbPattern* pattern, FILE* file)
     stitchOffset = emb_read_i32(file);
     formatFlags = emb_read_i32(file); /* TODO: find out what this means */
 
-    fread(date, 1, 8, file); /* TODO: check return value */
-    fread(time, 1, 8, file); /* TODO: check return value */
+    emb_fread(date, 1, 8, file); /* TODO: check return value */
+    emb_fread(time, 1, 8, file); /* TODO: check return value */
     numberOfColors = emb_read_i32(file);
     numberOfStitchs = emb_read_i32(file);
     hoopSize = emb_read_i32(file);
@@ -3515,55 +4798,63 @@ readJef(EmbPattern* pattern, FILE* file)
         puts("ERROR: this file is corrupted or has too many stitches.");
         return 0;
     }
-    if (emb_verbose>1) {
+    if (pattern->context->verbose>1) {
         printf("format flags = %d\n", formatFlags);
         printf("number of colors = %d\n", numberOfColors);
         printf("number of stitches = %d\n", numberOfStitchs);
     }
 
-    read_hoop(file, &bounds, "bounds");
-    read_hoop(file, &rectFrom110x110, "rectFrom110x110");
-    read_hoop(file, &rectFrom50x50, "rectFrom50x50");
-    read_hoop(file, &rectFrom200x140, "rectFrom200x140");
-    read_hoop(file, &rect_from_custom, "rect_from_custom");
+    read_hoop(file, &bounds, "bounds", pattern->context->verbose);
+    read_hoop(file, &rectFrom110x110, "rectFrom110x110", pattern->context->verbose);
+    read_hoop(file, &rectFrom50x50, "rectFrom50x50", pattern->context->verbose);
+    read_hoop(file, &rectFrom200x140, "rectFrom200x140", pattern->context->verbose);
+    read_hoop(file, &rect_from_custom, "rect_from_custom", pattern->context->verbose);
 
-    for (i = 0; i < numberOfColors; i++) {
-        int thread_num = emb_read_i32(file);
-        emb_pattern_addThread(pattern, jef_colors[thread_num % 79]);
+    if (pattern->read_options & EMB_READ_THREADS) {
+        for (i = 0; i < numberOfColors; i++) {
+            int thread_num = emb_read_i32(file);
+            emb_pattern_addThread(pattern, jef_colors[thread_num % 79]);
+        }
     }
-    fseek(file, stitchOffset, SEEK_SET);
+    if (!(pattern->read_options & EMB_READ_STITCHES)) {
+        return 1;
+    }
+    emb_fseek(file, stitchOffset, SEEK_SET);
+    emb_pattern_reserve_stitches(pattern, numberOfStitchs);
     stitchCount = 0;
+    emb_stitch_batch_init(&batch, pattern);
     while (stitchCount < numberOfStitchs + 100) {
-        unsigned char b[2];
+        const unsigned char *b;
         char dx = 0, dy = 0;
         int flags = NORMAL;
-        if (fread(b, 1, 2, file) != 2) {
+        if (!(b = emb_stream_take(file, 2))) {
             break;
         }
 
         if (b[0] == 0x80) {
             if (b[1] & 1) {
-                if (fread(b, 1, 2, file) != 2) {
+                if (!(b = emb_stream_take(file, 2))) {
                     break;
                 }
                 flags = STOP;
             }
             else if ((b[1] == 2) || (b[1] == 4) || b[1] == 6) {
-                if (fread(b, 1, 2, file) != 2) {
+                if (!(b = emb_stream_take(file, 2))) {
                     break;
                 }
                 flags = TRIM;
             }
             else if (b[1] == 0x10) {
-                emb_pattern_addStitchRel(pattern, 0.0, 0.0, END, 1);
+                emb_stitch_batch_rel(&batch, 0.0, 0.0, END);
                 break;
             }
         }
         dx = jefDecode(b[0]);
         dy = jefDecode(b[1]);
-        emb_pattern_addStitchRel(pattern, dx / 10.0, dy / 10.0, flags, 1);
+        emb_stitch_batch_rel(&batch, dx / 10.0, dy / 10.0, flags);
         stitchCount++;
     }
+    emb_stitch_batch_flush(&batch);
     return 1;
 }
 
@@ -3598,8 +4889,35 @@ jefEncode(unsigned char* b, char dx, char dy, int flags)
     }
 }
 
+/* Reads the stitch and color counts of a JEF design and its extents,
+ * stored as distances from the center of the hoop, into a probe.
+ */
+int
+jefProbeHeader(EmbStream* file, EmbProbe* probe)
+{
+    const unsigned char *b = emb_stream_take(file, 0x34);
+    int left, top, right, bottom;
+    if (!b) {
+        return 0;
+    }
+    probe->colors = (int32_t)emb_get_u32(b + 0x18);
+    probe->stitches = (int32_t)emb_get_u32(b + 0x1C);
+    left = (int32_t)emb_get_u32(b + 0x24);
+    top = (int32_t)emb_get_u32(b + 0x28);
+    right = (int32_t)emb_get_u32(b + 0x2C);
+    bottom = (int32_t)emb_get_u32(b + 0x30);
+    if (left < 0 || top < 0 || right < 0 || bottom < 0) {
+        return 0;
+    }
+    probe->min_x = -left / 10.0;
+    probe->max_x = right / 10.0;
+    probe->min_y = -bottom / 10.0;
+    probe->max_y = top / 10.0;
+    return 1;
+}
+
 char
-writeJef(EmbPattern* pattern, FILE* file)
+writeJef(EmbPattern* pattern, EmbStream* file)
 {
     int colorlistSize, minColors, designWidth, designHeight, i;
     EmbRect boundingRect;
@@ -3617,7 +4935,7 @@ writeJef(EmbPattern* pattern, FILE* file)
 
     embTime_initNow(&time);
 
-    fprintf(file, "%04d%02d%02d%02d%02d%02d", (int)(time.year + 1900),
+    emb_fprintf(file, "%04d%02d%02d%02d%02d%02d", (int)(time.year + 1900),
             (int)(time.month + 1), (int)(time.day), (int)(time.hour),
             (int)(time.minute), (int)(time.second));
     fpad(file, 0, 2);
@@ -3705,9 +5023,9 @@ writeJef(EmbPattern* pattern, FILE* file)
         pos.y += 0.1*dy;
         jefEncode(b, dx, dy, st.flags);
         if ((b[0] == 0x80) && ((b[1] == 1) || (b[1] == 2) || (b[1] == 4) || (b[1] == 0x10))) {
-            fwrite(b, 1, 4, file);
+            emb_fwrite(b, 1, 4, file);
         } else {
-            fwrite(b, 1, 2, file);
+            emb_fwrite(b, 1, 2, file);
         }
     }
     return 1;
@@ -3745,12 +5063,14 @@ ksmEncode(unsigned char* b, char dx, char dy, int flags)
 }
 
 char
-readKsm(EmbPattern* pattern, FILE* file)
+readKsm(EmbPattern* pattern, EmbStream* file)
 {
+    EmbStitchBatch batch;
     int prevStitchType = NORMAL;
     char b[3];
-    fseek(file, 0x200, SEEK_SET);
-    while (fread(b, 1, 3, file) == 3) {
+    emb_fseek(file, 0x200, SEEK_SET);
+    emb_stitch_batch_init(&batch, pattern);
+    while (emb_fread(b, 1, 3, file) == 3) {
         int flags = NORMAL;
 
         if (((prevStitchType & 0x08) == 0x08) && (b[2] & 0x08) == 0x08) {
@@ -3765,13 +5085,14 @@ readKsm(EmbPattern* pattern, FILE* file)
         if (b[2] & 0x20) {
             b[0] = -b[0];
         }
-        emb_pattern_addStitchRel(pattern, b[1] / 10.0, b[0] / 10.0, flags, 1);
+        emb_stitch_batch_rel(&batch, b[1] / 10.0, b[0] / 10.0, flags);
     }
+    emb_stitch_batch_flush(&batch);
     return 1;
 }
 
 char
-writeKsm(EmbPattern* pattern, FILE* file)
+writeKsm(EmbPattern* pattern, EmbStream* file)
 {
     EmbVector pos;
     int i;
@@ -3789,9 +5110,9 @@ writeKsm(EmbPattern* pattern, FILE* file)
         pos.x += 0.1*dx;
         pos.y += 0.1*dy;
         ksmEncode(b, dx, dy, st.flags);
-        fprintf(file, "%c%c", b[0], b[1]);
+        emb_fprintf(file, "%c%c", b[0], b[1]);
     }
-    fprintf(file, "\x1a");
+    emb_fprintf(file, "\x1a");
     return 1;
 }
 
@@ -3821,33 +5142,36 @@ const unsigned char max_header[] = {
 
 /* Pfaff MAX embroidery file format */
 char
-readMax(EmbPattern* pattern, FILE* file)
+readMax(EmbPattern* pattern, EmbStream* file)
 {
-    unsigned char b[8];
+    EmbStitchBatch batch;
+    const unsigned char *b;
 
-    fseek(file, 0xD5, SEEK_SET);
+    emb_fseek(file, 0xD5, SEEK_SET);
     /* stitchCount = emb_read_i32(file); CHECK IF THIS IS PRESENT */
     /* READ STITCH RECORDS */
-    while (fread(b, 1, 8, file) == 8) {
+    emb_stitch_batch_init(&batch, pattern);
+    while ((b = emb_stream_take(file, 8))) {
         EmbReal dx, dy;
         int flags;
         flags = NORMAL;
         dx = pfaffDecode(b[0], b[1], b[2]);
         dy = pfaffDecode(b[4], b[5], b[6]);
-        emb_pattern_addStitchAbs(pattern, dx / 10.0, dy / 10.0, flags, 1);
+        emb_stitch_batch_abs(&batch, dx / 10.0, dy / 10.0, flags);
     }
+    emb_stitch_batch_flush(&batch);
     emb_pattern_flipVertical(pattern);
     return 1;
 }
 
 char
-writeMax(EmbPattern* pattern, FILE* file)
+writeMax(EmbPattern* pattern, EmbStream* file)
 {
     int i;
     EmbReal x, y;
     EmbStitch st;
 
-    fwrite(max_header, 1, 0xD5, file);
+    emb_fwrite(max_header, 1, 0xD5, file);
     for (i = 0; i < pattern->stitch_list->count; i++) {
         st = pattern->stitch_list->stitch[i];
         x = (int)emb_round(st.x * 10.0);
@@ -3863,20 +5187,23 @@ writeMax(EmbPattern* pattern, FILE* file)
  * Stitch Only Format.
  */
 char
-readMit(EmbPattern* pattern, FILE* file)
+readMit(EmbPattern* pattern, EmbStream* file)
 {
+    EmbStitchBatch batch;
     unsigned char data[2];
 
-    while (fread(data, 1, 2, file) == 2) {
+    emb_stitch_batch_init(&batch, pattern);
+    while (emb_fread(data, 1, 2, file) == 2) {
         int x = mitDecodeStitch(data[0]);
         int y = mitDecodeStitch(data[1]);
-        emb_pattern_addStitchRel(pattern, x / 10.0, y / 10.0, NORMAL, 1);
+        emb_stitch_batch_rel(&batch, x / 10.0, y / 10.0, NORMAL);
     }
+    emb_stitch_batch_flush(&batch);
     return 1;
 }
 
 char
-writeMit(EmbPattern* pattern, FILE* file)
+writeMit(EmbPattern* pattern, EmbStream* file)
 {
     EmbReal xx, yy;
     int i;
@@ -3891,7 +5218,7 @@ writeMit(EmbPattern* pattern, FILE* file)
         b[1] = mitEncodeStitch(st.y - yy);
         xx = st.x;
         yy = st.y;
-        fwrite(b, 1, 2, file);
+        emb_fwrite(b, 1, 2, file);
     }
     return 1;
 }
@@ -3901,13 +5228,15 @@ writeMit(EmbPattern* pattern, FILE* file)
  * Stitch Only Format.
  */
 char
-readNew(EmbPattern* pattern, FILE* file)
+readNew(EmbPattern* pattern, EmbStream* file)
 {
+    EmbStitchBatch batch;
     unsigned int stitchCount;
     unsigned char data[3];
 
     LOAD_I16(file, stitchCount)
-    while (fread(data, 1, 3, file) == 3) {
+    emb_stitch_batch_init(&batch, pattern);
+    while (emb_fread(data, 1, 3, file) == 3) {
         int x = decodeNewStitch(data[0]);
         int y = decodeNewStitch(data[1]);
         int flag = NORMAL;
@@ -3935,15 +5264,16 @@ readNew(EmbPattern* pattern, FILE* file)
         if (val != 0 && data[2] != 0x9B && data[2] != 0x91) {
             int z = 1;
         }*/
-        emb_pattern_addStitchRel(pattern, x / 10.0, y / 10.0, flag, 1);
+        emb_stitch_batch_rel(&batch, x / 10.0, y / 10.0, flag);
     }
 
+    emb_stitch_batch_flush(&batch);
     return 1;
 }
 
 /* . */
 char
-writeNew(EmbPattern* pattern, FILE* file)
+writeNew(EmbPattern* pattern, EmbStream* file)
 {
     puts("Overridden, defaulting to dst.");
     writeDst(pattern, file);
@@ -3955,7 +5285,7 @@ writeNew(EmbPattern* pattern, FILE* file)
  * Stitch Only Format.
  */
 char*
-ofmReadLibrary(FILE* file)
+ofmReadLibrary(EmbStream* file)
 {
     int stringLength = 0;
     char* libraryName = 0;
@@ -3967,21 +5297,21 @@ ofmReadLibrary(FILE* file)
         return 0;
     }
 
-    fread(leadIn, 1, 3, file); /* TODO: check return value */
+    emb_fread(leadIn, 1, 3, file); /* TODO: check return value */
     unsigned char a;
-    fread(&a, 1, 1, file);
+    emb_fread(&a, 1, 1, file);
     stringLength = a;
     libraryName = (char*)malloc(sizeof(char) * stringLength * 2);
     if (!libraryName) {
         printf("ERROR: format-ofm.c ofmReadLibrary(), unable to allocate memory for libraryName\n");
         return 0;
     }
-    fread((unsigned char*)libraryName, 1, stringLength * 2, file); /* TODO: check return value */
+    emb_fread((unsigned char*)libraryName, 1, stringLength * 2, file); /* TODO: check return value */
     return libraryName;
 }
 
 static int
-ofmReadClass(FILE* file)
+ofmReadClass(EmbStream* file)
 {
     int len;
     EmbString s;
@@ -3994,7 +5324,7 @@ ofmReadClass(FILE* file)
     emb_read_i16(file);
     len = emb_read_i16(file);
 
-    fread((unsigned char*)s, 1, len, file);
+    emb_fread((unsigned char*)s, 1, len, file);
     /* TODO: check return value */
     s[len] = '\0';
     if (!strcmp(s, "CExpStitch")) {
@@ -4007,7 +5337,7 @@ ofmReadClass(FILE* file)
 }
 
 void
-ofmReadBlockHeader(FILE* file)
+ofmReadBlockHeader(EmbStream* file, EmbPattern* pattern)
 {
     int val[10], i; /* TODO: determine what these represent */
     unsigned char len;
@@ -4027,16 +5357,16 @@ ofmReadBlockHeader(FILE* file)
     LOAD_I32(file, unknown2)
     LOAD_I32(file, unknown3)
 
-    /* int v = fread(&v, 1, 3, file)?; TODO: review */
+    /* int v = emb_fread(&v, 1, 3, file)?; TODO: review */
     emb_read_i16(file);
-    fseek(file, 1, SEEK_CUR);
-    len = (char)fgetc(file);
+    emb_fseek(file, 1, SEEK_CUR);
+    len = (char)emb_fgetc(file);
     s = (char*)malloc(2 * len);
     if (!s) {
         printf("ERROR: format-ofm.c ofmReadBlockHeader(), unable to allocate memory for s\n");
         return;
     }
-    fread((unsigned char *)s, 1, 2 * len, file);
+    emb_fread((unsigned char *)s, 1, 2 * len, file);
     /* TODO: check return value */
     /* 0, 0, 0, 0, 1, 1, 1, 0, 64, 64 */
     for (i=0; i<10; i++) {
@@ -4048,7 +5378,7 @@ ofmReadBlockHeader(FILE* file)
 
 /* . */
 void
-ofmReadColorChange(FILE* file, EmbPattern* pattern)
+ofmReadColorChange(EmbStream* file, EmbPattern* pattern)
 {
     if (!file) {
         printf("ERROR: format-ofm.c ofmReadColorChange(), file argument is null\n");
@@ -4059,12 +5389,12 @@ ofmReadColorChange(FILE* file, EmbPattern* pattern)
         return;
     }
 
-    ofmReadBlockHeader(file);
+    ofmReadBlockHeader(file, pattern);
     emb_pattern_addStitchRel(pattern, 0.0, 0.0, STOP, 1);
 }
 
 void
-ofmReadThreads(FILE* file, EmbPattern* p)
+ofmReadThreads(EmbStream* file, EmbPattern* pattern)
 {
     int i, numberOfColors, stringLen, numberOfLibraries;
     char* primaryLibraryName = 0;
@@ -4074,24 +5404,24 @@ ofmReadThreads(FILE* file, EmbPattern* p)
         printf("ERROR: ofm_read_threads(), file argument is null\n");
         return;
     }
-    if (!p) {
-        printf("ERROR: ofm_read_threads(), p argument is null\n");
+    if (!pattern) {
+        printf("ERROR: ofm_read_threads(), pattern argument is null\n");
         return;
     }
 
     /* FF FE FF 00 */
-    fseek(file, 4, SEEK_CUR);
+    emb_fseek(file, 4, SEEK_CUR);
 
     numberOfColors = emb_read_i16(file);
 
-    fseek(file, 4, SEEK_CUR);
+    emb_fseek(file, 4, SEEK_CUR);
     stringLen = emb_read_i16(file);
     expandedString = (char*)malloc(stringLen);
     if (!expandedString) {
         printf("ERROR: format-ofm.c ofm_read_threads(), unable to allocate memory for expandedString\n");
         return;
     }
-    fread((unsigned char*)expandedString, 1, stringLen, file);
+    emb_fread((unsigned char*)expandedString, 1, stringLen, file);
     /* TODO: check return value */
     for (i = 0; i < numberOfColors; i++) {
         EmbThread thread;
@@ -4099,23 +5429,24 @@ ofmReadThreads(FILE* file, EmbPattern* p)
         int threadLibrary, colorNameLength, colorNumber;
         embColor_read(file, &(thread.color), 4);
         LOAD_I16(file, threadLibrary)
-        fseek(file, 2, SEEK_CUR);
+        emb_fseek(file, 2, SEEK_CUR);
         LOAD_I32(file, colorNumber)
-        fseek(file, 3, SEEK_CUR);
+        emb_fseek(file, 3, SEEK_CUR);
         LOAD_I8(file, colorNameLength)
-        fread(colorName, 1, colorNameLength*2, file);
+        emb_fread(colorName, 1, colorNameLength*2, file);
         /* TODO: check return value */
-        fseek(file, 2, SEEK_CUR);
+        colorName[colorNameLength*2] = 0;
+        emb_fseek(file, 2, SEEK_CUR);
         sprintf(colorNumberText, "%10d", colorNumber);
-        strcpy(thread.catalogNumber, colorNumberText);
-        strcpy(thread.description, colorName);
-        emb_pattern_addThread(p, thread);
+        thread.catalogNumber = colorNumberText;
+        thread.description = colorName;
+        emb_pattern_addThread(pattern, thread);
     }
-    fseek(file, 2, SEEK_CUR);
+    emb_fseek(file, 2, SEEK_CUR);
     primaryLibraryName = ofmReadLibrary(file);
     numberOfLibraries = emb_read_i16(file);
 
-    if (emb_verbose>1) {
+    if (pattern->context->verbose>1) {
         printf("primary library name: %s\n", primaryLibraryName);
     }
 
@@ -4134,8 +5465,9 @@ ofmDecode(unsigned char b1, unsigned char b2)
 }
 
 void
-ofmReadExpanded(FILE* file, EmbPattern* p)
+ofmReadExpanded(EmbStream* file, EmbPattern* p)
 {
+    EmbStitchBatch batch;
     int i, numberOfStitches = 0;
 
     if (!file) {
@@ -4147,34 +5479,36 @@ ofmReadExpanded(FILE* file, EmbPattern* p)
         return;
     }
 
-    ofmReadBlockHeader(file);
+    ofmReadBlockHeader(file, p);
     numberOfStitches = emb_read_i32(file);
 
+    emb_stitch_batch_init(&batch, p);
     for (i = 0; i < numberOfStitches; i++) {
         unsigned char stitch[5];
-        fread(stitch, 1, 5, file); /* TODO: check return value */
+        emb_fread(stitch, 1, 5, file); /* TODO: check return value */
         if (stitch[0] == 0) {
             EmbReal x = ofmDecode(stitch[1], stitch[2]) / 10.0;
             EmbReal y = ofmDecode(stitch[3], stitch[4]) / 10.0;
-            emb_pattern_addStitchAbs(p, x, y, i == 0 ? JUMP : NORMAL, 1);
+            emb_stitch_batch_abs(&batch, x, y, i == 0 ? JUMP : NORMAL);
         }
         else if (stitch[0] == 32) {
             EmbReal x = ofmDecode(stitch[1], stitch[2]) / 10.0;
             EmbReal y = ofmDecode(stitch[3], stitch[4]) / 10.0;
-            emb_pattern_addStitchAbs(p, x, y, i == 0 ? TRIM : NORMAL, 1);
+            emb_stitch_batch_abs(&batch, x, y, i == 0 ? TRIM : NORMAL);
         }
     }
+    emb_stitch_batch_flush(&batch);
 }
 
 char
-readOfm(EmbPattern* pattern, FILE* fileCompound)
+readOfm(EmbPattern* pattern, EmbStream* fileCompound)
 {
     int unknownCount, key = 0, classNameLength;
     char* s = 0;
-    FILE* file;
+    EmbStream* file;
     bcf_file* bcfFile = 0;
 
-    if (emb_verbose>1) {
+    if (pattern->context->verbose>1) {
         puts("Overridden during development.");
         return 0;
     }
@@ -4184,24 +5518,31 @@ readOfm(EmbPattern* pattern, FILE* fileCompound)
         printf("ERROR: format-ofm.c readOfm(), unable to allocate memory for bcfFile\n");
         return 0;
     }
-    bcfFile_read(fileCompound, bcfFile);
+    if (!bcfFile_read(fileCompound, bcfFile)) {
+        safe_free(bcfFile);
+        return 0;
+    }
     file = GetFile(bcfFile, fileCompound, "EdsIV Object");
     bcf_file_free(bcfFile);
     bcfFile = 0;
-    fseek(file, 0x1C6, SEEK_SET);
+    if (!file) {
+        return 0;
+    }
+    emb_fseek(file, 0x1C6, SEEK_SET);
     ofmReadThreads(file, pattern);
-    fseek(file, 0x110, SEEK_CUR);
-    fseek(file, 0x4, SEEK_CUR); /* EMB_INT32_LITTLE */
+    emb_fseek(file, 0x110, SEEK_CUR);
+    emb_fseek(file, 0x4, SEEK_CUR); /* EMB_INT32_LITTLE */
     classNameLength = emb_read_i16(file);
     s = (char*)malloc(sizeof(char) * classNameLength);
     if (!s) {
         printf("ERROR: format-ofm.c readOfm(), unable to allocate memory for s\n");
+        emb_stream_close(file);
         return 0;
     }
-    fread((unsigned char*)s, 1, classNameLength, file); /* TODO: check return value */
+    emb_fread((unsigned char*)s, 1, classNameLength, file); /* TODO: check return value */
     unknownCount = emb_read_i16(file);
     /* TODO: determine what unknown count represents */
-    if (emb_verbose>1) {
+    if (pattern->context->verbose>1) {
         printf("unknownCount = %d\n", unknownCount);
     }
 
@@ -4224,12 +5565,14 @@ readOfm(EmbPattern* pattern, FILE* fileCompound)
     }
 
     emb_pattern_flip(pattern, 1, 1);
+    safe_free(s);
+    emb_stream_close(file);
 
     return 1;
 }
 
 char
-writeOfm(EmbPattern* pattern, FILE* file)
+writeOfm(EmbPattern* pattern, EmbStream* file)
 {
     puts("Overridden, defaulting to dst.");
     writeDst(pattern, file);
@@ -4248,25 +5591,26 @@ writeOfm(EmbPattern* pattern, FILE* file)
  *
  */
 char
-readPcd(EmbPattern* pattern, const char *fileName, FILE* file)
+readPcd(EmbPattern* pattern, const char *fileName, EmbStream* file)
 {
+    EmbStitchBatch batch;
     char allZeroColor = 1;
     int i = 0;
-    unsigned char b[9];
+    const unsigned char *b;
     EmbReal dx = 0, dy = 0;
     int st = 0;
     unsigned char version, hoopSize;
     unsigned short colorCount = 0;
 
-    version = (char)fgetc(file);
+    version = (char)emb_fgetc(file);
     /* 0 for PCD
      * 1 for PCQ (MAXI)
      * 2 for PCS with small hoop(80x80)
      * 3 for PCS with large hoop (115x120)
      */
-    hoopSize = (char)fgetc(file);
+    hoopSize = (char)emb_fgetc(file);
     LOAD_U16(file, colorCount)
-    if (emb_verbose>1) {
+    if (pattern->context->verbose>1) {
         printf("version: %d\n", version);
         printf("hoop size: %d\n", hoopSize);
     }
@@ -4274,21 +5618,22 @@ readPcd(EmbPattern* pattern, const char *fileName, FILE* file)
     for (i = 0; i < colorCount; i++) {
         EmbThread t;
         embColor_read(file, &(t.color), 4);
-        strcpy(t.catalogNumber, "");
-        strcpy(t.description, "");
+        t.catalogNumber = "";
+        t.description = "";
         if (t.color.r || t.color.g || t.color.b) {
             allZeroColor = 0;
         }
         emb_pattern_addThread(pattern, t);
     }
-    if (allZeroColor) {
+    if (allZeroColor && fileName) {
         emb_pattern_loadExternalColorFile(pattern, fileName);
     }
     LOAD_U16(file, st)
     /* READ STITCH RECORDS */
+    emb_stitch_batch_init(&batch, pattern);
     for (i = 0; i < st; i++) {
         int flags;
-        if (fread(b, 1, 9, file) != 9) {
+        if (!(b = emb_stream_take(file, 9))) {
             break;
         }
         flags = NORMAL;
@@ -4301,18 +5646,19 @@ readPcd(EmbPattern* pattern, const char *fileName, FILE* file)
         }
         dx = pfaffDecode(b[1], b[2], b[3]);
         dy = pfaffDecode(b[5], b[6], b[7]);
-        emb_pattern_addStitchAbs(pattern, dx / 10.0, dy / 10.0, flags, 1);
+        emb_stitch_batch_abs(&batch, dx / 10.0, dy / 10.0, flags);
     }
+    emb_stitch_batch_flush(&batch);
     return 1;
 }
 
 char
-writePcd(EmbPattern* pattern, FILE* file)
+writePcd(EmbPattern* pattern, EmbStream* file)
 {
     int i;
 
     /* TODO: select hoop size defaulting to Large PCS hoop */
-    fwrite("2\x03", 1, 2, file);
+    emb_fwrite("2\x03", 1, 2, file);
     emb_write_u16(file, (unsigned short)pattern->thread_list->count);
     for (i = 0; i < pattern->thread_list->count; i++) {
         EmbColor color = pattern->thread_list->thread[i].color;
@@ -4337,31 +5683,33 @@ writePcd(EmbPattern* pattern, FILE* file)
  * The Pfaff pcm format is stitch-only.
  */
 char
-readPcm(EmbPattern* pattern, FILE* file)
+readPcm(EmbPattern* pattern, EmbStream* file)
 {
+    EmbStitchBatch batch;
     int i = 0, st;
     EmbReal dx = 0, dy = 0;
     int header_size = 16*2+6;
 
-    if (emb_verbose>1) {
+    if (pattern->context->verbose>1) {
         printf("TODO: check header_size %d\n", header_size);
     }
 
-    fseek(file, 4, SEEK_SET);
+    emb_fseek(file, 4, SEEK_SET);
     for (i = 0; i < 16; i++) {
         int colorNumber;
-        (void)fgetc(file); /* zero */
-        colorNumber = fgetc(file);
+        (void)emb_fgetc(file); /* zero */
+        colorNumber = emb_fgetc(file);
         emb_pattern_addThread(pattern, pcm_colors[colorNumber]);
     }
     st = emb_read_i16be(file);
     st = EMB_MIN(st, MAX_STITCHES);
     /* READ STITCH RECORDS */
+    emb_stitch_batch_init(&batch, pattern);
     for (i = 0; i < st; i++) {
         int flags;
-        unsigned char b[9];
+        const unsigned char *b;
         flags = NORMAL;
-        if (fread(b, 1, 9, file) != 9) {
+        if (!(b = emb_stream_take(file, 9))) {
             break;
         }
         if (b[8] & 0x01) {
@@ -4373,13 +5721,14 @@ readPcm(EmbPattern* pattern, FILE* file)
         }
         dx = pfaffDecode(b[2], b[1], b[0]);
         dy = pfaffDecode(b[6], b[5], b[4]);
-        emb_pattern_addStitchAbs(pattern, dx / 10.0, dy / 10.0, flags, 1);
+        emb_stitch_batch_abs(&batch, dx / 10.0, dy / 10.0, flags);
     }
+    emb_stitch_batch_flush(&batch);
     return 1;
 }
 
 char
-writePcm(EmbPattern* pattern, FILE* file)
+writePcm(EmbPattern* pattern, EmbStream* file)
 {
     puts("overridden, defaulting to dst");
     writeDst(pattern, file);
@@ -4392,25 +5741,26 @@ writePcm(EmbPattern* pattern, FILE* file)
  * The Pfaff pcq format is stitch-only.
  */
 char
-readPcq(EmbPattern* pattern, const char* fileName, FILE* file)
+readPcq(EmbPattern* pattern, const char* fileName, EmbStream* file)
 {
+    EmbStitchBatch batch;
     char allZeroColor = 1;
     int i = 0;
-    unsigned char b[9];
+    const unsigned char *b;
     EmbReal dx = 0, dy = 0;
     int flags = 0, st = 0;
     unsigned char version, hoopSize;
     unsigned short colorCount;
 
-    version = (char)fgetc(file);
-    hoopSize = (char)fgetc(file);
+    version = (char)emb_fgetc(file);
+    hoopSize = (char)emb_fgetc(file);
     /* 0 for PCD
      * 1 for PCQ (MAXI)
      * 2 for PCS with small hoop(80x80)
      * 3 for PCS with large hoop (115x120)
      */
     LOAD_U16(file, colorCount)
-    if (emb_verbose>1) {
+    if (pattern->context->verbose>1) {
         printf("version: %d\n", version);
         printf("hoop size: %d\n", hoopSize);
     }
@@ -4418,21 +5768,22 @@ readPcq(EmbPattern* pattern, const char* fileName, FILE* file)
     for (i = 0; i < colorCount; i++) {
         EmbThread t;
         embColor_read(file, &(t.color), 4);
-        strcpy(t.catalogNumber, "");
-        strcpy(t.description, "");
+        t.catalogNumber = "";
+        t.description = "";
         if (t.color.r || t.color.g || t.color.b) {
             allZeroColor = 0;
         }
         emb_pattern_addThread(pattern, t);
     }
-    if (allZeroColor) {
+    if (allZeroColor && fileName) {
         emb_pattern_loadExternalColorFile(pattern, fileName);
     }
     LOAD_U16(file, st)
     /* READ STITCH RECORDS */
+    emb_stitch_batch_init(&batch, pattern);
     for (i = 0; i < st; i++) {
         flags = NORMAL;
-        if (fread(b, 1, 9, file) != 9) {
+        if (!(b = emb_stream_take(file, 9))) {
             break;
         }
 
@@ -4447,18 +5798,19 @@ readPcq(EmbPattern* pattern, const char* fileName, FILE* file)
         }
         dx = pfaffDecode(b[1], b[2], b[3]);
         dy = pfaffDecode(b[5], b[6], b[7]);
-        emb_pattern_addStitchAbs(pattern, dx / 10.0, dy / 10.0, flags, 1);
+        emb_stitch_batch_abs(&batch, dx / 10.0, dy / 10.0, flags);
     }
+    emb_stitch_batch_flush(&batch);
     return 1;
 }
 
 char
-writePcq(EmbPattern* pattern, FILE* file)
+writePcq(EmbPattern* pattern, EmbStream* file)
 {
     int i;
 
     /* TODO: select hoop size defaulting to Large PCS hoop */
-    fwrite("2\x03", 1, 2, file);
+    emb_fwrite("2\x03", 1, 2, file);
     emb_write_u16(file, (unsigned short)pattern->thread_list->count);
     for (i = 0; i < pattern->thread_list->count; i++) {
         EmbColor color = pattern->thread_list->thread[i].color;
@@ -4483,24 +5835,25 @@ writePcq(EmbPattern* pattern, FILE* file)
  * The Pfaff pcs format is stitch-only.
  */
 char
-readPcs(EmbPattern* pattern, const char* fileName, FILE* file)
+readPcs(EmbPattern* pattern, const char* fileName, EmbStream* file)
 {
+    EmbStitchBatch batch;
     char allZeroColor = 1;
     int i = 0;
-    unsigned char b[9];
+    const unsigned char *b;
     EmbReal dx = 0, dy = 0;
     int flags = 0, st = 0;
     unsigned char version, hoopSize;
     unsigned short colorCount;
 
-    version = (char)fgetc(file);
+    version = (char)emb_fgetc(file);
 
     /* 0 for PCD
      * 1 for PCQ (MAXI)
      * 2 for PCS with small hoop(80x80)
      * 3 for PCS with large hoop (115x120)
      */
-    hoopSize = (char)fgetc(file);
+    hoopSize = (char)emb_fgetc(file);
     switch(hoopSize) {
         case 2:
             pattern->hoop_width = 80.0;
@@ -4513,7 +5866,7 @@ readPcs(EmbPattern* pattern, const char* fileName, FILE* file)
     }
 
     LOAD_U16(file, colorCount)
-    if (emb_verbose>1) {
+    if (pattern->context->verbose>1) {
         printf("version: %d\n", version);
         printf("hoop size: %d\n", hoopSize);
         printf("color count: %d\n", colorCount);
@@ -4522,21 +5875,22 @@ readPcs(EmbPattern* pattern, const char* fileName, FILE* file)
     for (i = 0; i < colorCount; i++) {
         EmbThread t;
         embColor_read(file, &(t.color), 4);
-        strcpy(t.catalogNumber, "");
-        strcpy(t.description, "");
+        t.catalogNumber = "";
+        t.description = "";
         if (t.color.r || t.color.g || t.color.b) {
             allZeroColor = 0;
         }
         emb_pattern_addThread(pattern, t);
     }
-    if (allZeroColor) {
+    if (allZeroColor && fileName) {
         emb_pattern_loadExternalColorFile(pattern, fileName);
     }
     LOAD_U16(file, st)
     /* READ STITCH RECORDS */
+    emb_stitch_batch_init(&batch, pattern);
     for (i = 0; i < st; i++) {
         flags = NORMAL;
-        if (fread(b, 1, 9, file) != 9)
+        if (!(b = emb_stream_take(file, 9)))
             break;
 
         if (b[8] & 0x01) {
@@ -4550,19 +5904,20 @@ readPcs(EmbPattern* pattern, const char* fileName, FILE* file)
         }
         dx = pfaffDecode(b[1], b[2], b[3]);
         dy = pfaffDecode(b[5], b[6], b[7]);
-        emb_pattern_addStitchAbs(pattern, dx / 10.0, dy / 10.0, flags, 1);
+        emb_stitch_batch_abs(&batch, dx / 10.0, dy / 10.0, flags);
     }
 
+    emb_stitch_batch_flush(&batch);
     return 1;
 }
 
 char
-writePcs(EmbPattern* pattern, FILE* file)
+writePcs(EmbPattern* pattern, EmbStream* file)
 {
     int i;
 
     /* TODO: select hoop size defaulting to Large PCS hoop */
-    fwrite("2\x03", 1, 2, file);
+    emb_fwrite("2\x03", 1, 2, file);
     emb_write_u16(file, (unsigned short)pattern->thread_list->count);
     for (i = 0; i < pattern->thread_list->count; i++) {
         EmbColor color = pattern->thread_list->thread[i].color;
@@ -4586,23 +5941,25 @@ writePcs(EmbPattern* pattern, FILE* file)
  * The Brother pec format is stitch-only.
  */
 void
-readPecStitches(EmbPattern* pattern, FILE* file)
+readPecStitches(EmbPattern* pattern, EmbStream* file)
 {
-    void *f = file;
-    unsigned char b[2];
+    EmbStitchBatch batch;
+    const unsigned char *b;
 
-    while (fread(b, 1, 2, f)==2) {
+    emb_stitch_batch_init(&batch, pattern);
+    while ((b = emb_stream_take(file, 2))) {
         int val1 = (int)b[0];
         int val2 = (int)b[1];
 
         int stitchType = NORMAL;
         if (b[0] == 0xFF && b[1] == 0x00) {
+            emb_stitch_batch_flush(&batch);
             emb_pattern_end(pattern);
             return;
         }
         if (b[0] == 0xFE && b[1] == 0xB0) {
-            (void)fgetc(f);
-            emb_pattern_addStitchRel(pattern, 0.0, 0.0, STOP, 1);
+            (void)emb_fgetc(file);
+            emb_stitch_batch_rel(&batch, 0.0, 0.0, STOP);
             continue;
         }
         /* High bit set means 12-bit offset, otherwise 7-bit signed delta */
@@ -4622,7 +5979,7 @@ readPecStitches(EmbPattern* pattern, FILE* file)
         if (val2 & 0x80) {
             if (val2 & 0x20) stitchType = TRIM;
             if (val2 & 0x10) stitchType = JUMP;
-            val2 = ((val2 & 0x0F) << 8) + fgetc(file);
+            val2 = ((val2 & 0x0F) << 8) + emb_fgetc(file);
 
             /* Signed 12-bit arithmetic */
             if (val2 & 0x800) {
@@ -4633,17 +5990,104 @@ readPecStitches(EmbPattern* pattern, FILE* file)
             val2 -= 0x80;
         }
 
-        emb_pattern_addStitchRel(pattern, val1 / 10.0,
-                val2 / 10.0, stitchType, 1);
+        emb_stitch_batch_rel(&batch, val1 / 10.0,
+                val2 / 10.0, stitchType);
+    }
+    emb_stitch_batch_flush(&batch);
+}
+
+/* Reads the color count of a PEC or PES design from its header and
+ * counts its stitches into a probe, without decoding them into a pattern.
+ * The count and extents are those readPec() and readPes() give, home
+ * stitch, END and the flip included.
+ */
+int
+pecProbe(EmbStream* file, EmbProbe* probe)
+{
+    const unsigned char *b;
+    int x = 0, y = 0, min_y = 0, max_y = 0, stops = 0, start;
+
+    if (probe->format == EMB_FORMAT_PES) {
+        if (!(b = emb_stream_take(file, 12))) {
+            return 0;
+        }
+        /* The PEC section starts with its label, as a PEC file does
+         * after its 8 byte signature, so the color count is 0x30 in. */
+        start = (int32_t)emb_get_u32(b + 8);
+        emb_fseek(file, start + 0x30, SEEK_SET);
+        probe->colors = emb_fgetc(file) + 1;
+        start += 528;
+    }
+    else {
+        if (!check_header_present(file, 0x20A)) {
+            return 0;
+        }
+        emb_fseek(file, 0x38, SEEK_SET);
+        probe->colors = emb_fgetc(file) + 1;
+        start = 0x21C;
+    }
+    if (probe->colors <= 0 || emb_fseek(file, start, SEEK_SET)) {
+        return 0;
+    }
+    probe->source = EMB_PROBE_SCAN;
+    probe->min_x = probe->max_x = 0.0;
+    while ((b = emb_stream_take(file, 2))) {
+        int val1 = (int)b[0];
+        int val2 = (int)b[1];
+        if (b[0] == 0xFF && b[1] == 0x00) {
+            break;
+        }
+        if (b[0] == 0xFE && b[1] == 0xB0) {
+            (void)emb_fgetc(file);
+            /* A STOP before any stitch is dropped, as is the home stitch
+             * the first stitch brings with it. */
+            if (probe->stitches > 0) {
+                probe->stitches++;
+                stops++;
+            }
+            continue;
+        }
+        if (val1 & 0x80) {
+            val1 = ((val1 & 0x0F) << 8) + val2;
+            if (val1 & 0x800) {
+                val1 -= 0x1000;
+            }
+        }
+        else if (val1 >= 0x40) {
+            val1 -= 0x80;
+        }
+        if (val2 & 0x80) {
+            val2 = ((val2 & 0x0F) << 8) + emb_fgetc(file);
+            if (val2 & 0x800) {
+                val2 -= 0x1000;
+            }
+        }
+        else if (val2 >= 0x40) {
+            val2 -= 0x80;
+        }
+        x += val1;
+        y += val2;
+        probe->min_x = EMB_MIN(probe->min_x, x / 10.0);
+        probe->max_x = EMB_MAX(probe->max_x, x / 10.0);
+        min_y = EMB_MIN(min_y, y);
+        max_y = EMB_MAX(max_y, y);
+        probe->stitches += (probe->stitches == 0) ? 2 : 1;
     }
+    if (probe->stitches > 0) {
+        probe->stitches++;
+        probe->colors = EMB_MAX(probe->colors, stops + 1);
+    }
+    probe->min_y = -max_y / 10.0;
+    probe->max_y = -min_y / 10.0;
+    return 1;
 }
 
 void
-pecEncodeJump(FILE* file, int x, int types)
+pecEncodeJump(EmbStream* file, int x, int types)
 {
     int outputVal = abs(x) & 0x7FF;
     unsigned int orPart = 0x80;
-    unsigned char toWrite;
+    unsigned char b[2];
 
     if (!file) {
         printf("ERROR: format-pec.c pecEncodeJump(), file argument is null\n");
@@ -4659,31 +6103,30 @@ pecEncodeJump(FILE* file, int x, int types)
         outputVal = (x + 0x1000) & 0x7FF;
         outputVal |= 0x800;
     }
-    toWrite = (unsigned char)(((outputVal >> 8) & 0x0F) | orPart);
-    fwrite(&toWrite, 1, 1, file);
-    toWrite = (unsigned char)(outputVal & 0xFF);
-    fwrite(&toWrite, 1, 1, file);
+    b[0] = (unsigned char)(((outputVal >> 8) & 0x0F) | orPart);
+    b[1] = (unsigned char)(outputVal & 0xFF);
+    emb_fwrite(b, 1, 2, file);
 }
 
 void
-pecEncodeStop(FILE* file, unsigned char val)
+pecEncodeStop(EmbStream* file, unsigned char val)
 {
     if (!file) {
         printf("ERROR: format-pec.c pecEncodeStop(), file argument is null\n");
         return;
     }
-    fwrite("\xFE\xB0", 1, 2, file);
-    fwrite(&val, 1, 1, file);
+    emb_fwrite("\xFE\xB0", 1, 2, file);
+    emb_fwrite(&val, 1, 1, file);
 }
 
 char
-readPec(EmbPattern* pattern, const char *fileName, FILE* file)
+readPec(EmbPattern* pattern, const char *fileName, EmbStream* file)
 {
     unsigned int graphicsOffset;
     unsigned char colorChanges;
     int i;
 
-    if (emb_verbose>1) {
+    if (pattern->context->verbose>1 && fileName) {
         printf("fileName: %s\n", fileName);
     }
 
@@ -4691,23 +6134,28 @@ readPec(EmbPattern* pattern, const char *fileName, FILE* file)
         return 0;
     }
 
-    fseek(file, 0x38, SEEK_SET);
-    colorChanges = (unsigned char)(char)fgetc(file);
-    for (i = 0; i <= colorChanges; i++) {
-        emb_pattern_addThread(pattern, pec_colors[(char)fgetc(file) % 65]);
+    if (pattern->read_options & EMB_READ_THREADS) {
+        emb_fseek(file, 0x38, SEEK_SET);
+        colorChanges = (unsigned char)(char)emb_fgetc(file);
+        for (i = 0; i <= colorChanges; i++) {
+            emb_pattern_addThread(pattern, pec_colors[(char)emb_fgetc(file) % 65]);
+        }
+    }
+    if (!(pattern->read_options & EMB_READ_STITCHES)) {
+        return 1;
     }
 
     /* Get Graphics offset */
-    fseek(file, 0x20A, SEEK_SET);
+    emb_fseek(file, 0x20A, SEEK_SET);
 
-    graphicsOffset = (unsigned int)(fgetc(file));
-    graphicsOffset |= (fgetc(file) << 8);
-    graphicsOffset |= (fgetc(file) << 16);
+    graphicsOffset = (unsigned int)(emb_fgetc(file));
+    graphicsOffset |= (emb_fgetc(file) << 8);
+    graphicsOffset |= (emb_fgetc(file) << 16);
     REPORT_INT(graphicsOffset)
 
-    (void)(char)fgetc(file); /* 0x31 */
-    (void)(char)fgetc(file); /* 0xFF */
-    (void)(char)fgetc(file); /* 0xF0 */
+    (void)(char)emb_fgetc(file); /* 0x31 */
+    (void)(char)emb_fgetc(file); /* 0xFF */
+    (void)(char)emb_fgetc(file); /* 0xF0 */
     /* Get X and Y size in .1 mm */
     /* 0x210 */
     emb_read_i16(file); /* x size */
@@ -4727,7 +6175,7 @@ readPec(EmbPattern* pattern, const char *fileName, FILE* file)
 }
 
 void
-pecEncode(FILE* file, EmbPattern* p)
+pecEncode(EmbStream* file, EmbPattern* p)
 {
     EmbReal thisX = 0.0;
     EmbReal thisY = 0.0;
@@ -4760,7 +6208,7 @@ pecEncode(FILE* file, EmbPattern* p)
                 stopCode = (unsigned char)2;
             }
         } else if (s.flags & END) {
-            fwrite("\xFF", 1, 1, file);
+            emb_fwrite("\xFF", 1, 1, file);
             break;
         } else if (deltaX < 63 && deltaX > -64 && deltaY < 63 && deltaY > -64 && (!(s.flags & (JUMP | TRIM)))) {
             unsigned char out[2];
@@ -4776,7 +6224,7 @@ pecEncode(FILE* file, EmbPattern* p)
             else {
                 out[1] = (unsigned char)deltaY;
             }
-            fwrite(out, 1, 2, file);
+            emb_fwrite(out, 1, 2, file);
         }
         else {
             pecEncodeJump(file, deltaX, s.flags);
@@ -4785,59 +6233,55 @@ pecEncode(FILE* file, EmbPattern* p)
     }
 }
 
-void writeImage(FILE* file, unsigned char image[][48]);
+void writeImage(EmbStream* file, unsigned char image[][48]);
 
 void
-writePecStitches(EmbPattern* pattern, FILE* file, const char *fileName)
+writePecStitches(EmbPattern* pattern, EmbStream* file, const char *fileName)
 {
     EmbRect bounds;
     unsigned char image[38][48], toWrite;
     int i, j, flen, graphicsOffsetLocation;
     int graphicsOffsetValue, height, width;
     EmbReal xFactor, yFactor;
-    const char* forwardSlashPos = fileName + string_rchar(fileName, '/');
-    const char* backSlashPos = fileName + string_rchar(fileName, '\\');
-    const char* dotPos = fileName + string_rchar(fileName, '.');
-    const char* start = 0;
-
-    start = fileName;
-    if (forwardSlashPos) {
-        start = forwardSlashPos + 1;
-    }
-    if (backSlashPos && backSlashPos > start) {
-        start = backSlashPos + 1;
-    }
-    fwrite("LA:", 1, 3, file);
-    flen = (int)(dotPos - start);
+    const char* start = fileName ? fileName : "";
+    const char* p;
 
-    while (start < dotPos) {
-        fwrite(start, 1, 1, file);
-        start++;
+    /* The label is the file name without its directory or extension,
+     * cut to the 16 characters of the field. */
+    for (p = start; *p; p++) {
+        if (*p == '/' || *p == '\\') {
+            start = p + 1;
+        }
     }
+    p = strrchr(start, '.');
+    flen = p ? (int)(p - start) : (int)strlen(start);
+    flen = EMB_MIN(flen, 16);
+    emb_fwrite("LA:", 1, 3, file);
+    emb_fwrite(start, 1, flen, file);
     fpad(file, 0x20, 16-flen);
-    fwrite("\x0D", 1, 1, file);
+    emb_fwrite("\x0D", 1, 1, file);
     fpad(file, 0x20, 12);
-    fwrite("\xff\x00\x06\x26", 1, 4, file);
+    emb_fwrite("\xff\x00\x06\x26", 1, 4, file);
 
     fpad(file, 0x20, 12);
     toWrite = (unsigned char)(pattern->thread_list->count-1);
-    fwrite(&toWrite, 1, 1, file);
+    emb_fwrite(&toWrite, 1, 1, file);
 
     for (i = 0; i < pattern->thread_list->count; i++) {
         EmbColor thr = pattern->thread_list->thread[i].color;
         unsigned char color = (unsigned char)
             emb_find_nearest_thread(thr,
             (EmbThread*)pec_colors, pecThreadCount);
-        fwrite(&color, 1, 1, file);
+        emb_fwrite(&color, 1, 1, file);
     }
     fpad(file, 0x20, (int)(0x1CF - pattern->thread_list->count));
     fpad(file, 0x00, 2);
 
-    graphicsOffsetLocation = ftell(file);
+    graphicsOffsetLocation = emb_ftell(file);
     /* placeholder bytes to be overwritten */
     fpad(file, 0x00, 3);
 
-    fwrite("\x31\xff\xf0", 1, 3, file);
+    emb_fwrite("\x31\xff\xf0", 1, 3, file);
 
     bounds = emb_pattern_bounds(pattern);
 
@@ -4851,21 +6295,21 @@ writePecStitches(EmbPattern* pattern, FILE* file, const char *fileName)
     emb_write_i16(file, height);
 
     /* Write 4 miscellaneous int16's */
-    fwrite("\x01\xe0\x01\xb0", 1, 4, file);
+    emb_fwrite("\x01\xe0\x01\xb0", 1, 4, file);
 
     /* CHECK: is this really big endian? */
     emb_write_i16be(file, top);
     emb_write_i16be(file, bottom);
 
     pecEncode(file, pattern);
-    graphicsOffsetValue = ftell(file) - graphicsOffsetLocation + 2;
-    fseek(file, graphicsOffsetLocation, SEEK_SET);
+    graphicsOffsetValue = emb_ftell(file) - graphicsOffsetLocation + 2;
+    emb_fseek(file, graphicsOffsetLocation, SEEK_SET);
 
-    fputc((unsigned char)(graphicsOffsetValue & 0xFF), file);
-    fputc((unsigned char)((graphicsOffsetValue >> 8) & 0xFF), file);
-    fputc((unsigned char)((graphicsOffsetValue >> 16) & 0xFF), file);
+    emb_fputc((unsigned char)(graphicsOffsetValue & 0xFF), file);
+    emb_fputc((unsigned char)((graphicsOffsetValue >> 8) & 0xFF), file);
+    emb_fputc((unsigned char)((graphicsOffsetValue >> 16) & 0xFF), file);
 
-    fseek(file, 0x00, SEEK_END);
+    emb_fseek(file, 0x00, SEEK_END);
 
     /* Writing all colors */
     memcpy(image, imageWithFrame, 48*38);
@@ -4902,7 +6346,7 @@ writePecStitches(EmbPattern* pattern, FILE* file, const char *fileName)
 }
 
 char
-writePec(EmbPattern* pattern, const char* fileName, FILE* file)
+writePec(EmbPattern* pattern, const char* fileName, EmbStream* file)
 {
     /* TODO: There needs to be a matching flipVertical() call after the write
         to ensure multiple writes from the same pattern work properly */
@@ -4910,7 +6354,7 @@ writePec(EmbPattern* pattern, const char* fileName, FILE* file)
     emb_pattern_fixColorCount(pattern);
     emb_pattern_correctForMaxStitchLength(pattern, 12.7, 204.7);
     emb_pattern_scale(pattern, 10.0);
-    fwrite("#PEC0001", 1, 8, file);
+    emb_fwrite("#PEC0001", 1, 8, file);
     writePecStitches(pattern, file, fileName);
     return 1;
 }
@@ -4920,7 +6364,7 @@ writePec(EmbPattern* pattern, const char* fileName, FILE* file)
  * The Brother pel format is stitch-only.
  */
 char
-readPel(EmbPattern *pattern, FILE* file)
+readPel(EmbPattern *pattern, EmbStream* file)
 {
     puts("ERROR: readPel is not implemented.");
     printf("%p, %p\n", pattern, file);
@@ -4928,7 +6372,7 @@ readPel(EmbPattern *pattern, FILE* file)
 }
 
 char
-writePel(EmbPattern * pattern, FILE* file)
+writePel(EmbPattern * pattern, EmbStream* file)
 {
     puts("ERROR: writePel is not implemented.");
     printf("%p, %p\n", pattern, file);
@@ -4940,7 +6384,7 @@ writePel(EmbPattern * pattern, FILE* file)
  * The Brother pem format is stitch-only.
  */
 char
-readPem(EmbPattern *pattern, FILE* file)
+readPem(EmbPattern *pattern, EmbStream* file)
 {
     puts("ERROR: readPem is not implemented.");
     printf("%p, %p\n", pattern, file);
@@ -4948,7 +6392,7 @@ readPem(EmbPattern *pattern, FILE* file)
 }
 
 char
-writePem(EmbPattern *pattern, FILE* file)
+writePem(EmbPattern *pattern, EmbStream* file)
 {
     puts("ERROR: writePem is not implemented.");
     printf("%p, %p\n", pattern, file);
@@ -4979,15 +6423,15 @@ const char *pes_version_strings[] = {
 /* ---------------------------------------------------------------- */
 /* format pes */
 
-int pes_version = PES0001;
-
 char
-readPes(EmbPattern* pattern, const char *fileName, FILE* file)
+readPes(EmbPattern* pattern, const char *fileName, EmbStream* file)
 {
-    printf("%s", fileName);
-    int pecstart, numColors, x, version, i;
+    int pecstart, numColors, x, version, i, options;
     char signature[9];
-    if (fread(signature, 1, 8, file) != 8) {
+    if (pattern->context->verbose>1 && fileName) {
+        printf("fileName: %s\n", fileName);
+    }
+    if (emb_fread(signature, 1, 8, file) != 8) {
         puts("ERROR PES: failed to read signature.");
         return 0;
     }
@@ -5001,14 +6445,28 @@ readPes(EmbPattern* pattern, const char *fileName, FILE* file)
             break;
         }
     }
+    pattern->context->pes_version = version;
 
-    if (version >= PES0040) {
-        fseek(file, 0x10, SEEK_SET);
+    options = pattern->read_options;
+    /* The PES section before the PEC one holds only metadata and
+     * threads, the stitches are all in the PEC section. */
+    if (version >= PES0040 && (options & EMB_READ_METADATA)) {
+        emb_fseek(file, 0x10, SEEK_SET);
         if (!read_descriptions(file, pattern)) {
             puts("ERROR PES: failed to read descriptions.");
             return 0;
         }
     }
+    else if (version >= PES0040 && (options & EMB_READ_THREADS)) {
+        emb_fseek(file, 0x10, SEEK_SET);
+        if (!skip_descriptions(file)) {
+            puts("ERROR PES: failed to read descriptions.");
+            return 0;
+        }
+    }
+    if (!(options & EMB_READ_THREADS)) {
+        version = -1;
+    }
 
     switch (version) {
     case PES0100:
@@ -5035,62 +6493,87 @@ readPes(EmbPattern* pattern, const char *fileName, FILE* file)
         break;
     }
 
-    /* fseek(file, pecstart + 48, SEEK_SET);
+    /* emb_fseek(file, pecstart + 48, SEEK_SET);
      * This seems wrong based on the readPESHeader functions. */
-    fseek(file, pecstart, SEEK_SET);
-
-    numColors = fgetc(file) + 1;
-    for (x = 0; x < numColors; x++) {
-        int color_index = fgetc(file);
-        if (color_index >= pecThreadCount) {
-            color_index = 0;
+    emb_fseek(file, pecstart, SEEK_SET);
+
+    if (options & EMB_READ_THREADS) {
+        numColors = emb_fgetc(file) + 1;
+        for (x = 0; x < numColors; x++) {
+            int color_index = emb_fgetc(file);
+            if (color_index >= pecThreadCount) {
+                color_index = 0;
+            }
+            emb_pattern_addThread(pattern, pec_colors[color_index]);
         }
-        emb_pattern_addThread(pattern, pec_colors[color_index]);
     }
 
-    fseek(file, pecstart + 528, SEEK_SET);
-    readPecStitches(pattern, file);
-
-    emb_pattern_flipVertical(pattern);
-
+    if (options & EMB_READ_STITCHES) {
+        emb_fseek(file, pecstart + 528, SEEK_SET);
+        readPecStitches(pattern, file);
+        emb_pattern_flipVertical(pattern);
+    }
     return 1;
 }
 
-int
-read_descriptions(FILE* file, EmbPattern* pattern)
+/* Reads one length-prefixed PES description string and interns it in
+ * pattern a pattern. Returns 0 if the file ends early.
+ */
+static const char*
+read_description(EmbStream* file, EmbPattern* pattern)
 {
-    size_t n;
-    n = (size_t)fgetc(file);
-    if (fread(pattern->design_name, 1, n, file) != n) {
-        return 0;
-    }
-    n = (size_t)fgetc(file);
-    if (fread(pattern->category, 1, n, file) != n) {
+    char buffer[256];
+    int n = emb_fgetc(file);
+    if (n == EOF || emb_fread(buffer, 1, n, file) != (size_t)n) {
         return 0;
     }
-    n = (size_t)fgetc(file);
-    if (fread(pattern->author, 1, n, file) != n) {
-        return 0;
-    }
-    n = (size_t)fgetc(file);
-    if (fread(pattern->keywords, 1, n, file) != n) {
-        return 0;
+    buffer[n] = 0;
+    return emb_pattern_intern(pattern, buffer);
+}
+
+/* Seeks over the five PES description strings. Returns 0 if the file
+ * ends early.
+ */
+int
+skip_descriptions(EmbStream* file)
+{
+    int i;
+    for (i = 0; i < 5; i++) {
+        int n = emb_fgetc(file);
+        if (n == EOF || emb_fseek(file, n, SEEK_CUR)) {
+            return 0;
+        }
     }
-    n = (size_t)fgetc(file);
-    if (fread(pattern->comments, 1, n, file) != n) {
+    return 1;
+}
+
+int
+read_descriptions(EmbStream* file, EmbPattern* pattern)
+{
+    const char *design_name, *category, *author, *keywords, *comments;
+    if (!(design_name = read_description(file, pattern))
+        || !(category = read_description(file, pattern))
+        || !(author = read_description(file, pattern))
+        || !(keywords = read_description(file, pattern))
+        || !(comments = read_description(file, pattern))) {
         return 0;
     }
+    pattern->design_name = design_name;
+    pattern->category = category;
+    pattern->author = author;
+    pattern->keywords = keywords;
+    pattern->comments = comments;
     return 1;
 }
 
 void
-readPESHeaderV5(FILE* file, EmbPattern* pattern)
+readPESHeaderV5(EmbStream* file, EmbPattern* pattern)
 {
     int fromImageStringLength;
-    fseek(file, 24, SEEK_CUR);
-    fromImageStringLength = fgetc(file);
-    fseek(file, fromImageStringLength, SEEK_CUR);
-    fseek(file, 24, SEEK_CUR);
+    emb_fseek(file, 24, SEEK_CUR);
+    fromImageStringLength = emb_fgetc(file);
+    emb_fseek(file, fromImageStringLength, SEEK_CUR);
+    emb_fseek(file, 24, SEEK_CUR);
     readProgrammableFills(file, pattern);
     readMotifPatterns(file, pattern);
     readFeatherPatterns(file, pattern);
@@ -5098,11 +6581,11 @@ readPESHeaderV5(FILE* file, EmbPattern* pattern)
 }
 
 void
-readPESHeaderV6(FILE* file, EmbPattern* pattern)
+readPESHeaderV6(EmbStream* file, EmbPattern* pattern)
 {
-    fseek(file, 36, SEEK_CUR);
+    emb_fseek(file, 36, SEEK_CUR);
     readImageString(file, pattern);
-    fseek(file, 24, SEEK_CUR);
+    emb_fseek(file, 24, SEEK_CUR);
     readProgrammableFills(file, pattern);
     readMotifPatterns(file, pattern);
     readFeatherPatterns(file, pattern);
@@ -5110,11 +6593,11 @@ readPESHeaderV6(FILE* file, EmbPattern* pattern)
 }
 
 void
-readPESHeaderV7(FILE* file, EmbPattern* pattern)
+readPESHeaderV7(EmbStream* file, EmbPattern* pattern)
 {
-    fseek(file, 36, SEEK_CUR);
+    emb_fseek(file, 36, SEEK_CUR);
     readImageString(file, pattern);
-    fseek(file, 24, SEEK_CUR);
+    emb_fseek(file, 24, SEEK_CUR);
     readProgrammableFills(file, pattern);
     readMotifPatterns(file, pattern);
     readFeatherPatterns(file, pattern);
@@ -5122,11 +6605,11 @@ readPESHeaderV7(FILE* file, EmbPattern* pattern)
 }
 
 void
-readPESHeaderV8(FILE* file, EmbPattern* pattern)
+readPESHeaderV8(EmbStream* file, EmbPattern* pattern)
 {
-    fseek(file, 38, SEEK_CUR);
+    emb_fseek(file, 38, SEEK_CUR);
     readImageString(file, pattern);
-    fseek(file, 26, SEEK_CUR);
+    emb_fseek(file, 26, SEEK_CUR);
     readProgrammableFills(file, pattern);
     readMotifPatterns(file, pattern);
     readFeatherPatterns(file, pattern);
@@ -5134,13 +6617,13 @@ readPESHeaderV8(FILE* file, EmbPattern* pattern)
 }
 
 void
-readPESHeaderV9(FILE* file, EmbPattern* pattern)
+readPESHeaderV9(EmbStream* file, EmbPattern* pattern)
 {
-    fseek(file, 14, SEEK_CUR);
+    emb_fseek(file, 14, SEEK_CUR);
     readHoopName(file, pattern);
-    fseek(file, 30, SEEK_CUR);
+    emb_fseek(file, 30, SEEK_CUR);
     readImageString(file, pattern);
-    fseek(file, 34, SEEK_CUR);
+    emb_fseek(file, 34, SEEK_CUR);
     readProgrammableFills(file, pattern);
     readMotifPatterns(file, pattern);
     readFeatherPatterns(file, pattern);
@@ -5148,13 +6631,13 @@ readPESHeaderV9(FILE* file, EmbPattern* pattern)
 }
 
 void
-readPESHeaderV10(FILE* file, EmbPattern* pattern)
+readPESHeaderV10(EmbStream* file, EmbPattern* pattern)
 {
-    fseek(file, 14, SEEK_CUR);
+    emb_fseek(file, 14, SEEK_CUR);
     readHoopName(file, pattern);
-    fseek(file, 38, SEEK_CUR);
+    emb_fseek(file, 38, SEEK_CUR);
     readImageString(file, pattern);
-    fseek(file, 34, SEEK_CUR);
+    emb_fseek(file, 34, SEEK_CUR);
     readProgrammableFills(file, pattern);
     readMotifPatterns(file, pattern);
     readFeatherPatterns(file, pattern);
@@ -5162,13 +6645,13 @@ readPESHeaderV10(FILE* file, EmbPattern* pattern)
 }
 
 void
-readHoopName(FILE* file, EmbPattern* pattern)
+readHoopName(EmbStream* file, EmbPattern* pattern)
 {
-    if (emb_verbose > 1) {
+    if (pattern->context->verbose > 1) {
         printf("Called with: (%p, %p)", (void*)file, (void*)pattern);
     }
     /*
-    int hoopNameStringLength = fgetc(file);
+    int hoopNameStringLength = emb_fgetc(file);
     EmbString hoopNameString = readString(hoopNameStringLength);
     if (hoopNameString.length() != 0) {
         pattern.setMetadata("hoop_name", hoopNameString);
@@ -5177,13 +6660,13 @@ readHoopName(FILE* file, EmbPattern* pattern)
 }
 
 void
-readImageString(FILE* file, EmbPattern* pattern)
+readImageString(EmbStream* file, EmbPattern* pattern)
 {
-    if (emb_verbose > 1) {
+    if (pattern->context->verbose > 1) {
         printf("Called with: (%p, %p)", (void*)file, (void*)pattern);
     }
     /*
-    int fromImageStringLength = fgetc(file);
+    int fromImageStringLength = emb_fgetc(file);
     EmbString fromImageString = readString(fromImageStringLength);
     if (fromImageString.length() != 0) {
         pattern.setMetadata("image_file", fromImageString);
@@ -5192,10 +6675,10 @@ readImageString(FILE* file, EmbPattern* pattern)
 }
 
 void
-readProgrammableFills(FILE* file, EmbPattern* pattern)
+readProgrammableFills(EmbStream* file, EmbPattern* pattern)
 {
     int numberOfProgrammableFillPatterns;
-    if (emb_verbose > 1) {
+    if (pattern->context->verbose > 1) {
         printf("Called with: (%p, %p)", (void*)file, (void*)pattern);
     }
     numberOfProgrammableFillPatterns = emb_read_i16(file);
@@ -5205,10 +6688,10 @@ readProgrammableFills(FILE* file, EmbPattern* pattern)
 }
 
 void
-readMotifPatterns(FILE* file, EmbPattern* pattern)
+readMotifPatterns(EmbStream* file, EmbPattern* pattern)
 {
     int numberOfMotifPatterns;
-    if (emb_verbose > 1) {
+    if (pattern->context->verbose > 1) {
         printf("Called with: (%p, %p)", (void*)file, (void*)pattern);
     }
     numberOfMotifPatterns = emb_read_i16(file);
@@ -5218,10 +6701,10 @@ readMotifPatterns(FILE* file, EmbPattern* pattern)
 }
 
 void
-readFeatherPatterns(FILE* file, EmbPattern* pattern)
+readFeatherPatterns(EmbStream* file, EmbPattern* pattern)
 {
     int featherPatternCount;
-    if (emb_verbose > 1) {
+    if (pattern->context->verbose > 1) {
         printf("Called with: (%p, %p)", (void*)file, (void*)pattern);
     }
     featherPatternCount = emb_read_i16(file);
@@ -5231,10 +6714,10 @@ readFeatherPatterns(FILE* file, EmbPattern* pattern)
 }
 
 void
-readThreads(FILE* file, EmbPattern* pattern)
+readThreads(EmbStream* file, EmbPattern* pattern)
 {
     int numberOfColors, i;
-    if (emb_verbose > 1) {
+    if (pattern->context->verbose > 1) {
         printf("Called with: (%p, %p)", (void*)file, (void*)pattern);
     }
     numberOfColors = emb_read_i16(file);
@@ -5244,22 +6727,22 @@ readThreads(FILE* file, EmbPattern* pattern)
         int descriptionStringLength;
         int brandStringLength;
         int threadChartStringLength;
-        color_code_length = fgetc(file);
+        color_code_length = emb_fgetc(file);
         /* strcpy(thread.color_code, readString(color_code_length)); */
-        thread.color.r = fgetc(file);
-        thread.color.g = fgetc(file);
-        thread.color.b = fgetc(file);
-        fseek(file, 5, SEEK_CUR);
-        descriptionStringLength = fgetc(file);
+        thread.color.r = emb_fgetc(file);
+        thread.color.g = emb_fgetc(file);
+        thread.color.b = emb_fgetc(file);
+        emb_fseek(file, 5, SEEK_CUR);
+        descriptionStringLength = emb_fgetc(file);
         /* strcpy(thread.description, readString(descriptionStringLength)); */
 
-        brandStringLength = fgetc(file);
+        brandStringLength = emb_fgetc(file);
         /* strcpy(thread.brand, readString(brandStringLength)); */
 
-        threadChartStringLength = fgetc(file);
+        threadChartStringLength = emb_fgetc(file);
         /* strcpy(thread.threadChart, readString(threadChartStringLength)); */
 
-        if (emb_verbose > 1) {
+        if (pattern->context->verbose > 1) {
             printf("color code length: %d\n", color_code_length);
             printf("description string length: %d\n", descriptionStringLength);
             printf("brand string length: %d\n", brandStringLength);
@@ -5271,7 +6754,7 @@ readThreads(FILE* file, EmbPattern* pattern)
 
 
 void
-pesWriteSewSegSection(EmbPattern* pattern, FILE* file)
+pesWriteSewSegSection(EmbPattern* pattern, EmbStream* file)
 {
     /* TODO: pointer safety */
     short* colorInfo = 0;
@@ -5314,7 +6797,7 @@ pesWriteSewSegSection(EmbPattern* pattern, FILE* file)
     emb_write_i16(file, 0x00);
 
     emb_write_i16(file, 0x07); /* string length */
-    fwrite("CSewSeg", 1, 7, file);
+    emb_fwrite("CSewSeg", 1, 7, file);
 
     if (colorCount > 1000) {
         puts("Color count exceeds 1000 this is likely an error. Truncating to 1000.");
@@ -5381,14 +6864,14 @@ pesWriteSewSegSection(EmbPattern* pattern, FILE* file)
 }
 
 void
-pesWriteEmbOneSection(EmbPattern* pattern, FILE* file)
+pesWriteEmbOneSection(EmbPattern* pattern, EmbStream* file)
 {
     /* TODO: pointer safety */
     //float x, width, height;
     int hoopHeight = 1800, hoopWidth = 1300;
     EmbRect bounds;
     emb_write_i16(file, 0x07); /* string length */
-    fwrite("CEmbOne", 1, 7, file);
+    emb_fwrite("CEmbOne", 1, 7, file);
     bounds = emb_pattern_bounds(pattern);
 
     fpad(file, 0, 16);
@@ -5412,12 +6895,12 @@ pesWriteEmbOneSection(EmbPattern* pattern, FILE* file)
 }
 
 char
-writePes(EmbPattern* pattern,  const char *fileName, FILE* file)
+writePes(EmbPattern* pattern,  const char *fileName, EmbStream* file)
 {
     int pecLocation;
     emb_pattern_flipVertical(pattern);
     emb_pattern_scale(pattern, 10.0);
-    fwrite("#PES0001", 1, 8, file);
+    emb_fwrite("#PES0001", 1, 8, file);
     /* WRITE PECPointer 32 bit int */
     emb_write_i32(file, 0x00);
 
@@ -5432,12 +6915,12 @@ writePes(EmbPattern* pattern,  const char *fileName, FILE* file)
     pesWriteEmbOneSection(pattern, file);
     pesWriteSewSegSection(pattern, file);
 
-    pecLocation = ftell(file);
-    fseek(file, 0x08, SEEK_SET);
-    fputc((unsigned char)(pecLocation & 0xFF), file);
-    fputc((unsigned char)(pecLocation >> 8) & 0xFF, file);
-    fputc((unsigned char)(pecLocation >> 16) & 0xFF, file);
-    fseek(file, 0x00, SEEK_END);
+    pecLocation = emb_ftell(file);
+    emb_fseek(file, 0x08, SEEK_SET);
+    emb_fputc((unsigned char)(pecLocation & 0xFF), file);
+    emb_fputc((unsigned char)(pecLocation >> 8) & 0xFF, file);
+    emb_fputc((unsigned char)(pecLocation >> 16) & 0xFF, file);
+    emb_fseek(file, 0x00, SEEK_END);
     writePecStitches(pattern, file, fileName);
     return 1;
 }
@@ -5448,43 +6931,43 @@ writePes(EmbPattern* pattern,  const char *fileName, FILE* file)
  */
 
 char
-readPhb(EmbPattern* pattern, FILE* file)
+readPhb(EmbPattern* pattern, EmbStream* file)
 {
     unsigned int fileOffset;
     short colorCount;
     int i;
 
-    fseek(file, 0x71, SEEK_SET);
+    emb_fseek(file, 0x71, SEEK_SET);
     colorCount = emb_read_i16(file);
 
     for (i = 0; i < colorCount; i++) {
-        EmbThread t = pec_colors[fgetc(file)];
+        EmbThread t = pec_colors[emb_fgetc(file)];
         emb_pattern_addThread(pattern, t);
     }
 
     /* TODO: check that file begins with #PHB */
-    fseek(file, 0x54, SEEK_SET);
+    emb_fseek(file, 0x54, SEEK_SET);
     fileOffset = 0x52;
     fileOffset += emb_read_i32(file);
 
-    fseek(file, fileOffset, SEEK_SET);
+    emb_fseek(file, fileOffset, SEEK_SET);
     fileOffset += emb_read_i32(file) + 2;
 
-    fseek(file, fileOffset, SEEK_SET);
+    emb_fseek(file, fileOffset, SEEK_SET);
     fileOffset += emb_read_i32(file);
 
-    fseek(file, fileOffset + 14, SEEK_SET); /* 28 */
+    emb_fseek(file, fileOffset + 14, SEEK_SET); /* 28 */
 
-    colorCount = (int16_t)(char)fgetc(file);
+    colorCount = (int16_t)(char)emb_fgetc(file);
     for (i = 0; i <  colorCount; i++) {
         char stor;
-        stor = (char)fgetc(file);
-        if (emb_verbose>1) {
+        stor = (char)emb_fgetc(file);
+        if (pattern->context->verbose>1) {
             printf("stor: %d\n", stor);
         }
     }
-    fseek(file, 4, SEEK_CUR); /* bytes to end of file */
-    fseek(file, 17, SEEK_CUR);
+    emb_fseek(file, 4, SEEK_CUR); /* bytes to end of file */
+    emb_fseek(file, 17, SEEK_CUR);
 
     readPecStitches(pattern, file);
 
@@ -5493,10 +6976,10 @@ readPhb(EmbPattern* pattern, FILE* file)
 }
 
 char
-writePhb(EmbPattern* pattern, FILE* file)
+writePhb(EmbPattern* pattern, EmbStream* file)
 {
     puts("ERROR: writePhb is not implemented.");
-    if (emb_verbose > 1) {
+    if (pattern->context->verbose > 1) {
         printf("Called with %p %p\n", (void*)pattern, (void*)file);
     }
     return 0; /*TODO: finish writePhb */
@@ -5508,7 +6991,7 @@ writePhb(EmbPattern* pattern, FILE* file)
  */
 
 char
-readPhc(EmbPattern* pattern, FILE* file)
+readPhc(EmbPattern* pattern, EmbStream* file)
 {
     int colorChanges, version, bytesInSection2;
     unsigned int fileLength;
@@ -5516,28 +6999,28 @@ readPhc(EmbPattern* pattern, FILE* file)
     char pecAdd;
     int i;
 
-    fseek(file, 0x07, SEEK_SET);
-    version = (char)fgetc(file) - 0x30; /* converting from ansi number */
-    fseek(file, 0x4D, SEEK_SET);
+    emb_fseek(file, 0x07, SEEK_SET);
+    version = (char)emb_fgetc(file) - 0x30; /* converting from ansi number */
+    emb_fseek(file, 0x4D, SEEK_SET);
     LOAD_U16(file, colorChanges)
 
     for (i = 0; i < colorChanges; i++) {
-        EmbThread t = pec_colors[(int)(char)fgetc(file)];
+        EmbThread t = pec_colors[(int)(char)emb_fgetc(file)];
         emb_pattern_addThread(pattern, t);
     }
-    fseek(file, 0x2B, SEEK_SET);
-    pecAdd = (char)fgetc(file);
+    emb_fseek(file, 0x2B, SEEK_SET);
+    pecAdd = (char)emb_fgetc(file);
     LOAD_I32(file, fileLength)
     LOAD_U16(file, pecOffset)
-    fseek(file, pecOffset + pecAdd, SEEK_SET);
+    emb_fseek(file, pecOffset + pecAdd, SEEK_SET);
     LOAD_U16(file, bytesInSection)
-    fseek(file, bytesInSection, SEEK_CUR);
+    emb_fseek(file, bytesInSection, SEEK_CUR);
     bytesInSection2 = emb_read_i32(file);
-    fseek(file, bytesInSection2, SEEK_CUR);
+    emb_fseek(file, bytesInSection2, SEEK_CUR);
     LOAD_U16(file, bytesInSection3)
-    fseek(file, bytesInSection3 + 0x12, SEEK_CUR);
+    emb_fseek(file, bytesInSection3 + 0x12, SEEK_CUR);
 
-    if (emb_verbose>1) {
+    if (pattern->context->verbose>1) {
         printf("version: %d\n", version);
     }
 
@@ -5548,10 +7031,10 @@ readPhc(EmbPattern* pattern, FILE* file)
 }
 
 char
-writePhc(EmbPattern* pattern, FILE* file)
+writePhc(EmbPattern* pattern, EmbStream* file)
 {
     puts("ERROR: writePhc is not implemented.");
-    if (emb_verbose > 1) {
+    if (pattern->context->verbose > 1) {
         printf("Called with %p %p\n", (void*)pattern, (void*)file);
     }
     return 0; /*TODO: finish writePhc */
@@ -5561,43 +7044,65 @@ writePhc(EmbPattern* pattern, FILE* file)
  * AutoCAD Embroidery Format (.plt)
  * The AutoCAD plt format is stitch-only.
  */
-char
-readPlt(EmbPattern* pattern, FILE* file)
+/* Parses a PD (pen down) or PU (pen up) command into an EmbStitch,
+ * skipping the other commands.
+ */
+static int
+pltParseCommand(const char *line, size_t length, void *record)
 {
-    EmbReal x, y;
     EmbReal scalingFactor = 40;
-    char input[512];
+    EmbStitch *st = (EmbStitch*)record;
+    const char *p = line, *end = line + length, *q;
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+    if (end - p < 2 || p[0] != 'P' || (p[1] != 'D' && p[1] != 'U')) {
+        return EMB_LINE_SKIP;
+    }
+    st->flags = (p[1] == 'D') ? NORMAL : STOP;
+    st->color = 0;
+    q = emb_parse_real(p + 2, end, &st->x);
+    if (q == p + 2 || q >= end || *q != ',') {
+        return EMB_LINE_STOP;
+    }
+    p = q + 1;
+    if (emb_parse_real(p, end, &st->y) == p) {
+        return EMB_LINE_STOP;
+    }
+    st->x /= scalingFactor;
+    st->y /= scalingFactor;
+    return EMB_LINE_RECORD;
+}
 
-    /* TODO: replace all scanf code */
-    while (emb_readline(file, input, 511)) {
-        if (input[0] == 'P' && input[1] == 'D') {
-            /* TODO: replace all scanf code */
-            if (sscanf(input, "PD%f,%f;", &x, &y) < 2) {
-                break;
-            }
-            emb_pattern_addStitchAbs(pattern, x / scalingFactor,
-                            y / scalingFactor, NORMAL, 1);
-        } else if (input[0] == 'P' && input[1] == 'U') {
-            /* TODO: replace all scanf code */
-            if (sscanf(input, "PU%f,%f;", &x, &y) < 2) {
-                break;
-            }
-            emb_pattern_addStitchAbs(pattern, x / scalingFactor,
-                    y / scalingFactor, STOP, 1);
-        }
+char
+readPlt(EmbPattern* pattern, EmbStream* file)
+{
+    EmbStitch *stitches;
+    int count, i;
+
+    /* Commands end with ';' and may share a line. */
+    if (!emb_stream_parse_lines(file, pltParseCommand, sizeof(EmbStitch), ';',
+        (void**)&stitches, &count)) {
+        return 0;
+    }
+    emb_pattern_reserve_stitches(pattern, count);
+    for (i = 0; i < count; i++) {
+        emb_pattern_addStitchAbs(pattern, stitches[i].x, stitches[i].y,
+            stitches[i].flags, 1);
     }
+    safe_free(stitches);
     return 1;
 }
 
 char
-writePlt(EmbPattern* pattern, FILE* file) {
+writePlt(EmbPattern* pattern, EmbStream* file) {
     /* TODO: pointer safety */
     EmbReal scalingFactor = 40;
     char firstStitchOfBlock = 1;
     int i;
 
-    fprintf(file, "IN;");
-    fprintf(file, "ND;");
+    emb_fprintf(file, "IN;");
+    emb_fprintf(file, "ND;");
 
     for (i = 0; i < pattern->stitch_list->count; i++) {
         EmbStitch stitch;
@@ -5606,22 +7111,28 @@ writePlt(EmbPattern* pattern, FILE* file) {
             firstStitchOfBlock = 1;
         }
         if (firstStitchOfBlock) {
-            fprintf(file, "PU%f,%f;", stitch.x * scalingFactor,
-                    stitch.y * scalingFactor);
-            fprintf(file, "ST0.00,0.00;");
-            fprintf(file, "SP0;");
-            fprintf(file, "HT0;");
-            fprintf(file, "HS0;");
-            fprintf(file, "TT0;");
-            fprintf(file, "TS0;");
+            emb_fputs("PU", file);
+            emb_write_real(file, stitch.x * scalingFactor);
+            emb_fputc(',', file);
+            emb_write_real(file, stitch.y * scalingFactor);
+            emb_fputc(';', file);
+            emb_fprintf(file, "ST0.00,0.00;");
+            emb_fprintf(file, "SP0;");
+            emb_fprintf(file, "HT0;");
+            emb_fprintf(file, "HS0;");
+            emb_fprintf(file, "TT0;");
+            emb_fprintf(file, "TS0;");
             firstStitchOfBlock = 0;
         } else {
-            fprintf(file, "PD%f,%f;", stitch.x * scalingFactor,
-                stitch.y * scalingFactor);
+            emb_fputs("PD", file);
+            emb_write_real(file, stitch.x * scalingFactor);
+            emb_fputc(',', file);
+            emb_write_real(file, stitch.y * scalingFactor);
+            emb_fputc(';', file);
         }
     }
-    fprintf(file, "PU0.0,0.0;");
-    fprintf(file, "PU0.0,0.0;");
+    emb_fprintf(file, "PU0.0,0.0;");
+    emb_fprintf(file, "PU0.0,0.0;");
     return 1; /*TODO: finish WritePlt */
 }
 
@@ -5630,30 +7141,30 @@ writePlt(EmbPattern* pattern, FILE* file) {
  * The RGB format is a color-only format to act as an external color file for other formats.
  */
 char
-readRgb(EmbPattern* pattern, FILE* file)
+readRgb(EmbPattern* pattern, EmbStream* file)
 {
     int i, numberOfColors;
 
-    fseek(file, 0x00, SEEK_END);
-    numberOfColors = ftell(file) / 4;
+    emb_fseek(file, 0x00, SEEK_END);
+    numberOfColors = emb_ftell(file) / 4;
 
     pattern->thread_list->count = 0;
 
     printf("numberOfColors: %d\n", numberOfColors);
 
-    fseek(file, 0x00, SEEK_SET);
+    emb_fseek(file, 0x00, SEEK_SET);
     for (i = 0; i < numberOfColors; i++) {
         EmbThread t;
         embColor_read(file, &(t.color), 4);
-        strcpy(t.catalogNumber, "");
-        strcpy(t.description, "");
+        t.catalogNumber = "";
+        t.description = "";
         emb_pattern_addThread(pattern, t);
     }
     return 1;
 }
 
 char
-writeRgb(EmbPattern* pattern, FILE* file)
+writeRgb(EmbPattern* pattern, EmbStream* file)
 {
     int i;
     for (i = 0; i < pattern->thread_list->count; i++) {
@@ -5676,27 +7187,29 @@ sewDecode(unsigned char inputByte)
 }
 
 char
-readSew(EmbPattern* pattern, FILE* file)
+readSew(EmbPattern* pattern, EmbStream* file)
 {
+    EmbStitchBatch batch;
     int i, flags, numberOfColors, fileLength;
     char dx, dy, thisStitchIsJump = 0;
 
-    fseek(file, 0x00, SEEK_END);
-    fileLength = ftell(file);
-    fseek(file, 0x00, SEEK_SET);
-    numberOfColors = fgetc(file);
-    numberOfColors += (fgetc(file) << 8);
+    emb_fseek(file, 0x00, SEEK_END);
+    fileLength = emb_ftell(file);
+    emb_fseek(file, 0x00, SEEK_SET);
+    numberOfColors = emb_fgetc(file);
+    numberOfColors += (emb_fgetc(file) << 8);
 
 
     for (i = 0; i < numberOfColors; i++) {
         int color = emb_read_i16(file);
         emb_pattern_addThread(pattern, jef_colors[color%78]);
     }
-    fseek(file, 0x1D78, SEEK_SET);
+    emb_fseek(file, 0x1D78, SEEK_SET);
 
-    for (i = 0; ftell(file) < fileLength; i++) {
+    emb_stitch_batch_init(&batch, pattern);
+    for (i = 0; emb_ftell(file) < fileLength; i++) {
         unsigned char b[2];
-        fread(b, 1, 2, file);
+        emb_fread(b, 1, 2, file);
 
         flags = NORMAL;
         if (thisStitchIsJump) {
@@ -5705,12 +7218,12 @@ readSew(EmbPattern* pattern, FILE* file)
         }
         if (b[0] == 0x80) {
             if (b[1] == 1) {
-                fread(b, 1, 2, file);
+                emb_fread(b, 1, 2, file);
                 flags = STOP;
             }
             else if ((b[1] == 0x02) || (b[1] == 0x04)) {
                 thisStitchIsJump = 1;
-                fread(b, 1, 2, file);
+                emb_fread(b, 1, 2, file);
                 flags = TRIM;
             }
             else if (b[1] == 0x10) {
@@ -5723,20 +7236,21 @@ readSew(EmbPattern* pattern, FILE* file)
             thisStitchIsJump = 1;
             flags = TRIM;
         }
-        emb_pattern_addStitchRel(pattern, dx / 10.0, dy / 10.0, flags, 1);
+        emb_stitch_batch_rel(&batch, dx / 10.0, dy / 10.0, flags);
     }
-    printf("current position: %ld\n", ftell(file));
+    printf("current position: %ld\n", emb_ftell(file));
+    emb_stitch_batch_flush(&batch);
     return 1;
 }
 
 char
-writeSew(EmbPattern* pattern, FILE* file)
+writeSew(EmbPattern* pattern, EmbStream* file)
 {
     int i;
     EmbReal xx = 0.0, yy = 0.0;
     emb_write_i16(file, pattern->thread_list->count);
 
-    if (emb_verbose>1) {
+    if (pattern->context->verbose>1) {
         printf("Debugging Information\n");
         printf("number of colors = %d\n", pattern->thread_list->count);
         printf("number of stitches = %d\n", pattern->stitch_list->count);
@@ -5765,26 +7279,26 @@ writeSew(EmbPattern* pattern, FILE* file)
             b[1] = 0x01;
             b[2] = dx;
             b[3] = dy;
-            fwrite(b, 1, 4, file);
+            emb_fwrite(b, 1, 4, file);
         }
         else if (st.flags & END) {
             b[0] = 0x80;
             b[1] = 0x10;
             b[2] = 0;
             b[3] = 0;
-            fwrite(b, 1, 4, file);
+            emb_fwrite(b, 1, 4, file);
         }
         else if ((st.flags & TRIM) || (st.flags & JUMP)) {
             b[0] = 0x80;
             b[1] = 2;
             b[2] = dx;
             b[3] = dy;
-            fwrite(b, 1, 4, file);
+            emb_fwrite(b, 1, 4, file);
         }
         else {
             b[0] = dx;
             b[1] = dy;
-            fwrite(b, 1, 2, file);
+            emb_fwrite(b, 1, 2, file);
         }
     }
     return 1;
@@ -5812,8 +7326,9 @@ short shvDecodeShort(unsigned short inputByte)
 }
 
 char
-readShv(EmbPattern* pattern, FILE* file)
+readShv(EmbPattern* pattern, EmbStream* file)
 {
+    EmbStitchBatch batch;
     int i;
     char inJump = 0;
     unsigned char fileNameLength, designWidth, designHeight;
@@ -5834,24 +7349,24 @@ readShv(EmbPattern* pattern, FILE* file)
         return 0;
     }
 
-    fseek(file, strlen(headerText), SEEK_SET);
-    fileNameLength = fgetc(file);
-    fseek(file, fileNameLength, SEEK_CUR);
-    designWidth = fgetc(file);
-    designHeight = fgetc(file);
+    emb_fseek(file, strlen(headerText), SEEK_SET);
+    fileNameLength = emb_fgetc(file);
+    emb_fseek(file, fileNameLength, SEEK_CUR);
+    designWidth = emb_fgetc(file);
+    designHeight = emb_fgetc(file);
     LOAD_I8(file, halfDesignWidth)
     LOAD_I8(file, halfDesignHeight)
     LOAD_I8(file, halfDesignWidth2)
     LOAD_I8(file, halfDesignHeight2)
     if ((designHeight % 2) == 1) {
-        fseek(file, ((designHeight + 1)*designWidth)/2, SEEK_CUR);
+        emb_fseek(file, ((designHeight + 1)*designWidth)/2, SEEK_CUR);
     }
     else {
-        fseek(file, (designHeight*designWidth)/2, SEEK_CUR);
+        emb_fseek(file, (designHeight*designWidth)/2, SEEK_CUR);
     }
-    numberOfColors = fgetc(file);
+    numberOfColors = emb_fgetc(file);
     LOAD_U16(file, magicCode)
-    fseek(file, 1, SEEK_CUR);
+    emb_fseek(file, 1, SEEK_CUR);
     LOAD_I32(file, something)
     LOAD_I16(file, left)
     LOAD_U16(file, top)
@@ -5865,25 +7380,26 @@ readShv(EmbPattern* pattern, FILE* file)
     for (i = 0; i < numberOfColors; i++) {
         unsigned int stitchCount, colorNumber;
         stitchCount = emb_read_i32be(file);
-        colorNumber = fgetc(file);
+        colorNumber = emb_fgetc(file);
         emb_pattern_addThread(pattern, shv_colors[colorNumber % 43]);
         stitchesPerColor[i] = stitchCount;
-        fseek(file, 9, SEEK_CUR);
+        emb_fseek(file, 9, SEEK_CUR);
     }
 
-    fseek(file, -2, SEEK_CUR);
+    emb_fseek(file, -2, SEEK_CUR);
 
-    for (i = 0; !feof(file); i++) {
+    emb_stitch_batch_init(&batch, pattern);
+    for (i = 0; !emb_feof(file); i++) {
         unsigned char b0, b1;
         int flags;
         flags = NORMAL;
         if (inJump) {
             flags = JUMP;
         }
-        b0 = fgetc(file);
-        b1 = fgetc(file);
+        b0 = emb_fgetc(file);
+        b1 = emb_fgetc(file);
         if (stitchesSinceChange >= stitchesPerColor[currColorIndex]) {
-            emb_pattern_addStitchRel(pattern, 0, 0, STOP, 1);
+            emb_stitch_batch_rel(&batch, 0, 0, STOP);
             currColorIndex++;
             stitchesSinceChange = 0;
         }
@@ -5898,31 +7414,32 @@ readShv(EmbPattern* pattern, FILE* file)
             }
             else if (b1 == 0x01) {
                 stitchesSinceChange += 2;
-                sx = fgetc(file);
-                sx = (unsigned short)(sx << 8 | fgetc(file));
-                sy = fgetc(file);
-                sy = (unsigned short)(sy << 8 | fgetc(file));
+                sx = emb_fgetc(file);
+                sx = (unsigned short)(sx << 8 | emb_fgetc(file));
+                sy = emb_fgetc(file);
+                sy = (unsigned short)(sy << 8 | emb_fgetc(file));
                 flags = TRIM;
                 inJump = 1;
-                emb_pattern_addStitchRel(pattern, shvDecodeShort(sx) / 10.0, shvDecodeShort(sy) / 10.0, flags, 1);
+                emb_stitch_batch_rel(&batch, shvDecodeShort(sx) / 10.0, shvDecodeShort(sy) / 10.0, flags);
                 continue;
             }
         }
         dx = shvDecode(b0);
         dy = shvDecode(b1);
     stitchesSinceChange++;
-        emb_pattern_addStitchRel(pattern, dx / 10.0, dy / 10.0, flags, 1);
+        emb_stitch_batch_rel(&batch, dx / 10.0, dy / 10.0, flags);
     }
+    emb_stitch_batch_flush(&batch);
     emb_pattern_flipVertical(pattern);
 
     return 1;
 }
 
 char
-writeShv(EmbPattern* pattern, FILE* file)
+writeShv(EmbPattern* pattern, EmbStream* file)
 {
     puts("writeShv not implemented.");
-    if (emb_verbose > 1) {
+    if (pattern->context->verbose > 1) {
         printf("Called with %p %p\n", (void*)pattern, (void*)file);
     }
     return 0; /*TODO: finish writeShv */
@@ -5933,22 +7450,24 @@ writeShv(EmbPattern* pattern, FILE* file)
  * The Sunstar sst format is stitch-only.
  */
 char
-readSst(EmbPattern* pattern, FILE* file)
+readSst(EmbPattern* pattern, EmbStream* file)
 {
+    EmbStitchBatch batch;
     int fileLength;
 
-    fseek(file, 0, SEEK_END);
-    fileLength = ftell(file);
-    fseek(file, 0xA0, SEEK_SET); /* skip the all zero header */
-    while (ftell(file) < fileLength) {
+    emb_fseek(file, 0, SEEK_END);
+    fileLength = emb_ftell(file);
+    emb_fseek(file, 0xA0, SEEK_SET); /* skip the all zero header */
+    emb_stitch_batch_init(&batch, pattern);
+    while (emb_ftell(file) < fileLength) {
         int stitchType = NORMAL;
 
-        int b1 = fgetc(file);
-        int b2 = fgetc(file);
-        unsigned char commandByte = (unsigned char)fgetc(file);
+        int b1 = emb_fgetc(file);
+        int b2 = emb_fgetc(file);
+        unsigned char commandByte = (unsigned char)emb_fgetc(file);
 
         if (commandByte == 0x04) {
-            emb_pattern_addStitchRel(pattern, 0, 0, END, 1);
+            emb_stitch_batch_rel(&batch, 0, 0, END);
             break;
         }
 
@@ -5960,19 +7479,20 @@ readSst(EmbPattern* pattern, FILE* file)
             b2 = -b2;
         if ((commandByte & 0x40) == 0x40)
             b1 = -b1;
-        emb_pattern_addStitchRel(pattern, b1 / 10.0, b2 / 10.0, stitchType, 1);
+        emb_stitch_batch_rel(&batch, b1 / 10.0, b2 / 10.0, stitchType);
     }
 
+    emb_stitch_batch_flush(&batch);
     return 1; /*TODO: finish readSst */
 }
 
 char
-writeSst(EmbPattern* pattern, FILE* file)
+writeSst(EmbPattern* pattern, EmbStream* file)
 {
     int i;
     int head_length = 0xA0;
     for (i=0; i<head_length; i++) {
-        fprintf(file, " ");
+        emb_fprintf(file, " ");
     }
     for (i=0; i<pattern->stitch_list->count; i++) {
         printf(".");
@@ -5985,7 +7505,7 @@ writeSst(EmbPattern* pattern, FILE* file)
  * The Data Stitch stx format is stitch-only.
  */
 int
-stxReadThread(StxThread* thread, FILE* file)
+stxReadThread(StxThread* thread, EmbStream* file, EmbPattern* pattern)
 {
     int j, colorNameLength, sectionNameLength;
     int somethingSomething, somethingSomething2, somethingElse, numberOfOtherDescriptors; /* TODO: determine what these represent */
@@ -6001,38 +7521,38 @@ stxReadThread(StxThread* thread, FILE* file)
     }
     if (!file) { printf("ERROR: format-stx.c stxReadThread(), file argument is null\n"); return 0; }
 
-    codeLength = fgetc(file);
+    codeLength = emb_fgetc(file);
     codeBuff = (char*)malloc(codeLength);
     if (!codeBuff) {
         printf("ERROR: format-stx.c stxReadThread(), unable to allocate memory for codeBuff\n");
         return 0;
     }
     /* TODO: check return value */
-    fread(codeBuff, 1, codeLength, file);
+    emb_fread(codeBuff, 1, codeLength, file);
     thread->colorCode = codeBuff;
-    colorNameLength = fgetc(file);
+    colorNameLength = emb_fgetc(file);
     codeNameBuff = (char*)malloc(colorNameLength);
     if (!codeNameBuff) {
         printf("ERROR: format-stx.c stxReadThread(), unable to allocate memory for codeNameBuff\n");
         return 0;
     }
-    fread((unsigned char*)codeNameBuff, 1, colorNameLength, file); /* TODO: check return value */
+    emb_fread((unsigned char*)codeNameBuff, 1, colorNameLength, file); /* TODO: check return value */
     thread->colorName = codeNameBuff;
 
     embColor_read(file, &col, 4);
-    if (emb_verbose>1) {
+    if (pattern->context->verbose>1) {
         printf("col red: %d\n", col.r);
         printf("col green: %d\n", col.g);
         printf("col blue: %d\n", col.b);
     }
 
-    sectionNameLength = fgetc(file);
+    sectionNameLength = emb_fgetc(file);
     sectionNameBuff = (char*)malloc(sectionNameLength);
     if (!sectionNameBuff) {
         printf("ERROR: format-stx.c stxReadThread(), unable to allocate memory for sectionNameBuff\n");
         return 0;
     }
-    fread((unsigned char*)sectionNameBuff, 1, sectionNameLength, file); /* TODO: check return value */
+    emb_fread((unsigned char*)sectionNameBuff, 1, sectionNameLength, file); /* TODO: check return value */
     thread->sectionName = sectionNameBuff;
 
     LOAD_I32(file, somethingSomething)
@@ -6053,21 +7573,21 @@ stxReadThread(StxThread* thread, FILE* file)
         sd.someNum = emb_read_i16(file);
         /* Debug.Assert(sd.someNum == 1); TODO: review */
         sd.someInt = emb_read_i32(file);
-        subCodeLength = fgetc(file);
+        subCodeLength = emb_fgetc(file);
         subCodeBuff = (char*)malloc(subCodeLength);
         if (!subCodeBuff) {
             printf("ERROR: format-stx.c stxReadThread(), unable to allocate memory for subCodeBuff\n");
             return 0;
         }
-        fread((unsigned char*)subCodeBuff, 1, subCodeLength, file); /* TODO: check return value */
+        emb_fread((unsigned char*)subCodeBuff, 1, subCodeLength, file); /* TODO: check return value */
         sd.colorCode = subCodeBuff;
-        subColorNameLength = fgetc(file);
+        subColorNameLength = emb_fgetc(file);
         subColorNameBuff = (char*)malloc(subColorNameLength);
         if (!subColorNameBuff) {
             printf("ERROR: format-stx.c stxReadThread(), unable to allocate memory for subColorNameBuff\n");
             return 0;
         }
-        fread((unsigned char*)subColorNameBuff, 1, subColorNameLength, file); /* TODO: check return value */
+        emb_fread((unsigned char*)subColorNameBuff, 1, subColorNameLength, file); /* TODO: check return value */
         sd.colorName = subColorNameBuff;
         sd.someOtherInt = emb_read_i32(file);
         thread->subDescriptors[j] = sd;
@@ -6076,8 +7596,9 @@ stxReadThread(StxThread* thread, FILE* file)
 }
 
 char
-readStx(EmbPattern* pattern, FILE* file)
+readStx(EmbPattern* pattern, EmbStream* file)
 {
+    EmbStitchBatch batch;
     int i, threadCount;
     unsigned char* gif = 0;
     /* public Bitmap Image; */
@@ -6109,8 +7630,8 @@ readStx(EmbPattern* pattern, FILE* file)
     filetype[3] = '\0';
     version[4] = '\0';
     /* byte 14 */
-    stor = (char)fgetc(file);
-    if (emb_verbose>1) {
+    stor = (char)emb_fgetc(file);
+    if (pattern->context->verbose>1) {
         printf("stor: %d\n", stor);
     }
 
@@ -6149,46 +7670,47 @@ readStx(EmbPattern* pattern, FILE* file)
     for (i = 0; i < threadCount; i++) {
         EmbThread t;
         StxThread st;
-        stxReadThread(&st, file);
+        stxReadThread(&st, file, pattern);
 
         t.color = st.stxColor;
-        strcpy(t.description, st.colorName);
-        strcpy(t.catalogNumber, st.colorCode);
+        t.description = st.colorName;
+        t.catalogNumber = st.colorCode;
         emb_pattern_addThread(pattern, t);
         stxThreads[i] = st;
     }
 
-    fseek(file, 15, SEEK_CUR);
+    emb_fseek(file, 15, SEEK_CUR);
 
     for (i = 0; i < 12; i++) {
         val[i] = emb_read_i16(file);
-        if (emb_verbose>1) {
+        if (pattern->context->verbose>1) {
             printf("identify val[%d] = %d", i, val[i]);
         }
     }
-    if (emb_verbose>1) {
+    if (pattern->context->verbose>1) {
         puts("val[4] == val[5] == 0");
         puts("val[10] == val[11] == 0");
     }
-    fseek(file, 8, SEEK_CUR); /* 0 0 */
+    emb_fseek(file, 8, SEEK_CUR); /* 0 0 */
     /* br.BaseStream.Position = stitchDataOffset; TODO: review */
+    emb_stitch_batch_init(&batch, pattern);
     for (i = 1; i < stitchCount; ) {
-        char b0 = (char)fgetc(file);
-        char b1 = (char)fgetc(file);
+        char b0 = (char)emb_fgetc(file);
+        char b1 = (char)emb_fgetc(file);
         if (b0 == -128) {
             switch (b1) {
                 case 1:
-                    b0 = (char)fgetc(file);
-                    b1 = (char)fgetc(file);
+                    b0 = (char)emb_fgetc(file);
+                    b1 = (char)emb_fgetc(file);
                     /*emb_pattern_addStitchRel(b0, b1, STOP); TODO: review */
 
                     i++;
                     break;
                 case 2:
-                    b0 = (char)fgetc(file);
-                    b1 = (char)fgetc(file);
-                    emb_pattern_addStitchRel(pattern, b0 / 10.0,
-                        b1 / 10.0, JUMP, 1);
+                    b0 = (char)emb_fgetc(file);
+                    b1 = (char)emb_fgetc(file);
+                    emb_stitch_batch_rel(&batch, b0 / 10.0,
+                        b1 / 10.0, JUMP);
                     i++;
                     break;
                 case -94:
@@ -6200,19 +7722,20 @@ readStx(EmbPattern* pattern, FILE* file)
                     break;
             }
         } else {
-            emb_pattern_addStitchRel(pattern, b0 / 10.0, b1 / 10.0, NORMAL, 1);
+            emb_stitch_batch_rel(&batch, b0 / 10.0, b1 / 10.0, NORMAL);
             i++;
         }
     }
+    emb_stitch_batch_flush(&batch);
     emb_pattern_flipVertical(pattern);
     return 1;
 }
 
 char
-writeStx(EmbPattern* pattern, FILE* file)
+writeStx(EmbPattern* pattern, EmbStream* file)
 {
     puts("ERROR: writeStx is not implemented.");
-    if (emb_verbose > 1) {
+    if (pattern->context->verbose > 1) {
         printf("Called with %p %p\n", (void*)pattern, (void*)file);
     }
     return 0; /*TODO: finish writeStx */
@@ -6222,17 +7745,6 @@ writeStx(EmbPattern* pattern, FILE* file)
  * Scalable Vector Graphics (.svg)
  * The scalable vector graphics (SVG) format is a graphics format maintained by ...
  */
-int svgCreator;
-
-int svgExpect;
-int svgMultiValue;
-
-int current_element_id;
-SvgAttribute attributeList[1000];
-int n_attributes = 0;
-char currentAttribute[1000];
-char currentValue[1000];
-
 int svg_identify_element(char *buff);
 
 #if 0
@@ -6339,11 +7851,11 @@ int svgPathCmdToEmbPathFlag(char cmd)
     return LINETO;
 }
 
-char* svgAttribute_getValue(const char* name) {
+char* svgAttribute_getValue(EmbSvgParser *svg, const char* name) {
     int i;
-    for (i=0; i<n_attributes; i++) {
-        if (!strcmp(attributeList[i].name, name)) {
-            return attributeList[i].value;
+    for (i=0; i<svg->n_attributes; i++) {
+        if (!strcmp(svg->attributes[i].name, name)) {
+            return svg->attributes[i].value;
         }
     }
     return "none";
@@ -6352,32 +7864,35 @@ char* svgAttribute_getValue(const char* name) {
 void
 parse_circle(EmbPattern *p)
 {
+    EmbSvgParser *svg = &p->context->svg;
     EmbCircle circle;
-    circle.center.x = atof(svgAttribute_getValue("cx"));
-    circle.center.y = atof(svgAttribute_getValue("cy"));
-    circle.radius = atof(svgAttribute_getValue("r"));
+    circle.center.x = atof(svgAttribute_getValue(svg, "cx"));
+    circle.center.y = atof(svgAttribute_getValue(svg, "cy"));
+    circle.radius = atof(svgAttribute_getValue(svg, "r"));
     emb_add_circle(p, circle);
 }
 
 void
 parse_ellipse(EmbPattern *p)
 {
+    EmbSvgParser *svg = &p->context->svg;
     EmbEllipse ellipse;
-    ellipse.center.x = atof(svgAttribute_getValue("cx"));
-    ellipse.center.y = atof(svgAttribute_getValue("cy"));
-    ellipse.radius.x = atof(svgAttribute_getValue("rx"));
-    ellipse.radius.y = atof(svgAttribute_getValue("ry"));
+    ellipse.center.x = atof(svgAttribute_getValue(svg, "cx"));
+    ellipse.center.y = atof(svgAttribute_getValue(svg, "cy"));
+    ellipse.radius.x = atof(svgAttribute_getValue(svg, "rx"));
+    ellipse.radius.y = atof(svgAttribute_getValue(svg, "ry"));
     emb_add_ellipse(p, ellipse);
 }
 
 void
 parse_line(EmbPattern *p)
 {
+    EmbSvgParser *svg = &p->context->svg;
     char *x1, *x2, *y1, *y2;
-    x1 = svgAttribute_getValue("x1");
-    y1 = svgAttribute_getValue("y1");
-    x2 = svgAttribute_getValue("x2");
-    y2 = svgAttribute_getValue("y2");
+    x1 = svgAttribute_getValue(svg, "x1");
+    y1 = svgAttribute_getValue(svg, "y1");
+    x2 = svgAttribute_getValue(svg, "x2");
+    y2 = svgAttribute_getValue(svg, "y2");
 
     /* If the starting and ending points are the same, it is a point */
     if (!strcmp(x1, x2) && !strcmp(y1, y2)) {
@@ -6400,23 +7915,24 @@ parse_line(EmbPattern *p)
 void
 parse_path(EmbPattern *p)
 {
+    EmbSvgParser *svg = &p->context->svg;
     /* TODO: finish */
     EmbVector position, f_point, l_point, c1_point, c2_point;
     int cmd, i, pos, reset, trip;
     EmbReal pathData[7];
     unsigned int numMoves;
     EmbColor color;
-    EmbArray* flagList = 0;
+    EmbIdList* flagList = 0;
     EmbPath path;
-    char* pointStr = svgAttribute_getValue("d");
-    char* mystrok = svgAttribute_getValue("stroke");
+    char* pointStr = svgAttribute_getValue(svg, "d");
+    char* mystrok = svgAttribute_getValue(svg, "stroke");
     int last = strlen(pointStr);
     int size = 32;
     int pendingTask = 0;
     int relative = 0;
     char* pathbuff = 0;
 
-    EmbArray* pointList = 0;
+    EmbVectorList* pointList = 0;
     pos = 0;
     /* An odometer aka 'tripometer' used for stepping thru the pathData */
     trip = -1;
@@ -6448,7 +7964,7 @@ parse_path(EmbPattern *p)
 
     for (i = 0; i < last; i++) {
         char c = pointStr[i];
-        if (emb_verbose>1) {
+        if (p->context->verbose>1) {
             printf("relative %d\n", relative);
             printf("c1.x %f\n", c1_point.x);
             printf("c2.x %f\n", c2_point.x);
@@ -6519,7 +8035,6 @@ parse_path(EmbPattern *p)
 
                     /* Check whether prior command need to be saved */
                     if (trip>=0) {
-                        EmbPoint test;
                         trip = -1;
                         reset = -1;
 
@@ -6595,12 +8110,12 @@ parse_path(EmbPattern *p)
                         }
 
                         if (!pointList && !flagList) {
-                            pointList = emb_array_create(EMB_POINT);
-                            flagList = emb_array_create(EMB_FLAG);
+                            pointList = emb_vector_list_create_in(p->arena,
+                                size);
+                            flagList = emb_id_list_create_in(p->arena, size);
                         }
-                        test.position = position;
-                        emb_array_addPoint(pointList, test);
-                        emb_array_add_flag(flagList, svgPathCmdToEmbPathFlag(cmd));
+                        emb_vector_list_add(pointList, position);
+                        emb_id_list_add(flagList, svgPathCmdToEmbPathFlag(cmd));
                         l_point = position;
 
                         pathbuff[0] = (char)cmd; /* set the command for compare */
@@ -6682,7 +8197,7 @@ parse_path(EmbPattern *p)
 
     /* TODO: subdivide numMoves > 1 */
 
-    color = svgColorToEmbColor(svgAttribute_getValue("stroke"));
+    color = svgColorToEmbColor(svgAttribute_getValue(svg, "stroke"));
 
     path.pointList = pointList;
     path.flagList = flagList;
@@ -6691,10 +8206,11 @@ parse_path(EmbPattern *p)
     emb_add_path(p, path);
 }
 
-EmbArray *
+EmbVectorList *
 parse_pointlist(EmbPattern *p)
 {
-    char* pointStr = svgAttribute_getValue("points");
+    EmbSvgParser *svg = &p->context->svg;
+    char* pointStr = svgAttribute_getValue(svg, "points");
     int last = strlen(pointStr);
     int size = 32;
     int i = 0;
@@ -6703,11 +8219,11 @@ parse_pointlist(EmbPattern *p)
     EmbReal xx = 0.0;
     EmbReal yy = 0.0;
 
-    EmbArray* pointList = 0;
+    EmbVectorList* pointList = 0;
 
     char* polybuff = 0;
 
-    if (emb_verbose > 1) {
+    if (p->context->verbose > 1) {
         printf("Called with %p\n", (void*)p);
     }
 
@@ -6731,16 +8247,14 @@ parse_pointlist(EmbPattern *p)
                     xx = atof(polybuff);
                 }
                 else {
-                    EmbPoint a;
                     odd = 1;
                     yy = atof(polybuff);
 
                     if (!pointList) {
-                        pointList = emb_array_create(EMB_POINT);
+                        pointList = emb_vector_list_create_in(p->arena,
+                            CHUNK_SIZE);
                     }
-                    a.position.x = xx;
-                    a.position.y = yy;
-                    emb_array_addPoint(pointList, a);
+                    emb_vector_list_add(pointList, emb_vector(xx, yy));
                 }
 
                 break;
@@ -6765,14 +8279,15 @@ parse_pointlist(EmbPattern *p)
 void
 parse_polygon(EmbPattern *p)
 {
-    if (emb_verbose > 1) {
+    EmbSvgParser *svg = &p->context->svg;
+    if (p->context->verbose > 1) {
         printf("Called with %p\n", (void*)p);
     }
     /*
     EmbPolygonObject polygonObj;
-    polygonObj.pointList = emb_array_create(EMB_POINT);
+    polygonObj.pointList = emb_vector_list_create_in(p->arena, CHUNK_SIZE);
     BROKEN: polygonObj.pointList = parse_pointlist(p);
-    polygonObj.color = svgColorToEmbColor(svgAttribute_getValue("stroke"));
+    polygonObj.color = svgColorToEmbColor(svgAttribute_getValue(svg, "stroke"));
     polygonObj.lineType = 1; TODO: use lineType enum
     emb_pattern_addPolygonObjectAbs(p, &polygonObj);
     */
@@ -6781,14 +8296,15 @@ parse_polygon(EmbPattern *p)
 void
 parse_polyline(EmbPattern *p)
 {
-    if (emb_verbose > 1) {
+    EmbSvgParser *svg = &p->context->svg;
+    if (p->context->verbose > 1) {
         printf("Called with %p\n", (void*)p);
     }
     /* BROKEN
     EmbPolylineObject* polylineObj;
     polylineObj = (EmbPolylineObject*)malloc(sizeof(EmbPolylineObject));
     polylineObj->pointList = parse_pointlist(p);
-    polylineObj->color = svgColorToEmbColor(svgAttribute_getValue("stroke"));
+    polylineObj->color = svgColorToEmbColor(svgAttribute_getValue(svg, "stroke"));
     polylineObj->lineType = 1; TODO: use lineType enum
     emb_pattern_addPolylineObjectAbs(p, polylineObj);
     */
@@ -6797,12 +8313,13 @@ parse_polyline(EmbPattern *p)
 void
 parse_rect(EmbPattern *p)
 {
+    EmbSvgParser *svg = &p->context->svg;
     EmbRect rect;
     float width, height;
-    rect.x = atof(svgAttribute_getValue("x"));
-    rect.y = atof(svgAttribute_getValue("y"));
-    width = atof(svgAttribute_getValue("width"));
-    height = atof(svgAttribute_getValue("height"));
+    rect.x = atof(svgAttribute_getValue(svg, "x"));
+    rect.y = atof(svgAttribute_getValue(svg, "y"));
+    width = atof(svgAttribute_getValue(svg, "width"));
+    height = atof(svgAttribute_getValue(svg, "height"));
     rect.right = rect.x + width;
     rect.bottom = rect.y + height;
     emb_pattern_addRectAbs(p, rect);
@@ -6815,7 +8332,7 @@ svgAddToPattern(EmbPattern* p)
         printf("ERROR: svgAddToPattern(), p argument is null\n");
         return;
     }
-    switch (current_element_id) {
+    switch (p->context->svg.element) {
     case ELEMENT_CIRCLE:
         parse_circle(p);
         break;
@@ -6853,20 +8370,20 @@ int svg_identify_element(char *buff)
     return -1;
 }
 
-int svgIsElement(const char* buff) {
+int svgIsElement(EmbSvgParser *svg, const char* buff) {
     if (stringInArray(buff, svg_element_tokens)) {
         return SVG_ELEMENT;
     }
     /* Attempt to identify the program that created the SVG file.
      * This should be in a comment at that occurs before the svg element. */
     else if (!strcmp(buff, "Embroidermodder")) {
-        svgCreator = SVG_CREATOR_EMBROIDERMODDER;
+        svg->creator = SVG_CREATOR_EMBROIDERMODDER;
     }
     else if (!strcmp(buff, "Illustrator")) {
-        svgCreator = SVG_CREATOR_ILLUSTRATOR;
+        svg->creator = SVG_CREATOR_ILLUSTRATOR;
     }
     else if (!strcmp(buff, "Inkscape")) {
-        svgCreator = SVG_CREATOR_INKSCAPE;
+        svg->creator = SVG_CREATOR_INKSCAPE;
     }
 
     return SVG_NULL;
@@ -6882,7 +8399,7 @@ svgIsSvgAttribute(const char* buff)
     if (stringInArray(buff, svg_attribute_tokens)) {
         return SVG_ATTRIBUTE;
     }
-    if (svgCreator == SVG_CREATOR_INKSCAPE) {
+    if (svg->creator == SVG_CREATOR_INKSCAPE) {
         if (stringInArray(buff, inkscape_tokens)) {
             return SVG_ATTRIBUTE;
         }
@@ -6893,24 +8410,24 @@ svgIsSvgAttribute(const char* buff)
 */
 
 void
-svgProcess(int c, const char* buff)
+svgProcess(EmbSvgParser *svg, int c, const char* buff)
 {
-    if (svgExpect == SVG_EXPECT_ELEMENT) {
+    if (svg->expect == SVG_EXPECT_ELEMENT) {
         char advance = 0;
         if (buff[0] == '/') {
             return;
         }
-        advance = (char)svgIsElement(buff);
+        advance = (char)svgIsElement(svg, buff);
         if (advance) {
             printf("ELEMENT:\n");
-            svgExpect = SVG_EXPECT_ATTRIBUTE;
-            current_element_id = svg_identify_element((char*)buff);
+            svg->expect = SVG_EXPECT_ATTRIBUTE;
+            svg->element = svg_identify_element((char*)buff);
         } else {
             return;
         }
-    } else if (svgExpect == SVG_EXPECT_ATTRIBUTE) {
+    } else if (svg->expect == SVG_EXPECT_ATTRIBUTE) {
         char advance = 0;
-        switch (current_element_id) {
+        switch (svg->element) {
         case ELEMENT_A:
         case ELEMENT_CIRCLE:
         case ELEMENT_DEFS:
@@ -6950,68 +8467,69 @@ svgProcess(int c, const char* buff)
             default: break;
         }
         if (!advance) {
-            if (stringInArray(buff, (const char **)svg_attribute_table[current_element_id])) {
+            if (stringInArray(buff, (const char **)svg_attribute_table[svg->element])) {
                 advance = SVG_ATTRIBUTE;
             }
             printf("ERROR %s not found in svg_attribute_table[%d].\n",
-                buff, current_element_id);
+                buff, svg->element);
         }
         if (advance) {
             printf("ATTRIBUTE:\n");
-            svgExpect = SVG_EXPECT_VALUE;
-            strcpy(currentAttribute, buff);
+            svg->expect = SVG_EXPECT_VALUE;
+            strcpy(svg->attribute, buff);
         }
-    } else if (svgExpect == SVG_EXPECT_VALUE) {
+    } else if (svg->expect == SVG_EXPECT_VALUE) {
         int last = strlen(buff) - 1;
         printf("VALUE:\n");
 
         /* single-value */
-        if ((buff[0] == '"' || buff[0] == '\'') && (buff[last] == '/' || buff[last] == '"' || buff[last] == '\'') && !svgMultiValue) {
-            svgExpect = SVG_EXPECT_ATTRIBUTE;
-            strcpy(attributeList[n_attributes].name, currentAttribute);
-            strcpy(attributeList[n_attributes].value, buff);
-            n_attributes++;
+        if ((buff[0] == '"' || buff[0] == '\'') && (buff[last] == '/' || buff[last] == '"' || buff[last] == '\'') && !svg->multi_value) {
+            svg->expect = SVG_EXPECT_ATTRIBUTE;
+            strcpy(svg->attributes[svg->n_attributes].name, svg->attribute);
+            strcpy(svg->attributes[svg->n_attributes].value, buff);
+            svg->n_attributes++;
         } else { /* multi-value */
-            svgMultiValue = 1;
-            if (strlen(currentValue)==0) {
-                strcpy(currentValue, buff);
+            svg->multi_value = 1;
+            if (strlen(svg->value)==0) {
+                strcpy(svg->value, buff);
             }
             else {
-                strcat(currentValue, " ");
-                strcat(currentValue, buff);
+                strcat(svg->value, " ");
+                strcat(svg->value, buff);
             }
             if (buff[last] == '/' || buff[last] == '"' || buff[last] == '\'') {
-                svgMultiValue = 0;
-                svgExpect = SVG_EXPECT_ATTRIBUTE;
-                strcpy(attributeList[n_attributes].name, currentAttribute);
-                strcpy(attributeList[n_attributes].value, currentValue);
-                n_attributes++;
+                svg->multi_value = 0;
+                svg->expect = SVG_EXPECT_ATTRIBUTE;
+                strcpy(svg->attributes[svg->n_attributes].name, svg->attribute);
+                strcpy(svg->attributes[svg->n_attributes].value, svg->value);
+                svg->n_attributes++;
             }
         }
     }
-    if (svgExpect != SVG_EXPECT_NULL) {
+    if (svg->expect != SVG_EXPECT_NULL) {
         printf("%s\n", buff);
     }
     if (c == '>') {
-        svgExpect = SVG_EXPECT_NULL;
+        svg->expect = SVG_EXPECT_NULL;
     }
 }
 #endif
 
 /* . */
 char
-readSvg(EmbPattern* pattern, FILE* file)
+readSvg(EmbPattern* pattern, EmbStream* file)
 {
     REPORT_PTR(pattern)
     REPORT_PTR(file)
 #if 0
     int size, pos, i;
     char* buff = 0, c;
+    EmbSvgParser *svg = &pattern->context->svg;
     size = 1024;
 
     for (i=0; i<1000; i++) {
-        attributeList[i].name = (char*)malloc(size);
-        attributeList[i].value = (char*)malloc(size);
+        svg->attributes[i].name = (char*)malloc(size);
+        svg->attributes[i].value = (char*)malloc(size);
     }
 
     buff = (char*)malloc(size);
@@ -7019,30 +8537,31 @@ readSvg(EmbPattern* pattern, FILE* file)
         printf("ERROR: readSvg(), cannot allocate memory for buff\n");
         return 0;
     }
-    svgCreator = SVG_CREATOR_NULL;
-    svgExpect = SVG_EXPECT_NULL;
-    svgMultiValue = 0;
+    svg->creator = SVG_CREATOR_NULL;
+    svg->expect = SVG_EXPECT_NULL;
+    svg->multi_value = 0;
+    svg->n_attributes = 0;
 
-    currentAttribute[0] = 0;
-    currentValue[0] = 0;
+    svg->attribute[0] = 0;
+    svg->value[0] = 0;
 
     /* Pre-flip in case of multiple reads on the same pattern */
     emb_pattern_flipVertical(pattern);
 
     pos = 0;
-    while (fread(&c, 1, 1, file)) {
+    while (emb_fread(&c, 1, 1, file)) {
         switch (c) {
         case '<':
-            if (svgExpect == SVG_EXPECT_NULL) {
+            if (svg->expect == SVG_EXPECT_NULL) {
                 svgAddToPattern(pattern);
-                svgExpect = SVG_EXPECT_ELEMENT;
+                svg->expect = SVG_EXPECT_ELEMENT;
             }
             break;
         case '>':
             /* abnormal case that may occur in svg element where '>' is all by itself */
             if (pos == 0) {
                 /*TODO: log a warning about this absurdity! */
-                svgExpect = SVG_EXPECT_ELEMENT;
+                svg->expect = SVG_EXPECT_ELEMENT;
             }
             break;
         case ' ':
@@ -7054,7 +8573,7 @@ readSvg(EmbPattern* pattern, FILE* file)
                 break;
             buff[pos] = 0;
             pos = 0;
-            svgProcess(c, buff);
+            svgProcess(svg, c, buff);
             break;
         default:
             buff[pos++] = (char)c;
@@ -7073,7 +8592,7 @@ readSvg(EmbPattern* pattern, FILE* file)
 
     safe_free(buff);
 
-    if (emb_verbose>1) {
+    if (pattern->context->verbose>1) {
         printf("OBJECT SUMMARY:\n");
         if (pattern->circles) {
             for (i = 0; i < pattern->circles->count; i++) {
@@ -7120,8 +8639,8 @@ readSvg(EmbPattern* pattern, FILE* file)
     }
 
     for (i=0; i<1000; i++) {
-        safe_free(attributeList[i].name);
-        safe_free(attributeList[i].value);
+        safe_free(svg->attributes[i].name);
+        safe_free(svg->attributes[i].value);
     }
     /* Flip the pattern since SVG Y+ is down and libembroidery Y+ is up. */
     emb_pattern_flipVertical(pattern);
@@ -7129,25 +8648,34 @@ readSvg(EmbPattern* pattern, FILE* file)
     return 1; /*TODO: finish readSvg */
 }
 
+/* Writes the point a v as "x,y", the form the points attribute takes. */
+static void
+svgWritePoint(EmbStream* file, EmbVector v)
+{
+    emb_write_real(file, v.x);
+    emb_fputc(',', file);
+    emb_write_real(file, v.y);
+}
+
 /*! Writes the data from a pattern to a file with the given a fileName.
  *  Returns \c true if successful, otherwise returns \c false. */
 char
-writeSvg(EmbPattern* pattern, FILE* file)
+writeSvg(EmbPattern* pattern, EmbStream* file)
 {
     EmbRect boundingRect;
     EmbRect rect;
     EmbColor color;
     int i, j;
-    char isNormal, tmpX[32], tmpY[32];
+    char isNormal, num[4][EMB_NUMBER_LENGTH];
     EmbRect border;
 
     /* Pre-flip the pattern since SVG Y+ is down and libembroidery Y+ is up. */
     emb_pattern_flipVertical(pattern);
     boundingRect = emb_pattern_bounds(pattern);
-    fprintf(file, "<?xml version=\"1.0\"?>\n");
-    fprintf(file, "<!-- Embroidermodder 2 SVG Embroidery File -->\n");
-    fprintf(file, "<!-- http://embroidermodder.github.io -->\n");
-    fprintf(file, "<svg ");
+    emb_fprintf(file, "<?xml version=\"1.0\"?>\n");
+    emb_fprintf(file, "<!-- Embroidermodder 2 SVG Embroidery File -->\n");
+    emb_fprintf(file, "<!-- http://embroidermodder.github.io -->\n");
+    emb_fprintf(file, "<svg ");
 
     /* TODO: See the SVG Tiny Version 1.2 Specification Section 7.14.
     *       Until all of the formats and API is stable, the width, height and viewBox attributes need to be left unspecified.
@@ -7165,16 +8693,14 @@ writeSvg(EmbPattern* pattern, FILE* file)
     border.y -= 0.1 * border.h;
     border.h += 0.2 * border.h;
     /* Sanity check here? */
-    fprintf(file, "viewBox=\"%f %f %f %f\" ",
-            border.x, border.y, border.w, border.h);
+    emb_fprintf(file, "viewBox=\"%s %s %s %s\" ",
+            emb_optOut(border.x, num[0]), emb_optOut(border.y, num[1]),
+            emb_optOut(border.w, num[2]), emb_optOut(border.h, num[3]));
 
-    fprintf(file, "xmlns=\"http://www.w3.org/2000/svg\" version=\"1.2\" baseProfile=\"tiny\">");
-    fprintf(file, "\n<g transform=\"scale(10)\">");
-    /*TODO: Low Priority Optimization:
-    *      Using %g in embFile_printf just doesn't work good enough at trimming trailing zeroes.
-    *      It's precision refers to significant digits, not decimal places (which is what we want).
-    *      We need to roll our own function for trimming trailing zeroes to keep
-    *      the precision as high as possible if needed, but help reduce file size also. */
+    emb_fprintf(file, "xmlns=\"http://www.w3.org/2000/svg\" version=\"1.2\" baseProfile=\"tiny\">");
+    emb_fprintf(file, "\n<g transform=\"scale(10)\">");
+    /* Numbers are written by emb_format_real() with as few digits as
+     * read back exactly, which keeps the precision and the file small. */
 
     /*TODO: Low Priority Optimization:
     *      Make sure that the line length that is output doesn't exceed 1000 characters. */
@@ -7188,37 +8714,38 @@ writeSvg(EmbPattern* pattern, FILE* file)
         case EMB_CIRCLE: {
             EmbCircle circle = g.object.circle;
             /* TODO: use proper thread width for stoke-width rather than just 0.2 */
-            fprintf(file, "\n<circle stroke-width=\"0.2\" stroke=\"#%02x%02x%02x\" fill=\"none\" cx=\"%f\" cy=\"%f\" r=\"%f\" />",
+            emb_fprintf(file, "\n<circle stroke-width=\"0.2\" stroke=\"#%02x%02x%02x\" fill=\"none\" cx=\"%s\" cy=\"%s\" r=\"%s\" />",
                 g.color.r,
                 g.color.g,
                 g.color.b,
-                circle.center.x,
-                circle.center.y,
-                circle.radius);
+                emb_optOut(circle.center.x, num[0]),
+                emb_optOut(circle.center.y, num[1]),
+                emb_optOut(circle.radius, num[2]));
             break;
         }
         case EMB_ELLIPSE: {
             EmbEllipse ellipse = g.object.ellipse;
             color = g.color;
             /* TODO: use proper thread width for stoke-width rather than just 0.2 */
-            fprintf(file, "\n<ellipse stroke-width=\"0.2\" stroke=\"#%02x%02x%02x\" fill=\"none\" cx=\"%f\" cy=\"%f\" rx=\"%f\" ry=\"%f\" />",
+            emb_fprintf(file, "\n<ellipse stroke-width=\"0.2\" stroke=\"#%02x%02x%02x\" fill=\"none\" cx=\"%s\" cy=\"%s\" rx=\"%s\" ry=\"%s\" />",
                         color.r,
                         color.g,
                         color.b,
-                        ellipse.center.x,
-                        ellipse.center.y,
-                        ellipse.radius.x,
-                        ellipse.radius.y);
+                        emb_optOut(ellipse.center.x, num[0]),
+                        emb_optOut(ellipse.center.y, num[1]),
+                        emb_optOut(ellipse.radius.x, num[2]),
+                        emb_optOut(ellipse.radius.y, num[3]));
             break;
         }
         case EMB_LINE: {
             EmbLine line = g.object.line;
             color = g.color;
             /* TODO: use proper thread width for stoke-width rather than just 0.2 */
-            fprintf(file,
-                "\n<line stroke-width=\"0.2\" stroke=\"#%02x%02x%02x\" fill=\"none\" x1=\"%f\" y1=\"%f\" x2=\"%f\" y2=\"%f\" />",
+            emb_fprintf(file,
+                "\n<line stroke-width=\"0.2\" stroke=\"#%02x%02x%02x\" fill=\"none\" x1=\"%s\" y1=\"%s\" x2=\"%s\" y2=\"%s\" />",
                 color.r, color.g, color.b,
-                line.start.x, line.start.y, line.end.x, line.end.y);
+                emb_optOut(line.start.x, num[0]), emb_optOut(line.start.y, num[1]),
+                emb_optOut(line.end.x, num[2]), emb_optOut(line.end.y, num[3]));
             break;
         }
         case EMB_POINT: {
@@ -7227,46 +8754,43 @@ writeSvg(EmbPattern* pattern, FILE* file)
              * Section 9.5 The 'line' element
              * Section C.6 'path' element implementation notes */
             /* TODO: use proper thread width for stoke-width rather than just 0.2 */
-            fprintf(file,
-                "\n<line stroke-linecap=\"round\" stroke-width=\"0.2\" stroke=\"#%02x%02x%02x\" fill=\"none\" x1=\"%f\" y1=\"%f\" x2=\"%f\" y2=\"%f\" />",
+            emb_fprintf(file,
+                "\n<line stroke-linecap=\"round\" stroke-width=\"0.2\" stroke=\"#%02x%02x%02x\" fill=\"none\" x1=\"%s\" y1=\"%s\" x2=\"%s\" y2=\"%s\" />",
                 p.color.r, p.color.g, p.color.b,
-                p.position.x, p.position.y, p.position.x, p.position.y);
+                emb_optOut(p.position.x, num[0]), emb_optOut(p.position.y, num[1]),
+                num[0], num[1]);
             break;
         }
         case EMB_POLYGON: {
-            EmbArray *pointList = g.object.polygon.pointList;
+            EmbVectorList *pointList = g.object.polygon.pointList;
             color = g.object.color;
             /* TODO: use proper thread width for stoke-width rather than just 0.2 */
-                fprintf(file, "\n<polygon stroke-linejoin=\"round\" stroke-linecap=\"round\" stroke-width=\"0.2\" stroke=\"#%02x%02x%02x\" fill=\"none\" points=\"%s,%s",
-                    color.r, color.g, color.b,
-                    emb_optOut(pointList->geometry[0].object.point.position.x, tmpX),
-                    emb_optOut(pointList->geometry[0].object.point.position.y, tmpY));
+                emb_fprintf(file, "\n<polygon stroke-linejoin=\"round\" stroke-linecap=\"round\" stroke-width=\"0.2\" stroke=\"#%02x%02x%02x\" fill=\"none\" points=\"",
+                    color.r, color.g, color.b);
+            svgWritePoint(file, pointList->data[0]);
             for (j=1; j < pointList->count; j++) {
-                fprintf(file, " %s,%s",
-                    emb_optOut(pointList->geometry[j].object.point.position.x, tmpX),
-                    emb_optOut(pointList->geometry[j].object.point.position.y, tmpY));
+                emb_fputc(' ', file);
+                svgWritePoint(file, pointList->data[j]);
             }
-            fprintf(file, "\"/>");
+            emb_fprintf(file, "\"/>");
             break;
         }
         case EMB_POLYLINE: {
-            EmbArray *pointList = g.object.polyline.pointList;
+            EmbVectorList *pointList = g.object.polyline.pointList;
             color = g.object.polyline.color;
             /* TODO: use proper thread width for stoke-width rather
              * than just 0.2.
              */
-            fprintf(file, "\n<polyline stroke-linejoin=\"round\" stroke-linecap=\"round\" stroke-width=\"0.2\" stroke=\"#%02x%02x%02x\" fill=\"none\" points=\"%s,%s",
+            emb_fprintf(file, "\n<polyline stroke-linejoin=\"round\" stroke-linecap=\"round\" stroke-width=\"0.2\" stroke=\"#%02x%02x%02x\" fill=\"none\" points=\"",
                     color.r,
                     color.g,
-                    color.b,
-                    emb_optOut(pointList->geometry[0].object.point.position.x, tmpX),
-                    emb_optOut(pointList->geometry[0].object.point.position.y, tmpY));
+                    color.b);
+            svgWritePoint(file, pointList->data[0]);
             for (j=1; j < pointList->count; j++) {
-                fprintf(file, " %s,%s",
-                    emb_optOut(pointList->geometry[j].object.point.position.x, tmpX),
-                    emb_optOut(pointList->geometry[j].object.point.position.y, tmpY));
+                emb_fputc(' ', file);
+                svgWritePoint(file, pointList->data[j]);
             }
-            fprintf(file, "\"/>");
+            emb_fprintf(file, "\"/>");
             break;
         }
         case EMB_RECT: {
@@ -7275,9 +8799,10 @@ writeSvg(EmbPattern* pattern, FILE* file)
             /* TODO: use proper thread width for stoke-width rather
              * than just 0.2.
              */
-            fprintf(file, "\n<rect stroke-width=\"0.2\" stroke=\"#%02x%02x%02x\" fill=\"none\" x=\"%f\" y=\"%f\" width=\"%f\" height=\"%f\" />",
+            emb_fprintf(file, "\n<rect stroke-width=\"0.2\" stroke=\"#%02x%02x%02x\" fill=\"none\" x=\"%s\" y=\"%s\" width=\"%s\" height=\"%s\" />",
                 color.r, color.g, color.b,
-                rect.x, rect.y, rect.w, rect.h);
+                emb_optOut(rect.x, num[0]), emb_optOut(rect.y, num[1]),
+                emb_optOut(rect.w, num[2]), emb_optOut(rect.h, num[3]));
             break;
         }
         default:
@@ -7298,24 +8823,24 @@ writeSvg(EmbPattern* pattern, FILE* file)
             /* TODO: use proper thread width for stoke-width rather
              * than just 0.2.
              */
-              fprintf(file, "\n<polyline stroke-linejoin=\"round\" stroke-linecap=\"round\" stroke-width=\"0.2\" stroke=\"#%02x%02x%02x\" fill=\"none\" points=\"%s,%s",
+              emb_fprintf(file, "\n<polyline stroke-linejoin=\"round\" stroke-linecap=\"round\" stroke-width=\"0.2\" stroke=\"#%02x%02x%02x\" fill=\"none\" points=\"",
                                 color.r,
                                 color.g,
-                                color.b,
-                                emb_optOut(st.x, tmpX),
-                                emb_optOut(st.y, tmpY));
+                                color.b);
+              svgWritePoint(file, emb_vector(st.x, st.y));
             }
             else if (st.flags == NORMAL && isNormal)
             {
-                fprintf(file, " %s,%s", emb_optOut(st.x, tmpX), emb_optOut(st.y, tmpY));
+                emb_fputc(' ', file);
+                svgWritePoint(file, emb_vector(st.x, st.y));
             }
             else if (st.flags != NORMAL && isNormal)
             {
                 isNormal = 0;
-                fprintf(file, "\"/>");
+                emb_fprintf(file, "\"/>");
             }
     }
-    fprintf(file, "\n</g>\n</svg>\n");
+    emb_fprintf(file, "\n</g>\n</svg>\n");
 
     /* Reset the pattern so future writes(regardless of format)
      * are not flipped.
@@ -7331,23 +8856,26 @@ writeSvg(EmbPattern* pattern, FILE* file)
  */
 
 char
-readT01(EmbPattern* pattern, FILE* file)
+readT01(EmbPattern* pattern, EmbStream* file)
 {
-    unsigned char b[3];
+    EmbStitchBatch batch;
+    const unsigned char *b;
 
-    while (fread(b, 1, 3, file) == 3) {
+    emb_stitch_batch_init(&batch, pattern);
+    while ((b = emb_stream_take(file, 3))) {
         int flags, x, y;
         decode_t01_record(b, &flags, &x, &y);
-        emb_pattern_addStitchRel(pattern, x / 10.0, y / 10.0, flags, 1);
+        emb_stitch_batch_rel(&batch, x / 10.0, y / 10.0, flags);
         if (flags == END) {
             break;
         }
     }
+    emb_stitch_batch_flush(&batch);
     return 1;
 }
 
 char
-writeT01(EmbPattern* pattern, FILE* file)
+writeT01(EmbPattern* pattern, EmbStream* file)
 {
     EmbRect boundingRect;
     int i;
@@ -7356,7 +8884,7 @@ writeT01(EmbPattern* pattern, FILE* file)
     emb_pattern_correctForMaxStitchLength(pattern, 12.1, 12.1);
 
     boundingRect = emb_pattern_bounds(pattern);
-    if (emb_verbose>1) {
+    if (pattern->context->verbose>1) {
         printf("bounding rectangle with top %f not used ", boundingRect.x);
         printf("in the function writeT01\n");
     }
@@ -7372,7 +8900,7 @@ writeT01(EmbPattern* pattern, FILE* file)
         pos.x += 0.1*dx;
         pos.y += 0.1*dy;
         encode_t01_record(b, dx, dy, st.flags);
-        fwrite(b, 1, 3, file);
+        emb_fwrite(b, 1, 3, file);
     }
     return 1;
 }
@@ -7383,13 +8911,15 @@ writeT01(EmbPattern* pattern, FILE* file)
  */
 
 char
-readT09(EmbPattern* pattern, FILE* file)
+readT09(EmbPattern* pattern, EmbStream* file)
 {
-    unsigned char b[3];
+    EmbStitchBatch batch;
+    const unsigned char *b;
 
-    fseek(file, 0x0C, SEEK_SET);
+    emb_fseek(file, 0x0C, SEEK_SET);
 
-    while (fread(b, 1, 3, file) == 3) {
+    emb_stitch_batch_init(&batch, pattern);
+    while ((b = emb_stream_take(file, 3))) {
         int stitchType = NORMAL;
         int b1 = b[0];
         int b2 = b[1];
@@ -7406,13 +8936,14 @@ readT09(EmbPattern* pattern, FILE* file)
         if (commandByte & 0x40) {
             b2 = -b2;
         }
-        emb_pattern_addStitchRel(pattern, b2 / 10.0, b1 / 10.0, stitchType, 1);
+        emb_stitch_batch_rel(&batch, b2 / 10.0, b1 / 10.0, stitchType);
     }
+    emb_stitch_batch_flush(&batch);
     return 1;
 }
 
 char
-writeT09(EmbPattern* pattern, FILE* file)
+writeT09(EmbPattern* pattern, EmbStream* file)
 {
     int i;
     EmbVector pos;
@@ -7449,7 +8980,7 @@ writeT09(EmbPattern* pattern, FILE* file)
             b[0] = -dy;
             b[2] |= 0x40;
         }
-        fwrite(b, 1, 3, file);
+        emb_fwrite(b, 1, 3, file);
     }
     return 1;
 }
@@ -7460,7 +8991,7 @@ writeT09(EmbPattern* pattern, FILE* file)
  */
 
 void
-encode_tap_record(FILE* file, int x, int y, int flags)
+encode_tap_record(EmbStream* file, int x, int y, int flags)
 {
     unsigned char b[3];
     encode_tajima_ternary(b, x, y);
@@ -7477,7 +9008,7 @@ encode_tap_record(FILE* file, int x, int y, int flags)
     if (flags & STOP) {
         b[2] = (char)(b[2] | 0xC3);
     }
-    fwrite(b, 1, 3, file);
+    emb_fwrite(b, 1, 3, file);
 }
 
 int
@@ -7499,23 +9030,26 @@ decode_tap_record_flags(unsigned char b2)
 }
 
 char
-readTap(EmbPattern* pattern, FILE* file) {
-    unsigned char b[3];
+readTap(EmbPattern* pattern, EmbStream* file) {
+    EmbStitchBatch batch;
+    const unsigned char *b;
 
-    while (fread(b, 1, 3, file) == 3) {
+    emb_stitch_batch_init(&batch, pattern);
+    while ((b = emb_stream_take(file, 3))) {
         int flags, x, y;
         decode_tajima_ternary(b, &x, &y);
         flags = decode_tap_record_flags(b[2]);
-        emb_pattern_addStitchRel(pattern, x / 10.0, y / 10.0, flags, 1);
+        emb_stitch_batch_rel(&batch, x / 10.0, y / 10.0, flags);
         if (flags == END) {
             break;
         }
     }
+    emb_stitch_batch_flush(&batch);
     return 1;
 }
 
 char
-writeTap(EmbPattern* pattern, FILE* file)
+writeTap(EmbPattern* pattern, EmbStream* file)
 {
     int i;
     EmbVector pos;
@@ -7561,7 +9095,7 @@ writeTap(EmbPattern* pattern, FILE* file)
  * 31      set for user edited stitches
  */
 char
-readThr(EmbPattern* pattern, FILE* file)
+readThr(EmbPattern* pattern, EmbStream* file)
 {
     ThredHeader header;
     EmbColor background;
@@ -7585,7 +9119,7 @@ readThr(EmbPattern* pattern, FILE* file)
             case 1:
             case 2:
                 /* skip the file header extension */
-                fseek(file, 144, SEEK_CUR);
+                emb_fseek(file, 144, SEEK_CUR);
                 break;
             default:
                 return 0; /* unsupported version */
@@ -7609,16 +9143,16 @@ readThr(EmbPattern* pattern, FILE* file)
         }
         emb_pattern_addStitchAbs(pattern, x, y, type, 0);
     }
-    fseek(file, 16, SEEK_CUR); /* skip bitmap name (16 chars) */
+    emb_fseek(file, 16, SEEK_CUR); /* skip bitmap name (16 chars) */
 
     embColor_read(file, &background, 4);
-    if (emb_verbose>1) {
+    if (pattern->context->verbose>1) {
         printf("background: %c %c %c\n", background.r, background.g, background.b);
     }
     for (i = 0; i < 16; i++) {
         EmbThread thread;
-        strcpy(thread.description, "NULL");
-        strcpy(thread.catalogNumber, "NULL");
+        thread.description = "NULL";
+        thread.catalogNumber = "NULL";
         embColor_read(file, &(thread.color), 4);
         emb_pattern_addThread(pattern, thread);
     }
@@ -7628,7 +9162,7 @@ readThr(EmbPattern* pattern, FILE* file)
 }
 
 char
-writeThr(EmbPattern* pattern, FILE* file)
+writeThr(EmbPattern* pattern, EmbStream* file)
 {
     int i, stitchCount;
     unsigned char version = 0;
@@ -7664,10 +9198,10 @@ writeThr(EmbPattern* pattern, FILE* file)
         emb_write_i32(file, extension.hoopX);
         emb_write_i32(file, extension.hoopY);
         emb_write_i32(file, extension.stitchGranularity);
-        fwrite(extension.creatorName, 1, 50, file);
-        fwrite(extension.modifierName, 1, 50, file);
-        fputc(extension.auxFormat, file);
-        fwrite(extension.reserved, 1, 31, file);
+        emb_fwrite(extension.creatorName, 1, 50, file);
+        emb_fwrite(extension.modifierName, 1, 50, file);
+        emb_fputc(extension.auxFormat, file);
+        emb_fwrite(extension.reserved, 1, 31, file);
     }
 
     /* write stitches */
@@ -7681,9 +9215,9 @@ writeThr(EmbPattern* pattern, FILE* file)
         emb_write_i32(file, y);
         emb_write_u32(file, NOTFRM | (st.color & 0x0F));
     }
-    fwrite(bitmapName, 1, 16, file);
+    emb_fwrite(bitmapName, 1, 16, file);
     /* background color */
-    fwrite("\xFF\xFF\xFF\x00", 1, 4, file);
+    emb_fwrite("\xFF\xFF\xFF\x00", 1, 4, file);
 
     for (i = 0; i < pattern->thread_list->count; i++) {
         EmbColor c = pattern->thread_list->thread[i].color;
@@ -7702,62 +9236,78 @@ writeThr(EmbPattern* pattern, FILE* file)
  * Text File (.txt)
  * The txt format is stitch-only and isn't associated with a specific company.
  */
-char
-readTxt(EmbPattern* pattern, FILE* file)
+/* Parses a "x,y color:c flags:f" line into an EmbStitch. */
+static int
+txtParseLine(const char *line, size_t length, void *record)
 {
-    EmbString line;
-    int stated_count, i;
-    emb_readline(file, line, 99);
-    stated_count = atoi(line);
-    for (i=0; i<stated_count; i++) {
-        EmbStitch st;
-        char *p, *y, *color, *flags;
-        int state = 0;
-        emb_readline(file, line, 99);
-        p = line;
-        y = line;
-        color = line;
-        flags = line;
-        for (p=line; *p; p++) {
-            if (*p == ',' || *p == ' ') {
-                *p = 0;
-                switch (state) {
-                case 0:
-                    y = p+1;
-                    break;
-                case 1:
-                    color = p+7;
-                    break;
-                case 2:
-                    flags = p+7;
-                    break;
-                default:
-                    break;
-                }
-                state++;
-            }
+    EmbStitch *st = (EmbStitch*)record;
+    const char *p, *end = line + length;
+    if (length == 0) {
+        return EMB_LINE_SKIP;
+    }
+    st->x = 0.0f;
+    st->y = 0.0f;
+    st->color = 0;
+    st->flags = 0;
+    p = emb_parse_real(line, end, &st->x);
+    if (p < end && *p == ',') {
+        p = emb_parse_real(p + 1, end, &st->y);
+    }
+    p = (const char*)memchr(p, ':', (size_t)(end - p));
+    if (p) {
+        p = emb_parse_int(p + 1, end, &st->color);
+        p = (const char*)memchr(p, ':', (size_t)(end - p));
+        if (p) {
+            emb_parse_int(p + 1, end, &st->flags);
         }
-        st.x = atof(line);
-        st.y = atof(y);
-        st.color = atoi(color);
-        st.flags = atoi(flags);
+    }
+    return EMB_LINE_RECORD;
+}
+
+char
+readTxt(EmbPattern* pattern, EmbStream* file)
+{
+    char buffer[100];
+    const char *line;
+    size_t length;
+    int stated_count = 0, count, i;
+    EmbStitch *stitches;
+
+    line = emb_stream_line(file, buffer, sizeof(buffer), &length);
+    if (!line) {
+        return 0;
+    }
+    emb_parse_int(line, line + length, &stated_count);
+    if (!emb_stream_parse_lines(file, txtParseLine, sizeof(EmbStitch), 0,
+        (void**)&stitches, &count)) {
+        return 0;
+    }
+    count = EMB_MIN(count, stated_count);
+    emb_pattern_reserve_stitches(pattern, count);
+    for (i = 0; i < count; i++) {
+        EmbStitch st = stitches[i];
         emb_pattern_addStitchAbs(pattern, st.x, st.y, st.flags, st.color);
     }
-    puts("Overridden, defaulting to dst.");
-    readDst(pattern, file);
-    return 0; /*TODO: finish readTxt */
+    safe_free(stitches);
+    return 1;
 }
 
 char
-writeTxt(EmbPattern* pattern, FILE* file)
+writeTxt(EmbPattern* pattern, EmbStream* file)
 {
     int i;
-    fprintf(file, "%u\n", (unsigned int) pattern->stitch_list->count);
+    emb_fprintf(file, "%u\n", (unsigned int) pattern->stitch_list->count);
 
     for (i = 0; i < pattern->stitch_list->count; i++) {
         EmbStitch s = pattern->stitch_list->stitch[i];
-        fprintf(file, "%.1f,%.1f color:%i flags:%i\n",
-                s.x, s.y, s.color, s.flags);
+        emb_write_fixed(file, s.x, 1);
+        emb_fputc(',', file);
+        emb_write_fixed(file, s.y, 1);
+        emb_fputs(" color:", file);
+        emb_write_int(file, s.color);
+        emb_fputs(" flags:", file);
+        emb_write_int(file, s.flags);
+        emb_fputc('\n', file);
     }
     return 1;
 }
@@ -7767,12 +9317,13 @@ writeTxt(EmbPattern* pattern, FILE* file)
  * The Barudan u00 format is stitch-only.
  */
 char
-readU00(EmbPattern* pattern, FILE* file)
+readU00(EmbPattern* pattern, EmbStream* file)
 {
+    EmbStitchBatch batch;
     int i;
     char dx = 0, dy = 0;
     int flags = NORMAL;
-    unsigned char b[3];
+    const unsigned char *b;
 
     if (!check_header_present(file, 0x100)) {
         return 0;
@@ -7780,17 +9331,18 @@ readU00(EmbPattern* pattern, FILE* file)
 
     /* 16 3byte RGB's start @ 0x08 followed by 14 bytes between
         0 and 15 with index of color for each color change */
-    fseek(file, 0x08, SEEK_SET);
+    emb_fseek(file, 0x08, SEEK_SET);
     for (i = 0; i < 16; i++) {
         EmbThread t;
         embColor_read(file, &(t.color), 3);
-        strcpy(t.catalogNumber, "");
-        strcpy(t.description, "");
+        t.catalogNumber = "";
+        t.description = "";
         emb_pattern_addThread(pattern, t);
     }
 
-    fseek(file, 0x100, SEEK_SET);
-    while (fread(b, 1, 3, file) == 3) {
+    emb_fseek(file, 0x100, SEEK_SET);
+    emb_stitch_batch_init(&batch, pattern);
+    while ((b = emb_stream_take(file, 3))) {
         char negativeX , negativeY;
 
         if (b[0] == 0xF8 || b[0] == 0x87 || b[0] == 0x91) {
@@ -7814,16 +9366,17 @@ readU00(EmbPattern* pattern, FILE* file)
         if (negativeY) {
             dy = (char) -dy;
         }
-        emb_pattern_addStitchRel(pattern, dx / 10.0, dy / 10.0, flags, 1);
+        emb_stitch_batch_rel(&batch, dx / 10.0, dy / 10.0, flags);
     }
+    emb_stitch_batch_flush(&batch);
     return 1;
 }
 
 char
-writeU00(EmbPattern* pattern, FILE* file)
+writeU00(EmbPattern* pattern, EmbStream* file)
 {
     puts("writeU00 not implemented.");
-    if (emb_verbose > 1) {
+    if (pattern->context->verbose > 1) {
         printf("Called with %p %p\n", (void*)pattern, (void*)file);
     }
     return 0; /*TODO: finish WriteU00 */
@@ -7837,8 +9390,9 @@ writeU00(EmbPattern* pattern, FILE* file)
  * files and handle accordingly.
  */
 char
-readU01(EmbPattern* pattern, FILE* file)
+readU01(EmbPattern* pattern, EmbStream* file)
 {
+    EmbStitchBatch batch;
     int fileLength, negativeX = 0, negativeY = 0, flags = NORMAL;
     char dx, dy;
     unsigned char data[3];
@@ -7847,15 +9401,16 @@ readU01(EmbPattern* pattern, FILE* file)
         return 0;
     }
 
-    fseek(file, 0, SEEK_END);
-    fileLength = ftell(file);
-    fseek(file, 0x100, SEEK_SET);
+    emb_fseek(file, 0, SEEK_END);
+    fileLength = emb_ftell(file);
+    emb_fseek(file, 0x100, SEEK_SET);
 
-    if (emb_verbose>1) {
+    if (pattern->context->verbose>1) {
         printf("file length: %d\n", fileLength);
     }
 
-    while (fread(data, 1, 3, file) == 3) {
+    emb_stitch_batch_init(&batch, pattern);
+    while (emb_fread(data, 1, 3, file) == 3) {
         if (data[0] == 0xF8 || data[0] == 0x87 || data[0] == 0x91) {
             break;
         }
@@ -7877,15 +9432,16 @@ readU01(EmbPattern* pattern, FILE* file)
         if (negativeY) {
             dy = (char) -dy;
         }
-        emb_pattern_addStitchRel(pattern, dx / 10.0, dy / 10.0, flags, 1);
+        emb_stitch_batch_rel(&batch, dx / 10.0, dy / 10.0, flags);
     }
+    emb_stitch_batch_flush(&batch);
     return 1;
 }
 
 char
-writeU01(EmbPattern* pattern, FILE* file)
+writeU01(EmbPattern* pattern, EmbStream* file)
 {
-    if (emb_verbose > 1) {
+    if (pattern->context->verbose > 1) {
         printf("Called with %p %p\n", (void*)pattern, (void*)file);
     }
     return 0; /*TODO: finish writeU01 */
@@ -7960,8 +9516,9 @@ vipDecompressData(unsigned char* input, int compressedInputLength, int decompres
 }
 
 char
-readVip(EmbPattern* pattern, FILE* file)
+readVip(EmbPattern* pattern, EmbStream* file)
 {
+    EmbStitchBatch batch;
     int fileLength;
     int i;
     unsigned char prevByte = 0;
@@ -7995,14 +9552,17 @@ readVip(EmbPattern* pattern, FILE* file)
     header.unknown = emb_read_i16(file);
 
     header.colorLength = emb_read_i32(file);
-    decodedColors = (unsigned char*)malloc(header.numberOfColors*4);
+    if (!(pattern->read_options & EMB_READ_THREADS)) {
+        header.numberOfColors = 0;
+    }
+    decodedColors = (unsigned char*)malloc(header.numberOfColors*4 + 1);
     if (!decodedColors) {
         printf("ERROR: format-vip.c readVip(), ");
         printf("cannot allocate memory for decodedColors\n");
         return 0;
     }
     for (i = 0; i < header.numberOfColors*4; ++i) {
-        unsigned char inputByte = (char)fgetc(file);
+        unsigned char inputByte = (char)emb_fgetc(file);
         unsigned char tmpByte = (unsigned char) (inputByte ^ vipDecodingTable[i]);
         decodedColors[i] = (unsigned char) (tmpByte ^ prevByte);
         prevByte = inputByte;
@@ -8016,37 +9576,48 @@ readVip(EmbPattern* pattern, FILE* file)
         /* printf("%d\n", decodedColors[startIndex + 3]); */
         emb_pattern_addThread(pattern, thread);
     }
-    fseek(file, header.attributeOffset, SEEK_SET);
+    safe_free(decodedColors);
+    if (!(pattern->read_options & EMB_READ_STITCHES)) {
+        return 1;
+    }
+    /* As with HUS, the decompressed buffers are sized from the header. */
+    if (!emb_pattern_limit(pattern, header.numberOfStitches,
+            3 * (size_t)EMB_MAX(header.numberOfStitches, 0))) {
+        return 0;
+    }
+    emb_fseek(file, header.attributeOffset, SEEK_SET);
     attributeData = (unsigned char*)malloc(header.xOffset - header.attributeOffset);
     if (!attributeData) {
         printf("ERROR: format-vip.c readVip(), cannot allocate memory for attributeData\n");
         return 0;
     }
-    fread(attributeData, 1, header.xOffset - header.attributeOffset, file); /* TODO: check return value */
+    emb_fread(attributeData, 1, header.xOffset - header.attributeOffset, file); /* TODO: check return value */
     attributeDataDecompressed = vipDecompressData(attributeData, header.xOffset - header.attributeOffset, header.numberOfStitches);
 
-    fseek(file, header.xOffset, SEEK_SET);
+    emb_fseek(file, header.xOffset, SEEK_SET);
     xData = (unsigned char*)malloc(header.yOffset - header.xOffset);
     if (!xData) {
         printf("ERROR: format-vip.c readVip(), cannot allocate memory for xData\n");
         return 0;
     }
-    fread(xData, 1, header.yOffset - header.xOffset, file); /* TODO: check return value */
+    emb_fread(xData, 1, header.yOffset - header.xOffset, file); /* TODO: check return value */
     xDecompressed = vipDecompressData(xData, header.yOffset - header.xOffset, header.numberOfStitches);
 
-    fseek(file, header.yOffset, SEEK_SET);
+    emb_fseek(file, header.yOffset, SEEK_SET);
     yData = (unsigned char*)malloc(fileLength - header.yOffset);
     if (!yData) { printf("ERROR: format-vip.c readVip(), cannot allocate memory for yData\n"); return 0; }
-    fread(yData, 1, fileLength - header.yOffset, file); /* TODO: check return value */
+    emb_fread(yData, 1, fileLength - header.yOffset, file); /* TODO: check return value */
     yDecompressed = vipDecompressData(yData, fileLength - header.yOffset, header.numberOfStitches);
 
-    for (i = 0; i < header.numberOfStitches; i++) {
-        emb_pattern_addStitchRel(pattern,
+    emb_pattern_reserve_stitches(pattern, header.numberOfStitches);
+    emb_stitch_batch_init(&batch, pattern);
+    for (i = 0; i < header.numberOfStitches && !file->stopped; i++) {
+        emb_stitch_batch_rel(&batch,
                     vipDecodeByte(xDecompressed[i]) / 10.0,
                     vipDecodeByte(yDecompressed[i]) / 10.0,
-                    vipDecodeStitchType(attributeDataDecompressed[i]), 1);
+                    vipDecodeStitchType(attributeDataDecompressed[i]));
     }
-    emb_pattern_addStitchRel(pattern, 0, 0, END, 1);
+    emb_stitch_batch_rel(&batch, 0, 0, END);
 
     safe_free(attributeData);
     safe_free(xData);
@@ -8094,7 +9665,7 @@ vipEncodeStitchType(int st)
 }
 
 char
-writeVip(EmbPattern* pattern, FILE* file)
+writeVip(EmbPattern* pattern, EmbStream* file)
 {
     EmbRect boundingRect;
     int stitchCount, minColors, patternColor;
@@ -8129,7 +9700,7 @@ writeVip(EmbPattern* pattern, FILE* file)
     /* emb_pattern_correctForMaxStitchLength(pattern, 0x7F, 0x7F); */
 
     patternColor = minColors;
-    if (emb_verbose>1) {
+    if (pattern->context->verbose>1) {
         printf("patternColor: %d\n", patternColor);
     }
     if (minColors > 24) {
@@ -8187,16 +9758,16 @@ writeVip(EmbPattern* pattern, FILE* file)
         for (i = 0; i < minColors << 2; ++i) {
             unsigned char tmpByte = (unsigned char) (decodedColors[i] ^ vipDecodingTable[i]);
             prevByte = (unsigned char) (tmpByte ^ prevByte);
-            fputc(prevByte, file);
+            emb_fputc(prevByte, file);
         }
         for (i = 0; i <= minColors; i++) {
             emb_write_i32(file, 1);
         }
         emb_write_u32(file, 0); /* string length */
         emb_write_i16(file, 0);
-        fwrite((char*) attributeCompressed, 1, attributeSize, file);
-        fwrite((char*) xCompressed, 1, xCompressedSize, file);
-        fwrite((char*) yCompressed, 1, yCompressedSize, file);
+        emb_fwrite((char*) attributeCompressed, 1, attributeSize, file);
+        emb_fwrite((char*) xCompressed, 1, xCompressedSize, file);
+        emb_fwrite((char*) yCompressed, 1, yCompressedSize, file);
     }
 
     safe_free(attributeCompressed);
@@ -8217,7 +9788,7 @@ writeVip(EmbPattern* pattern, FILE* file)
  * The Pfaff vp3 format is stitch-only.
  */
 unsigned char*
-vp3ReadString(FILE* file)
+vp3ReadString(EmbStream* file)
 {
     short stringLength;
     unsigned char* charString = 0;
@@ -8231,7 +9802,7 @@ vp3ReadString(FILE* file)
         printf("ERROR: format-vp3.c vp3ReadString(), cannot allocate memory for charString\n");
         return 0;
     }
-    fread(charString, 1, stringLength, file); /* TODO: check return value */
+    emb_fread(charString, 1, stringLength, file); /* TODO: check return value */
     return charString;
 }
 
@@ -8254,7 +9825,7 @@ vp3DecodeInt16(unsigned short inputByte)
 }
 
 vp3Hoop
-vp3ReadHoopSection(FILE* file)
+vp3ReadHoopSection(EmbStream* file)
 {
     vp3Hoop hoop;
 
@@ -8293,8 +9864,8 @@ vp3ReadHoopSection(FILE* file)
 
     /* yes, it seems this is _not_ big endian */
     hoop.threadLength = emb_read_i32(file);
-    hoop.unknown2 = (char)fgetc(file);
-    hoop.numberOfColors = (char)fgetc(file);
+    hoop.unknown2 = (char)emb_fgetc(file);
+    hoop.numberOfColors = (char)emb_fgetc(file);
     hoop.unknown3 = emb_read_i16be(file);
     hoop.unknown4 = emb_read_i32be(file);
     hoop.numberOfBytesRemaining = emb_read_i32be(file);
@@ -8302,9 +9873,9 @@ vp3ReadHoopSection(FILE* file)
     hoop.xOffset = emb_read_i32be(file);
     hoop.yOffset = emb_read_i32be(file);
 
-    hoop.byte1 = (char)fgetc(file);
-    hoop.byte2 = (char)fgetc(file);
-    hoop.byte3 = (char)fgetc(file);
+    hoop.byte1 = (char)emb_fgetc(file);
+    hoop.byte2 = (char)emb_fgetc(file);
+    hoop.byte3 = (char)emb_fgetc(file);
 
     /* Centered hoop dimensions */
     hoop.right2 = emb_read_i32be(file);
@@ -8318,8 +9889,9 @@ vp3ReadHoopSection(FILE* file)
 }
 
 char
-readVp3(EmbPattern* pattern, FILE* file)
+readVp3(EmbPattern* pattern, EmbStream* file)
 {
+    EmbStitchBatch batch;
     unsigned char magicString[5];
     unsigned char some;
     unsigned char* softwareVendorString = 0;
@@ -8335,7 +9907,7 @@ readVp3(EmbPattern* pattern, FILE* file)
     unsigned char* anotherCommentString = 0;
     int i;
 
-    fread(magicString, 1, 5, file); /* %vsm% */ /* TODO: check return value */
+    emb_fread(magicString, 1, 5, file); /* %vsm% */ /* TODO: check return value */
     LOAD_I8(file, some) /* 0 */
     softwareVendorString = vp3ReadString(file);
     REPORT_STR(softwareVendorString)
@@ -8343,7 +9915,7 @@ readVp3(EmbPattern* pattern, FILE* file)
     LOAD_I8(file, someByte)
     LOAD_I32(file, bytesRemainingInFile)
     fileCommentString = vp3ReadString(file);
-    hoopConfigurationOffset = (int)ftell(file);
+    hoopConfigurationOffset = (int)emb_ftell(file);
     REPORT_INT(hoopConfigurationOffset);
 
     vp3ReadHoopSection(file);
@@ -8354,15 +9926,15 @@ readVp3(EmbPattern* pattern, FILE* file)
     /* TODO: review v1 thru v18 variables and use emb_unused() if needed */
     for (i = 0; i < 18; i++) {
         unsigned char v1;
-        v1 = (char)fgetc(file);
-        if (emb_verbose>1) {
+        v1 = (char)emb_fgetc(file);
+        if (pattern->context->verbose>1) {
             printf("v%d = %d\n", i, v1);
         }
     }
 
     /* TODO: check return value */
     /* 0x78 0x78 0x55 0x55 0x01 0x00 */
-    if (fread(magicCode, 1, 6, file) != 6) {
+    if (emb_fread(magicCode, 1, 6, file) != 6) {
         puts("ERROR: Failed to read magicCode.");
         return 0;
     }
@@ -8371,8 +9943,9 @@ readVp3(EmbPattern* pattern, FILE* file)
     REPORT_STR(anotherSoftwareVendorString);
 
     numberOfColors = emb_read_i16be(file);
-    colorSectionOffset = (int)ftell(file);
+    colorSectionOffset = (int)emb_ftell(file);
 
+    emb_stitch_batch_init(&batch, pattern);
     for (i = 0; i < numberOfColors; i++) {
         EmbThread t;
         char tableSize;
@@ -8380,23 +9953,23 @@ readVp3(EmbPattern* pattern, FILE* file)
         unsigned char* threadColorNumber, *colorName, *threadVendor;
         int unknownThreadString, numberOfBytesInColor;
 
-        strcpy(t.catalogNumber, "");
-        strcpy(t.description, "");
-        fseek(file, colorSectionOffset, SEEK_SET);
-        printf("ERROR: format-vp3.c Color Check Byte #1: 0 == %d\n", (char)fgetc(file));
-        printf("ERROR: format-vp3.c Color Check Byte #2: 5 == %d\n", (char)fgetc(file));
-        printf("ERROR: format-vp3.c Color Check Byte #3: 0 == %d\n", (char)fgetc(file));
+        t.catalogNumber = "";
+        t.description = "";
+        emb_fseek(file, colorSectionOffset, SEEK_SET);
+        printf("ERROR: format-vp3.c Color Check Byte #1: 0 == %d\n", (char)emb_fgetc(file));
+        printf("ERROR: format-vp3.c Color Check Byte #2: 5 == %d\n", (char)emb_fgetc(file));
+        printf("ERROR: format-vp3.c Color Check Byte #3: 0 == %d\n", (char)emb_fgetc(file));
         colorSectionOffset = emb_read_i32be(file);
-        colorSectionOffset += ftell(file);
+        colorSectionOffset += emb_ftell(file);
         startX = emb_read_i32be(file);
         startY = emb_read_i32be(file);
-        emb_pattern_addStitchAbs(pattern, startX / 1000.0, -startY / 1000.0, JUMP, 1);
+        emb_stitch_batch_abs(&batch, startX / 1000.0, -startY / 1000.0, JUMP);
 
-        tableSize = (char)fgetc(file);
-        fseek(file, 1, SEEK_CUR);
+        tableSize = (char)emb_fgetc(file);
+        emb_fseek(file, 1, SEEK_CUR);
         embColor_read(file, &(t.color), 3);
         emb_pattern_addThread(pattern, t);
-        fseek(file, 6*tableSize - 1, SEEK_CUR);
+        emb_fseek(file, 6*tableSize - 1, SEEK_CUR);
 
         threadColorNumber = vp3ReadString(file);
         colorName = vp3ReadString(file);
@@ -8406,11 +9979,11 @@ readVp3(EmbPattern* pattern, FILE* file)
         offsetToNextColorY = emb_read_i32be(file);
 
         unknownThreadString = emb_read_i16be(file);
-        fseek(file, unknownThreadString, SEEK_CUR);
+        emb_fseek(file, unknownThreadString, SEEK_CUR);
         numberOfBytesInColor = emb_read_i32be(file);
-        fseek(file, 0x3, SEEK_CUR);
+        emb_fseek(file, 0x3, SEEK_CUR);
 
-        if (emb_verbose>1) {
+        if (pattern->context->verbose>1) {
             printf("number of bytes in color: %d\n", numberOfBytesInColor);
             printf("thread color number: %s\n", threadColorNumber);
             printf("offset to next color x: %d\n", offsetToNextColorX);
@@ -8420,10 +9993,10 @@ readVp3(EmbPattern* pattern, FILE* file)
             printf("fileCommentString: %s\n", fileCommentString);
         }
 
-        while (ftell(file) < colorSectionOffset - 1) {
-            int lastFilePosition = ftell(file);
-            int x = vp3Decode((char)fgetc(file));
-            int y = vp3Decode((char)fgetc(file));
+        while (emb_ftell(file) < colorSectionOffset - 1) {
+            int lastFilePosition = emb_ftell(file);
+            int x = vp3Decode((char)emb_fgetc(file));
+            int y = vp3Decode((char)emb_fgetc(file));
             short readIn;
             if (x == 0x80) {
                 switch (y) {
@@ -8435,55 +10008,57 @@ readVp3(EmbPattern* pattern, FILE* file)
                         x = vp3DecodeInt16(readIn);
                         readIn = emb_read_i16be(file);
                         y = vp3DecodeInt16(readIn);
-                        fseek(file, 2, SEEK_CUR);
-                        emb_pattern_addStitchRel(pattern, x/ 10.0, y / 10.0, TRIM, 1);
+                        emb_fseek(file, 2, SEEK_CUR);
+                        emb_stitch_batch_rel(&batch, x/ 10.0, y / 10.0, TRIM);
                         break;
                     }
                     default:
                         break;
                 }
             } else {
-                emb_pattern_addStitchRel(pattern, x / 10.0, y / 10.0, NORMAL, 1);
+                emb_stitch_batch_rel(&batch, x / 10.0, y / 10.0, NORMAL);
             }
 
-            if (ftell(file) == lastFilePosition) {
+            if (emb_ftell(file) == lastFilePosition) {
                 printf("ERROR: format-vp3.c could not read stitch block in entirety\n");
+                emb_stitch_batch_flush(&batch);
                 return 0;
             }
         }
         if (i + 1 < numberOfColors) {
-            emb_pattern_addStitchRel(pattern, 0, 0, STOP, 1);
+            emb_stitch_batch_rel(&batch, 0, 0, STOP);
         }
     }
+    emb_stitch_batch_flush(&batch);
     emb_pattern_flipVertical(pattern);
     return 1;
 }
 
 void
-vp3WriteStringLen(FILE* file, const char* str, int len)
+vp3WriteStringLen(EmbStream* file, const char* str, int len)
 {
     emb_write_u16be(file, len);
-    fwrite(str, 1, len, file);
+    emb_fwrite(str, 1, len, file);
 }
 
 void
-vp3WriteString(FILE* file, const char* str)
+vp3WriteString(EmbStream* file, const char* str)
 {
     vp3WriteStringLen(file, str, strlen(str));
 }
 
 void
-vp3PatchByteCount(FILE* file, int offset, int adjustment)
+vp3PatchByteCount(EmbStream* file, int offset, int adjustment)
 {
-    int currentPos = ftell(file);
-    fseek(file, offset, SEEK_SET);
+    int currentPos = emb_ftell(file);
+    emb_fseek(file, offset, SEEK_SET);
     printf("Patching byte count: %d\n", currentPos - offset + adjustment);
     emb_write_i32be(file, currentPos - offset + adjustment);
-    fseek(file, currentPos, SEEK_SET);
+    emb_fseek(file, currentPos, SEEK_SET);
 }
 
 char
-writeVp3(EmbPattern* pattern, FILE* file)
+writeVp3(EmbPattern* pattern, EmbStream* file)
 {
     EmbRect bounds;
     int remainingBytesPos, remainingBytesPos2;
@@ -8499,11 +10074,11 @@ writeVp3(EmbPattern* pattern, FILE* file)
 
     emb_pattern_flipVertical(pattern);
 
-    fwrite("%vsm%\0", 1, 6, file);
+    emb_fwrite("%vsm%\0", 1, 6, file);
     vp3WriteString(file, "Embroidermodder");
-    fwrite("\x00\x02\x00", 1, 3, file);
+    emb_fwrite("\x00\x02\x00", 1, 3, file);
 
-    remainingBytesPos = ftell(file);
+    remainingBytesPos = emb_ftell(file);
     emb_write_i32(file, 0); /* placeholder */
     vp3WriteString(file, "");
     emb_write_i32be(file, (bounds.x + bounds.w) * 1000);
@@ -8511,13 +10086,13 @@ writeVp3(EmbPattern* pattern, FILE* file)
     emb_write_i32be(file, bounds.x * 1000);
     emb_write_i32be(file, bounds.y * 1000);
     emb_write_i32(file, 0); /* this would be some (unknown) function of thread length */
-    fputc(0, file);
+    emb_fputc(0, file);
 
     numberOfColors = emb_pattern_color_count(pattern, color);
-    fputc(numberOfColors, file);
-    fwrite("\x0C\x00\x01\x00\x03\x00", 1, 6, file);
+    emb_fputc(numberOfColors, file);
+    emb_fwrite("\x0C\x00\x01\x00\x03\x00", 1, 6, file);
 
-    remainingBytesPos2 = ftell(file);
+    remainingBytesPos2 = emb_ftell(file);
     emb_write_i32(file, 0); /* placeholder */
 
     emb_write_i32be(file, 0); /* origin X */
@@ -8539,7 +10114,7 @@ writeVp3(EmbPattern* pattern, FILE* file)
     emb_write_i32be(file, 0);
     emb_write_i32be(file, 4096);
 
-    fwrite("xxPP\x01\0", 1, 6, file);
+    emb_fwrite("xxPP\x01\0", 1, 6, file);
     vp3WriteString(file, "");
     emb_write_i16be(file, numberOfColors);
 
@@ -8557,13 +10132,13 @@ writeVp3(EmbPattern* pattern, FILE* file)
         s.flags = 0;
 
         if (!first) {
-            fputc(0, file);
+            emb_fputc(0, file);
         }
-        fputc(0, file);
-        fputc(5, file);
-        fputc(0, file);
+        emb_fputc(0, file);
+        emb_fputc(5, file);
+        emb_fputc(0, file);
 
-        colorSectionLengthPos = ftell(file);
+        colorSectionLengthPos = emb_ftell(file);
         emb_write_i32(file, 0); /* placeholder */
 
         /*
@@ -8576,7 +10151,7 @@ writeVp3(EmbPattern* pattern, FILE* file)
 
         s = pointer->stitch;
         */
-        if (emb_verbose>1) {
+        if (pattern->context->verbose>1) {
             printf("%d\n", j);
             printf("format-vp3.c DEBUG %d, %f, %f\n", s.flags, s.x, s.y);
         }
@@ -8589,17 +10164,17 @@ writeVp3(EmbPattern* pattern, FILE* file)
         lastX = s.x;
         lastY = s.y;
         lastColor = s.color;
-        if (emb_verbose>1) {
+        if (pattern->context->verbose>1) {
             printf("last %f %f %d\n", lastX, lastY, lastColor);
         }
 
-        fwrite("\x01\x00", 1, 2, file);
+        emb_fwrite("\x01\x00", 1, 2, file);
 
         printf("format-vp3.c writeVp3(), switching to color (%d, %d, %d)\n", color.r, color.g, color.b);
         embColor_write(file, color, 4);
 
-        fwrite("\x00\x00\x05", 1, 3, file);
-        fputc(40, file);
+        emb_fwrite("\x00\x00\x05", 1, 3, file);
+        emb_fputc(40, file);
 
         vp3WriteString(file, "");
 
@@ -8613,12 +10188,12 @@ writeVp3(EmbPattern* pattern, FILE* file)
 
         vp3WriteStringLen(file, "\0", 1);
 
-        colorSectionStitchBytes = ftell(file);
+        colorSectionStitchBytes = emb_ftell(file);
         emb_write_i32(file, 0); /* placeholder */
 
-        fputc(10, file);
-        fputc(246, file);
-        fputc(0, file);
+        emb_fputc(10, file);
+        emb_fputc(246, file);
+        emb_fputc(0, file);
 
         /*
         for (j=i; j<pattern->stitch_list->count; j++) {
@@ -8639,18 +10214,18 @@ writeVp3(EmbPattern* pattern, FILE* file)
             lastY = lastY + dy / 10.0;
 
             if (dx < -127 || dx > 127 || dy < -127 || dy > 127) {
-                fputc(128, file);
-                fputc(1, file);
+                emb_fputc(128, file);
+                emb_fputc(1, file);
                 emb_write_i16be(file, dx);
                 emb_write_i16be(file, dy);
-                fputc(128, file);
-                fputc(2, file);
+                emb_fputc(128, file);
+                emb_fputc(2, file);
             }
             else {
                 char b[2];
                 b[0] = dx;
                 b[1] = dy;
-                fwrite(b, 1, 2, file);
+                emb_fwrite(b, 1, 2, file);
             }
 
             pointer = pointer->next;
@@ -8685,43 +10260,45 @@ xxxDecodeByte(unsigned char inputByte)
 }
 
 char
-readXxx(EmbPattern* pattern, FILE* file)
+readXxx(EmbPattern* pattern, EmbStream* file)
 {
+    EmbStitchBatch batch;
     int dx = 0, dy = 0, numberOfColors, paletteOffset, i;
     char thisStitchJump = 0;
 
-    if (emb_verbose>1) {
+    if (pattern->context->verbose>1) {
         puts("readXxx has been overridden.");
         return 0;
     }
 
-    fseek(file, 0x27, SEEK_SET);
+    emb_fseek(file, 0x27, SEEK_SET);
     numberOfColors = emb_read_i16(file);
-    fseek(file, 0xFC, SEEK_SET);
+    emb_fseek(file, 0xFC, SEEK_SET);
     paletteOffset = emb_read_i32(file);
-    fseek(file, paletteOffset + 6, SEEK_SET);
+    emb_fseek(file, paletteOffset + 6, SEEK_SET);
 
     for (i = 0; i < numberOfColors; i++) {
         EmbThread thread;
-        strcpy(thread.catalogNumber, "NULL");
-        strcpy(thread.description, "NULL");
-        fseek(file, 1, SEEK_CUR);
+        thread.catalogNumber = "NULL";
+        thread.description = "NULL";
+        emb_fseek(file, 1, SEEK_CUR);
         embColor_read(file, &(thread.color), 3);
         emb_pattern_addThread(pattern, thread);
     }
-    fseek(file, 0x100, SEEK_SET);
+    emb_fseek(file, 0x100, SEEK_SET);
 
-    for (i = 0; !feof(file) && ftell(file) < paletteOffset; i++) {
+    emb_stitch_batch_init(&batch, pattern);
+    for (i = 0; !emb_feof(file) && emb_ftell(file) < paletteOffset; i++) {
         unsigned char b0, b1;
         int flags;
         flags = NORMAL;
         if (thisStitchJump) flags = TRIM;
         thisStitchJump = 0;
-        b0 = (char)fgetc(file);
-        b1 = (char)fgetc(file);
+        b0 = (char)emb_fgetc(file);
+        b1 = (char)emb_fgetc(file);
         /* TODO: ARE THERE OTHER BIG JUMP CODES? */
         if (b0 == 0x7E || b0 == 0x7D) {
-            dx = b1 + ((char)fgetc(file) << 8);
+            dx = b1 + ((char)emb_fgetc(file) << 8);
             dx = ((int16_t) dx);
             dy = emb_read_i16(file);
             flags = TRIM;
@@ -8734,8 +10311,8 @@ readXxx(EmbPattern* pattern, FILE* file)
                 flags = STOP;
             } else if (b1 == 1) {
                 flags = TRIM;
-                b0 = (char)fgetc(file);
-                b1 = (char)fgetc(file);
+                b0 = (char)emb_fgetc(file);
+                b1 = (char)emb_fgetc(file);
             } else {
                 continue;
             }
@@ -8745,36 +10322,37 @@ readXxx(EmbPattern* pattern, FILE* file)
             dx = xxxDecodeByte(b0);
             dy = xxxDecodeByte(b1);
         }
-        emb_pattern_addStitchRel(pattern, dx / 10.0, dy / 10.0, flags, 1);
+        emb_stitch_batch_rel(&batch, dx / 10.0, dy / 10.0, flags);
     }
     /* TODO: check end of pattern for multiple STOPs */
+    emb_stitch_batch_flush(&batch);
     return 1;
 }
 
 void
-xxxEncodeStop(FILE* file, EmbStitch s)
+xxxEncodeStop(EmbStream* file, EmbStitch s)
 {
-    fputc((unsigned char)0x7F, file);
-    fputc((unsigned char)(s.color + 8), file);
+    emb_fputc((unsigned char)0x7F, file);
+    emb_fputc((unsigned char)(s.color + 8), file);
 }
 
 void
-xxxEncodeStitch(FILE* file, EmbReal deltaX, EmbReal deltaY, int flags)
+xxxEncodeStitch(EmbStream* file, EmbReal deltaX, EmbReal deltaY, int flags)
 {
     if ((flags & (JUMP | TRIM)) && (fabs(deltaX) > 124 || fabs(deltaY) > 124)) {
-        fputc(0x7E, file);
+        emb_fputc(0x7E, file);
         /* Does this cast work right? */
         emb_write_i16(file, (int16_t)deltaX);
         emb_write_i16(file, (int16_t)deltaY);
     } else {
         /* TODO: Verify this works after changing this to unsigned char */
-        fputc((unsigned char)emb_round(deltaX), file);
-        fputc((unsigned char)emb_round(deltaY), file);
+        emb_fputc((unsigned char)emb_round(deltaX), file);
+        emb_fputc((unsigned char)emb_round(deltaY), file);
     }
 }
 
 void
-xxxEncodeDesign(FILE* file, EmbPattern* p)
+xxxEncodeDesign(EmbStream* file, EmbPattern* p)
 {
     int i;
     EmbReal thisX = 0.0f;
@@ -8803,7 +10381,7 @@ xxxEncodeDesign(FILE* file, EmbPattern* p)
 }
 
 char
-writeXxx(EmbPattern* pattern, FILE* file)
+writeXxx(EmbPattern* pattern, EmbStream* file)
 {
     int i;
     EmbRect rect;
@@ -8843,22 +10421,22 @@ writeXxx(EmbPattern* pattern, FILE* file)
     /* place holder for end of stitches */
     emb_write_i32(file, 0x0000);
     xxxEncodeDesign(file, pattern);
-    endOfStitches = ftell(file);
-    fseek(file, 0xFC, SEEK_SET);
+    endOfStitches = emb_ftell(file);
+    emb_fseek(file, 0xFC, SEEK_SET);
     emb_write_u32(file, endOfStitches);
-    fseek(file, 0, SEEK_END);
+    emb_fseek(file, 0, SEEK_END);
     /* is this really correct? */
-    fwrite("\x7F\x7F\x03\x14\x00\x00", 1, 6, file);
+    emb_fwrite("\x7F\x7F\x03\x14\x00\x00", 1, 6, file);
 
     for (i = 0; i < pattern->thread_list->count; i++) {
         EmbColor c = pattern->thread_list->thread[i].color;
-        fputc(0x00, file);
+        emb_fputc(0x00, file);
         embColor_write(file, c, 3);
     }
     for (i = 0; i < (22 - pattern->thread_list->count); i++) {
         emb_write_u32(file, 0x01000000);
     }
-    fwrite("\x00\x01", 1, 2, file);
+    emb_fwrite("\x00\x01", 1, 2, file);
     return 1;
 }
 
@@ -8870,30 +10448,30 @@ writeXxx(EmbPattern* pattern, FILE* file)
  */
 
 char
-readZsk(EmbPattern* pattern, FILE* file)
+readZsk(EmbPattern* pattern, EmbStream* file)
 {
     char b[3];
     unsigned char colorNumber;
 
-    fseek(file, 0, SEEK_END);
-    if (ftell(file) < 0x230) {
+    emb_fseek(file, 0, SEEK_END);
+    if (emb_ftell(file) < 0x230) {
         return 0;
     }
 
-    fseek(file, 0x230, SEEK_SET);
-    colorNumber = fgetc(file);
+    emb_fseek(file, 0x230, SEEK_SET);
+    colorNumber = emb_fgetc(file);
     while (colorNumber != 0) {
         EmbThread t;
         embColor_read(file, &(t.color), 3);
-        strcpy(t.catalogNumber, "");
-        strcpy(t.description, "");
+        t.catalogNumber = "";
+        t.description = "";
         emb_pattern_addThread(pattern, t);
-        fseek(file, 0x48, SEEK_CUR);
-        colorNumber = fgetc(file);
+        emb_fseek(file, 0x48, SEEK_CUR);
+        colorNumber = emb_fgetc(file);
     }
-    fseek(file, 0x2E, SEEK_CUR);
+    emb_fseek(file, 0x2E, SEEK_CUR);
 
-    while (fread(b, 1, 3, file) == 3) {
+    while (emb_fread(b, 1, 3, file) == 3) {
         int stitchType = NORMAL;
         if (b[0] & 0x04) {
             b[2] = -b[2];
@@ -8929,17 +10507,17 @@ readZsk(EmbPattern* pattern, FILE* file)
 
 /* based on the readZsk function */
 char
-writeZsk(EmbPattern* pattern, FILE* file)
+writeZsk(EmbPattern* pattern, EmbStream* file)
 {
     int i;
     fpad(file, 0x00, 0x230);
 
-    fprintf(file, "%c", pattern->thread_list->count);
+    emb_fprintf(file, "%c", pattern->thread_list->count);
     for (i=pattern->thread_list->count; i>0; i--) {
         EmbThread t = pattern->thread_list->thread[i-1];
         embColor_write(file, t.color, 3);
         fpad(file, 0x00, 0x48);
-        fprintf(file, "%c", i-1);
+        emb_fprintf(file, "%c", i-1);
     }
 
     fpad(file, 0x00, 0x2E);
@@ -8976,10 +10554,10 @@ writeZsk(EmbPattern* pattern, FILE* file)
             b[0] |= 0x20;
             b[1] = 0x80;
             b[2] = 0x00;
-            fwrite(b, 1, 3, file);
+            emb_fwrite(b, 1, 3, file);
             break;
         }
-        fwrite(b, 1, 3, file);
+        emb_fwrite(b, 1, 3, file);
     }
     return 1;
 }
@@ -2589,19 +2589,19 @@ save_to_polyline(EmbPattern* pattern, const EmbVector& objPos, const QPainterPat
 {
     float startX = objPos.x();
     float startY = objPos.y();
-    EmbArray *pointList = emb_array_create(EMB_POINT);
-    EmbPoint lastPoint;
+    EmbVectorList *pointList = emb_vector_list_create(objPath.elementCount());
+    EmbVector lastPoint;
     QPainterPath::Element element;
     for (int i = 0; i < objPath.elementCount(); ++i) {
         element = objPath.elementAt(i);
         if (pointList->count == 0) {
-            lastPoint.position.x = element.x + startX;
-            lastPoint.position.y = -(element.y + startY);
-            emb_array_addPoint(pointList, lastPoint);
+            lastPoint.x = element.x + startX;
+            lastPoint.y = -(element.y + startY);
+            emb_vector_list_add(pointList, lastPoint);
         }
         else {
-            lastPoint.position.x += element.x + startX;
-            lastPoint.position.y += -(element.y + startY);
+            lastPoint.x += element.x + startX;
+            lastPoint.y += -(element.y + startY);
         }
     }
 
@@ -0,0 +1,587 @@
+/*! \file loader.c
+ * \brief Reading many input files at once for the batch converter.
+ *
+ * Libembroidery 1.0.0-alpha
+ * https://www.libembroidery.org
+ *
+ * A library for reading, writing, altering and otherwise
+ * processing machine embroidery files and designs.
+ *
+ * Also, the core library supporting the Embroidermodder Project's
+ * family of machine embroidery interfaces.
+ *
+ * -----------------------------------------------------------------------------
+ *
+ * Copyright 2018-2025 The Embroidermodder Team
+ * Licensed under the terms of the zlib license.
+ *
+ * -----------------------------------------------------------------------------
+ *
+ * Unlike the rest of the library this file uses POSIX and Linux calls
+ * beyond those in the C standard, so it asks for them before including
+ * anything. Where they are missing every loader falls back to
+ * emb_stream_open().
+ *
+ * A loader turns a list of file names into memory streams that the
+ * readers decode from, see emb_pattern_read_stream(). There are three:
+ *
+ *   EMB_LOADER_MAP      maps each file, as emb_stream_open() does, and
+ *                       touches its pages so the reads happen here
+ *                       rather than in the decoder.
+ *   EMB_LOADER_PREAD    reads each file whole into a buffer with one
+ *                       pread() where its size is known.
+ *   EMB_LOADER_IO_URING submits the opens, reads and closes of up to
+ *                       EMB_LOADER_DEPTH files to the kernel at once, so a
+ *                       library of small designs costs three system calls
+ *                       per group of files rather than three per file.
+ *
+ * The io_uring loader reads into buffers registered with the kernel once
+ * and copies each file out of its buffer into a stream of its own, so the
+ * buffers can take the next group while the streams wait to be decoded.
+ * Files larger than a buffer are finished with pread(). Each step falls
+ * back to the plain call if the kernel does not know the operation, and
+ * a loader that cannot set up a ring at all, or whose ring fails, acts
+ * as EMB_LOADER_PREAD.
+ */
+
+#if !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "embroidery.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define EMB_LOADER_POSIX
+#endif
+
+#if defined(__linux__) && defined(__GNUC__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) \
+    && defined(__NR_io_uring_register)
+#define EMB_LOADER_URING
+#endif
+#endif
+
+#if defined(EMB_LOADER_URING)
+/* The parts of a ring that are mapped from the kernel. */
+typedef struct EmbRing_ {
+    int fd;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    struct io_uring_sqe *sqes;
+    void *sq_ring;
+    void *cq_ring;
+    size_t sq_ring_size;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    int registered;        /* the buffers are registered with the kernel */
+} EmbRing;
+#endif
+
+struct EmbLoader_ {
+    int kind;
+#if defined(EMB_LOADER_URING)
+    EmbRing ring;
+    unsigned char *buffers;
+    struct iovec iov[EMB_LOADER_DEPTH];
+#endif
+};
+
+/* Reads a byte of each page of a stream, so that a mapped file is in
+ * memory before the decoder gets to it.
+ */
+static void
+emb_stream_touch(EmbStream *stream)
+{
+    volatile unsigned char sum = 0;
+    size_t i;
+    if (!stream->data) {
+        return;
+    }
+    for (i = 0; i < stream->length; i += 4096) {
+        sum ^= stream->data[i];
+    }
+    (void)sum;
+}
+
+#if defined(EMB_LOADER_POSIX)
+/* Reads the file a fd from a offset to its end into a stream that
+ * already holds its first a offset bytes, if any. Returns 0 on failure.
+ */
+static int
+emb_stream_pread_rest(EmbStream *stream, int fd, size_t offset)
+{
+    while (offset < stream->capacity) {
+        ssize_t n = pread(fd, stream->data + offset,
+            stream->capacity - offset, (off_t)offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return 0;
+        }
+        if (n == 0) {
+            break;
+        }
+        offset += (size_t)n;
+    }
+    stream->length = offset;
+    return 1;
+}
+
+/* Returns a stream of the whole of the open file a fd with a head
+ * bytes of it already read into a buffer, or 0 on failure.
+ */
+static EmbStream*
+emb_stream_pread(int fd, const unsigned char *buffer, size_t head)
+{
+    struct stat st;
+    EmbStream *stream;
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+        return emb_stream_fd(fd, "rb");
+    }
+    stream = emb_stream_buffer(EMB_MAX((size_t)st.st_size, head));
+    if (!stream) {
+        return 0;
+    }
+    if (head > 0) {
+        memcpy(stream->data, buffer, head);
+    }
+    if (!emb_stream_pread_rest(stream, fd, head)) {
+        emb_stream_close(stream);
+        return 0;
+    }
+    return stream;
+}
+#endif
+
+/* Loads the file a fileName into memory one call at a time, mapped for
+ * EMB_LOADER_MAP and read otherwise.
+ */
+static EmbStream*
+emb_loader_open(int kind, const char *fileName)
+{
+    EmbStream *stream;
+#if defined(EMB_LOADER_POSIX)
+    if (kind != EMB_LOADER_MAP) {
+        int fd = open(fileName, O_RDONLY);
+        if (fd < 0) {
+            return 0;
+        }
+        stream = emb_stream_pread(fd, 0, 0);
+        close(fd);
+        return stream;
+    }
+#endif
+    (void)kind;
+    stream = emb_stream_open(fileName, "rb");
+    if (stream) {
+        emb_stream_touch(stream);
+    }
+    return stream;
+}
+
+#if defined(EMB_LOADER_URING)
+static void
+emb_ring_free(EmbRing *ring)
+{
+    if (ring->sqes) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_ring && ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    if (ring->sq_ring) {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+    ring->fd = -1;
+}
+
+/* Sets up a ring of a entries. Returns 0 if the system will not. */
+static int
+emb_ring_init(EmbRing *ring, unsigned entries)
+{
+    struct io_uring_params params;
+    unsigned char *sq, *cq;
+    memset(ring, 0, sizeof(EmbRing));
+    memset(&params, 0, sizeof(params));
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) {
+        ring->fd = -1;
+        return 0;
+    }
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes
+        + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->sq_ring_size = EMB_MAX(ring->sq_ring_size, ring->cq_ring_size);
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+    ring->sq_ring = mmap(0, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        ring->sq_ring = 0;
+        emb_ring_free(ring);
+        return 0;
+    }
+    ring->cq_ring = ring->sq_ring;
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        ring->cq_ring = mmap(0, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) {
+            ring->cq_ring = 0;
+            emb_ring_free(ring);
+            return 0;
+        }
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe*)mmap(0, ring->sqes_size,
+        PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = 0;
+        emb_ring_free(ring);
+        return 0;
+    }
+    sq = (unsigned char*)ring->sq_ring;
+    cq = (unsigned char*)ring->cq_ring;
+    ring->sq_head = (unsigned*)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    return 1;
+}
+
+/* Returns the next submission entry, cleared, to be filled in and
+ * passed to emb_ring_push().
+ */
+static struct io_uring_sqe*
+emb_ring_next(EmbRing *ring)
+{
+    unsigned tail = *ring->sq_tail;
+    struct io_uring_sqe *sqe = ring->sqes + (tail & *ring->sq_mask);
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    return sqe;
+}
+
+static void
+emb_ring_push(EmbRing *ring)
+{
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & *ring->sq_mask;
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/* Stores the result of each completed entry of a ring in a results by
+ * its user data. Returns the number of entries completed.
+ */
+static int
+emb_ring_reap(EmbRing *ring, int *results)
+{
+    unsigned head = *ring->cq_head;
+    int completed = 0;
+    while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe *cqe = ring->cqes + (head & *ring->cq_mask);
+        results[cqe->user_data] = cqe->res;
+        head++;
+        completed++;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    return completed;
+}
+
+/* Submits the a n entries pushed and waits for them all to complete,
+ * storing the result of each in a results by its user data.
+ *
+ * Returns 0 if the ring fails. The entries the kernel did not take are
+ * taken back off the ring and the ones it did are waited for, so only
+ * the results of those are stored. The ring is not to be used again.
+ */
+static int
+emb_ring_run(EmbRing *ring, int n, int *results)
+{
+    int submitted = 0, completed = 0, failed = 0;
+    while (completed < n) {
+        long r = syscall(__NR_io_uring_enter, ring->fd, n - submitted,
+            n - completed, IORING_ENTER_GETEVENTS, 0, 0);
+        if (r < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (failed) {
+                emb_ring_reap(ring, results);
+                break;
+            }
+            __atomic_store_n(ring->sq_tail,
+                *ring->sq_tail - (unsigned)(n - submitted), __ATOMIC_RELEASE);
+            n = submitted;
+            failed = 1;
+        }
+        else {
+            submitted += (int)r;
+        }
+        completed += emb_ring_reap(ring, results);
+    }
+    return !failed;
+}
+
+/* Gives up the ring of a loader after it failed, so the loader reads
+ * with pread() from then on. The buffers stay with the loader until it
+ * is freed, in case the kernel has not finished with them.
+ */
+static void
+emb_loader_drop_ring(EmbLoader *loader)
+{
+    emb_ring_free(&loader->ring);
+    loader->kind = EMB_LOADER_PREAD;
+}
+
+/* Loads a n files of no more than EMB_LOADER_DEPTH through the ring
+ * of a loader. Returns 0 if the ring fails, having closed the files it
+ * opened and given up the ring, leaving the files to be loaded another
+ * way.
+ */
+static int
+emb_loader_uring(EmbLoader *loader, char **files, int n, EmbStream **streams)
+{
+    EmbRing *ring = &loader->ring;
+    int fds[EMB_LOADER_DEPTH], res[EMB_LOADER_DEPTH];
+    int i, k;
+
+    /* Open every file. */
+    for (i = 0; i < n; i++) {
+        struct io_uring_sqe *sqe = emb_ring_next(ring);
+        fds[i] = -ECANCELED;
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (unsigned long)files[i];
+        sqe->open_flags = O_RDONLY | O_CLOEXEC;
+        sqe->user_data = i;
+        emb_ring_push(ring);
+    }
+    if (!emb_ring_run(ring, n, fds)) {
+        for (i = 0; i < n; i++) {
+            if (fds[i] >= 0) {
+                close(fds[i]);
+            }
+        }
+        emb_loader_drop_ring(loader);
+        return 0;
+    }
+    for (i = 0; i < n; i++) {
+        if (fds[i] == -EINVAL) {
+            fds[i] = open(files[i], O_RDONLY);
+        }
+    }
+
+    /* Read the start of each into a buffer of its own. */
+    k = 0;
+    for (i = 0; i < n; i++) {
+        struct io_uring_sqe *sqe;
+        res[i] = -EBADF;
+        if (fds[i] < 0) {
+            continue;
+        }
+        sqe = emb_ring_next(ring);
+        sqe->fd = fds[i];
+        sqe->off = 0;
+        if (loader->ring.registered) {
+            sqe->opcode = IORING_OP_READ_FIXED;
+            sqe->addr = (unsigned long)loader->iov[i].iov_base;
+            sqe->len = (unsigned)loader->iov[i].iov_len;
+            sqe->buf_index = (unsigned short)i;
+        }
+        else {
+            sqe->opcode = IORING_OP_READV;
+            sqe->addr = (unsigned long)(loader->iov + i);
+            sqe->len = 1;
+        }
+        sqe->user_data = i;
+        emb_ring_push(ring);
+        k++;
+    }
+    if (k > 0 && !emb_ring_run(ring, k, res)) {
+        for (i = 0; i < n; i++) {
+            if (fds[i] >= 0) {
+                close(fds[i]);
+            }
+        }
+        emb_loader_drop_ring(loader);
+        return 0;
+    }
+
+    /* Hand each file over, reading the rest of those that filled their
+     * buffer, and close them all at once.
+     */
+    k = 0;
+    for (i = 0; i < n; i++) {
+        size_t head = (res[i] > 0) ? (size_t)res[i] : 0;
+        struct io_uring_sqe *sqe;
+        streams[i] = 0;
+        if (fds[i] < 0) {
+            continue;
+        }
+        if (res[i] >= 0 && head < EMB_LOADER_BUFFER_SIZE) {
+            streams[i] = emb_stream_buffer(head);
+            if (streams[i]) {
+                memcpy(streams[i]->data, loader->iov[i].iov_base, head);
+                streams[i]->length = head;
+            }
+        }
+        else {
+            if (res[i] < 0) {
+                head = 0;
+            }
+            streams[i] = emb_stream_pread(fds[i],
+                (const unsigned char*)loader->iov[i].iov_base, head);
+        }
+        sqe = emb_ring_next(ring);
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = fds[i];
+        sqe->user_data = i;
+        emb_ring_push(ring);
+        res[i] = -ECANCELED;
+        k++;
+    }
+    if (k > 0 && !emb_ring_run(ring, k, res)) {
+        emb_loader_drop_ring(loader);
+    }
+    for (i = 0; i < n; i++) {
+        if (fds[i] >= 0 && (res[i] == -EINVAL || res[i] == -ECANCELED)) {
+            close(fds[i]);
+        }
+    }
+    return 1;
+}
+#endif
+
+/* Creates a loader of a kind, or of the nearest kind the system has:
+ * EMB_LOADER_IO_URING falls back to EMB_LOADER_PREAD, which falls back
+ * to EMB_LOADER_MAP. See emb_loader_kind() for the one it settled on.
+ *
+ * An io_uring loader is not thread safe, the others are.
+ */
+EmbLoader*
+emb_loader_create(int kind)
+{
+    EmbLoader *loader = (EmbLoader*)malloc(sizeof(EmbLoader));
+    if (!loader) {
+        printf("ERROR: emb_loader_create(), cannot allocate loader\n");
+        return 0;
+    }
+    memset(loader, 0, sizeof(EmbLoader));
+    loader->kind = kind;
+#if defined(EMB_LOADER_URING)
+    loader->ring.fd = -1;
+    if (kind == EMB_LOADER_IO_URING) {
+        int i;
+        loader->buffers = (unsigned char*)malloc(
+            EMB_LOADER_DEPTH * EMB_LOADER_BUFFER_SIZE);
+        if (loader->buffers && emb_ring_init(&loader->ring, EMB_LOADER_DEPTH)) {
+            for (i = 0; i < EMB_LOADER_DEPTH; i++) {
+                loader->iov[i].iov_base = loader->buffers
+                    + i * EMB_LOADER_BUFFER_SIZE;
+                loader->iov[i].iov_len = EMB_LOADER_BUFFER_SIZE;
+            }
+            /* Registering can fail on the locked memory limit, in which
+             * case the buffers are passed with each read instead.
+             */
+            loader->ring.registered = syscall(__NR_io_uring_register,
+                loader->ring.fd, IORING_REGISTER_BUFFERS, loader->iov,
+                EMB_LOADER_DEPTH) == 0;
+        }
+        else {
+            safe_free(loader->buffers);
+            loader->kind = EMB_LOADER_PREAD;
+        }
+    }
+#else
+    if (kind == EMB_LOADER_IO_URING) {
+        loader->kind = EMB_LOADER_PREAD;
+    }
+#endif
+#if !defined(EMB_LOADER_POSIX)
+    loader->kind = EMB_LOADER_MAP;
+#endif
+    return loader;
+}
+
+/* Returns the kind of a loader, after any fallback. */
+int
+emb_loader_kind(const EmbLoader *loader)
+{
+    return loader->kind;
+}
+
+/* Loads the a count files a files into memory, setting each of
+ * a streams to a stream of the whole file or to 0 for a file that cannot
+ * be read. Close the streams with emb_stream_close().
+ *
+ * Returns the number of files loaded.
+ */
+int
+emb_loader_load(EmbLoader *loader, char **files, int count,
+    EmbStream **streams)
+{
+    int i, loaded = 0;
+    for (i = 0; i < count; i += EMB_LOADER_DEPTH) {
+        int j, n = EMB_MIN(count - i, EMB_LOADER_DEPTH);
+        int done = 0;
+#if defined(EMB_LOADER_URING)
+        if (loader->kind == EMB_LOADER_IO_URING) {
+            done = emb_loader_uring(loader, files + i, n, streams + i);
+        }
+#endif
+        for (j = 0; j < n; j++) {
+            if (!done) {
+                streams[i+j] = emb_loader_open(loader->kind, files[i+j]);
+            }
+            if (streams[i+j]) {
+                loaded++;
+            }
+            else {
+                printf("ERROR: Failed to open file with name: %s.\n",
+                    files[i+j]);
+            }
+        }
+    }
+    return loaded;
+}
+
+/* Frees a loader. */
+void
+emb_loader_free(EmbLoader *loader)
+{
+    if (!loader) {
+        return;
+    }
+#if defined(EMB_LOADER_URING)
+    emb_ring_free(&loader->ring);
+    safe_free(loader->buffers);
+#endif
+    safe_free(loader);
+}
@@ -37,6 +37,43 @@
 
 #include "embroidery.h"
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <pthread.h>
+#define EMB_STREAM_MMAP
+#define EMB_THREADS
+#endif
+
+/* The most workers emb_parallel_for() starts. */
+#define EMB_MAX_THREADS            64
+
+/* The text each worker of emb_stream_parse_lines() takes at a time. */
+#define EMB_PARSE_CHUNK_SIZE      (1024*1024)
+
+/* The step in which files that cannot be mapped are loaded. */
+#define EMB_STREAM_LOAD_SIZE      (64*1024)
+
+#if defined(__SSE2__)
+#define EMB_COLUMNS_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define EMB_COLUMNS_NEON
+#include <arm_neon.h>
+#endif
+
+#if defined(__SSSE3__)
+#define EMB_TAJIMA_SSSE3
+#include <tmmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define EMB_TAJIMA_NEON
+#endif
+
 /* Internal Data
  * ----------------------------------------------------------------------------
  *
@@ -118,7 +155,9 @@ const int NUMBINS = 10;
 double epsilon = 0.000000001;
 
 EmbThread black_thread = { { 0, 0, 0 }, "Black", "Black" };
-int emb_verbose = 0;
+
+/* The context of the functions that do not take one. */
+static EmbContext emb_default_context;
 
 const EmbReal embConstantPi = 3.1415926535;
 
@@ -424,108 +463,718 @@ fix_endian(char *a, int bytes, int endian)
     }
 }
 
-/* Read a little-endian signed 16-bit integer. */
-int16_t
-emb_read_i16(FILE* f)
+/* Parallel work.
+ *
+ * emb_parallel_for() runs a task over the indices 0 to count-1 on up to
+ * threads workers, the calling thread being one of them. Each worker
+ * takes the next index as it finishes one, so uneven items balance out.
+ * Without thread support the items run in order on the calling thread.
+ */
+
+/* Returns the number of processors online, or 1 if it is not known. */
+int
+emb_cpu_count(void)
+{
+#if defined(EMB_THREADS)
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n > 0) {
+        return (int)n;
+    }
+#endif
+    return 1;
+}
+
+#if defined(EMB_THREADS)
+typedef struct EmbParallel_ {
+    EmbTask task;
+    void *data;
+    int count;
+    int next;
+    pthread_mutex_t lock;
+} EmbParallel;
+
+static void*
+emb_parallel_worker(void *arg)
+{
+    EmbParallel *job = (EmbParallel*)arg;
+    for (;;) {
+        int i;
+        pthread_mutex_lock(&job->lock);
+        i = job->next++;
+        pthread_mutex_unlock(&job->lock);
+        if (i >= job->count) {
+            break;
+        }
+        job->task(job->data, i);
+    }
+    return 0;
+}
+#endif
+
+/* Runs a task for each index below a count, with a data passed through.
+ * A threads of 0 or less uses a worker per processor.
+ */
+void
+emb_parallel_for(EmbTask task, void *data, int count, int threads)
+{
+    int i;
+    if (threads <= 0) {
+        threads = emb_cpu_count();
+    }
+    threads = EMB_MIN(threads, EMB_MIN(count, EMB_MAX_THREADS));
+#if defined(EMB_THREADS)
+    if (threads > 1) {
+        pthread_t workers[EMB_MAX_THREADS];
+        int started = 0;
+        EmbParallel job;
+        job.task = task;
+        job.data = data;
+        job.count = count;
+        job.next = 0;
+        pthread_mutex_init(&job.lock, 0);
+        for (i = 1; i < threads; i++) {
+            if (pthread_create(&workers[started], 0, emb_parallel_worker, &job) == 0) {
+                started++;
+            }
+        }
+        emb_parallel_worker(&job);
+        for (i = 0; i < started; i++) {
+            pthread_join(workers[i], 0);
+        }
+        pthread_mutex_destroy(&job.lock);
+        return;
+    }
+#endif
+    for (i = 0; i < count; i++) {
+        task(data, i);
+    }
+}
+
+/* The stream layer.
+ *
+ * Every reader and writer in formats.c goes through EmbStream rather
+ * than stdio directly. A stream is either a thin wrapper over a FILE*
+ * or a view of a memory block, which lets emb_pattern_read_memory() run
+ * the same readers over a caller's buffer without touching the disk.
+ * The emb_f* functions follow the stdio calls they replace, including
+ * the end of file flag, so a reader behaves the same on either backing.
+ *
+ * Files opened for reading are mapped where the system allows it, so in
+ * practice only writers see a stdio stream and the readers' cursor
+ * reads in embroidery.h stay on their inline path.
+ */
+
+/* Allocates a stream with no backing. */
+static EmbStream*
+emb_stream_alloc(void)
+{
+    EmbStream *stream = (EmbStream*)malloc(sizeof(EmbStream));
+    if (!stream) {
+        printf("ERROR: emb_stream_alloc(), cannot allocate stream\n");
+        return 0;
+    }
+    stream->file = 0;
+    stream->data = 0;
+    stream->length = 0;
+    stream->capacity = 0;
+    stream->position = 0;
+    stream->offset = 0;
+    stream->flags = 0;
+    stream->fd = -1;
+    stream->work = 0;
+    stream->stopped = EMB_LIMIT_NONE;
+    return stream;
+}
+
+/* Creates a read-only stream over a length bytes at a data.
+ * The memory is not copied, so it has to outlive the stream.
+ */
+EmbStream*
+emb_stream_memory(const void *data, size_t length)
+{
+    EmbStream *stream = emb_stream_alloc();
+    if (!stream) {
+        return 0;
+    }
+    stream->data = (unsigned char*)data;
+    stream->length = length;
+    return stream;
+}
+
+/* Creates an empty memory stream that grows as it is written to,
+ * starting with room for a capacity bytes.
+ */
+EmbStream*
+emb_stream_buffer(size_t capacity)
+{
+    EmbStream *stream = emb_stream_alloc();
+    if (!stream) {
+        return 0;
+    }
+    capacity = EMB_MAX(capacity, 64);
+    stream->data = (unsigned char*)malloc(capacity);
+    if (!stream->data) {
+        printf("ERROR: emb_stream_buffer(), cannot allocate %d bytes\n",
+            (int)capacity);
+        safe_free(stream);
+        return 0;
+    }
+    stream->capacity = capacity;
+    stream->flags = EMB_STREAM_OWNED;
+    return stream;
+}
+
+#if defined(EMB_STREAM_MMAP)
+/* Writes all a length bytes at a data to a fd, retrying short writes.
+ * Returns 0 on failure.
+ */
+static int
+emb_fd_write_all(int fd, const unsigned char *data, size_t length)
+{
+    while (length > 0) {
+        ssize_t n = write(fd, data, length);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 0;
+        }
+        data += n;
+        length -= (size_t)n;
+    }
+    return 1;
+}
+#endif
+
+/* Closes the file or frees the owned memory behind a stream.
+ * A buffered file is flushed, and a stream made by emb_stream_fd() for
+ * writing hands its data to the descriptor first.
+ *
+ * Returns 0 on success and EOF if the data could not be written out.
+ */
+int
+emb_stream_close(EmbStream *stream)
+{
+    int result = 0;
+    if (!stream) {
+        return 0;
+    }
+    if (stream->file) {
+        if (emb_stream_flush(stream) != 0) {
+            result = EOF;
+        }
+        if (fclose(stream->file) != 0) {
+            result = EOF;
+        }
+    }
+#if defined(EMB_STREAM_MMAP)
+    if (stream->fd >= 0
+        && !emb_fd_write_all(stream->fd, stream->data, stream->length)) {
+        result = EOF;
+    }
+#endif
+    if (stream->flags & EMB_STREAM_OWNED) {
+        safe_free(stream->data);
+    }
+#if defined(EMB_STREAM_MMAP)
+    if (stream->flags & EMB_STREAM_MAPPED) {
+        munmap(stream->data, stream->length);
+    }
+#endif
+    safe_free(stream);
+    return result;
+}
+
+/* Makes room for a memory stream to hold a end bytes.
+ * Returns 0 if the stream is read-only or the memory could not be
+ * allocated.
+ */
+static int
+emb_stream_reserve(EmbStream *stream, size_t end)
+{
+    size_t capacity;
+    unsigned char *data;
+    if (!(stream->flags & EMB_STREAM_OWNED)) {
+        stream->flags |= EMB_STREAM_ERROR;
+        return 0;
+    }
+    if (end <= stream->capacity) {
+        return 1;
+    }
+    capacity = stream->capacity;
+    while (capacity < end) {
+        capacity *= 2;
+    }
+    data = (unsigned char*)realloc(stream->data, capacity);
+    if (!data) {
+        printf("ERROR: emb_stream_reserve(), cannot allocate %d bytes\n",
+            (int)capacity);
+        stream->flags |= EMB_STREAM_ERROR;
+        return 0;
+    }
+    stream->data = data;
+    stream->capacity = capacity;
+    return 1;
+}
+
+/* Loads what is left of a file into an owned memory stream and closes
+ * the file. This is the fallback for files that cannot be mapped, such
+ * as pipes, and for systems without mmap().
+ */
+static EmbStream*
+emb_stream_load(FILE *file)
+{
+    size_t n;
+    EmbStream *stream = emb_stream_buffer(EMB_STREAM_LOAD_SIZE);
+    if (!stream) {
+        fclose(file);
+        return 0;
+    }
+    while (emb_stream_reserve(stream, stream->length + EMB_STREAM_LOAD_SIZE)) {
+        n = fread(stream->data + stream->length, 1,
+            stream->capacity - stream->length, file);
+        stream->length += n;
+        if (n == 0) {
+            break;
+        }
+    }
+    fclose(file);
+    return stream;
+}
+
+#if defined(EMB_STREAM_MMAP)
+/* Maps the regular file behind a fd read-only, from its start.
+ * Returns 0 if it cannot be mapped, for instance because it is empty or
+ * not a regular file, so the caller can fall back to loading it.
+ */
+static EmbStream*
+emb_stream_map_fd(int fd)
 {
-    char data[2];
-    if (fread(data, 1, 2, f) != 2) {
-        puts("ERROR: Failed to read a int16_t.");
+    EmbStream *stream;
+    struct stat st;
+    void *data;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+        return 0;
+    }
+    data = mmap(0, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
         return 0;
     }
-    fix_endian(data, 2, EMB_LITTLE_ENDIAN);
-    return *((int16_t*)data);
+    stream = emb_stream_memory(data, (size_t)st.st_size);
+    if (!stream) {
+        munmap(data, (size_t)st.st_size);
+        return 0;
+    }
+    stream->flags |= EMB_STREAM_MAPPED;
+    return stream;
 }
 
-/* Read a little-endian unsigned 16-bit integer. */
-uint16_t
-emb_read_u16(FILE* f)
+/* Reads a fd from its current position to its end into an owned
+ * memory stream.
+ */
+static EmbStream*
+emb_stream_load_fd(int fd)
 {
-    char data[2];
-    if (fread(data, 1, 2, f) != 2) {
-        puts("ERROR: Failed to read a uint16_t.");
+    ssize_t n;
+    EmbStream *stream = emb_stream_buffer(EMB_STREAM_LOAD_SIZE);
+    if (!stream) {
         return 0;
     }
-    fix_endian(data, 2, EMB_LITTLE_ENDIAN);
-    return *((uint16_t*)data);
+    while (emb_stream_reserve(stream, stream->length + EMB_STREAM_LOAD_SIZE)) {
+        n = read(fd, stream->data + stream->length,
+            stream->capacity - stream->length);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            printf("ERROR: emb_stream_load_fd(), failed to read from %d\n", fd);
+            emb_stream_close(stream);
+            return 0;
+        }
+        if (n == 0) {
+            break;
+        }
+        stream->length += (size_t)n;
+    }
+    return stream;
 }
+#endif
 
-/* Read a little-endian signed 32-bit integer. */
-int32_t
-emb_read_i32(FILE* f)
+/* Maps the file a fileName read-only.
+ * Returns 0 if it cannot be mapped, see emb_stream_map_fd().
+ */
+static EmbStream*
+emb_stream_map(const char *fileName)
 {
-    char data[4];
-    if (fread(data, 1, 4, f) != 4) {
-        puts("ERROR: Failed to read a int32_t.");
+#if defined(EMB_STREAM_MMAP)
+    EmbStream *stream;
+    int fd = open(fileName, O_RDONLY);
+    if (fd < 0) {
         return 0;
     }
-    fix_endian(data, 4, EMB_LITTLE_ENDIAN);
-    return *((int32_t*)data);
+    stream = emb_stream_map_fd(fd);
+    close(fd);
+    return stream;
+#else
+    (void)fileName;
+    return 0;
+#endif
+}
+
+/* Opens the file a fileName with the stdio a mode.
+ *
+ * A file opened only for reading is mapped, or loaded whole if that
+ * fails, so that the readers work on memory. A file truncated for
+ * writing gets a write buffer, see emb_stream_flush(). Append and update
+ * modes get a plain stdio stream.
+ *
+ * Returns 0 without reporting if the file cannot be opened, so that
+ * the caller can decide whether a missing file is an error.
+ */
+EmbStream*
+emb_stream_open(const char *fileName, const char *mode)
+{
+    EmbStream *stream;
+    FILE *file;
+    int reading = (mode[0] == 'r') && !strchr(mode, '+');
+    if (reading) {
+        stream = emb_stream_map(fileName);
+        if (stream) {
+            return stream;
+        }
+    }
+    file = fopen(fileName, mode);
+    if (!file) {
+        return 0;
+    }
+    if (reading) {
+        return emb_stream_load(file);
+    }
+    stream = emb_stream_alloc();
+    if (!stream) {
+        fclose(file);
+        return 0;
+    }
+    stream->file = file;
+    if (mode[0] == 'w' && !strchr(mode, '+')) {
+        stream->data = (unsigned char*)malloc(EMB_STREAM_WRITE_SIZE);
+        if (stream->data) {
+            stream->capacity = EMB_STREAM_WRITE_SIZE;
+            stream->flags = EMB_STREAM_OWNED | EMB_STREAM_BUFFERED;
+        }
+    }
+    return stream;
 }
 
-/* Read a little-endian unsigned 32-bit integer. */
-uint32_t
-emb_read_u32(FILE* f)
+/* Creates a stream over the open file descriptor a fd, which the
+ * stream does not close.
+ *
+ * For reading, a regular file is mapped from its start and anything
+ * else, such as a pipe, is read from its current position to its end.
+ * For writing, the output is gathered in memory and written to a fd by
+ * emb_stream_close(), so writers that seek back to patch a header work
+ * on pipes too.
+ */
+EmbStream*
+emb_stream_fd(int fd, const char *mode)
 {
-    char data[4];
-    if (fread(data, 1, 4, f) != 4) {
-        puts("ERROR: Failed to read a uint32_t.");
+#if defined(EMB_STREAM_MMAP)
+    EmbStream *stream;
+    if (fd < 0) {
+        printf("ERROR: emb_stream_fd(), invalid descriptor %d\n", fd);
         return 0;
     }
-    fix_endian(data, 4, EMB_LITTLE_ENDIAN);
-    return *((uint32_t*)data);
+    if (mode[0] == 'r') {
+        stream = emb_stream_map_fd(fd);
+        if (stream) {
+            return stream;
+        }
+        return emb_stream_load_fd(fd);
+    }
+    stream = emb_stream_buffer(EMB_STREAM_LOAD_SIZE);
+    if (stream) {
+        stream->fd = fd;
+    }
+    return stream;
+#else
+    (void)fd;
+    (void)mode;
+    printf("ERROR: emb_stream_fd(), descriptors are not supported on this system\n");
+    return 0;
+#endif
 }
 
-/* Read a big-endian signed 16-bit integer. */
-int16_t
-emb_read_i16be(FILE* f)
+/* Reads up to a n items of a size bytes, as fread() does. */
+size_t
+emb_fread(void *ptr, size_t size, size_t n, EmbStream *stream)
 {
-    char data[2];
-    if (fread(data, 1, 2, f) != 2) {
-        puts("ERROR: Failed to read a int16_t.");
+    size_t wanted, available;
+    if (stream->stopped) {
         return 0;
     }
-    fix_endian(data, 2, EMB_BIG_ENDIAN);
-    return *((int16_t*)data);
+    if (stream->file) {
+        return fread(ptr, size, n, stream->file);
+    }
+    wanted = size * n;
+    if (wanted == 0) {
+        return 0;
+    }
+    available = 0;
+    if (stream->position < stream->length) {
+        available = stream->length - stream->position;
+    }
+    if (wanted > available) {
+        wanted = available;
+        stream->flags |= EMB_STREAM_EOF;
+    }
+    memcpy(ptr, stream->data + stream->position, wanted);
+    stream->position += wanted;
+    return wanted / size;
 }
 
-/* Read a big-endian unsigned 16-bit integer. */
-uint16_t
-emb_read_u16be(FILE* f)
+/* Writes the buffer of a buffered file out and empties it.
+ *
+ * The buffer covers the file from stream->offset, and the file position
+ * is kept there until the buffer is written, so seeking back into what
+ * has not been written yet only moves the cursor. Afterwards the file is
+ * positioned where the stream's cursor was.
+ *
+ * Returns 0 on success and EOF on failure, as fflush() does. Other
+ * streams have nothing to flush.
+ */
+int
+emb_stream_flush(EmbStream *stream)
 {
-    char data[2];
-    if (fread(data, 1, 2, f) != 2) {
-        puts("ERROR: Failed to read a uint16_t.");
+    long offset;
+    if (!(stream->flags & EMB_STREAM_BUFFERED)) {
         return 0;
     }
-    fix_endian(data, 2, EMB_BIG_ENDIAN);
-    return *((uint16_t*)data);
+    offset = stream->offset;
+    if (stream->length > 0
+        && fwrite(stream->data, 1, stream->length, stream->file)
+            != stream->length) {
+        stream->flags |= EMB_STREAM_ERROR;
+        return EOF;
+    }
+    if (stream->position != stream->length
+        && fseek(stream->file, offset + (long)stream->position, SEEK_SET)) {
+        stream->flags |= EMB_STREAM_ERROR;
+        return EOF;
+    }
+    stream->offset = offset + (long)stream->position;
+    stream->length = 0;
+    stream->position = 0;
+    return 0;
 }
 
-/* Read a big-endian signed 32-bit integer. */
-int32_t
-emb_read_i32be(FILE* f)
+/* The out of line part of emb_fwrite().
+ *
+ * A buffered file is flushed when the write does not fit and writes at
+ * least as large as the buffer go straight to stdio. Writing past the
+ * end of a memory stream fills the gap with zeroes.
+ */
+size_t
+emb_stream_write_slow(const void *ptr, size_t size, size_t n,
+    EmbStream *stream)
 {
-    char data[4];
-    if (fread(data, 1, 4, f) != 4) {
-        puts("ERROR: Failed to read a int32_t.");
+    size_t count, end;
+    count = size * n;
+    if (count == 0 || stream->stopped) {
+        return 0;
+    }
+    /* Only here does a write need more room, so it is where the limits
+     * of a write are looked at. */
+    if (stream->work && !emb_work_limit(stream->work, 0,
+            stream->work->held + EMB_MAX(stream->capacity,
+                stream->position + count))) {
+        return 0;
+    }
+    if (stream->flags & EMB_STREAM_BUFFERED) {
+        if (emb_stream_flush(stream) != 0) {
+            return 0;
+        }
+        if (count < stream->capacity) {
+            memcpy(stream->data, ptr, count);
+            stream->position = count;
+            stream->length = count;
+            return n;
+        }
+        n = fwrite(ptr, size, n, stream->file);
+        stream->offset += (long)(n * size);
+        return n;
+    }
+    if (stream->file) {
+        return fwrite(ptr, size, n, stream->file);
+    }
+    end = stream->position + count;
+    if (!emb_stream_reserve(stream, end)) {
         return 0;
     }
-    fix_endian(data, 4, EMB_BIG_ENDIAN);
-    return *((int32_t*)data);
+    if (stream->position > stream->length) {
+        memset(stream->data + stream->length, 0,
+            stream->position - stream->length);
+    }
+    memcpy(stream->data + stream->position, ptr, count);
+    stream->position = end;
+    stream->length = EMB_MAX(stream->length, end);
+    return n;
+}
+
+/* The out of line part of emb_stream_take().
+ *
+ * A stdio stream is read into the scratch buffer, which holds up to 16
+ * bytes. A memory stream that is too short is marked as ended, having
+ * consumed what was left, as a short emb_fread() would.
+ */
+const unsigned char*
+emb_stream_take_slow(EmbStream *stream, size_t n)
+{
+    if (stream->file && !stream->stopped) {
+        if (n > sizeof(stream->scratch)) {
+            printf("ERROR: emb_stream_take(), %d bytes is too many for a stdio stream\n",
+                (int)n);
+            return 0;
+        }
+        if (fread(stream->scratch, 1, n, stream->file) != n) {
+            return 0;
+        }
+        return stream->scratch;
+    }
+    stream->position = EMB_MAX(stream->position, stream->length);
+    stream->flags |= EMB_STREAM_EOF;
+    return 0;
+}
+
+/* The out of line part of emb_fgetc(). */
+int
+emb_stream_getc_slow(EmbStream *stream)
+{
+    if (stream->file && !stream->stopped) {
+        return fgetc(stream->file);
+    }
+    stream->flags |= EMB_STREAM_EOF;
+    return EOF;
+}
+
+/* Reports a failed emb_read_* call for the integer type a type. */
+void
+emb_stream_read_error(const char *type)
+{
+    printf("ERROR: Failed to read a %s.\n", type);
 }
 
-/* Read a big-endian unsigned 32-bit integer. */
-uint32_t
-emb_read_u32be(FILE* f)
+/* Moves the position as fseek() does, clearing the end of file flag.
+ * Returns 0 on success and -1 if the position would be negative or
+ * a limit has stopped the stream.
+ */
+int
+emb_fseek(EmbStream *stream, long offset, int whence)
 {
-    char data[4];
-    if (fread(data, 1, 4, f) != 4) {
-        puts("ERROR: Failed to read a uint32_t.");
+    long base = 0;
+    if (stream->stopped) {
+        return -1;
+    }
+    if (stream->flags & EMB_STREAM_BUFFERED) {
+        long target = offset;
+        if (whence == SEEK_CUR) {
+            target += stream->offset + (long)stream->position;
+        }
+        if (whence != SEEK_END && target >= stream->offset
+            && target <= stream->offset + (long)stream->length) {
+            stream->position = (size_t)(target - stream->offset);
+            return 0;
+        }
+        if (emb_stream_flush(stream) != 0) {
+            return -1;
+        }
+        if (whence == SEEK_CUR) {
+            whence = SEEK_SET;
+            offset = target;
+        }
+        if (fseek(stream->file, offset, whence) != 0) {
+            return -1;
+        }
+        stream->offset = ftell(stream->file);
         return 0;
     }
-    fix_endian(data, 4, EMB_BIG_ENDIAN);
-    return *((uint32_t*)data);
+    if (stream->file) {
+        return fseek(stream->file, offset, whence);
+    }
+    if (whence == SEEK_CUR) {
+        base = (long)stream->position;
+    }
+    if (whence == SEEK_END) {
+        base = (long)stream->length;
+    }
+    if (base + offset < 0) {
+        return -1;
+    }
+    stream->position = (size_t)(base + offset);
+    stream->flags &= ~EMB_STREAM_EOF;
+    return 0;
+}
+
+/* Returns the current position. */
+long
+emb_ftell(EmbStream *stream)
+{
+    if (stream->flags & EMB_STREAM_BUFFERED) {
+        return stream->offset + (long)stream->position;
+    }
+    if (stream->file) {
+        return ftell(stream->file);
+    }
+    return (long)stream->position;
+}
+
+/* Returns non-zero once a read has run past the end of the stream. */
+int
+emb_feof(EmbStream *stream)
+{
+    if (stream->file) {
+        return feof(stream->file);
+    }
+    return stream->flags & EMB_STREAM_EOF;
+}
+
+/* Writes formatted text as fprintf() does.
+ * Returns the number of characters written, or a negative value on failure.
+ */
+int
+emb_fprintf(EmbStream *stream, const char *format, ...)
+{
+    char buffer[256];
+    char *text = buffer;
+    va_list args;
+    int n;
+    va_start(args, format);
+    if (stream->file && !(stream->flags & EMB_STREAM_BUFFERED)) {
+        n = vfprintf(stream->file, format, args);
+        va_end(args);
+        return n;
+    }
+    n = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (n < 0) {
+        return n;
+    }
+    if ((size_t)n >= sizeof(buffer)) {
+        text = (char*)malloc(n + 1);
+        if (!text) {
+            printf("ERROR: emb_fprintf(), cannot allocate %d bytes\n", n + 1);
+            return -1;
+        }
+        va_start(args, format);
+        vsnprintf(text, n + 1, format, args);
+        va_end(args);
+    }
+    if (emb_fwrite(text, 1, n, stream) != (size_t)n) {
+        n = -1;
+    }
+    if (text != buffer) {
+        safe_free(text);
+    }
+    return n;
 }
 
 /* a b a x a y a flags .
@@ -533,7 +1182,7 @@ emb_read_u32be(FILE* f)
  * \todo remove the unused return argument.
  */
 int
-decode_t01_record(unsigned char b[3], int *x, int *y, int *flags)
+decode_t01_record(const unsigned char b[3], int *x, int *y, int *flags)
 {
     decode_tajima_ternary(b, x, y);
 
@@ -582,6 +1231,126 @@ encode_t01_record(unsigned char b[3], int x, int y, int flags)
     }
 }
 
+/* The Tajima ternary codec.
+ *
+ * DST and its relatives store each axis of a move as five balanced
+ * ternary digits, weights 1, 3, 9, 27 and 81, spread over the three
+ * bytes of a record with a bit for each of +1 and -1 per digit. In the
+ * low nibble of the first two bytes are the x digits of weights 1 and 9
+ * (times 3 in the second byte), in their high nibble the y digits with
+ * their bits reversed. The third byte holds only the 81 digits, in bits
+ * 0x0C and 0x30, next to the flags.
+ *
+ * So each nibble adds a fixed amount to x or y, which is what the
+ * decoding tables hold, and every value in [-121, 121] has exactly one
+ * encoding, which is what the encoding tables hold.
+ */
+
+/* What the low nibble of each byte of a record adds to x. */
+static const signed char emb_tajima_x[3][16] = {
+    {0, 1, -1, 0, 9, 10, 8, 9, -9, -8, -10, -9, 0, 1, -1, 0},
+    {0, 3, -3, 0, 27, 30, 24, 27, -27, -24, -30, -27, 0, 3, -3, 0},
+    {0, 0, 0, 0, 81, 81, 81, 81, -81, -81, -81, -81, 0, 0, 0, 0}
+};
+
+/* What the high nibble of each byte of a record adds to y. */
+static const signed char emb_tajima_y[3][16] = {
+    {0, -9, 9, 0, -1, -10, 8, -1, 1, -8, 10, 1, 0, -9, 9, 0},
+    {0, -27, 27, 0, -3, -30, 24, -3, 3, -24, 30, 3, 0, -27, 27, 0},
+    {0, -81, 81, 0, 0, -81, 81, 0, 0, -81, 81, 0, 0, -81, 81, 0}
+};
+
+/* The bits set by each x value from -121 to 121, first byte lowest. */
+static const uint32_t emb_tajima_encode_x[243] = {
+    0x080a0a, 0x080a08, 0x080a09, 0x08080a, 0x080808, 0x080809, 0x08090a, 0x080908,
+    0x080909, 0x080a02, 0x080a00, 0x080a01, 0x080802, 0x080800, 0x080801, 0x080902,
+    0x080900, 0x080901, 0x080a06, 0x080a04, 0x080a05, 0x080806, 0x080804, 0x080805,
+    0x080906, 0x080904, 0x080905, 0x08020a, 0x080208, 0x080209, 0x08000a, 0x080008,
+    0x080009, 0x08010a, 0x080108, 0x080109, 0x080202, 0x080200, 0x080201, 0x080002,
+    0x080000, 0x080001, 0x080102, 0x080100, 0x080101, 0x080206, 0x080204, 0x080205,
+    0x080006, 0x080004, 0x080005, 0x080106, 0x080104, 0x080105, 0x08060a, 0x080608,
+    0x080609, 0x08040a, 0x080408, 0x080409, 0x08050a, 0x080508, 0x080509, 0x080602,
+    0x080600, 0x080601, 0x080402, 0x080400, 0x080401, 0x080502, 0x080500, 0x080501,
+    0x080606, 0x080604, 0x080605, 0x080406, 0x080404, 0x080405, 0x080506, 0x080504,
+    0x080505, 0x000a0a, 0x000a08, 0x000a09, 0x00080a, 0x000808, 0x000809, 0x00090a,
+    0x000908, 0x000909, 0x000a02, 0x000a00, 0x000a01, 0x000802, 0x000800, 0x000801,
+    0x000902, 0x000900, 0x000901, 0x000a06, 0x000a04, 0x000a05, 0x000806, 0x000804,
+    0x000805, 0x000906, 0x000904, 0x000905, 0x00020a, 0x000208, 0x000209, 0x00000a,
+    0x000008, 0x000009, 0x00010a, 0x000108, 0x000109, 0x000202, 0x000200, 0x000201,
+    0x000002, 0x000000, 0x000001, 0x000102, 0x000100, 0x000101, 0x000206, 0x000204,
+    0x000205, 0x000006, 0x000004, 0x000005, 0x000106, 0x000104, 0x000105, 0x00060a,
+    0x000608, 0x000609, 0x00040a, 0x000408, 0x000409, 0x00050a, 0x000508, 0x000509,
+    0x000602, 0x000600, 0x000601, 0x000402, 0x000400, 0x000401, 0x000502, 0x000500,
+    0x000501, 0x000606, 0x000604, 0x000605, 0x000406, 0x000404, 0x000405, 0x000506,
+    0x000504, 0x000505, 0x040a0a, 0x040a08, 0x040a09, 0x04080a, 0x040808, 0x040809,
+    0x04090a, 0x040908, 0x040909, 0x040a02, 0x040a00, 0x040a01, 0x040802, 0x040800,
+    0x040801, 0x040902, 0x040900, 0x040901, 0x040a06, 0x040a04, 0x040a05, 0x040806,
+    0x040804, 0x040805, 0x040906, 0x040904, 0x040905, 0x04020a, 0x040208, 0x040209,
+    0x04000a, 0x040008, 0x040009, 0x04010a, 0x040108, 0x040109, 0x040202, 0x040200,
+    0x040201, 0x040002, 0x040000, 0x040001, 0x040102, 0x040100, 0x040101, 0x040206,
+    0x040204, 0x040205, 0x040006, 0x040004, 0x040005, 0x040106, 0x040104, 0x040105,
+    0x04060a, 0x040608, 0x040609, 0x04040a, 0x040408, 0x040409, 0x04050a, 0x040508,
+    0x040509, 0x040602, 0x040600, 0x040601, 0x040402, 0x040400, 0x040401, 0x040502,
+    0x040500, 0x040501, 0x040606, 0x040604, 0x040605, 0x040406, 0x040404, 0x040405,
+    0x040506, 0x040504, 0x040505
+};
+
+/* The bits set by each y value from -121 to 121, first byte lowest. */
+static const uint32_t emb_tajima_encode_y[243] = {
+    0x105050, 0x105010, 0x105090, 0x101050, 0x101010, 0x101090, 0x109050, 0x109010,
+    0x109090, 0x105040, 0x105000, 0x105080, 0x101040, 0x101000, 0x101080, 0x109040,
+    0x109000, 0x109080, 0x105060, 0x105020, 0x1050a0, 0x101060, 0x101020, 0x1010a0,
+    0x109060, 0x109020, 0x1090a0, 0x104050, 0x104010, 0x104090, 0x100050, 0x100010,
+    0x100090, 0x108050, 0x108010, 0x108090, 0x104040, 0x104000, 0x104080, 0x100040,
+    0x100000, 0x100080, 0x108040, 0x108000, 0x108080, 0x104060, 0x104020, 0x1040a0,
+    0x100060, 0x100020, 0x1000a0, 0x108060, 0x108020, 0x1080a0, 0x106050, 0x106010,
+    0x106090, 0x102050, 0x102010, 0x102090, 0x10a050, 0x10a010, 0x10a090, 0x106040,
+    0x106000, 0x106080, 0x102040, 0x102000, 0x102080, 0x10a040, 0x10a000, 0x10a080,
+    0x106060, 0x106020, 0x1060a0, 0x102060, 0x102020, 0x1020a0, 0x10a060, 0x10a020,
+    0x10a0a0, 0x005050, 0x005010, 0x005090, 0x001050, 0x001010, 0x001090, 0x009050,
+    0x009010, 0x009090, 0x005040, 0x005000, 0x005080, 0x001040, 0x001000, 0x001080,
+    0x009040, 0x009000, 0x009080, 0x005060, 0x005020, 0x0050a0, 0x001060, 0x001020,
+    0x0010a0, 0x009060, 0x009020, 0x0090a0, 0x004050, 0x004010, 0x004090, 0x000050,
+    0x000010, 0x000090, 0x008050, 0x008010, 0x008090, 0x004040, 0x004000, 0x004080,
+    0x000040, 0x000000, 0x000080, 0x008040, 0x008000, 0x008080, 0x004060, 0x004020,
+    0x0040a0, 0x000060, 0x000020, 0x0000a0, 0x008060, 0x008020, 0x0080a0, 0x006050,
+    0x006010, 0x006090, 0x002050, 0x002010, 0x002090, 0x00a050, 0x00a010, 0x00a090,
+    0x006040, 0x006000, 0x006080, 0x002040, 0x002000, 0x002080, 0x00a040, 0x00a000,
+    0x00a080, 0x006060, 0x006020, 0x0060a0, 0x002060, 0x002020, 0x0020a0, 0x00a060,
+    0x00a020, 0x00a0a0, 0x205050, 0x205010, 0x205090, 0x201050, 0x201010, 0x201090,
+    0x209050, 0x209010, 0x209090, 0x205040, 0x205000, 0x205080, 0x201040, 0x201000,
+    0x201080, 0x209040, 0x209000, 0x209080, 0x205060, 0x205020, 0x2050a0, 0x201060,
+    0x201020, 0x2010a0, 0x209060, 0x209020, 0x2090a0, 0x204050, 0x204010, 0x204090,
+    0x200050, 0x200010, 0x200090, 0x208050, 0x208010, 0x208090, 0x204040, 0x204000,
+    0x204080, 0x200040, 0x200000, 0x200080, 0x208040, 0x208000, 0x208080, 0x204060,
+    0x204020, 0x2040a0, 0x200060, 0x200020, 0x2000a0, 0x208060, 0x208020, 0x2080a0,
+    0x206050, 0x206010, 0x206090, 0x202050, 0x202010, 0x202090, 0x20a050, 0x20a010,
+    0x20a090, 0x206040, 0x206000, 0x206080, 0x202040, 0x202000, 0x202080, 0x20a040,
+    0x20a000, 0x20a080, 0x206060, 0x206020, 0x2060a0, 0x202060, 0x202020, 0x2020a0,
+    0x20a060, 0x20a020, 0x20a0a0
+};
+
+#if defined(EMB_TAJIMA_SSSE3)
+/* Gathers byte k of 16 consecutive records from the vth 16 bytes. */
+static const signed char emb_tajima_shuffle[3][3][16] = {
+    {
+        {0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+        {-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1},
+        {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13}
+    },
+    {
+        {1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+        {-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1},
+        {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14}
+    },
+    {
+        {2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+        {-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1},
+        {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15}
+    }
+};
+#endif
+
 /* Encode the signed ternary of the tajima format into
  * a b the position values a x and a y.
  *
@@ -592,6 +1361,8 @@ encode_t01_record(unsigned char b[3], int x, int y, int flags)
 int
 encode_tajima_ternary(unsigned char b[3], int x, int y)
 {
+    uint32_t bits;
+
     b[0] = 0;
     b[1] = 0;
     b[2] = 0;
@@ -608,96 +1379,10 @@ encode_tajima_ternary(unsigned char b[3], int x, int y)
         return 0;
     }
 
-    if (x >= +41) {
-        b[2] |= 0x04;
-        x -= 81;
-    }
-    if (x <= -41) {
-        b[2] |= 0x08;
-        x += 81;
-    }
-    if (x >= +14) {
-        b[1] |= 0x04;
-        x -= 27;
-    }
-    if (x <= -14) {
-        b[1] |= 0x08;
-        x += 27;
-    }
-    if (x >= +5) {
-        b[0] |= 0x04;
-        x -= 9;
-    }
-    if (x <= -5) {
-        b[0] |= 0x08;
-        x += 9;
-    }
-    if (x >= +2) {
-        b[1] |= 0x01;
-        x -= 3;
-    }
-    if (x <= -2) {
-        b[1] |= 0x02;
-        x += 3;
-    }
-    if (x >= +1) {
-        b[0] |= 0x01;
-        x -= 1;
-    }
-    if (x <= -1) {
-        b[0] |= 0x02;
-        x += 1;
-    }
-    if (x != 0) {
-        printf("ERROR: format-dst.c encode_record(), ");
-        printf("x should be zero yet x = %d\n", x);
-        return 0;
-    }
-    if (y >= +41) {
-        b[2] |= 0x20;
-        y -= 81;
-    }
-    if (y <= -41) {
-        b[2] |= 0x10;
-        y += 81;
-    }
-    if (y >= +14) {
-        b[1] |= 0x20;
-        y -= 27;
-    }
-    if (y <= -14) {
-        b[1] |= 0x10;
-        y += 27;
-    }
-    if (y >= +5) {
-        b[0] |= 0x20;
-        y -= 9;
-    }
-    if (y <= -5) {
-        b[0] |= 0x10;
-        y += 9;
-    }
-    if (y >= +2) {
-        b[1] |= 0x80;
-        y -= 3;
-    }
-    if (y <= -2) {
-        b[1] |= 0x40;
-        y += 3;
-    }
-    if (y >= +1) {
-        b[0] |= 0x80;
-        y -= 1;
-    }
-    if (y <= -1) {
-        b[0] |= 0x40;
-        y += 1;
-    }
-    if (y != 0) {
-        printf("ERROR: format-dst.c encode_record(), ");
-        printf("y should be zero yet y = %d\n", y);
-        return 0;
-    }
+    bits = emb_tajima_encode_x[x + 121] | emb_tajima_encode_y[y + 121];
+    b[0] = (unsigned char)bits;
+    b[1] = (unsigned char)(bits >> 8);
+    b[2] = (unsigned char)(bits >> 16);
     return 1;
 }
 
@@ -707,75 +1392,96 @@ encode_tajima_ternary(unsigned char b[3], int x, int y)
  * There is no return argument.
  */
 void
-decode_tajima_ternary(unsigned char b[3], int *x, int *y)
+decode_tajima_ternary(const unsigned char b[3], int *x, int *y)
 {
-    *x = 0;
-    *y = 0;
-    if (b[0] & 0x01) {
-        *x += 1;
-    }
-    if (b[0] & 0x02) {
-        *x -= 1;
-    }
-    if (b[0] & 0x04) {
-        *x += 9;
-    }
-    if (b[0] & 0x08) {
-        *x -= 9;
-    }
-    if (b[0] & 0x80) {
-        *y += 1;
-    }
-    if (b[0] & 0x40) {
-        *y -= 1;
-    }
-    if (b[0] & 0x20) {
-        *y += 9;
-    }
-    if (b[0] & 0x10) {
-        *y -= 9;
-    }
-    if (b[1] & 0x01) {
-        *x += 3;
-    }
-    if (b[1] & 0x02) {
-        *x -= 3;
-    }
-    if (b[1] & 0x04) {
-        *x += 27;
-    }
-    if (b[1] & 0x08) {
-        *x -= 27;
-    }
-    if (b[1] & 0x80) {
-        *y += 3;
-    }
-    if (b[1] & 0x40) {
-        *y -= 3;
-    }
-    if (b[1] & 0x20) {
-        *y += 27;
-    }
-    if (b[1] & 0x10) {
-        *y -= 27;
-    }
-    if (b[2] & 0x04) {
-        *x += 81;
-    }
-    if (b[2] & 0x08) {
-        *x -= 81;
+    *x = emb_tajima_x[0][b[0] & 0x0F] + emb_tajima_x[1][b[1] & 0x0F]
+        + emb_tajima_x[2][b[2] & 0x0F];
+    *y = emb_tajima_y[0][b[0] >> 4] + emb_tajima_y[1][b[1] >> 4]
+        + emb_tajima_y[2][b[2] >> 4];
+}
+
+/* Decodes the a n 3 byte records at a b into the moves a x and a y,
+ * as decode_tajima_ternary() does for one. The flags are left to the
+ * caller since each format reads them differently.
+ */
+void
+decode_tajima_records(const unsigned char *b, int n, int16_t *x, int16_t *y)
+{
+    int i = 0;
+#if defined(EMB_TAJIMA_SSSE3)
+    {
+        const __m128i low = _mm_set1_epi8(0x0F);
+        const __m128i zero = _mm_setzero_si128();
+        __m128i tx[3], ty[3], shuffle[3][3];
+        int j, k;
+        for (k = 0; k < 3; k++) {
+            tx[k] = _mm_loadu_si128((const __m128i*)emb_tajima_x[k]);
+            ty[k] = _mm_loadu_si128((const __m128i*)emb_tajima_y[k]);
+            for (j = 0; j < 3; j++) {
+                shuffle[k][j] = _mm_loadu_si128(
+                    (const __m128i*)emb_tajima_shuffle[k][j]);
+            }
+        }
+        for (; i + 16 <= n; i += 16) {
+            __m128i v[3], sx = zero, sy = zero, sign;
+            v[0] = _mm_loadu_si128((const __m128i*)(b + 3*i));
+            v[1] = _mm_loadu_si128((const __m128i*)(b + 3*i + 16));
+            v[2] = _mm_loadu_si128((const __m128i*)(b + 3*i + 32));
+            for (k = 0; k < 3; k++) {
+                /* byte k of each of the 16 records */
+                __m128i r = _mm_or_si128(
+                    _mm_or_si128(_mm_shuffle_epi8(v[0], shuffle[k][0]),
+                        _mm_shuffle_epi8(v[1], shuffle[k][1])),
+                    _mm_shuffle_epi8(v[2], shuffle[k][2]));
+                sx = _mm_add_epi8(sx,
+                    _mm_shuffle_epi8(tx[k], _mm_and_si128(r, low)));
+                sy = _mm_add_epi8(sy, _mm_shuffle_epi8(ty[k],
+                    _mm_and_si128(_mm_srli_epi16(r, 4), low)));
+            }
+            sign = _mm_cmpgt_epi8(zero, sx);
+            _mm_storeu_si128((__m128i*)(x + i), _mm_unpacklo_epi8(sx, sign));
+            _mm_storeu_si128((__m128i*)(x + i + 8), _mm_unpackhi_epi8(sx, sign));
+            sign = _mm_cmpgt_epi8(zero, sy);
+            _mm_storeu_si128((__m128i*)(y + i), _mm_unpacklo_epi8(sy, sign));
+            _mm_storeu_si128((__m128i*)(y + i + 8), _mm_unpackhi_epi8(sy, sign));
+        }
     }
-    if (b[2] & 0x20) {
-        *y += 81;
+#elif defined(EMB_TAJIMA_NEON)
+    {
+        const uint8x16_t low = vdupq_n_u8(0x0F);
+        int8x16_t tx[3], ty[3];
+        int k;
+        for (k = 0; k < 3; k++) {
+            tx[k] = vld1q_s8(emb_tajima_x[k]);
+            ty[k] = vld1q_s8(emb_tajima_y[k]);
+        }
+        for (; i + 16 <= n; i += 16) {
+            /* vld3q_u8 splits the records into their three bytes */
+            uint8x16x3_t v = vld3q_u8(b + 3*i);
+            int8x16_t sx = vdupq_n_s8(0), sy = vdupq_n_s8(0);
+            for (k = 0; k < 3; k++) {
+                sx = vaddq_s8(sx, vqtbl1q_s8(tx[k], vandq_u8(v.val[k], low)));
+                sy = vaddq_s8(sy, vqtbl1q_s8(ty[k], vshrq_n_u8(v.val[k], 4)));
+            }
+            vst1q_s16(x + i, vmovl_s8(vget_low_s8(sx)));
+            vst1q_s16(x + i + 8, vmovl_s8(vget_high_s8(sx)));
+            vst1q_s16(y + i, vmovl_s8(vget_low_s8(sy)));
+            vst1q_s16(y + i + 8, vmovl_s8(vget_high_s8(sy)));
+        }
     }
-    if (b[2] & 0x10) {
-        *y -= 81;
+#endif
+    for (; i < n; i++) {
+        const unsigned char *r = b + 3*i;
+        x[i] = (int16_t)(emb_tajima_x[0][r[0] & 0x0F]
+            + emb_tajima_x[1][r[1] & 0x0F] + emb_tajima_x[2][r[2] & 0x0F]);
+        y[i] = (int16_t)(emb_tajima_y[0][r[0] >> 4]
+            + emb_tajima_y[1][r[1] >> 4] + emb_tajima_y[2][r[2] >> 4]);
     }
 }
 
 /* a file a dx a dy a flags
  */
-void pfaffEncode(FILE* file, int dx, int dy, int flags)
+void pfaffEncode(EmbStream* file, int dx, int dy, int flags)
 {
     unsigned char flagsToWrite = 0;
 
@@ -795,7 +1501,7 @@ void pfaffEncode(FILE* file, int dx, int dy, int flags)
     {
         flagsToWrite |= 0x04;
     }
-    fwrite(&flagsToWrite, 1, 1, file);
+    emb_fwrite(&flagsToWrite, 1, 1, file);
 }
 
 /* Decode the bytes a a1, a a2 and a a3 .
@@ -844,215 +1550,854 @@ decodeNewStitch(unsigned char value)
     return (int)value;
 }
 
-/* . */
+/* Writes a n copies of the byte a c. */
 void
-fpad(FILE* file, char c, int n)
+fpad(EmbStream* file, char c, int n)
 {
-    int i;
-    for (i = 0; i < n; i++) {
-        fwrite(&c, 1, 1, file);
+    unsigned char block[256];
+    memset(block, c, sizeof(block));
+    while (n > 0) {
+        int count = EMB_MIN(n, (int)sizeof(block));
+        emb_fwrite(block, 1, count, file);
+        n -= count;
     }
 }
 
-/* . */
-void
-emb_write_i16(FILE* f, int16_t data)
+/* end of encoding section. */
+
+/* The arena allocator.
+ *
+ * A pattern owns an arena that its arrays and nested point lists are
+ * carved from, so building a pattern does not call malloc once per
+ * path and freeing it releases a handful of blocks instead of walking
+ * every geometry.
+ *
+ * Small allocations are bumped out of shared blocks of a block_size
+ * bytes. The most recent one can grow in place, which covers the usual
+ * case of a list being appended to while it is built. Allocations
+ * larger than a quarter of a block get a dedicated block each, so big
+ * stitch buffers can still be grown with realloc and given back early
+ * with emb_arena_release().
+ *
+ * emb_arena_reset() keeps every block as a spare for later
+ * allocations, so an arena that is reused for similar patterns stops
+ * calling malloc altogether.
+ */
+
+#define EMB_ARENA_ALIGN           16
+#define EMB_ARENA_ROUND(n) \
+    (((n) + EMB_ARENA_ALIGN - 1) & ~((size_t)EMB_ARENA_ALIGN - 1))
+
+typedef struct EmbArenaBlock_ {
+    struct EmbArenaBlock_ *next;
+    struct EmbArenaBlock_ *prev;
+    size_t size;
+    size_t used;
+} EmbArenaBlock;
+
+#define EMB_ARENA_HEADER          EMB_ARENA_ROUND(sizeof(EmbArenaBlock))
+#define EMB_ARENA_DATA(block)     ((char*)(block) + EMB_ARENA_HEADER)
+
+struct EmbArena_ {
+    EmbArenaBlock *blocks; /* shared blocks, the current one first */
+    EmbArenaBlock *large;  /* dedicated blocks, doubly linked */
+    EmbArenaBlock *spare;  /* empty shared blocks kept by a reset */
+    EmbArenaBlock *spare_large; /* empty dedicated blocks kept by a reset */
+    void *last;            /* most recent allocation in the current block */
+    size_t block_size;
+    int refs;              /* patterns sharing the arena, see emb_arena_share() */
+};
+
+/* Creates an empty arena that allocates in blocks of a block_size bytes.
+ * No memory beyond the arena itself is taken until the first allocation.
+ */
+EmbArena*
+emb_arena_create(size_t block_size)
 {
-    char *b = (char*)(&data);
-    fix_endian(b, 2, EMB_LITTLE_ENDIAN);
-    fwrite(b, 1, 2, f);
+    EmbArena *arena = (EmbArena*)malloc(sizeof(EmbArena));
+    if (!arena) {
+        printf("ERROR: emb_arena_create(), cannot allocate arena\n");
+        return 0;
+    }
+    arena->blocks = 0;
+    arena->large = 0;
+    arena->spare = 0;
+    arena->spare_large = 0;
+    arena->last = 0;
+    arena->block_size = EMB_MAX(block_size, 4*EMB_ARENA_ALIGN);
+    arena->refs = 1;
+    return arena;
 }
 
-/* . */
-void
-emb_write_u16(FILE* f, uint16_t data)
+/* Adds a reference to a arena, which is then only freed by the last of
+ * the matching calls to emb_arena_free(). Cloned patterns share their
+ * source's arena this way, so they must be used from a single thread.
+ */
+EmbArena*
+emb_arena_share(EmbArena *arena)
 {
-    char *b = (char*)(&data);
-    fix_endian(b, 2, EMB_LITTLE_ENDIAN);
-    fwrite(b, 1, 2, f);
+    arena->refs++;
+    return arena;
 }
 
-/* . */
-void
-emb_write_i16be(FILE* f, int16_t data)
+/* Whether an allocation of a size bytes gets its own block. */
+static int
+emb_arena_is_large(EmbArena *arena, size_t size)
 {
-    char *b = (char*)(&data);
-    fix_endian(b, 2, EMB_BIG_ENDIAN);
-    fwrite(b, 1, 2, f);
+    return EMB_ARENA_ROUND(size) > arena->block_size / 4;
 }
 
-/* . */
-void
-emb_write_u16be(FILE* f, uint16_t data)
+/* Returns a size bytes from a arena, aligned to EMB_ARENA_ALIGN, or 0 if
+ * the memory could not be allocated. The memory is released when the
+ * arena is freed.
+ */
+void*
+emb_arena_alloc(EmbArena *arena, size_t size)
+{
+    EmbArenaBlock *block;
+    void *data;
+    size = EMB_ARENA_ROUND(size);
+    if (emb_arena_is_large(arena, size)) {
+        EmbArenaBlock **spare = &(arena->spare_large);
+        while (*spare && (*spare)->size < size) {
+            spare = &((*spare)->next);
+        }
+        if (*spare) {
+            block = *spare;
+            *spare = block->next;
+        }
+        else {
+            block = (EmbArenaBlock*)malloc(EMB_ARENA_HEADER + size);
+            if (!block) {
+                return 0;
+            }
+            block->size = size;
+        }
+        block->used = size;
+        block->prev = 0;
+        block->next = arena->large;
+        if (arena->large) {
+            arena->large->prev = block;
+        }
+        arena->large = block;
+        return EMB_ARENA_DATA(block);
+    }
+    block = arena->blocks;
+    if (!block || block->used + size > block->size) {
+        if (arena->spare) {
+            block = arena->spare;
+            arena->spare = block->next;
+        }
+        else {
+            block = (EmbArenaBlock*)malloc(EMB_ARENA_HEADER + arena->block_size);
+            if (!block) {
+                return 0;
+            }
+        }
+        block->size = arena->block_size;
+        block->used = 0;
+        block->prev = 0;
+        block->next = arena->blocks;
+        arena->blocks = block;
+    }
+    data = EMB_ARENA_DATA(block) + block->used;
+    block->used += size;
+    arena->last = data;
+    return data;
+}
+
+/* Resizes the allocation a ptr of a old_size bytes in a arena to
+ * a size bytes, in place when it is the most recent small allocation or
+ * has a block of its own. Returns 0 on failure, leaving a ptr intact.
+ */
+void*
+emb_arena_realloc(EmbArena *arena, void *ptr, size_t old_size, size_t size)
 {
-    char *b = (char*)(&data);
-    fix_endian(b, 2, EMB_BIG_ENDIAN);
-    fwrite(b, 1, 2, f);
+    void *data;
+    if (!ptr) {
+        return emb_arena_alloc(arena, size);
+    }
+    if (size <= old_size) {
+        return ptr;
+    }
+    if (emb_arena_is_large(arena, old_size)) {
+        EmbArenaBlock *block = (EmbArenaBlock*)((char*)ptr - EMB_ARENA_HEADER);
+        size = EMB_ARENA_ROUND(size);
+        if (size <= block->size) {
+            return ptr;
+        }
+        block = (EmbArenaBlock*)realloc(block, EMB_ARENA_HEADER + size);
+        if (!block) {
+            return 0;
+        }
+        block->size = size;
+        block->used = size;
+        if (block->prev) {
+            block->prev->next = block;
+        }
+        else {
+            arena->large = block;
+        }
+        if (block->next) {
+            block->next->prev = block;
+        }
+        return EMB_ARENA_DATA(block);
+    }
+    if (ptr == arena->last && !emb_arena_is_large(arena, size)) {
+        EmbArenaBlock *block = arena->blocks;
+        size_t start = (char*)ptr - EMB_ARENA_DATA(block);
+        if (start + EMB_ARENA_ROUND(size) <= block->size) {
+            block->used = start + EMB_ARENA_ROUND(size);
+            return ptr;
+        }
+    }
+    data = emb_arena_alloc(arena, size);
+    if (!data) {
+        return 0;
+    }
+    memcpy(data, ptr, old_size);
+    return data;
 }
 
-/* . */
+/* Gives the allocation a ptr of a size bytes back to a arena early.
+ * Dedicated blocks are freed and the most recent small allocation is
+ * rewound; anything else stays reserved until the arena is freed.
+ */
 void
-emb_write_i32(FILE* f, int32_t data)
+emb_arena_release(EmbArena *arena, void *ptr, size_t size)
 {
-    char *b = (char*)(&data);
-    fix_endian(b, 4, EMB_LITTLE_ENDIAN);
-    fwrite(b, 1, 4, f);
+    if (!ptr) {
+        return;
+    }
+    if (emb_arena_is_large(arena, size)) {
+        EmbArenaBlock *block = (EmbArenaBlock*)((char*)ptr - EMB_ARENA_HEADER);
+        if (block->prev) {
+            block->prev->next = block->next;
+        }
+        else {
+            arena->large = block->next;
+        }
+        if (block->next) {
+            block->next->prev = block->prev;
+        }
+        free(block);
+        return;
+    }
+    if (ptr == arena->last) {
+        arena->blocks->used = (char*)ptr - EMB_ARENA_DATA(arena->blocks);
+        arena->last = 0;
+    }
 }
 
-/* . */
+/* Invalidates everything allocated from a arena while keeping its
+ * blocks as spares, so that the next allocations reuse them.
+ */
 void
-emb_write_u32(FILE* f, uint32_t data)
+emb_arena_reset(EmbArena *arena)
 {
-    char *b = (char*)(&data);
-    fix_endian(b, 4, EMB_LITTLE_ENDIAN);
-    fwrite(b, 1, 4, f);
+    EmbArenaBlock *block = arena->blocks;
+    while (block) {
+        EmbArenaBlock *next = block->next;
+        block->next = arena->spare;
+        arena->spare = block;
+        block = next;
+    }
+    block = arena->large;
+    while (block) {
+        EmbArenaBlock *next = block->next;
+        block->next = arena->spare_large;
+        arena->spare_large = block;
+        block = next;
+    }
+    arena->blocks = 0;
+    arena->large = 0;
+    arena->last = 0;
 }
 
-/* . */
-void
-emb_write_i32be(FILE* f, int32_t data)
+/* Frees the blocks in the list starting at a block. */
+static void
+emb_arena_free_blocks(EmbArenaBlock *block)
 {
-    char *b = (char*)(&data);
-    fix_endian(b, 4, EMB_BIG_ENDIAN);
-    fwrite(b, 1, 4, f);
+    while (block) {
+        EmbArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
 }
 
-/* . */
+/* Frees a arena and everything allocated from it, once every reference
+ * taken with emb_arena_share() has been dropped. The cost depends on
+ * the number of blocks, not on the number of allocations.
+ */
 void
-emb_write_u32be(FILE* f, uint32_t data)
+emb_arena_free(EmbArena *arena)
 {
-    char *b = (char*)(&data);
-    fix_endian(b, 4, EMB_BIG_ENDIAN);
-    fwrite(b, 1, 4, f);
+    if (!arena) {
+        return;
+    }
+    arena->refs--;
+    if (arena->refs > 0) {
+        return;
+    }
+    emb_arena_free_blocks(arena->blocks);
+    emb_arena_free_blocks(arena->large);
+    emb_arena_free_blocks(arena->spare);
+    emb_arena_free_blocks(arena->spare_large);
+    free(arena);
 }
 
-/* end of encoding section. */
+/* Allocates from a arena when there is one and from the heap otherwise. */
+static void*
+emb_alloc(EmbArena *arena, size_t size)
+{
+    if (arena) {
+        return emb_arena_alloc(arena, size);
+    }
+    return malloc(size);
+}
+
+/* Resizes memory from emb_alloc(), see emb_arena_realloc(). */
+static void*
+emb_realloc(EmbArena *arena, void *ptr, size_t old_size, size_t size)
+{
+    if (arena) {
+        return emb_arena_realloc(arena, ptr, old_size, size);
+    }
+    return realloc(ptr, size);
+}
+
+/* Releases memory from emb_alloc(), see emb_arena_release(). */
+static void
+emb_release(EmbArena *arena, void *ptr, size_t size)
+{
+    if (arena) {
+        emb_arena_release(arena, ptr, size);
+        return;
+    }
+    safe_free(ptr);
+}
+
+/* The string pool.
+ *
+ * Thread descriptions, catalog numbers and the design metadata are
+ * stored once per distinct string in the pattern's arena, and the
+ * records that use them hold pointers into the pool. This keeps
+ * EmbThread small and makes repeated names, which are common in brand
+ * tables and multi-color designs, cost nothing extra.
+ */
+
+struct EmbStringPool_ {
+    EmbArena *arena;
+    const char **slots;
+    int count;
+    int size; /* a power of two */
+};
+
+/* FNV-1a hash of the string a s. */
+static uint32_t
+emb_string_hash(const char *s)
+{
+    uint32_t h = 2166136261u;
+    for (; *s; s++) {
+        h ^= (unsigned char)*s;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* Creates an empty string pool whose strings live in a arena. */
+EmbStringPool*
+emb_string_pool_create(EmbArena *arena)
+{
+    EmbStringPool *pool;
+    pool = (EmbStringPool*)emb_arena_alloc(arena, sizeof(EmbStringPool));
+    if (!pool) {
+        printf("ERROR: emb_string_pool_create(), cannot allocate pool\n");
+        return 0;
+    }
+    pool->arena = arena;
+    pool->slots = 0;
+    pool->count = 0;
+    pool->size = 0;
+    return pool;
+}
+
+/* Doubles the hash table of a pool, rehashing the strings it holds. */
+static int
+emb_string_pool_grow(EmbStringPool *pool)
+{
+    int i;
+    int size = pool->size ? 2*pool->size : 64;
+    const char **slots = (const char**)emb_arena_alloc(pool->arena,
+        size*sizeof(const char*));
+    if (!slots) {
+        return 0;
+    }
+    memset(slots, 0, size*sizeof(const char*));
+    for (i = 0; i < pool->size; i++) {
+        if (pool->slots[i]) {
+            uint32_t j = emb_string_hash(pool->slots[i]) & (size - 1);
+            while (slots[j]) {
+                j = (j + 1) & (size - 1);
+            }
+            slots[j] = pool->slots[i];
+        }
+    }
+    emb_arena_release(pool->arena, pool->slots,
+        pool->size*sizeof(const char*));
+    pool->slots = slots;
+    pool->size = size;
+    return 1;
+}
+
+/* Returns the pooled copy of a s, adding it on first use. Equal strings
+ * give the same pointer. A null or empty a s gives a shared "" and
+ * 0 is returned if the memory could not be allocated.
+ */
+const char*
+emb_string_pool_intern(EmbStringPool *pool, const char *s)
+{
+    uint32_t i;
+    size_t length;
+    char *copy;
+    if (!s || !s[0]) {
+        return "";
+    }
+    if (4*(pool->count + 1) > 3*pool->size) {
+        if (!emb_string_pool_grow(pool)) {
+            printf("ERROR: emb_string_pool_intern(), cannot grow pool\n");
+            return 0;
+        }
+    }
+    i = emb_string_hash(s) & (pool->size - 1);
+    while (pool->slots[i]) {
+        if (pool->slots[i] == s || !strcmp(pool->slots[i], s)) {
+            return pool->slots[i];
+        }
+        i = (i + 1) & (pool->size - 1);
+    }
+    length = strlen(s) + 1;
+    copy = (char*)emb_arena_alloc(pool->arena, length);
+    if (!copy) {
+        printf("ERROR: emb_string_pool_intern(), cannot copy string\n");
+        return 0;
+    }
+    memcpy(copy, s, length);
+    pool->slots[i] = copy;
+    pool->count++;
+    return copy;
+}
 
 /* The array management for libembroidery's arrays.
  */
 
+/* The size in bytes of one entry of an array of type a type. */
+static size_t
+emb_array_entry_size(int type)
+{
+    switch (type) {
+    case EMB_STITCH:
+        return sizeof(EmbStitch);
+    case EMB_THREAD:
+        return sizeof(EmbThread);
+    default:
+        break;
+    }
+    return sizeof(EmbGeometry);
+}
+
 /* Allocates memory for an EmbArray of the type determined by
  * the argument a type.
  */
 EmbArray*
 emb_array_create(int type)
+{
+    return emb_array_create_in(0, type);
+}
+
+/* Allocates an EmbArray of the type a type whose storage comes from
+ * a arena, or from the heap if a arena is null. Arrays in an arena are
+ * released along with it, so emb_array_free() on them is cheap.
+ */
+EmbArray*
+emb_array_create_in(EmbArena *arena, int type)
 {
     EmbArray *a;
-    a = (EmbArray*)malloc(sizeof(EmbArray));
+    void *data;
+    a = (EmbArray*)emb_alloc(arena, sizeof(EmbArray));
+    data = emb_alloc(arena, CHUNK_SIZE*emb_array_entry_size(type));
+    if (!a || !data) {
+        printf("ERROR: emb_array_create(), cannot allocate array\n");
+        if (!arena) {
+            safe_free(a);
+            safe_free(data);
+        }
+        return 0;
+    }
     a->type = type;
     a->length = CHUNK_SIZE;
     a->count = 0;
+    a->arena = arena;
+    a->heap_lists = 0;
+    a->refs = 0;
+    a->geometry = 0;
+    a->stitch = 0;
+    a->thread = 0;
     switch (type) {
     case EMB_STITCH:
-        a->stitch = (EmbStitch*)malloc(CHUNK_SIZE*sizeof(EmbStitch));
+        a->stitch = (EmbStitch*)data;
         break;
     case EMB_THREAD:
-        a->thread = (EmbThread*)malloc(CHUNK_SIZE*sizeof(EmbThread));
+        a->thread = (EmbThread*)data;
         break;
     default:
-        a->geometry = (EmbGeometry*)malloc(CHUNK_SIZE*sizeof(EmbGeometry));
+        a->geometry = (EmbGeometry*)data;
         break;
     }
     return a;
 }
 
-/* Resizes the array a a to be CHUNK_SIZE entries longer
- * if and only if the amount of room left is less than
- * 3 entries.
- */
-int
-emb_array_resize(EmbArray *a)
+/* The storage of the array a a. */
+static void*
+emb_array_data(EmbArray *a)
 {
-    if (a->count < a->length - 3) {
-        return 1;
-    }
-    a->length += CHUNK_SIZE;
     switch (a->type) {
     case EMB_STITCH:
-        a->stitch = (EmbStitch*)realloc(a->stitch, a->length*sizeof(EmbStitch));
-        if (!a->stitch) {
-            /* TODO: Error reporting */
-            return 0;
-        }
-        break;
+        return a->stitch;
     case EMB_THREAD:
-        a->thread = (EmbThread*)realloc(a->thread, a->length*sizeof(EmbThread));
-        if (!a->thread) {
-            /* TODO: Error reporting */
-            return 0;
-        }
-        break;
+        return a->thread;
     default:
-        a->geometry = (EmbGeometry *)realloc(a->geometry, a->length*sizeof(EmbGeometry));
-        if (!a->geometry) {
-            /* TODO: Error reporting */
-            return 0;
-        }
         break;
     }
-
-    return 1;
+    return a->geometry;
 }
 
-/* Copies all entries in the EmbArray struct from a src to a dst.
- */
-void
-emb_array_copy(EmbArray *dst, EmbArray *src)
+/* Points the array a a at the storage a data. */
+static void
+emb_array_set_data(EmbArray *a, void *data)
 {
-    dst = emb_array_create(src->type);
-    dst->length = src->length;
-    dst->count = src->count;
-    emb_array_resize(dst);
-    /* BUG: Potential failure to copy path memory, only copy pointers? */
-
-    switch (dst->type) {
+    switch (a->type) {
     case EMB_STITCH:
-        memcpy(dst->stitch, src->stitch, sizeof(EmbStitch)*src->count);
+        a->stitch = (EmbStitch*)data;
         break;
     case EMB_THREAD:
-        memcpy(dst->thread, src->thread, sizeof(EmbThread)*src->count);
+        a->thread = (EmbThread*)data;
         break;
     default:
-        memcpy(dst->geometry, src->geometry, sizeof(EmbGeometry)*src->count);
+        a->geometry = (EmbGeometry*)data;
         break;
     }
 }
 
-/* Add a circle a b to the EmbArray a a and it returns if the
- * element was successfully added.
+/* Replaces the point and flag lists of the geometry in a a with copies
+ * allocated in its own arena, so that a a no longer shares them.
  */
-int
-emb_array_add_circle(EmbArray *a, EmbCircle b)
+static int
+emb_array_copy_lists(EmbArray *a)
 {
-    a->count++;
-    if (!emb_array_resize(a)) {
-        return 0;
+    int i, j;
+    if (a->type == EMB_STITCH || a->type == EMB_THREAD) {
+        return 1;
     }
-    a->geometry[a->count - 1].object.circle = b;
-    a->geometry[a->count - 1].type = EMB_CIRCLE;
+    for (i = 0; i < a->count; i++) {
+        EmbPath *path = &(a->geometry[i].object.path);
+        switch (a->geometry[i].type) {
+        case EMB_PATH:
+        case EMB_POLYGON:
+        case EMB_POLYLINE:
+            if (path->pointList) {
+                EmbVectorList *points = emb_vector_list_create_in(a->arena,
+                    path->pointList->count);
+                if (!points) {
+                    return 0;
+                }
+                memcpy(points->data, path->pointList->data,
+                    path->pointList->count*sizeof(EmbVector));
+                points->count = path->pointList->count;
+                path->pointList = points;
+            }
+            if (path->flagList) {
+                EmbIdList *flags = emb_id_list_create_in(a->arena,
+                    path->flagList->count);
+                if (!flags) {
+                    return 0;
+                }
+                for (j = 0; j < path->flagList->count; j++) {
+                    flags->data[j] = path->flagList->data[j];
+                }
+                flags->count = path->flagList->count;
+                path->flagList = flags;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    a->heap_lists = 0;
     return 1;
 }
 
-/* Add an ellipse a b to the EmbArray a a and it returns if the
- * element was successfully added.
+/* Returns an array that shares the storage of a a until one of them is
+ * modified, see emb_array_writable(). The copy costs O(1) and lives in
+ * the same arena as a a.
  */
-int
-emb_array_add_ellipse(EmbArray *a, EmbEllipse b)
+EmbArray*
+emb_array_share(EmbArray *a)
 {
-    a->count++;
-    if (!emb_array_resize(a)) {
+    EmbArray *copy;
+    if (!a->refs) {
+        a->refs = (int*)emb_alloc(a->arena, sizeof(int));
+        if (!a->refs) {
+            printf("ERROR: emb_array_share(), cannot allocate reference count\n");
+            return 0;
+        }
+        *(a->refs) = 1;
+    }
+    copy = (EmbArray*)emb_alloc(a->arena, sizeof(EmbArray));
+    if (!copy) {
+        printf("ERROR: emb_array_share(), cannot allocate array\n");
         return 0;
     }
-    a->geometry[a->count - 1].object.ellipse = b;
-    a->geometry[a->count - 1].type = EMB_ELLIPSE;
-    return 1;
+    *copy = *a;
+    *(a->refs) += 1;
+    return copy;
 }
 
-/* Add a flag a b to the EmbArray a a and it returns if the
- * element was successfully added.
+/* Makes sure that the array a a is the only owner of its storage before
+ * it is modified, copying the entries and any point lists they hold if
+ * it is shared with a clone. Every function that writes to an array in
+ * place calls this first.
+ *
+ * Returns 0 if the memory for the copy could not be allocated.
  */
 int
-emb_array_add_flag(EmbArray *a, EmbFlag b)
+emb_array_writable(EmbArray *a)
+{
+    size_t entry;
+    void *data;
+    if (!a->refs) {
+        return 1;
+    }
+    if (*(a->refs) == 1) {
+        emb_release(a->arena, a->refs, sizeof(int));
+        a->refs = 0;
+        return 1;
+    }
+    entry = emb_array_entry_size(a->type);
+    data = emb_alloc(a->arena, a->length*entry);
+    if (!data) {
+        printf("ERROR: emb_array_writable(), cannot copy shared array\n");
+        return 0;
+    }
+    memcpy(data, emb_array_data(a), a->count*entry);
+    *(a->refs) -= 1;
+    a->refs = 0;
+    emb_array_set_data(a, data);
+    if (!emb_array_copy_lists(a)) {
+        printf("ERROR: emb_array_writable(), cannot copy point lists\n");
+        return 0;
+    }
+    return 1;
+}
+
+/* Reallocate the storage of the array a a so that it can hold a length
+ * entries. Returns 0 on allocation failure, leaving the array untouched.
+ */
+static int
+emb_array_set_length(EmbArray *a, int length)
+{
+    size_t entry = emb_array_entry_size(a->type);
+    void *data;
+    if (!emb_array_writable(a)) {
+        return 0;
+    }
+    data = emb_realloc(a->arena, emb_array_data(a), a->length*entry,
+        length*entry);
+    if (!data) {
+        return 0;
+    }
+    emb_array_set_data(a, data);
+    a->length = length;
+    return 1;
+}
+
+/* Grows the array a a if and only if the amount of room left is less than
+ * 3 entries.
+ *
+ * The capacity doubles on each resize so that appending n entries costs
+ * O(n) copies in total rather than the O(n^2) of fixed CHUNK_SIZE steps.
+ */
+int
+emb_array_resize(EmbArray *a)
+{
+    int length;
+    if (!emb_array_writable(a)) {
+        return 0;
+    }
+    if (a->count < a->length - 3) {
+        return 1;
+    }
+    length = EMB_MAX(2 * a->length, a->count + 4);
+    if (length < CHUNK_SIZE) {
+        length = CHUNK_SIZE;
+    }
+    if (!emb_array_set_length(a, length)) {
+        printf("ERROR: emb_array_resize(), failed to grow array to %d entries\n",
+            length);
+        return 0;
+    }
+    return 1;
+}
+
+/* Makes room in the array a a for at least a n entries in total, so that
+ * filling it up to a n entries performs no further allocations.
+ *
+ * Returns 0 if the memory could not be allocated.
+ */
+int
+emb_array_reserve(EmbArray *a, int n)
+{
+    if (!a) {
+        return 0;
+    }
+    /* emb_array_resize keeps 3 entries of slack at the end. */
+    if (n + 4 <= a->length) {
+        return 1;
+    }
+    if (!emb_array_set_length(a, n + 4)) {
+        printf("ERROR: emb_array_reserve(), failed to reserve %d entries\n", n);
+        return 0;
+    }
+    return 1;
+}
+
+/* Frees the point and flag lists held by the geometry in a a from the
+ * entry a first on, unless they are released along with its arena.
+ */
+static void
+emb_array_free_lists(EmbArray *a, int first)
+{
+    int i;
+    if (a->type == EMB_STITCH || a->type == EMB_THREAD
+        || (a->arena && !a->heap_lists)) {
+        return;
+    }
+    for (i = first; i < a->count; i++) {
+        EmbGeometry g = a->geometry[i];
+        switch (a->geometry[i].type) {
+        case EMB_PATH:
+        case EMB_POLYGON:
+        case EMB_POLYLINE: {
+            emb_vector_list_free(g.object.path.pointList);
+            emb_id_list_free(g.object.path.flagList);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+}
+
+/* Drops the entries of the array a a from a count on, along with any
+ * point lists they hold. Returns 0 if a shared array could not be copied.
+ */
+int
+emb_array_truncate(EmbArray *a, int count)
+{
+    if (!a || count >= a->count) {
+        return 1;
+    }
+    if (!emb_array_writable(a)) {
+        return 0;
+    }
+    count = EMB_MAX(count, 0);
+    emb_array_free_lists(a, count);
+    a->count = count;
+    return 1;
+}
+
+/* Copies all entries in the EmbArray struct from a src to a dst,
+ * replacing the contents of a dst, which must be an array of the same
+ * type. Point lists are copied too, so the two arrays are independent.
+ *
+ * Returns 0 if the types differ or the memory could not be allocated.
+ */
+int
+emb_array_copy(EmbArray *dst, EmbArray *src)
+{
+    if (!dst || !src) {
+        printf("ERROR: emb_array_copy(), argument is null\n");
+        return 0;
+    }
+    if (emb_array_entry_size(dst->type) != emb_array_entry_size(src->type)) {
+        printf("ERROR: emb_array_copy(), arrays hold different types\n");
+        return 0;
+    }
+    if (!emb_array_writable(dst)) {
+        return 0;
+    }
+    emb_array_free_lists(dst, 0);
+    dst->count = 0;
+    if (!emb_array_reserve(dst, src->count)) {
+        return 0;
+    }
+    memcpy(emb_array_data(dst), emb_array_data(src),
+        src->count*emb_array_entry_size(src->type));
+    dst->count = src->count;
+    return emb_array_copy_lists(dst);
+}
+
+/* Records in the arena-backed array a a that a geometry added to it
+ * holds point or flag lists from outside its arena, which
+ * emb_array_free() then has to release one by one.
+ */
+static void
+emb_array_note_lists(EmbArray *a, EmbVectorList *points, EmbIdList *flags)
+{
+    if (!a->arena) {
+        return;
+    }
+    if ((points && points->arena != a->arena)
+        || (flags && flags->arena != a->arena)) {
+        a->heap_lists = 1;
+    }
+}
+
+/* Add a circle a b to the EmbArray a a and it returns if the
+ * element was successfully added.
+ */
+int
+emb_array_add_circle(EmbArray *a, EmbCircle b)
+{
+    a->count++;
+    if (!emb_array_resize(a)) {
+        return 0;
+    }
+    a->geometry[a->count - 1].object.circle = b;
+    a->geometry[a->count - 1].type = EMB_CIRCLE;
+    return 1;
+}
+
+/* Add an ellipse a b to the EmbArray a a and it returns if the
+ * element was successfully added.
+ */
+int
+emb_array_add_ellipse(EmbArray *a, EmbEllipse b)
+{
+    a->count++;
+    if (!emb_array_resize(a)) {
+        return 0;
+    }
+    a->geometry[a->count - 1].object.ellipse = b;
+    a->geometry[a->count - 1].type = EMB_ELLIPSE;
+    return 1;
+}
+
+/* Add a flag a b to the EmbArray a a and it returns if the
+ * element was successfully added.
+ */
+int
+emb_array_add_flag(EmbArray *a, EmbFlag b)
 {
     a->count++;
     if (!emb_array_resize(a)) {
@@ -1088,6 +2433,7 @@ emb_array_addPath(EmbArray *a, EmbPath b)
     if (!emb_array_resize(a)) {
         return 0;
     }
+    emb_array_note_lists(a, b.pointList, b.flagList);
     a->geometry[a->count - 1].object.path = b;
     a->geometry[a->count - 1].type = EMB_PATH;
     return 1;
@@ -1118,6 +2464,7 @@ emb_array_addPolyline(EmbArray *a, EmbPolyline b)
     if (!emb_array_resize(a)) {
         return 0;
     }
+    emb_array_note_lists(a, b.pointList, b.flagList);
     a->geometry[a->count - 1].object.polyline = b;
     a->geometry[a->count - 1].type = EMB_POLYLINE;
     return 1;
@@ -1133,6 +2480,7 @@ emb_array_addPolygon(EmbArray *a, EmbPolygon b)
     if (!emb_array_resize(a)) {
         return 0;
     }
+    emb_array_note_lists(a, b.pointList, b.flagList);
     a->geometry[a->count - 1].object.polygon = b;
     a->geometry[a->count - 1].type = EMB_POLYGON;
     return 1;
@@ -1179,6 +2527,16 @@ emb_array_add_geometry(EmbArray *a, EmbGeometry g)
         return 0;
     }
     a->geometry[a->count - 1] = g;
+    switch (g.type) {
+    case EMB_PATH:
+    case EMB_POLYGON:
+    case EMB_POLYLINE:
+        emb_array_note_lists(a, g.object.path.pointList,
+            g.object.path.flagList);
+        break;
+    default:
+        break;
+    }
     return 1;
 }
 
@@ -1198,6 +2556,11 @@ emb_array_addVector(EmbArray *a, EmbVector b)
 }
 
 /* Free the memory of EmbArray a a, recursively if necessary.
+ *
+ * An array that lives in an arena only gives its storage back to the
+ * arena, and only visits its geometry if some of it holds lists that
+ * were allocated on the heap. Storage that is still shared with a clone
+ * is left to the clone.
  */
 void
 emb_array_free(EmbArray* a)
@@ -1205,39 +2568,151 @@ emb_array_free(EmbArray* a)
     if (!a) {
         return;
     }
-    switch (a->type) {
-    case EMB_STITCH:
-        safe_free(a->stitch);
-        break;
-    case EMB_THREAD:
-        safe_free(a->thread);
-        break;
-    default: {
-        int i;
-        for (i = 0; i < a->count; i++) {
-            EmbGeometry g = a->geometry[i];
-            switch (a->geometry[i].type) {
-            case EMB_PATH: {
-                emb_array_free(g.object.path.pointList);
-                break;
-            }
-            case EMB_POLYGON: {
-                emb_array_free(g.object.polygon.pointList);
-                break;
-            }
-            case EMB_POLYLINE: {
-                emb_array_free(g.object.polyline.pointList);
-                break;
-            }
-            default:
-                break;
-            }
+    if (a->refs && *(a->refs) > 1) {
+        *(a->refs) -= 1;
+    }
+    else {
+        emb_array_free_lists(a, 0);
+        emb_release(a->arena, a->refs, sizeof(int));
+        emb_release(a->arena, emb_array_data(a),
+            a->length*emb_array_entry_size(a->type));
+    }
+    emb_release(a->arena, a, sizeof(EmbArray));
+}
+
+/* Allocates an empty EmbVectorList with room for a size points.
+ *
+ * Polylines, polygons, paths and satin outlines store their vertices
+ * in these dense lists rather than in one EmbGeometry per vertex.
+ */
+EmbVectorList*
+emb_vector_list_create(int size)
+{
+    return emb_vector_list_create_in(0, size);
+}
+
+/* Allocates an empty EmbVectorList in a arena, or on the heap if a arena
+ * is null. Geometry added to a pattern should use the pattern's arena.
+ */
+EmbVectorList*
+emb_vector_list_create_in(EmbArena *arena, int size)
+{
+    EmbVectorList *list = (EmbVectorList*)emb_alloc(arena,
+        sizeof(EmbVectorList));
+    if (!list) {
+        printf("ERROR: emb_vector_list_create(), cannot allocate list\n");
+        return 0;
+    }
+    if (size < 4) {
+        size = 4;
+    }
+    list->data = (EmbVector*)emb_alloc(arena, size*sizeof(EmbVector));
+    if (!list->data) {
+        printf("ERROR: emb_vector_list_create(), cannot allocate data\n");
+        emb_release(arena, list, sizeof(EmbVectorList));
+        return 0;
+    }
+    list->count = 0;
+    list->size = size;
+    list->arena = arena;
+    return list;
+}
+
+/* Appends the vector a v to a list, doubling the storage when it is full.
+ * Returns 0 if the memory could not be allocated.
+ */
+int
+emb_vector_list_add(EmbVectorList *list, EmbVector v)
+{
+    if (list->count == list->size) {
+        EmbVector *data = (EmbVector*)emb_realloc(list->arena, list->data,
+            list->size*sizeof(EmbVector), 2*list->size*sizeof(EmbVector));
+        if (!data) {
+            printf("ERROR: emb_vector_list_add(), cannot grow list\n");
+            return 0;
         }
-        safe_free(a->geometry);
-        break;
+        list->data = data;
+        list->size *= 2;
+    }
+    list->data[list->count] = v;
+    list->count++;
+    return 1;
+}
+
+/* Frees the EmbVectorList a list, which may be null. */
+void
+emb_vector_list_free(EmbVectorList *list)
+{
+    if (!list) {
+        return;
+    }
+    emb_release(list->arena, list->data, list->size*sizeof(EmbVector));
+    emb_release(list->arena, list, sizeof(EmbVectorList));
+}
+
+/* Allocates an empty EmbIdList with room for a size identifiers. */
+EmbIdList*
+emb_id_list_create(int size)
+{
+    return emb_id_list_create_in(0, size);
+}
+
+/* Allocates an empty EmbIdList in a arena, or on the heap if a arena
+ * is null.
+ */
+EmbIdList*
+emb_id_list_create_in(EmbArena *arena, int size)
+{
+    EmbIdList *list = (EmbIdList*)emb_alloc(arena, sizeof(EmbIdList));
+    if (!list) {
+        printf("ERROR: emb_id_list_create(), cannot allocate list\n");
+        return 0;
+    }
+    if (size < 4) {
+        size = 4;
+    }
+    list->data = (int32_t*)emb_alloc(arena, size*sizeof(int32_t));
+    if (!list->data) {
+        printf("ERROR: emb_id_list_create(), cannot allocate data\n");
+        emb_release(arena, list, sizeof(EmbIdList));
+        return 0;
+    }
+    list->count = 0;
+    list->size = size;
+    list->arena = arena;
+    return list;
+}
+
+/* Appends the identifier a id to a list, doubling the storage when it is
+ * full. Returns 0 if the memory could not be allocated.
+ */
+int
+emb_id_list_add(EmbIdList *list, int32_t id)
+{
+    if (list->count == list->size) {
+        int32_t *data = (int32_t*)emb_realloc(list->arena, list->data,
+            list->size*sizeof(int32_t), 2*list->size*sizeof(int32_t));
+        if (!data) {
+            printf("ERROR: emb_id_list_add(), cannot grow list\n");
+            return 0;
+        }
+        list->data = data;
+        list->size *= 2;
     }
+    list->data[list->count] = id;
+    list->count++;
+    return 1;
+}
+
+/* Frees the EmbIdList a list, which may be null. */
+void
+emb_id_list_free(EmbIdList *list)
+{
+    if (!list) {
+        return;
     }
-    safe_free(a);
+    emb_release(list->arena, list->data, list->size*sizeof(int32_t));
+    emb_release(list->arena, list, sizeof(EmbIdList));
 }
 
 /* Print the vector "v2 with the name "label". */
@@ -1262,12 +2737,12 @@ void emb_arc_print(EmbArc arc)
  * if there are.
  */
 int
-check_header_present(FILE* file, int minimum_header_length)
+check_header_present(EmbStream* file, int minimum_header_length)
 {
     int length;
-    fseek(file, 0, SEEK_END);
-    length = ftell(file);
-    fseek(file, 0, SEEK_SET);
+    emb_fseek(file, 0, SEEK_END);
+    length = emb_ftell(file);
+    emb_fseek(file, 0, SEEK_SET);
     if (length < minimum_header_length) {
         return 0;
     }
@@ -1294,15 +2769,15 @@ haveExtraDIFATSectors(bcf_file* file)
 
 /* . */
 int
-seekToSector(bcf_file* bcfFile, FILE* file, const unsigned int sector)
+seekToSector(bcf_file* bcfFile, EmbStream* file, const unsigned int sector)
 {
     unsigned int offset = sector * sectorSize(bcfFile) + sectorSize(bcfFile);
-    return fseek(file, offset, SEEK_SET);
+    return emb_fseek(file, offset, SEEK_SET);
 }
 
 /* . */
 void
-parseDIFATSectors(FILE* file, bcf_file* bcfFile)
+parseDIFATSectors(EmbStream* file, bcf_file* bcfFile)
 {
     unsigned int difatEntriesToRead = bcfFile->header.numberOfFATSectors - difatEntriesInHeader;
     unsigned int difatSectorNumber = bcfFile->header.firstDifatSectorLocation;
@@ -1314,7 +2789,7 @@ parseDIFATSectors(FILE* file, bcf_file* bcfFile)
 
 /* . */
 int
-bcfFile_read(FILE* file, bcf_file* bcfFile)
+bcfFile_read(EmbStream* file, bcf_file* bcfFile)
 {
     unsigned int i, numberOfDirectoryEntriesPerSector;
     unsigned int directorySectorToReadFrom;
@@ -1350,13 +2825,17 @@ bcfFile_read(FILE* file, bcf_file* bcfFile)
     return 1;
 }
 
-/* Get the File object. */
+/* Get the File object.
+ *
+ * The stream is extracted into a memory stream positioned at its start,
+ * which the caller closes with emb_stream_close().
+ */
 void*
-GetFile(bcf_file* bcfFile, FILE* file, char* fileToFind)
+GetFile(bcf_file* bcfFile, EmbStream* file, char* fileToFind)
 {
     int filesize, sectorSize, currentSector;
     int sizeToWrite, currentSize, totalSectors, i, j;
-    FILE* fileOut = tmpfile();
+    EmbStream* fileOut;
     bcf_directory_entry* pointer = bcfFile->directory->dirEntries;
     while (pointer) {
         if (!strcmp(fileToFind, pointer->directoryEntryName)) {
@@ -1364,7 +2843,15 @@ GetFile(bcf_file* bcfFile, FILE* file, char* fileToFind)
         }
         pointer = pointer->next;
     }
+    if (!pointer) {
+        printf("ERROR: GetFile(), no stream named %s.\n", fileToFind);
+        return 0;
+    }
     filesize = pointer->streamSize;
+    fileOut = emb_stream_buffer(filesize);
+    if (!fileOut) {
+        return 0;
+    }
     sectorSize = bcfFile->difat->sectorSize;
     currentSize = 0;
     currentSector = pointer->startingSectorLocation;
@@ -1377,12 +2864,12 @@ GetFile(bcf_file* bcfFile, FILE* file, char* fileToFind)
         }
         for (j=0; j<sizeToWrite; j++) {
             char input;
-            if (fread(&input, 1, 1, file) != 1) {
+            if (emb_fread(&input, 1, 1, file) != 1) {
                 /* TODO: Needs an error code. */
                 puts("ERROR: GetFile failed to read byte.");
                 return fileOut;
             }
-            if (fwrite(&input, 1, 1, fileOut) != 1) {
+            if (emb_fwrite(&input, 1, 1, fileOut) != 1) {
                 /* TODO: Needs an error code. */
                 puts("ERROR: GetFile failed to read byte.");
                 return fileOut;
@@ -1391,6 +2878,7 @@ GetFile(bcf_file* bcfFile, FILE* file, char* fileToFind)
         currentSize += sizeToWrite;
         currentSector = bcfFile->fat->fatEntries[currentSector];
     }
+    emb_fseek(fileOut, 0, SEEK_SET);
     return fileOut;
 }
 
@@ -1406,7 +2894,7 @@ bcf_file_free(bcf_file* bcfFile)
 
 /* . */
 bcf_file_difat*
-bcf_difat_create(FILE* file, unsigned int fatSectors, const unsigned int sectorSize)
+bcf_difat_create(EmbStream* file, unsigned int fatSectors, const unsigned int sectorSize)
 {
     unsigned int i;
     bcf_file_difat* difat = 0;
@@ -1447,7 +2935,7 @@ entriesInDifatSector(bcf_file_difat* fat)
 /* . */
 unsigned int
 readFullSector(
-    FILE* file,
+    EmbStream* file,
     bcf_file_difat* bcfFile,
     unsigned int* difatEntriesToRead)
 {
@@ -1482,7 +2970,7 @@ readFullSector(
 
 /* . */
 void
-parseDirectoryEntryName(FILE* file, bcf_directory_entry* dir)
+parseDirectoryEntryName(EmbStream* file, bcf_directory_entry* dir)
 {
     int i;
     for (i = 0; i < 32; ++i) {
@@ -1509,7 +2997,7 @@ CompoundFileDirectory(const unsigned int maxNumberOfDirectoryEntries)
 
 /* . */
 EmbTime
-parseTime(FILE* file)
+parseTime(EmbStream* file)
 {
     EmbTime returnVal;
     unsigned int ft_low, ft_high;
@@ -1529,7 +3017,7 @@ parseTime(FILE* file)
 
 /* . */
 bcf_directory_entry*
-CompoundFileDirectoryEntry(FILE* file)
+CompoundFileDirectoryEntry(EmbStream* file)
 {
     int i;
     const int guidSize = 16;
@@ -1542,17 +3030,17 @@ CompoundFileDirectoryEntry(FILE* file)
     parseDirectoryEntryName(file, dir);
     dir->next = 0;
     dir->directoryEntryNameLength = emb_read_u16(file);
-    dir->objectType = (unsigned char)fgetc(file);
+    dir->objectType = (unsigned char)emb_fgetc(file);
     if ((dir->objectType != ObjectTypeStorage) && (dir->objectType != ObjectTypeStream) && (dir->objectType != ObjectTypeRootEntry)) {
         printf("ERROR: compound-file-directory.c CompoundFileDirectoryEntry()");
         printf(", unexpected object type: %d\n", dir->objectType);
         return NULL;
     }
-    dir->colorFlag = (unsigned char)fgetc(file);
+    dir->colorFlag = (unsigned char)emb_fgetc(file);
     dir->leftSiblingId = emb_read_i32(file);
     dir->rightSiblingId = emb_read_i32(file);
     dir->childId = emb_read_i32(file);
-    if (fread(dir->CLSID, 1, guidSize, file) < guidSize) {
+    if (emb_fread(dir->CLSID, 1, guidSize, file) < guidSize) {
         printf("ERROR: Failed to read guidSize bytes for CLSID");
         return dir;
     }
@@ -1574,7 +3062,7 @@ CompoundFileDirectoryEntry(FILE* file)
 
 /* . */
 void
-readNextSector(FILE* file, bcf_directory* dir)
+readNextSector(EmbStream* file, bcf_directory* dir)
 {
     unsigned int i;
     for (i = 0; i < dir->maxNumberOfDirectoryEntries; ++i) {
@@ -1632,7 +3120,7 @@ bcfFileFat_create(const unsigned int sectorSize)
 
 /* . */
 void
-loadFatFromSector(bcf_file_fat* fat, FILE* file)
+loadFatFromSector(bcf_file_fat* fat, EmbStream* file)
 {
     unsigned int i;
     unsigned int current_fat_entries = fat->fatEntryCount;
@@ -1645,14 +3133,14 @@ loadFatFromSector(bcf_file_fat* fat, FILE* file)
 
 /* . */
 bcf_file_header
-bcfFileHeader_read(FILE* file)
+bcfFileHeader_read(EmbStream* file)
 {
     bcf_file_header header;
-    if (fread(header.signature, 1, 8, file) < 8) {
+    if (emb_fread(header.signature, 1, 8, file) < 8) {
         puts("ERROR: failed to read signature bytes from bcf file.");
         return header;
     }
-    if (fread(header.CLSID, 1, 16, file) < 16) {
+    if (emb_fread(header.CLSID, 1, 16, file) < 16) {
         puts("ERROR: failed to read CLSID bytes from bcf file.");
         return header;
     }
@@ -1677,7 +3165,7 @@ bcfFileHeader_read(FILE* file)
 
 /* . */
 int
-emb_generate_satin_outline(EmbArray *lines, EmbReal thickness, EmbSatinOutline* result)
+emb_generate_satin_outline(EmbVectorList *lines, EmbReal thickness, EmbSatinOutline* result)
 {
     int i;
     EmbLine line1, line2;
@@ -1686,94 +3174,94 @@ emb_generate_satin_outline(EmbArray *lines, EmbReal thickness, EmbSatinOutline*
     EmbVector v1;
     EmbVector temp;
     EmbLine line;
+    EmbVector *v = lines->data;
 
     EmbReal halfThickness = thickness / 2.0;
     int intermediateOutlineCount = 2 * lines->count - 2;
-    outline.side1 = emb_array_create(EMB_VECTOR);
-    if (!outline.side1) {
-        printf("ERROR: emb_generate_satin_outline(), cannot allocate memory for outline->side1\n");
+
+    if (!result) {
+        printf("ERROR: emb_generate_satin_outline(), result argument is null\n");
         return 0;
     }
-    outline.side2 = emb_array_create(EMB_VECTOR);
-    if (!outline.side2) {
-        printf("ERROR: emb_generate_satin_outline(), cannot allocate memory for outline->side2\n");
+    outline.side1 = emb_vector_list_create(intermediateOutlineCount);
+    outline.side2 = emb_vector_list_create(intermediateOutlineCount);
+    if (!outline.side1 || !outline.side2) {
+        printf("ERROR: emb_generate_satin_outline(), cannot allocate memory for outline\n");
+        emb_vector_list_free(outline.side1);
+        emb_vector_list_free(outline.side2);
         return 0;
     }
 
     for (i = 1; i < lines->count; i++) {
-        line.start = lines->geometry[i - 1].object.vector;
-        line.end = lines->geometry[i].object.vector;
+        line.start = v[i - 1];
+        line.end = v[i];
 
         v1 = emb_line_normalVector(line, 1);
 
         temp = emb_vector_scale(v1, halfThickness);
-        temp = emb_vector_add(temp, lines->geometry[i-1].object.vector);
-        emb_array_addVector(outline.side1, temp);
-        temp = emb_vector_add(temp, lines->geometry[i].object.vector);
-        emb_array_addVector(outline.side1, temp);
+        temp = emb_vector_add(temp, v[i-1]);
+        emb_vector_list_add(outline.side1, temp);
+        temp = emb_vector_add(temp, v[i]);
+        emb_vector_list_add(outline.side1, temp);
 
         temp = emb_vector_scale(v1, -halfThickness);
-        temp = emb_vector_add(temp, lines->geometry[i - 1].object.vector);
-        emb_array_addVector(outline.side2, temp);
-        temp = emb_vector_add(temp, lines->geometry[i].object.vector);
-        emb_array_addVector(outline.side2, temp);
-    }
-
-    if (!result) {
-        printf("ERROR: emb_generate_satin_outline(), result argument is null\n");
-        return 0;
-    }
-    result->side1 = emb_array_create(EMB_VECTOR);
-    if (!result->side1) {
-        printf("ERROR: emb_generate_satin_outline(), cannot allocate memory for result->side1\n");
-        return 0;
-    }
-    result->side2 = emb_array_create(EMB_VECTOR);
-    if (!result->side2) {
-        printf("ERROR: emb_generate_satin_outline(), cannot allocate memory for result->side2\n");
+        temp = emb_vector_add(temp, v[i - 1]);
+        emb_vector_list_add(outline.side2, temp);
+        temp = emb_vector_add(temp, v[i]);
+        emb_vector_list_add(outline.side2, temp);
+    }
+
+    result->side1 = emb_vector_list_create(lines->count);
+    result->side2 = emb_vector_list_create(lines->count);
+    if (!result->side1 || !result->side2) {
+        printf("ERROR: emb_generate_satin_outline(), cannot allocate memory for result\n");
+        emb_vector_list_free(outline.side1);
+        emb_vector_list_free(outline.side2);
         return 0;
     }
 
-    emb_array_addVector(result->side1, outline.side1->geometry[0].object.vector);
-    emb_array_addVector(result->side2, outline.side2->geometry[0].object.vector);
+    emb_vector_list_add(result->side1, outline.side1->data[0]);
+    emb_vector_list_add(result->side2, outline.side2->data[0]);
 
     for (i = 3; i < intermediateOutlineCount; i += 2) {
         int emb_error = 0;
-        line1.start = outline.side1->geometry[i - 3].object.vector;
-        line1.end = outline.side1->geometry[i - 2].object.vector;
-        line2.start = outline.side1->geometry[i - 1].object.vector;
-        line2.end = outline.side1->geometry[i].object.vector;
+        line1.start = outline.side1->data[i - 3];
+        line1.end = outline.side1->data[i - 2];
+        line2.start = outline.side1->data[i - 1];
+        line2.end = outline.side1->data[i];
         out = emb_line_intersectionPoint(line1, line2, &emb_error);
         if (emb_error) {
             puts("No intersection point.");
         }
-        emb_array_addVector(result->side1, out);
+        emb_vector_list_add(result->side1, out);
 
-        line1.start = outline.side2->geometry[i - 3].object.vector;
-        line1.end = outline.side2->geometry[i - 2].object.vector;
-        line2.start = outline.side2->geometry[i - 1].object.vector;
-        line2.end = outline.side2->geometry[i].object.vector;
+        line1.start = outline.side2->data[i - 3];
+        line1.end = outline.side2->data[i - 2];
+        line2.start = outline.side2->data[i - 1];
+        line2.end = outline.side2->data[i];
         out = emb_line_intersectionPoint(line1, line2, &emb_error);
         if (emb_error) {
             puts("No intersection point.");
         }
-        emb_array_addVector(result->side2, out);
+        emb_vector_list_add(result->side2, out);
     }
 
-    emb_array_addVector(result->side1, outline.side1->geometry[2 * lines->count - 3].object.vector);
-    emb_array_addVector(result->side2, outline.side2->geometry[2 * lines->count - 3].object.vector);
+    emb_vector_list_add(result->side1, outline.side1->data[2 * lines->count - 3]);
+    emb_vector_list_add(result->side2, outline.side2->data[2 * lines->count - 3]);
     result->length = lines->count;
+    emb_vector_list_free(outline.side1);
+    emb_vector_list_free(outline.side2);
     return 1;
 }
 
 /* . */
-EmbArray*
+EmbVectorList*
 emb_satin_outline_render(EmbSatinOutline* result, EmbReal density)
 {
     int i, j;
     EmbVector currTop, currBottom, topDiff, bottomDiff, midDiff;
     EmbVector midLeft, midRight, topStep, bottomStep;
-    EmbArray* stitches = 0;
+    EmbVectorList* stitches = 0;
     int numberOfSteps;
     EmbReal midLength;
 
@@ -1783,16 +3271,17 @@ emb_satin_outline_render(EmbSatinOutline* result, EmbReal density)
     }
 
     if (result->length > 0) {
+        stitches = emb_vector_list_create(2 * result->length);
         for (j = 0; j < result->length - 1; j++) {
-            EmbGeometry *g10 = &(result->side1->geometry[j+0]);
-            EmbGeometry *g11 = &(result->side1->geometry[j+1]);
-            EmbGeometry *g20 = &(result->side2->geometry[j+0]);
-            EmbGeometry *g21 = &(result->side2->geometry[j+1]);
-            topDiff = emb_vector_subtract(g10->object.vector, g11->object.vector);
-            bottomDiff = emb_vector_subtract(g21->object.vector, g20->object.vector);
+            EmbVector v10 = result->side1->data[j+0];
+            EmbVector v11 = result->side1->data[j+1];
+            EmbVector v20 = result->side2->data[j+0];
+            EmbVector v21 = result->side2->data[j+1];
+            topDiff = emb_vector_subtract(v10, v11);
+            bottomDiff = emb_vector_subtract(v21, v20);
 
-            midLeft = emb_vector_average(g10->object.vector, g20->object.vector);
-            midRight = emb_vector_average(g11->object.vector, g21->object.vector);
+            midLeft = emb_vector_average(v10, v20);
+            midRight = emb_vector_average(v11, v21);
 
             midDiff = emb_vector_subtract(midLeft, midRight);
             midLength = emb_vector_length(midDiff);
@@ -1800,35 +3289,32 @@ emb_satin_outline_render(EmbSatinOutline* result, EmbReal density)
             numberOfSteps = (int)(midLength * density / 200);
             topStep = emb_vector_scale(topDiff, 1.0/numberOfSteps);
             bottomStep = emb_vector_scale(bottomDiff, 1.0/numberOfSteps);
-            currTop = g10->object.vector;
-            currBottom = g20->object.vector;
+            currTop = v10;
+            currBottom = v20;
 
             for (i = 0; i < numberOfSteps; i++) {
-                if (!stitches) {
-                    stitches = emb_array_create(EMB_VECTOR);
-                }
-                emb_array_addVector(stitches, currTop);
-                emb_array_addVector(stitches, currBottom);
+                emb_vector_list_add(stitches, currTop);
+                emb_vector_list_add(stitches, currBottom);
                 currTop = emb_vector_add(currTop, topStep);
                 currBottom = emb_vector_add(currBottom, bottomStep);
             }
         }
-        emb_array_addVector(stitches, currTop);
-        emb_array_addVector(stitches, currBottom);
+        emb_vector_list_add(stitches, currTop);
+        emb_vector_list_add(stitches, currBottom);
     }
     return stitches;
 }
 
 /* . */
 void
-write_24bit(FILE* file, int x)
+write_24bit(EmbStream* file, int x)
 {
     unsigned char a[4];
     a[0] = (unsigned char)0;
     a[1] = (unsigned char)(x & 0xFF);
     a[2] = (unsigned char)((x >> 8) & 0xFF);
     a[3] = (unsigned char)((x >> 16) & 0xFF);
-    fwrite(a, 1, 4, file);
+    emb_fwrite(a, 1, 4, file);
 }
 
 /* . */
@@ -1847,7 +3333,7 @@ void
 embColor_read(void *f, EmbColor *c, int toRead)
 {
     unsigned char b[4];
-    if (fread(b, 1, toRead, f) < (unsigned int)toRead) {
+    if (emb_fread(b, 1, toRead, f) < (unsigned int)toRead) {
         puts("ERROR: Failed to read embColor bytes.");
         return;
     }
@@ -1865,7 +3351,7 @@ embColor_write(void *f, EmbColor c, int toWrite)
     b[1] = c.g;
     b[2] = c.b;
     b[3] = 0;
-    fwrite(b, 1, toWrite, f);
+    emb_fwrite(b, 1, toWrite, f);
 }
 
 /* Returns the closest color to the required color based on
@@ -1922,38 +3408,249 @@ emb_find_nearest_thread(EmbColor color, EmbThread *thread_list, int n_threads)
  */
 EmbThread
 emb_get_random_thread(void)
+{
+    return emb_context_random_thread(&emb_default_context);
+}
+
+/* Returns a random thread color drawn from the seed of a ctx, so threads
+ * with their own context do not share the state of rand().
+ */
+EmbThread
+emb_context_random_thread(EmbContext *ctx)
 {
     EmbThread c;
-    c.color.r = rand()%256;
-    c.color.g = rand()%256;
-    c.color.b = rand()%256;
-    strcpy(c.description, "random");
-    strcpy(c.catalogNumber, "");
+    unsigned char rgb[3];
+    int i;
+    for (i = 0; i < 3; i++) {
+        ctx->seed = ctx->seed * 1103515245u + 12345u;
+        rgb[i] = (unsigned char)((ctx->seed >> 16) & 0xFF);
+    }
+    c.color.r = rgb[0];
+    c.color.g = rgb[1];
+    c.color.b = rgb[2];
+    c.description = "random";
+    c.catalogNumber = "";
     return c;
 }
 
-/* . */
-void
-binaryReadString(FILE* file, char* buffer, int maxLength)
+/* Returns the wall clock time in seconds from some fixed point. */
+static double
+emb_wall_clock(void)
 {
-    int i = 0;
-    while (i < maxLength) {
-        buffer[i] = (char)fgetc(file);
-        if (buffer[i] == '\0') {
-            break;
-        }
-        i++;
+#if defined(EMB_STREAM_MMAP)
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+#else
+    return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+/* Creates a context with the same settings as a new default context.
+ * Free it with emb_context_free() once the patterns that use it are
+ * freed.
+ */
+EmbContext*
+emb_context_create(void)
+{
+    EmbContext *ctx = (EmbContext*)malloc(sizeof(EmbContext));
+    if (!ctx) {
+        printf("ERROR: emb_context_create(), cannot allocate context\n");
+        return 0;
     }
+    memset(ctx, 0, sizeof(EmbContext));
+    ctx->pes_version = PES0001;
+    emb_limits_init(&ctx->limits);
+    return ctx;
 }
 
-/* . */
+/* Frees a context from emb_context_create(). */
 void
-binaryReadUnicodeString(FILE* file, char *buffer, const int stringLength)
+emb_context_free(EmbContext *ctx)
 {
-    int i = 0;
-    for (i = 0; i < stringLength * 2; i++) {
-        char input = (char)fgetc(file);
-        if (input != 0) {
+    safe_free(ctx);
+}
+
+/* Returns the context of the functions that do not take one, which is
+ * shared by everything that uses them.
+ */
+EmbContext*
+emb_context_default(void)
+{
+    return &emb_default_context;
+}
+
+/* Limits
+ * -----------------------------------------------------------------------------
+ *
+ * A read or write runs between emb_work_begin() and emb_work_end(), with
+ * an EmbWork that its caller keeps linked from the pattern and the
+ * stream, so that patterns sharing a context can be read at the same
+ * time. While it runs, the stitches added to the pattern are counted
+ * against the limits of the context and every check_every of them the
+ * cancel flag, the clock and the memory held are looked at, as they are
+ * whenever a write needs more room. Past a limit the stream is stopped,
+ * so the decoder runs out of input at once and an encoder can write no
+ * more, and the read or write fails.
+ */
+
+/* Sets a limits to the defaults: MAX_STITCHES stitches and nothing else
+ * limited.
+ */
+void
+emb_limits_init(EmbLimits *limits)
+{
+    limits->max_stitches = MAX_STITCHES;
+    limits->max_bytes = 0;
+    limits->max_seconds = 0.0;
+    limits->cancel = 0;
+    limits->check_every = EMB_LIMIT_CHECK_EVERY;
+}
+
+/* Returns the most stitches a limits allow. */
+static int
+emb_limits_stitches(const EmbLimits *limits)
+{
+    return limits->max_stitches > 0 ? limits->max_stitches : MAX_STITCHES;
+}
+
+/* Returns whether the cancel flag of a limits has been set, which
+ * another thread may do at any time.
+ */
+static int
+emb_limits_cancelled(const EmbLimits *limits)
+{
+    if (!limits->cancel) {
+        return 0;
+    }
+#if defined(__GNUC__)
+    return __atomic_load_n(limits->cancel, __ATOMIC_RELAXED) != 0;
+#else
+    return *(volatile int *)limits->cancel != 0;
+#endif
+}
+
+/* Returns the bytes held by the lists of a p. */
+static size_t
+emb_pattern_bytes(const EmbPattern *p)
+{
+    return (size_t)p->stitch_list->length * sizeof(EmbStitch)
+        + (size_t)p->thread_list->length * sizeof(EmbThread)
+        + (size_t)p->geometry->length * sizeof(EmbGeometry);
+}
+
+/* Starts a work reading or writing a p, which may be null, through
+ * a stream, held to the limits of a ctx. A pattern to be written may
+ * already be past them. Returns 0 if it is stopped before it starts; the
+ * caller still ends it with emb_work_end().
+ */
+int
+emb_work_begin(EmbWork *work, EmbContext *ctx, EmbPattern *p,
+    EmbStream *stream)
+{
+    work->limits = ctx->limits;
+    work->pattern = p;
+    work->stream = stream;
+    work->started = emb_wall_clock();
+    work->held = 0;
+    work->stopped = EMB_LIMIT_NONE;
+    stream->work = work;
+    stream->stopped = EMB_LIMIT_NONE;
+    if (!p) {
+        return emb_work_limit(work, 0, 0);
+    }
+    p->work = work;
+    p->stopped = EMB_LIMIT_NONE;
+    work->held = emb_pattern_bytes(p);
+    return emb_work_limit(work, p->stitch_list->count, work->held);
+}
+
+/* Ends a work, reporting a limit that stopped it as an error of
+ * a function. Returns 0 if it was stopped.
+ */
+int
+emb_work_end(EmbWork *work, const char *function)
+{
+    const char *reasons[5] = {"", "the stitch limit", "the memory limit",
+        "the time limit", "cancellation"};
+    work->stream->work = 0;
+    if (work->pattern) {
+        work->pattern->work = 0;
+        work->pattern->stopped = work->stopped;
+    }
+    if (work->stopped != EMB_LIMIT_NONE) {
+        printf("ERROR: %s(), stopped by %s.\n", function,
+            reasons[work->stopped]);
+        return 0;
+    }
+    return 1;
+}
+
+/* Stops a work for a reason, leaving its stream ended. Returns 0 so that
+ * a check can return it.
+ */
+int
+emb_work_stop(EmbWork *work, int reason)
+{
+    EmbStream *stream = work->stream;
+    if (work->stopped == EMB_LIMIT_NONE) {
+        work->stopped = reason;
+    }
+    stream->stopped = work->stopped;
+    stream->position = EMB_MAX(stream->position, stream->length);
+    stream->flags |= EMB_STREAM_EOF;
+    return 0;
+}
+
+/* Looks at the cancel flag and the clock of a work, and whether the
+ * a stitches and a bytes it holds are too many. Returns 0, having
+ * stopped it, if it cannot go on.
+ */
+int
+emb_work_limit(EmbWork *work, long stitches, size_t bytes)
+{
+    const EmbLimits *limits = &work->limits;
+    if (work->stopped != EMB_LIMIT_NONE) {
+        return 0;
+    }
+    if (stitches > emb_limits_stitches(limits)) {
+        return emb_work_stop(work, EMB_LIMIT_STITCHES);
+    }
+    if (emb_limits_cancelled(limits)) {
+        return emb_work_stop(work, EMB_LIMIT_CANCELLED);
+    }
+    if (limits->max_bytes > 0 && bytes > limits->max_bytes) {
+        return emb_work_stop(work, EMB_LIMIT_BYTES);
+    }
+    if (limits->max_seconds > 0.0
+        && emb_wall_clock() - work->started > limits->max_seconds) {
+        return emb_work_stop(work, EMB_LIMIT_TIME);
+    }
+    return 1;
+}
+
+/* . */
+void
+binaryReadString(EmbStream* file, char* buffer, int maxLength)
+{
+    int i = 0;
+    while (i < maxLength) {
+        buffer[i] = (char)emb_fgetc(file);
+        if (buffer[i] == '\0') {
+            break;
+        }
+        i++;
+    }
+}
+
+/* . */
+void
+binaryReadUnicodeString(EmbStream* file, char *buffer, const int stringLength)
+{
+    int i = 0;
+    for (i = 0; i < stringLength * 2; i++) {
+        char input = (char)emb_fgetc(file);
+        if (input != 0) {
             buffer[i] = input;
         }
     }
@@ -1979,23 +3676,52 @@ stringInArray(const char *s, const char **array)
     return 0;
 }
 
-/* . */
+/* Reads a line of at most a maxLength-1 characters into a line,
+ * accepting LF, CR and CRLF endings, none of which are stored.
+ *
+ * Returns the length of the line.
+ */
 int
-emb_readline(FILE* file, char *line, int maxLength)
+emb_readline(EmbStream* file, char *line, int maxLength)
 {
     int i;
     char c;
+    if (!file->file) {
+        /* Scan memory directly rather than a byte per emb_fread(). */
+        for (i = 0; i < maxLength-1; i++) {
+            if (file->position >= file->length) {
+                file->flags |= EMB_STREAM_EOF;
+                break;
+            }
+            c = (char)file->data[file->position++];
+            if (c == '\r') {
+                if (file->position >= file->length) {
+                    file->flags |= EMB_STREAM_EOF;
+                }
+                else if (file->data[file->position] == '\n') {
+                    file->position++;
+                }
+                break;
+            }
+            if (c == '\n') {
+                break;
+            }
+            line[i] = c;
+        }
+        line[i] = 0;
+        return i;
+    }
     for (i = 0; i < maxLength-1; i++) {
-        if (!fread(&c, 1, 1, file)) {
+        if (!emb_fread(&c, 1, 1, file)) {
             break;
         }
         if (c == '\r') {
-            if (fread(&c, 1, 1, file) != 1) {
+            if (emb_fread(&c, 1, 1, file) != 1) {
                 /* Incomplete Windows-style line ending. */
                 break;
             }
             if (c != '\n') {
-                fseek(file, -1L, SEEK_CUR);
+                emb_fseek(file, -1L, SEEK_CUR);
             }
             break;
         }
@@ -2009,6 +3735,410 @@ emb_readline(FILE* file, char *line, int maxLength)
     return i;
 }
 
+/* Returns the next line of a stream, without its LF, CR or CRLF ending,
+ * and sets a length to its length, or returns 0 at the end.
+ *
+ * A memory stream hands out the line where it lies, however long. A
+ * stdio stream reads it into a buffer of a size bytes, splitting lines
+ * that do not fit as emb_readline() does.
+ */
+const char*
+emb_stream_line(EmbStream *stream, char *buffer, int size, size_t *length)
+{
+    const char *p, *q, *end;
+    if (stream->file) {
+        int c = fgetc(stream->file);
+        if (c == EOF) {
+            return 0;
+        }
+        ungetc(c, stream->file);
+        *length = (size_t)emb_readline(stream, buffer, size);
+        return buffer;
+    }
+    if (stream->position >= stream->length) {
+        stream->flags |= EMB_STREAM_EOF;
+        return 0;
+    }
+    p = (const char*)stream->data + stream->position;
+    end = (const char*)stream->data + stream->length;
+    for (q = p; q < end && *q != '\n' && *q != '\r'; q++) {
+    }
+    *length = (size_t)(q - p);
+    if (q < end) {
+        if (*q == '\r' && q + 1 < end && q[1] == '\n') {
+            q++;
+        }
+        q++;
+    }
+    stream->position = (size_t)(q - (const char*)stream->data);
+    return p;
+}
+
+static const double emb_parse_pow10[] = {
+    1.0e0, 1.0e1, 1.0e2, 1.0e3, 1.0e4, 1.0e5, 1.0e6, 1.0e7, 1.0e8, 1.0e9,
+    1.0e10, 1.0e11, 1.0e12, 1.0e13, 1.0e14, 1.0e15, 1.0e16, 1.0e17, 1.0e18,
+    1.0e19, 1.0e20, 1.0e21, 1.0e22
+};
+
+/* Parses a decimal number, with an optional sign, fraction and exponent,
+ * from the text between a s and a end into a value. Leading spaces and
+ * tabs are skipped, as atof() does.
+ *
+ * Returns the end of the number, or a s if there is none, in which case
+ * a value is left alone. Numbers of up to 15 significant digits are
+ * converted exactly without the C library.
+ */
+const char*
+emb_parse_real(const char *s, const char *end, EmbReal *value)
+{
+    const char *p = s;
+    uint64_t mantissa = 0;
+    int digits = 0, exponent = 0, negative = 0, any = 0;
+    double v;
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = (*p == '-');
+        p++;
+    }
+    for (; p < end && *p >= '0' && *p <= '9'; p++) {
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+            digits += (mantissa != 0);
+        }
+        else {
+            exponent++;
+        }
+        any = 1;
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++) {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+                digits += (mantissa != 0);
+                exponent--;
+            }
+            any = 1;
+        }
+    }
+    if (!any) {
+        return s;
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char *q = p + 1;
+        int e = 0, e_negative = 0;
+        if (q < end && (*q == '-' || *q == '+')) {
+            e_negative = (*q == '-');
+            q++;
+        }
+        if (q < end && *q >= '0' && *q <= '9') {
+            for (; q < end && *q >= '0' && *q <= '9'; q++) {
+                if (e < 10000) {
+                    e = e * 10 + (*q - '0');
+                }
+            }
+            exponent += e_negative ? -e : e;
+            p = q;
+        }
+    }
+    if (mantissa < ((uint64_t)1 << 53) && exponent >= -22 && exponent <= 22) {
+        v = (double)mantissa;
+        v = (exponent < 0) ? v / emb_parse_pow10[-exponent]
+            : v * emb_parse_pow10[exponent];
+    }
+    else {
+        /* Outside the exact range, leave the rounding to the C library. */
+        char number[64];
+        size_t n = (size_t)(p - s);
+        if (n >= sizeof(number)) {
+            n = sizeof(number) - 1;
+        }
+        memcpy(number, s, n);
+        number[n] = 0;
+        *value = (EmbReal)strtod(number, 0);
+        return p;
+    }
+    *value = (EmbReal)(negative ? -v : v);
+    return p;
+}
+
+/* Parses a decimal integer from the text between a s and a end into
+ * a value, as emb_parse_real() does.
+ */
+const char*
+emb_parse_int(const char *s, const char *end, int *value)
+{
+    const char *p = s;
+    long n = 0;
+    int negative = 0;
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = (*p == '-');
+        p++;
+    }
+    if (p >= end || *p < '0' || *p > '9') {
+        return s;
+    }
+    for (; p < end && *p >= '0' && *p <= '9'; p++) {
+        if (n < 100000000000L) {
+            n = n * 10 + (*p - '0');
+        }
+    }
+    n = negative ? -n : n;
+    *value = (int)EMB_MAX(EMB_MIN(n, 2147483647L), -2147483647L - 1);
+    return p;
+}
+
+/* Bulk text ingestion.
+ *
+ * emb_stream_parse_lines() cuts the rest of a memory stream into chunks
+ * at line boundaries and has a line parser turn each line into a record,
+ * the chunks being parsed in parallel into arrays of their own. The
+ * records are then gathered in file order for the reader to apply to the
+ * pattern, which is cheap next to the parsing.
+ */
+
+/* Cuts text into lines, remembering where the next of each terminator
+ * lies so that every byte is searched once.
+ */
+typedef struct EmbLines_ {
+    const char *p;
+    const char *end;
+    const char *lf;
+    const char *cr;
+    const char *sep;
+    int separator;
+} EmbLines;
+
+static const char*
+emb_lines_find(const char *p, const char *end, int c)
+{
+    const char *found;
+    if (!c) {
+        return end;
+    }
+    found = (const char*)memchr(p, c, (size_t)(end - p));
+    return found ? found : end;
+}
+
+static void
+emb_lines_init(EmbLines *lines, const char *p, const char *end, int separator)
+{
+    lines->p = p;
+    lines->end = end;
+    lines->separator = separator;
+    lines->lf = emb_lines_find(p, end, '\n');
+    lines->cr = emb_lines_find(p, end, '\r');
+    lines->sep = emb_lines_find(p, end, separator);
+}
+
+static int
+emb_lines_next(EmbLines *lines, const char **line, size_t *length)
+{
+    const char *stop;
+    if (lines->p >= lines->end) {
+        return 0;
+    }
+    if (lines->lf < lines->p) {
+        lines->lf = emb_lines_find(lines->p, lines->end, '\n');
+    }
+    if (lines->cr < lines->p) {
+        lines->cr = emb_lines_find(lines->p, lines->end, '\r');
+    }
+    if (lines->sep < lines->p) {
+        lines->sep = emb_lines_find(lines->p, lines->end, lines->separator);
+    }
+    stop = lines->lf;
+    if (lines->cr < stop) {
+        stop = lines->cr;
+    }
+    if (lines->sep < stop) {
+        stop = lines->sep;
+    }
+    *line = lines->p;
+    *length = (size_t)(stop - lines->p);
+    if (stop < lines->end && *stop == '\r'
+        && stop + 1 < lines->end && stop[1] == '\n') {
+        stop++;
+    }
+    lines->p = (stop < lines->end) ? stop + 1 : stop;
+    return 1;
+}
+
+typedef struct EmbParseChunk_ {
+    const char *start;
+    const char *end;
+    char *records;
+    int count;
+    int capacity;
+    int status;
+} EmbParseChunk;
+
+typedef struct EmbParseJob_ {
+    EmbParseChunk *chunks;
+    EmbLineParser parse;
+    size_t record_size;
+    int separator;
+} EmbParseJob;
+
+static void
+emb_parse_chunk(void *data, int index)
+{
+    EmbParseJob *job = (EmbParseJob*)data;
+    EmbParseChunk *chunk = job->chunks + index;
+    EmbLines lines;
+    const char *line;
+    size_t length;
+
+    /* Guess a record per 16 bytes of text and grow from there. */
+    chunk->capacity = (int)EMB_MAX(16, (chunk->end - chunk->start) / 16);
+    chunk->records = (char*)malloc(chunk->capacity * job->record_size);
+    if (!chunk->records) {
+        chunk->status = EMB_LINE_ERROR;
+        return;
+    }
+    emb_lines_init(&lines, chunk->start, chunk->end, job->separator);
+    while (emb_lines_next(&lines, &line, &length)) {
+        int result;
+        if (chunk->count == chunk->capacity) {
+            char *records = (char*)realloc(chunk->records,
+                2 * chunk->capacity * job->record_size);
+            if (!records) {
+                chunk->status = EMB_LINE_ERROR;
+                return;
+            }
+            chunk->records = records;
+            chunk->capacity *= 2;
+        }
+        result = job->parse(line, length,
+            chunk->records + chunk->count * job->record_size);
+        if (result == EMB_LINE_RECORD) {
+            chunk->count++;
+        }
+        else if (result != EMB_LINE_SKIP) {
+            chunk->status = result;
+            return;
+        }
+    }
+}
+
+/* Runs a parse over every line left in a stream and returns the records
+ * it makes, each of a record_size bytes, in a records and their number
+ * in a count. The caller frees a records with safe_free().
+ *
+ * Lines end at LF, CR or CRLF, and also at the byte a separator unless
+ * it is 0, for formats that run several commands on a line. A parser
+ * returning EMB_LINE_STOP ends the input before that line and one
+ * returning EMB_LINE_ERROR fails the whole parse.
+ *
+ * Returns 1 on success and 0 on failure.
+ */
+int
+emb_stream_parse_lines(EmbStream *stream, EmbLineParser parse,
+    size_t record_size, int separator, void **records, int *count)
+{
+    EmbParseChunk *chunks;
+    EmbParseJob job;
+    const char *start, *end;
+    char *out;
+    int i, n, allocated, total, status = EMB_LINE_SKIP;
+
+    *records = 0;
+    *count = 0;
+    if (stream->file) {
+        /* Only the rare stdio stream is copied into memory first. */
+        EmbStream *copy = emb_stream_buffer(EMB_STREAM_LOAD_SIZE);
+        unsigned char block[4096];
+        size_t got;
+        if (!copy) {
+            return 0;
+        }
+        while ((got = fread(block, 1, sizeof(block), stream->file)) > 0) {
+            emb_fwrite(block, 1, got, copy);
+        }
+        copy->position = 0;
+        i = emb_stream_parse_lines(copy, parse, record_size, separator,
+            records, count);
+        emb_stream_close(copy);
+        return i;
+    }
+
+    start = (const char*)stream->data + EMB_MIN(stream->position, stream->length);
+    end = (const char*)stream->data + stream->length;
+    stream->position = EMB_MAX(stream->position, stream->length);
+    n = (int)((end - start) / EMB_PARSE_CHUNK_SIZE) + 1;
+    allocated = n;
+    chunks = (EmbParseChunk*)calloc(n, sizeof(EmbParseChunk));
+    if (!chunks) {
+        printf("ERROR: emb_stream_parse_lines(), cannot allocate %d chunks\n", n);
+        return 0;
+    }
+    for (i = 0; i < n; i++) {
+        const char *cut = end;
+        chunks[i].start = (i == 0) ? start : chunks[i-1].end;
+        if (end - chunks[i].start > EMB_PARSE_CHUNK_SIZE) {
+            const char *from = chunks[i].start + EMB_PARSE_CHUNK_SIZE;
+            const char *lf = emb_lines_find(from, end, '\n');
+            const char *sep = emb_lines_find(from, end, separator);
+            cut = EMB_MIN(lf, sep);
+            if (cut < end) {
+                cut++;
+            }
+        }
+        chunks[i].end = cut;
+        if (cut == end) {
+            n = i + 1;
+        }
+    }
+
+    job.chunks = chunks;
+    job.parse = parse;
+    job.record_size = record_size;
+    job.separator = separator;
+    emb_parallel_for(emb_parse_chunk, &job, n, (n > 1) ? 0 : 1);
+
+    total = 0;
+    for (i = 0; i < n; i++) {
+        total += chunks[i].count;
+        status = chunks[i].status;
+        if (status != EMB_LINE_SKIP) {
+            n = i + 1;
+            break;
+        }
+    }
+    out = 0;
+    if (status != EMB_LINE_ERROR && total > 0) {
+        out = (char*)malloc(total * record_size);
+        if (!out) {
+            printf("ERROR: emb_stream_parse_lines(), cannot allocate %d records\n",
+                total);
+            status = EMB_LINE_ERROR;
+        }
+    }
+    total = 0;
+    for (i = 0; i < n; i++) {
+        if (out) {
+            memcpy(out + total * record_size, chunks[i].records,
+                chunks[i].count * record_size);
+            total += chunks[i].count;
+        }
+    }
+    for (i = 0; i < allocated; i++) {
+        safe_free(chunks[i].records);
+    }
+    safe_free(chunks);
+    if (status == EMB_LINE_ERROR) {
+        safe_free(out);
+        return 0;
+    }
+    *records = out;
+    *count = total;
+    return 1;
+}
+
 /* TODO: description */
 
 /* Get the trim bounds object. */
@@ -2040,47 +4170,190 @@ copy_trim(char const *s)
     return result;
 }
 
-/* Optimizes the number (a num) for output to a text file and returns
- * it as a string (a str).
+/* Number formatting for the text formats.
+ *
+ * The text writers print a coordinate or two per stitch, so these avoid
+ * printf(): the number is scaled to an integer and its digits written
+ * directly, which also keeps the output independent of the locale.
+ * Each function writes at most EMB_NUMBER_LENGTH bytes including the
+ * terminator into a buf and returns the length of the text.
  */
-char*
-emb_optOut(EmbReal num, char* str)
+
+static const double emb_pow10[] = {
+    1.0e0, 1.0e1, 1.0e2, 1.0e3, 1.0e4, 1.0e5, 1.0e6, 1.0e7, 1.0e8, 1.0e9
+};
+
+/* Writes the integer a value in decimal. */
+int
+emb_format_int(char *buf, long value)
 {
-    char *str_end;
-    /* Convert the number to a string */
-    sprintf(str, "%.10f", num);
-    /* Remove trailing zeroes */
-    str_end = str + string_len(str);
-    while (*--str_end == '0');
-    str_end[1] = 0;
-    /* Remove the decimal point if it happens to be an integer */
-    if (*str_end == '.') {
-        *str_end = 0;
+    char digits[24];
+    unsigned long u = (unsigned long)value;
+    int n = 0, length = 0;
+    if (value < 0) {
+        buf[length++] = '-';
+        u = 0UL - u;
     }
-    return str;
+    do {
+        digits[n++] = (char)('0' + u % 10);
+        u /= 10;
+    } while (u);
+    while (n > 0) {
+        buf[length++] = digits[--n];
+    }
+    buf[length] = 0;
+    return length;
 }
 
-/* . */
-void
-embTime_initNow(EmbTime* t)
+/* Writes the integer a scaled with its last a places digits after the
+ * decimal point.
+ */
+static int
+emb_format_scaled(char *buf, int negative, uint64_t scaled, int places)
 {
-    printf("%d", t->year);
-    /*
-    time_t rawtime;
-    struct tm* timeinfo;
-    time(&rawtime);
-    timeinfo = localtime(&rawtime);
+    char digits[24];
+    int n = 0, length = 0;
+    if (negative) {
+        buf[length++] = '-';
+    }
+    do {
+        digits[n++] = (char)('0' + scaled % 10);
+        scaled /= 10;
+    } while (scaled || n <= places);
+    while (n > places) {
+        buf[length++] = digits[--n];
+    }
+    if (places > 0) {
+        buf[length++] = '.';
+        while (n > 0) {
+            buf[length++] = digits[--n];
+        }
+    }
+    buf[length] = 0;
+    return length;
+}
 
-    t->year   = timeinfo->tm_year;
-    t->month  = timeinfo->tm_mon;
-    t->day    = timeinfo->tm_mday;
-    t->hour   = timeinfo->tm_hour;
-    t->minute = timeinfo->tm_min;
-    t->second = timeinfo->tm_sec;
-    */
+/* Writes a value with exactly a places decimals, from 0 to 9, as "%.*f"
+ * does.
+ */
+int
+emb_format_fixed(char *buf, double value, int places)
+{
+    double a, r, scaled, fraction;
+    places = EMB_MAX(0, EMB_MIN(places, 9));
+    a = fabs(value);
+    r = a * emb_pow10[places];
+    /* Out of range or not a number, leave it to the C library. */
+    if (!(r < 1.0e18)) {
+        return snprintf(buf, EMB_NUMBER_LENGTH, "%.*g", 9, value);
+    }
+    scaled = floor(r);
+    fraction = r - scaled;
+    /* The product is rounded, so an apparent tie is settled by the
+     * error fma() recovers, and an exact tie goes to even as in printf(). */
+    if (fraction == 0.5) {
+        double error = fma(a, emb_pow10[places], -r);
+        if (error > 0.0 || (error == 0.0 && fmod(scaled, 2.0) != 0.0)) {
+            scaled += 1.0;
+        }
+    }
+    else if (fraction > 0.5) {
+        scaled += 1.0;
+    }
+    return emb_format_scaled(buf, value < 0.0, (uint64_t)scaled, places);
 }
 
-/* . */
+/* Writes a value with the fewest decimals that read back as the same
+ * EmbReal, so 1.5 is written "1.5" rather than "1.500000".
+ *
+ * Values that need more than 9 decimals, or more than 9 digits before
+ * the point, fall back to 9 significant digits, which always round trip.
+ */
+int
+emb_format_real(char *buf, EmbReal value)
+{
+    int places;
+    double a = fabs((double)value);
+    if (a < 1.0e9) {
+        for (places = 0; places <= 9; places++) {
+            double scaled = floor(a * emb_pow10[places] + 0.5);
+            if ((EmbReal)(scaled / emb_pow10[places]) == (EmbReal)a) {
+                return emb_format_scaled(buf, value < 0.0f,
+                    (uint64_t)scaled, places);
+            }
+        }
+    }
+    return snprintf(buf, EMB_NUMBER_LENGTH, "%.9g", (double)value);
+}
+
+/* Writes the string a s, as fputs() does. */
+int
+emb_fputs(const char *s, EmbStream *stream)
+{
+    size_t length = strlen(s);
+    if (emb_fwrite(s, 1, length, stream) != length) {
+        return EOF;
+    }
+    return (int)length;
+}
+
+/* Writes the integer a value as text. */
+void
+emb_write_int(EmbStream *stream, long value)
+{
+    char buf[EMB_NUMBER_LENGTH];
+    emb_fwrite(buf, 1, emb_format_int(buf, value), stream);
+}
+
+/* Writes a value as text with a places decimals, see emb_format_fixed(). */
+void
+emb_write_fixed(EmbStream *stream, double value, int places)
+{
+    char buf[EMB_NUMBER_LENGTH];
+    emb_fwrite(buf, 1, emb_format_fixed(buf, value, places), stream);
+}
+
+/* Writes a value as short text that reads back exactly, see
+ * emb_format_real().
+ */
+void
+emb_write_real(EmbStream *stream, EmbReal value)
+{
+    char buf[EMB_NUMBER_LENGTH];
+    emb_fwrite(buf, 1, emb_format_real(buf, value), stream);
+}
+
+/* Optimizes the number (a num) for output to a text file and returns
+ * it as a string (a str), which needs EMB_NUMBER_LENGTH bytes.
+ */
+char*
+emb_optOut(EmbReal num, char* str)
+{
+    emb_format_real(str, num);
+    return str;
+}
+
+/* . */
+void
+embTime_initNow(EmbTime* t)
+{
+    printf("%d", t->year);
+    /*
+    time_t rawtime;
+    struct tm* timeinfo;
+    time(&rawtime);
+    timeinfo = localtime(&rawtime);
+
+    t->year   = timeinfo->tm_year;
+    t->month  = timeinfo->tm_mon;
+    t->day    = timeinfo->tm_mday;
+    t->hour   = timeinfo->tm_hour;
+    t->minute = timeinfo->tm_min;
+    t->second = timeinfo->tm_sec;
+    */
+}
+
+/* . */
 EmbTime
 embTime_time(EmbTime* t)
 {
@@ -2131,29 +4404,22 @@ formats(void)
     puts("");
 }
 
-/* . */
+/* Converts the files after the format in argv[i+1] to that format, one
+ * at a time, see emb_convert_batch().
+ */
 void
 to_flag(char **argv, int argc, int i)
 {
     if (i + 2 < argc) {
-        int j;
         EmbString output_fname;
         int format;
         sprintf(output_fname, "example.%s", argv[i+1]);
         format = emb_identify_format(output_fname);
         if (format < 0) {
             puts("Error: format unrecognised.");
+            return;
         }
-        for (j=i+2; j<argc; j++) {
-            int length = string_len(argv[j]);
-            output_fname[0] = 0;
-            strcpy(output_fname, argv[j]);
-            output_fname[length-4] = 0;
-            strcat(output_fname, formatTable[format].extension);
-            printf("Converting %s to %s.\n",
-                argv[j], output_fname);
-            convert(argv[j], output_fname);
-        }
+        emb_convert_batch(argv + i + 2, argc - i - 2, format, 1, 0, 1, 0);
     }
     else {
         puts("Usage of the to flag is:");
@@ -2848,8 +5114,8 @@ MergeParallelEdges(EmbArray *vertices, float tolerance)
 }
 #endif
 
-void embPolygon_reduceByDistance(EmbArray *vertices, EmbArray *simplified, float distance);
-void embPolygon_reduceByNth(EmbArray *vertices, EmbArray *out, int nth);
+void embPolygon_reduceByDistance(EmbVectorList *vertices, EmbVectorList *simplified, float distance);
+void embPolygon_reduceByNth(EmbVectorList *vertices, EmbVectorList *out, int nth);
 
 /* vertices a simplified a distance
  *
@@ -2858,12 +5124,14 @@ void embPolygon_reduceByNth(EmbArray *vertices, EmbArray *out, int nth);
  * This is a non-destructive function, so the caller is responsible for
  * freeing "vertices" if they choose to keep "simplified".
  */
-void embPolygon_reduceByDistance(EmbArray *vertices, EmbArray *simplified, float distance)
+void embPolygon_reduceByDistance(EmbVectorList *vertices, EmbVectorList *simplified, float distance)
 {
     int i;
     /* We can't simplify polygons under 3 vertices */
     if (vertices->count < 3) {
-        emb_array_copy(simplified, vertices);
+        for (i = 0; i < vertices->count; i++) {
+            emb_vector_list_add(simplified, vertices->data[i]);
+        }
         return;
     }
 
@@ -2871,16 +5139,14 @@ void embPolygon_reduceByDistance(EmbArray *vertices, EmbArray *simplified, float
         EmbVector delta;
         int nextId = (i + 1) % vertices->count;
 
-        delta = emb_vector_subtract(
-            vertices->geometry[nextId].object.vector,
-            vertices->geometry[i].object.vector);
+        delta = emb_vector_subtract(vertices->data[nextId], vertices->data[i]);
 
         /* If they are closer than the distance, continue */
         if (emb_vector_length(delta) < distance) {
             continue;
         }
 
-        emb_array_addVector(simplified, vertices->geometry[i].object.vector);
+        emb_vector_list_add(simplified, vertices->data[i]);
     }
 }
 
@@ -2891,43 +5157,151 @@ void embPolygon_reduceByDistance(EmbArray *vertices, EmbArray *simplified, float
  * freeing vertices if they choose to keep out.
  */
 void
-embPolygon_reduceByNth(EmbArray *vertices, EmbArray *out, int nth)
+embPolygon_reduceByNth(EmbVectorList *vertices, EmbVectorList *out, int nth)
 {
     int i;
-    /* We can't simplify polygons under 3 vertices */
-    if (vertices->count < 3) {
-        emb_array_copy(out, vertices);
-        return;
-    }
-
     for (i=0; i<vertices->count; i++) {
-        if (i!=nth) {
-            emb_array_addVector(out, vertices->geometry[i].object.vector);
+        /* We can't simplify polygons under 3 vertices */
+        if (i != nth || vertices->count < 3) {
+            emb_vector_list_add(out, vertices->data[i]);
         }
     }
 }
 
-/* p1 a p2
+/* Places pattern a p2 atop pattern a p1 in a new pattern, sharing
+ * threads that match, see emb_pattern_combine_n().
+ *
  * Returns EmbPattern*
  */
 EmbPattern *
 emb_pattern_combine(EmbPattern *p1, EmbPattern *p2)
 {
-    int i;
-    EmbPattern *out = emb_pattern_create();
-    for (i=0; i<p1->stitch_list->count; i++) {
-        emb_array_addStitch(out->stitch_list, p1->stitch_list->stitch[i]);
+    EmbPattern *patterns[2];
+    patterns[0] = p1;
+    patterns[1] = p2;
+    return emb_pattern_combine_n(patterns, 2,
+        EMB_COMBINE_MERGE_THREADS | EMB_COMBINE_STRIP_ENDS);
+}
+
+/* Hash of a thread by its color and its interned catalog number. */
+static uint32_t
+emb_thread_hash(EmbColor color, const char *catalog)
+{
+    uint32_t h = 2166136261u;
+    uintptr_t p = (uintptr_t)catalog;
+    h = (h ^ color.r) * 16777619u;
+    h = (h ^ color.g) * 16777619u;
+    h = (h ^ color.b) * 16777619u;
+    h = (h ^ (uint32_t)(p >> 4)) * 16777619u;
+    return h;
+}
+
+/* Combines the a n patterns in a patterns into a new pattern, placing
+ * them atop each other in order.
+ *
+ * The output is sized once and each stitch list is copied as a block.
+ * With EMB_COMBINE_MERGE_THREADS set, threads with the same color and
+ * catalog number are stored once, found through a hash table, and the
+ * color indices of the copied stitches are remapped in a single pass.
+ * Otherwise the thread lists are appended. With EMB_COMBINE_STRIP_ENDS
+ * set, the END stitch that closes every pattern but the last is dropped
+ * so that machines do not stop at the first design.
+ *
+ * Returns the new pattern, or 0 if any of the patterns is null or the
+ * memory could not be allocated.
+ */
+EmbPattern *
+emb_pattern_combine_n(EmbPattern **patterns, int n, int flags)
+{
+    int i, j, stitches = 0, threads = 0, max_threads = 0, table_size = 16;
+    int *remap, *table;
+    EmbPattern *out;
+
+    if (!patterns || n <= 0) {
+        printf("ERROR: emb_pattern_combine_n(), no patterns to combine\n");
+        return 0;
     }
-    for (i=0; i<p2->stitch_list->count; i++) {
-        emb_array_addStitch(out->stitch_list, p2->stitch_list->stitch[i]);
+    for (i = 0; i < n; i++) {
+        if (!patterns[i]) {
+            printf("ERROR: emb_pattern_combine_n(), pattern %d is null\n", i);
+            return 0;
+        }
+    }
+    for (i = 0; i < n; i++) {
+        stitches += patterns[i]->stitch_list->count;
+        threads += patterns[i]->thread_list->count;
+        max_threads = EMB_MAX(max_threads, patterns[i]->thread_list->count);
+    }
+    while (table_size < 2*threads) {
+        table_size *= 2;
+    }
+
+    out = emb_pattern_create_context(patterns[0]->context);
+    remap = (int*)malloc((max_threads + 1)*sizeof(int));
+    table = (int*)malloc(table_size*sizeof(int));
+    if (!out || !remap || !table
+        || !emb_array_reserve(out->stitch_list, stitches)
+        || !emb_array_reserve(out->thread_list, threads)) {
+        printf("ERROR: emb_pattern_combine_n(), cannot allocate output\n");
+        safe_free(remap);
+        safe_free(table);
+        if (out) {
+            emb_pattern_free(out);
+        }
+        return 0;
     }
-    /* These need to be merged, not appended. */
-    for (i=0; i<p1->thread_list->count; i++) {
-        emb_pattern_addThread(out, p1->thread_list->thread[i]);
+    for (i = 0; i < table_size; i++) {
+        table[i] = -1;
     }
-    for (i=0; i<p2->thread_list->count; i++) {
-        emb_pattern_addThread(out, p2->thread_list->thread[i]);
+
+    for (i = 0; i < n; i++) {
+        EmbArray *src = patterns[i]->stitch_list;
+        EmbArray *thread_list = patterns[i]->thread_list;
+        EmbStitch *dst = out->stitch_list->stitch + out->stitch_list->count;
+        int count = src->count;
+
+        for (j = 0; j < thread_list->count; j++) {
+            EmbThread t = thread_list->thread[j];
+            if (flags & EMB_COMBINE_MERGE_THREADS) {
+                uint32_t k;
+                t.catalogNumber = emb_pattern_intern(out, t.catalogNumber);
+                k = emb_thread_hash(t.color, t.catalogNumber) & (table_size - 1);
+                while (table[k] >= 0) {
+                    EmbThread *match = out->thread_list->thread + table[k];
+                    if (match->catalogNumber == t.catalogNumber
+                        && match->color.r == t.color.r
+                        && match->color.g == t.color.g
+                        && match->color.b == t.color.b) {
+                        break;
+                    }
+                    k = (k + 1) & (table_size - 1);
+                }
+                if (table[k] >= 0) {
+                    remap[j] = table[k];
+                    continue;
+                }
+                table[k] = out->thread_list->count;
+            }
+            remap[j] = out->thread_list->count;
+            emb_pattern_addThread(out, t);
+        }
+
+        memcpy(dst, src->stitch, count*sizeof(EmbStitch));
+        for (j = 0; j < count; j++) {
+            int color = dst[j].color;
+            if (color >= 0 && color < thread_list->count) {
+                dst[j].color = remap[color];
+            }
+        }
+        if ((flags & EMB_COMBINE_STRIP_ENDS) && i + 1 < n
+            && count > 0 && (dst[count-1].flags & END)) {
+            count--;
+        }
+        out->stitch_list->count += count;
     }
+
+    safe_free(remap);
+    safe_free(table);
     return out;
 }
 
@@ -3186,9 +5560,10 @@ char_to_lower(unsigned char a)
  * Write a PES embedded a image to the given a file pointer.
  */
 void
-writeImage(FILE* file, unsigned char image[][48])
+writeImage(EmbStream* file, unsigned char image[][48])
 {
     int i, j;
+    unsigned char bits[38*6];
 
     if (!file) {
         printf("ERROR: format-pec.c writeImage(), file argument is null\n");
@@ -3206,9 +5581,10 @@ writeImage(FILE* file, unsigned char image[][48])
             output |= (unsigned char)(image[i][offset + 5] != (unsigned char)0) << 5;
             output |= (unsigned char)(image[i][offset + 6] != (unsigned char)0) << 6;
             output |= (unsigned char)(image[i][offset + 7] != (unsigned char)0) << 7;
-            fwrite(&output, 1, 1, file);
+            bits[i*6 + j] = output;
         }
     }
+    emb_fwrite(bits, 1, sizeof(bits), file);
 }
 
 /* The distance between the arrays a and b of length size. */
@@ -3327,6 +5703,33 @@ embImage_free(EmbImage *image)
     safe_free(image->data);
 }
 
+/* Sets the fields of pattern a p to those of an empty pattern, creating
+ * its arrays in its arena.
+ */
+static int
+emb_pattern_init(EmbPattern *p)
+{
+    p->dstJumpsPerTrim = 6;
+    p->home.x = 0.0;
+    p->home.y = 0.0;
+    p->currentColorIndex = 0;
+    p->stitch_list = emb_array_create_in(p->arena, EMB_STITCH);
+    p->thread_list = emb_array_create_in(p->arena, EMB_THREAD);
+    p->hoop_height = 0.0;
+    p->hoop_width = 0.0;
+    p->geometry = emb_array_create_in(p->arena, EMB_LINE);
+    p->strings = emb_string_pool_create(p->arena);
+    p->design_name = "";
+    p->category = "";
+    p->author = "";
+    p->keywords = "";
+    p->comments = "";
+    p->read_options = EMB_READ_ALL;
+    p->work = 0;
+    p->stopped = EMB_LIMIT_NONE;
+    return p->stitch_list && p->thread_list && p->geometry && p->strings;
+}
+
 /* The file is for the management of the main struct: EmbPattern.
  *
  * Returns a pointer to an EmbPattern. It is created on the heap.
@@ -3337,6 +5740,15 @@ embImage_free(EmbImage *image)
  */
 EmbPattern*
 emb_pattern_create(void)
+{
+    return emb_pattern_create_context(&emb_default_context);
+}
+
+/* Creates a pattern that is read, written and changed with the state in
+ * a ctx, see emb_pattern_create().
+ */
+EmbPattern*
+emb_pattern_create_context(EmbContext *ctx)
 {
     EmbPattern* p = (EmbPattern*)malloc(sizeof(EmbPattern));
     if (!p) {
@@ -3344,18 +5756,273 @@ emb_pattern_create(void)
         printf("unable to allocate memory for p\n");
         return 0;
     }
-    p->dstJumpsPerTrim = 6;
-    p->home.x = 0.0;
-    p->home.y = 0.0;
-    p->currentColorIndex = 0;
-    p->stitch_list = emb_array_create(EMB_STITCH);
-    p->thread_list = emb_array_create(EMB_THREAD);
-    p->hoop_height = 0.0;
-    p->hoop_width = 0.0;
-    p->geometry = emb_array_create(EMB_LINE);
+    p->arena = emb_arena_create(EMB_ARENA_BLOCK_SIZE);
+    if (!p->arena) {
+        safe_free(p);
+        return 0;
+    }
+    if (!emb_pattern_init(p)) {
+        printf("ERROR: emb-pattern.c emb_pattern_create(), ");
+        printf("unable to allocate memory for the arrays\n");
+        emb_arena_free(p->arena);
+        safe_free(p);
+        return 0;
+    }
+    p->context = ctx;
+    return p;
+}
+
+/* Empties the pattern a p so that it can be used for another design,
+ * as if it had just been created. The memory it holds is kept: the
+ * arena's blocks are recycled and the stitch, thread and geometry
+ * arrays start with the capacity they had before, so reading a design
+ * of a similar size into it does not allocate.
+ *
+ * Returns 0 if the arrays could not be recreated, in which case the
+ * pattern should be freed.
+ */
+int
+emb_pattern_reset(EmbPattern *p)
+{
+    int stitches, threads, geometry;
+    if (!p) {
+        printf("ERROR: emb-pattern.c emb_pattern_reset(), p argument is null\n");
+        return 0;
+    }
+    stitches = p->stitch_list->count;
+    threads = p->thread_list->count;
+    geometry = p->geometry->count;
+    emb_array_free(p->stitch_list);
+    emb_array_free(p->thread_list);
+    emb_array_free(p->geometry);
+    p->stitch_list = 0;
+    p->thread_list = 0;
+    p->geometry = 0;
+    if (p->arena->refs > 1) {
+        /* The arena is shared with clones, so start a new one. */
+        emb_arena_free(p->arena);
+        p->arena = emb_arena_create(EMB_ARENA_BLOCK_SIZE);
+        if (!p->arena) {
+            return 0;
+        }
+    }
+    else {
+        emb_arena_reset(p->arena);
+    }
+    if (!emb_pattern_init(p)) {
+        printf("ERROR: emb-pattern.c emb_pattern_reset(), ");
+        printf("unable to allocate memory for the arrays\n");
+        return 0;
+    }
+    return emb_array_reserve(p->stitch_list, stitches)
+        && emb_array_reserve(p->thread_list, threads)
+        && emb_array_reserve(p->geometry, geometry);
+}
+
+/* Returns a copy of the pattern a p in O(1) time.
+ *
+ * The copy shares the stitch, thread and geometry storage of a p, and
+ * whichever of the two is modified first copies the array it changes,
+ * so a writer that rewrites the stitches of its input only pays for
+ * the stitches. Both patterns share an arena as well, so they must not
+ * be used from different threads at the same time. Free the copy with
+ * emb_pattern_free().
+ */
+EmbPattern*
+emb_pattern_clone(EmbPattern *p)
+{
+    EmbPattern *clone;
+    if (!p) {
+        printf("ERROR: emb-pattern.c emb_pattern_clone(), p argument is null\n");
+        return 0;
+    }
+    clone = (EmbPattern*)malloc(sizeof(EmbPattern));
+    if (!clone) {
+        printf("ERROR: emb-pattern.c emb_pattern_clone(), ");
+        printf("unable to allocate memory for the clone\n");
+        return 0;
+    }
+    *clone = *p;
+    clone->arena = emb_arena_share(p->arena);
+    clone->stitch_list = emb_array_share(p->stitch_list);
+    clone->thread_list = emb_array_share(p->thread_list);
+    clone->geometry = emb_array_share(p->geometry);
+    if (!clone->stitch_list || !clone->thread_list || !clone->geometry) {
+        emb_pattern_free(clone);
+        return 0;
+    }
+    return clone;
+}
+
+/* Creates a pattern with a context of its own, set up as the default
+ * context is, so that it shares no state with other patterns.
+ */
+static EmbPattern*
+emb_pattern_create_own_context(void)
+{
+    EmbPattern *p;
+    EmbContext *ctx = emb_context_create();
+    if (!ctx) {
+        return 0;
+    }
+    ctx->verbose = emb_verbose;
+    ctx->limits = emb_context_default()->limits;
+    p = emb_pattern_create_context(ctx);
+    if (!p) {
+        emb_context_free(ctx);
+    }
     return p;
 }
 
+/* Frees a pattern along with its context, unless that is the default. */
+static void
+emb_pattern_free_own_context(EmbPattern *p)
+{
+    EmbContext *ctx = p->context;
+    emb_pattern_free(p);
+    if (ctx != emb_context_default()) {
+        emb_context_free(ctx);
+    }
+}
+
+/* A pool of patterns for batch work.
+ *
+ * Patterns that are put back are reset and kept, up to the size of the
+ * pool, so a converter that gets one pattern per file reaches a steady
+ * state where it does not allocate at all. Each pattern the pool makes
+ * has a context of its own, so patterns in use on different threads
+ * share no state, and the context goes with the pattern when the pool
+ * frees it. The pool itself is not thread safe; use one pool per thread
+ * or guard it with a lock.
+ */
+struct EmbPatternPool_ {
+    EmbPattern **patterns;
+    int count;
+    int size;
+};
+
+/* Creates an empty pool that keeps up to a size patterns. */
+EmbPatternPool*
+emb_pattern_pool_create(int size)
+{
+    EmbPatternPool *pool = (EmbPatternPool*)malloc(sizeof(EmbPatternPool));
+    if (!pool) {
+        printf("ERROR: emb_pattern_pool_create(), cannot allocate pool\n");
+        return 0;
+    }
+    size = EMB_MAX(size, 1);
+    pool->patterns = (EmbPattern**)malloc(size*sizeof(EmbPattern*));
+    if (!pool->patterns) {
+        printf("ERROR: emb_pattern_pool_create(), cannot allocate pool\n");
+        safe_free(pool);
+        return 0;
+    }
+    pool->count = 0;
+    pool->size = size;
+    return pool;
+}
+
+/* Returns an empty pattern with a context of its own, reusing one from
+ * a pool when there is one. Give it back with emb_pattern_pool_put()
+ * rather than freeing it.
+ */
+EmbPattern*
+emb_pattern_pool_get(EmbPatternPool *pool)
+{
+    if (pool && pool->count > 0) {
+        pool->count--;
+        return pool->patterns[pool->count];
+    }
+    return emb_pattern_create_own_context();
+}
+
+/* Resets the pattern p and keeps it in a pool for the next
+ * emb_pattern_pool_get(). It is freed if the pool is full, along with
+ * its context unless that is the default.
+ */
+void
+emb_pattern_pool_put(EmbPatternPool *pool, EmbPattern *p)
+{
+    if (!p) {
+        return;
+    }
+    if (!pool || pool->count == pool->size || !emb_pattern_reset(p)) {
+        emb_pattern_free_own_context(p);
+        return;
+    }
+    pool->patterns[pool->count] = p;
+    pool->count++;
+}
+
+/* Frees a pool and the patterns it holds, with their contexts. */
+void
+emb_pattern_pool_free(EmbPatternPool *pool)
+{
+    int i;
+    if (!pool) {
+        return;
+    }
+    for (i = 0; i < pool->count; i++) {
+        emb_pattern_free_own_context(pool->patterns[i]);
+    }
+    safe_free(pool->patterns);
+    safe_free(pool);
+}
+
+/* Makes room in pattern a p for a n stitches in addition to the
+ * ones already present, plus the HOME and END stitches that the
+ * pattern adds itself. Readers that know their stitch count from the
+ * header call this so that decoding performs a single allocation.
+ *
+ * Counts are clamped to the stitch limit of the context, MAX_STITCHES
+ * unless set, so a corrupt header cannot request an unreasonable amount
+ * of memory.
+ */
+int
+emb_pattern_reserve_stitches(EmbPattern *p, int n)
+{
+    if (!p) {
+        printf("ERROR: emb_pattern_reserve_stitches(), p argument is null\n");
+        return 0;
+    }
+    if (n <= 0) {
+        return 1;
+    }
+    n = EMB_MIN(n, emb_limits_stitches(p->work ? &p->work->limits
+        : &p->context->limits));
+    return emb_array_reserve(p->stitch_list, p->stitch_list->count + n + 2);
+}
+
+/* Returns 1 if a p can take a n more stitches, and a decoder a bytes
+ * more memory for them, within the limits of the work reading or
+ * writing it. Outside a read or write there are no limits. Otherwise the
+ * work is stopped and 0 is returned; the rest of the limits are looked
+ * at whenever a bytes is given or the stitches pass a multiple of
+ * check_every.
+ */
+int
+emb_pattern_limit(EmbPattern *p, int n, size_t bytes)
+{
+    EmbWork *work = p->work;
+    long count = p->stitch_list->count;
+    long every;
+    if (!work) {
+        return 1;
+    }
+    if (work->stopped != EMB_LIMIT_NONE) {
+        return 0;
+    }
+    if (n < 0 || count + n > emb_limits_stitches(&work->limits)) {
+        return emb_work_stop(work, EMB_LIMIT_STITCHES);
+    }
+    every = work->limits.check_every > 0 ? work->limits.check_every
+        : EMB_LIMIT_CHECK_EVERY;
+    if (bytes == 0 && count / every == (count + n) / every) {
+        return 1;
+    }
+    return emb_work_limit(work, count + n, emb_pattern_bytes(p) + bytes);
+}
+
 /* a p a length
  */
 void
@@ -3371,6 +6038,9 @@ emb_pattern_hideStitchesOverLength(EmbPattern* p, int length)
         printf("p argument is null\n");
         return;
     }
+    if (!emb_array_writable(p->stitch_list)) {
+        return;
+    }
     for (i = 0; i < p->stitch_list->count; i++) {
         if ((fabs(p->stitch_list->stitch[i].x - prev.x) > length)
          || (fabs(p->stitch_list->stitch[i].y - prev.y) > length)) {
@@ -3382,12 +6052,33 @@ emb_pattern_hideStitchesOverLength(EmbPattern* p, int length)
     }
 }
 
-/* a pattern a thread
+/* Interns the string a s in the string pool of pattern a p, see
+ * emb_string_pool_intern(). Strings stored in the pattern must come
+ * from here so that they live as long as the pattern does.
+ */
+const char*
+emb_pattern_intern(EmbPattern *p, const char *s)
+{
+    const char *interned = emb_string_pool_intern(p->strings, s);
+    if (!interned) {
+        return "";
+    }
+    return interned;
+}
+
+/* Adds a thread to the thread list of a pattern. Its description and
+ * catalog number are interned, so they may point to temporary storage.
+ *
  * Returns int
  */
 int
 emb_pattern_addThread(EmbPattern *pattern, EmbThread thread)
 {
+    thread.description = emb_pattern_intern(pattern, thread.description);
+    thread.catalogNumber = emb_pattern_intern(pattern, thread.catalogNumber);
+    if (!emb_array_writable(pattern->thread_list)) {
+        return 0;
+    }
     if (pattern->thread_list->count + 1 > pattern->thread_list->length) {
         if (!emb_array_resize(pattern->thread_list)) {
             return 0;
@@ -3422,7 +6113,7 @@ emb_pattern_fixColorCount(EmbPattern* p)
         if (maxColorIndex > 0) {
             while (p->thread_list->count <= maxColorIndex) {
 /*        printf("%d %d\n", p->n_threads, maxColorIndex);*/
-                emb_pattern_addThread(p, emb_get_random_thread());
+                emb_pattern_addThread(p, emb_context_random_thread(p->context));
             }
         }
     }
@@ -3440,7 +6131,7 @@ void
 emb_pattern_copystitch_listToPolylines(EmbPattern* p)
 {
     int breakAtFlags, i;
-    EmbPoint point;
+    EmbVector point;
     EmbColor color;
 
     if (!p) {
@@ -3452,7 +6143,7 @@ emb_pattern_copystitch_listToPolylines(EmbPattern* p)
     breakAtFlags = (STOP | JUMP | TRIM);
 
     for (i = 0; i < p->stitch_list->count; i++) {
-        EmbArray *pointList = 0;
+        EmbVectorList *pointList = 0;
         for (; i < p->stitch_list->count; i++) {
             EmbStitch st = p->stitch_list->stitch[i];
             if (st.flags & breakAtFlags) {
@@ -3460,12 +6151,13 @@ emb_pattern_copystitch_listToPolylines(EmbPattern* p)
             }
             if (!(st.flags & JUMP)) {
                 if (!pointList) {
-                    pointList = emb_array_create(EMB_POINT);
+                    pointList = emb_vector_list_create_in(p->arena,
+                        CHUNK_SIZE);
                     color = p->thread_list->thread[st.color].color;
                 }
-                point.position.x = st.x;
-                point.position.y = st.y;
-                emb_array_addPoint(pointList, point);
+                point.x = st.x;
+                point.y = st.y;
+                emb_vector_list_add(pointList, point);
             }
         }
 
@@ -3473,6 +6165,7 @@ emb_pattern_copystitch_listToPolylines(EmbPattern* p)
         if (pointList) {
             EmbPolyline currentPolyline;
             currentPolyline.pointList = pointList;
+            currentPolyline.flagList = 0;
             currentPolyline.color = color;
             /* TODO: Determine what the correct value should be */
             currentPolyline.lineType = 1;
@@ -3498,7 +6191,7 @@ emb_pattern_copyPolylinesTostitch_list(EmbPattern* p)
     }
     for (i = 0; i < p->geometry->count; i++) {
         EmbPolyline currentPoly;
-        EmbArray* currentPointList;
+        EmbVectorList* currentPointList;
         EmbThread thread;
 
         if (p->geometry->geometry[i].type != EMB_POLYLINE) {
@@ -3508,25 +6201,25 @@ emb_pattern_copyPolylinesTostitch_list(EmbPattern* p)
         currentPoly = p->geometry->geometry[i].object.polyline;
         currentPointList = currentPoly.pointList;
 
-        strcpy(thread.catalogNumber, "");
+        thread.catalogNumber = "";
         thread.color = currentPoly.color;
-        strcpy(thread.description, "");
+        thread.description = "";
         emb_pattern_addThread(p, thread);
 
         if (!firstObject) {
             emb_pattern_addStitchAbs(p,
-                currentPointList->geometry[0].object.point.position.x,
-                currentPointList->geometry[0].object.point.position.y, TRIM, 1);
+                currentPointList->data[0].x,
+                currentPointList->data[0].y, TRIM, 1);
             emb_pattern_addStitchRel(p, 0.0, 0.0, STOP, 1);
         }
 
         emb_pattern_addStitchAbs(p,
-            currentPointList->geometry[0].object.point.position.x,
-            currentPointList->geometry[0].object.point.position.y,
+            currentPointList->data[0].x,
+            currentPointList->data[0].y,
             JUMP,
             1);
         for (j = 1; j < currentPointList->count; j++) {
-            EmbVector v = currentPointList->geometry[j].object.point.position;
+            EmbVector v = currentPointList->data[j];
             emb_pattern_addStitchAbs(p, v.x, v.y, NORMAL, 1);
         }
         firstObject = 0;
@@ -3577,6 +6270,9 @@ emb_pattern_addStitchAbs(EmbPattern* p, EmbReal x, EmbReal y,
         printf("p argument is null\n");
         return;
     }
+    if (!emb_pattern_limit(p, 1, 0)) {
+        return;
+    }
 
     if (flags & END) {
         if (p->stitch_list->count == 0) {
@@ -3644,18 +6340,127 @@ emb_pattern_addStitchRel(EmbPattern* p, EmbReal dx, EmbReal dy,
     emb_pattern_addStitchAbs(p, x, y, flags, isAutoColorIndex);
 }
 
-/* Change the currentColorIndex of pattern a p to a index.
+/* Adds the a n stitches at a stitches to a p, as many calls to
+ * emb_pattern_addStitchAbs() with automatic color changes would, or
+ * emb_pattern_addStitchRel() if a relative is set. The colors of
+ * the stitches are ignored.
+ *
+ * Room is made once for the whole run and the stitches are written in
+ * place, so the per stitch work is only the checks for STOP and END.
  */
-void
-emb_pattern_changeColor(EmbPattern* p, int index)
+static void
+emb_pattern_append_stitches(EmbPattern* p, const EmbStitch *stitches, int n,
+    int relative)
 {
+    EmbArray *list;
+    int i;
+
     if (!p) {
-        printf("ERROR: emb-pattern.c emb_pattern_changeColor(), p argument is null\n");
+        printf("ERROR: emb-pattern.c emb_pattern_append_stitches(), ");
+        printf("p argument is null\n");
         return;
     }
-    p->currentColorIndex = index;
-}
-
+    if (n <= 0) {
+        return;
+    }
+    list = p->stitch_list;
+    /* One more for the home stitch. */
+    if (!emb_pattern_limit(p, n + (list->count == 0), 0)
+        || !emb_array_writable(list) || !emb_array_reserve(list, list->count + n + 1)) {
+        return;
+    }
+    for (i = 0; i < n; i++) {
+        EmbStitch st = stitches[i];
+        if (relative) {
+            if (list->count > 0) {
+                st.x = list->stitch[list->count - 1].x + st.x;
+                st.y = list->stitch[list->count - 1].y + st.y;
+            }
+            else {
+                st.x = p->home.x + st.x;
+                st.y = p->home.y + st.y;
+            }
+        }
+        if (st.flags & END) {
+            if (list->count == 0) {
+                continue;
+            }
+            if (list->stitch[list->count - 1].flags & END) {
+                printf("ERROR: emb-pattern.c emb_pattern_append_stitches(), found multiple END stitches\n");
+                continue;
+            }
+            emb_pattern_fixColorCount(p);
+        }
+        if (st.flags & STOP) {
+            if (list->count == 0) {
+                continue;
+            }
+            p->currentColorIndex++;
+        }
+        if (list->count == 0) {
+            EmbStitch h;
+            h.x = p->home.x;
+            h.y = p->home.y;
+            h.flags = JUMP;
+            h.color = p->currentColorIndex;
+            list->stitch[list->count++] = h;
+        }
+        st.color = p->currentColorIndex;
+        list->stitch[list->count++] = st;
+    }
+}
+
+/* Adds the a n stitches at a stitches to a p at their absolute
+ * positions, see emb_pattern_append_stitches().
+ */
+void
+emb_pattern_append_stitches_abs(EmbPattern* p, const EmbStitch *stitches, int n)
+{
+    emb_pattern_append_stitches(p, stitches, n, 0);
+}
+
+/* Adds the a n stitches at a stitches to a p, each moved from the one
+ * before, see emb_pattern_append_stitches().
+ */
+void
+emb_pattern_append_stitches_rel(EmbPattern* p, const EmbStitch *stitches, int n)
+{
+    emb_pattern_append_stitches(p, stitches, n, 1);
+}
+
+/* Starts an empty batch of stitches for the pattern a p. */
+void
+emb_stitch_batch_init(EmbStitchBatch *batch, EmbPattern *p)
+{
+    batch->pattern = p;
+    batch->relative = 1;
+    batch->count = 0;
+}
+
+/* Adds the stitches gathered in a batch to its pattern. A reader flushes
+ * before it returns and before anything that looks at or changes the
+ * stitches or the current color.
+ */
+void
+emb_stitch_batch_flush(EmbStitchBatch *batch)
+{
+    emb_pattern_append_stitches(batch->pattern, batch->stitch, batch->count,
+        batch->relative);
+    batch->count = 0;
+}
+
+/* Change the currentColorIndex of pattern a p to a index.
+ */
+void
+emb_pattern_changeColor(EmbPattern* p, int index)
+{
+    if (!p) {
+        printf("ERROR: emb-pattern.c emb_pattern_changeColor(), p argument is null\n");
+        return;
+    }
+    p->currentColorIndex = index;
+}
+
 /* Very simple scaling of the x and y axis for every point.
  * Doesn't insert or delete stitches to preserve density.
  */
@@ -3667,6 +6472,9 @@ emb_pattern_scale(EmbPattern* p, EmbReal scale)
         printf("ERROR: emb-pattern.c emb_pattern_scale(), p argument is null\n");
         return;
     }
+    if (!emb_array_writable(p->stitch_list)) {
+        return;
+    }
 
     for (i = 0; i < p->stitch_list->count; i++) {
         p->stitch_list->stitch[i].x *= scale;
@@ -3674,6 +6482,24 @@ emb_pattern_scale(EmbPattern* p, EmbReal scale)
     }
 }
 
+static int emb_stitch_columns_extents(const EmbStitchColumns *c,
+    EmbReal *extents);
+
+/* Loads the stitches of a p into the columns a c for the stitch passes
+ * below, which free them afterwards. Returns 0 if they could not be
+ * loaded, in which case the pass walks the stitch list instead.
+ */
+static int
+emb_pattern_columns(EmbPattern *p, EmbStitchColumns *c)
+{
+    memset(c, 0, sizeof(EmbStitchColumns));
+    if (!emb_stitch_columns_load(c, p->stitch_list)) {
+        emb_stitch_columns_free(c);
+        return 0;
+    }
+    return 1;
+}
+
 /* Returns an EmbRect that encapsulates all stitches and objects in the
  * pattern (a p).
  */
@@ -3682,6 +6508,8 @@ emb_pattern_bounds(EmbPattern* p)
 {
     EmbRect r;
     EmbStitch pt;
+    EmbStitchColumns c;
+    EmbReal extents[4];
     int i, j;
 
     r.x = 0.0;
@@ -3707,15 +6535,26 @@ emb_pattern_bounds(EmbPattern* p)
     double right = 99999.0;
     double bottom = 99999.0;
 
-    for (i = 0; i < p->stitch_list->count; i++) {
-        /* If the point lies outside of the accumulated bounding
-         * rectangle, then inflate the bounding rect to include it. */
-        pt = p->stitch_list->stitch[i];
-        if (!(pt.flags & TRIM)) {
-            r.x = EMB_MAX(r.x, pt.x);
-            r.y = EMB_MAX(r.y, pt.y);
-            right = EMB_MIN(right, pt.x);
-            bottom = EMB_MIN(bottom, pt.y);
+    if (emb_pattern_columns(p, &c)) {
+        if (emb_stitch_columns_extents(&c, extents)) {
+            r.x = EMB_MAX(r.x, extents[2]);
+            r.y = EMB_MAX(r.y, extents[3]);
+            right = EMB_MIN(right, extents[0]);
+            bottom = EMB_MIN(bottom, extents[1]);
+        }
+        emb_stitch_columns_free(&c);
+    }
+    else {
+        for (i = 0; i < p->stitch_list->count; i++) {
+            /* If the point lies outside of the accumulated bounding
+             * rectangle, then inflate the bounding rect to include it. */
+            pt = p->stitch_list->stitch[i];
+            if (!(pt.flags & TRIM)) {
+                r.x = EMB_MAX(r.x, pt.x);
+                r.y = EMB_MAX(r.y, pt.y);
+                right = EMB_MIN(right, pt.x);
+                bottom = EMB_MIN(bottom, pt.y);
+            }
         }
     }
 
@@ -3770,14 +6609,14 @@ emb_pattern_bounds(EmbPattern* p)
             break;
         }
         case EMB_POLYGON: {
-            EmbArray *polygon = g.object.polygon.pointList;
+            EmbVectorList *polygon = g.object.polygon.pointList;
             for (j=0; j < polygon->count; j++) {
                 /* TODO: emb_pattern_calcBoundingBox for polygons */
             }
             break;
         }
         case EMB_POLYLINE: {
-            EmbArray *polyline = g.object.polyline.pointList;
+            EmbVectorList *polyline = g.object.polyline.pointList;
             for (j=0; j < polyline->count; j++) {
                 /* TODO: emb_pattern_calcBoundingBox for polylines */
             }
@@ -3846,6 +6685,10 @@ emb_pattern_flip(EmbPattern* p, int horz, int vert)
         printf("ERROR: emb-pattern.c emb_pattern_flip(), p argument is null\n");
         return;
     }
+    if (!emb_array_writable(p->stitch_list)
+        || !emb_array_writable(p->geometry)) {
+        return;
+    }
 
     for (i = 0; i < p->stitch_list->count; i++) {
         if (horz) {
@@ -3900,18 +6743,6 @@ emb_pattern_flip(EmbPattern* p, int horz, int vert)
                 g->object.ellipse.center.y *= -1.0;
             }
             break;
-        case EMB_PATH: {
-            EmbArray *point_list = g->object.path.pointList;
-            for (j=0; j < point_list->count; j++) {
-                if (horz) {
-                    point_list->geometry[j].object.point.position.x *= -1.0;
-                }
-                if (vert) {
-                    point_list->geometry[j].object.point.position.y *= -1.0;
-                }
-            }
-            break;
-        }
         case EMB_POINT:
             if (horz) {
                 g->object.point.position.x *= -1.0;
@@ -3920,26 +6751,16 @@ emb_pattern_flip(EmbPattern* p, int horz, int vert)
                 g->object.point.position.y *= -1.0;
             }
             break;
-        case EMB_POLYGON: {
-            EmbArray *point_list = g->object.polygon.pointList;
-            for (j=0; j < point_list->count; j++) {
-                if (horz) {
-                    point_list->geometry[i].object.point.position.x *= -1.0;
-                }
-                if (vert) {
-                    point_list->geometry[i].object.point.position.y *= -1.0;
-                }
-            }
-            break;
-        }
+        case EMB_PATH:
+        case EMB_POLYGON:
         case EMB_POLYLINE: {
-            EmbArray *point_list = g->object.polygon.pointList;
+            EmbVectorList *point_list = g->object.path.pointList;
             for (j=0; j < point_list->count; j++) {
                 if (horz) {
-                    point_list->geometry[j].object.point.position.x *= -1.0;
+                    point_list->data[j].x *= -1.0;
                 }
                 if (vert) {
-                    point_list->geometry[j].object.point.position.y *= -1.0;
+                    point_list->data[j].y *= -1.0;
                 }
             }
             break;
@@ -3978,7 +6799,7 @@ emb_pattern_combineJumpStitches(EmbPattern* p)
         printf("p argument is null\n");
         return;
     }
-    newList = emb_array_create(EMB_STITCH);
+    newList = emb_array_create_in(p->arena, EMB_STITCH);
     for (i = 0; i < p->stitch_list->count; i++) {
         EmbStitch st = p->stitch_list->stitch[i];
         if (st.flags & JUMP) {
@@ -4000,9 +6821,53 @@ emb_pattern_combineJumpStitches(EmbPattern* p)
     p->stitch_list = newList;
 }
 
-/* \todo The params determine the max XY movement rather than the length.
+/* Adds the stitch a st to a out, preceded by the stitches needed so
+ * that no move from a prev is longer than the limits allow. Returns 0
+ * if the array could not grow.
+ *
+ * \todo The params determine the max XY movement rather than the length.
  * They need renamed or clarified further.
  */
+int
+emb_stitch_split(EmbArray *out, EmbStitch prev, EmbStitch st,
+    EmbReal maxStitchLength, EmbReal maxJumpLength)
+{
+    int j, splits;
+    EmbReal maxXY, maxLen, addX, addY;
+    EmbReal xx = st.x;
+    EmbReal yy = st.y;
+    EmbReal dx = prev.x - xx;
+    EmbReal dy = prev.y - yy;
+    if ((fabs(dx) > maxStitchLength) || (fabs(dy) > maxStitchLength)) {
+        maxXY = EMB_MAX(fabs(dx), fabs(dy));
+        if (st.flags & (JUMP | TRIM)) {
+            maxLen = maxJumpLength;
+        } else {
+            maxLen = maxStitchLength;
+        }
+        splits = (int)ceil((EmbReal)maxXY / maxLen);
+
+        if (splits > 1) {
+            addX = (EmbReal)dx / splits;
+            addY = (EmbReal)dy / splits;
+
+            for (j = 1; j < splits; j++) {
+                EmbStitch s;
+                s = st;
+                s.x = xx + addX * j;
+                s.y = yy + addY * j;
+                if (!emb_array_addStitch(out, s)) {
+                    return 0;
+                }
+            }
+        }
+    }
+    return emb_array_addStitch(out, st);
+}
+
+/* Splits the stitches of a p that move further than the limits allow,
+ * see emb_stitch_split().
+ */
 void
 emb_pattern_correctForMaxStitchLength(EmbPattern* p,
                         EmbReal maxStitchLength, EmbReal maxJumpLength)
@@ -4013,38 +6878,11 @@ emb_pattern_correctForMaxStitchLength(EmbPattern* p,
         return;
     }
     if (p->stitch_list->count > 1) {
-        int i, j, splits;
-        EmbReal maxXY, maxLen, addX, addY;
-        EmbArray *newList = emb_array_create(EMB_STITCH);
+        int i;
+        EmbArray *newList = emb_array_create_in(p->arena, EMB_STITCH);
         for (i=1; i < p->stitch_list->count; i++) {
-            EmbStitch st = p->stitch_list->stitch[i];
-            EmbReal xx = st.x;
-            EmbReal yy = st.y;
-            EmbReal dx = p->stitch_list->stitch[i-1].x - xx;
-            EmbReal dy = p->stitch_list->stitch[i-1].y - yy;
-            if ((fabs(dx) > maxStitchLength) || (fabs(dy) > maxStitchLength)) {
-                maxXY = EMB_MAX(fabs(dx), fabs(dy));
-                if (st.flags & (JUMP | TRIM)) {
-                    maxLen = maxJumpLength;
-                } else {
-                    maxLen = maxStitchLength;
-                }
-                splits = (int)ceil((EmbReal)maxXY / maxLen);
-
-                if (splits > 1) {
-                    addX = (EmbReal)dx / splits;
-                    addY = (EmbReal)dy / splits;
-
-                    for (j = 1; j < splits; j++) {
-                        EmbStitch s;
-                        s = st;
-                        s.x = xx + addX * j;
-                        s.y = yy + addY * j;
-                        emb_array_addStitch(newList, s);
-                    }
-                }
-            }
-            emb_array_addStitch(newList, st);
+            emb_stitch_split(newList, p->stitch_list->stitch[i-1],
+                p->stitch_list->stitch[i], maxStitchLength, maxJumpLength);
         }
         emb_array_free(p->stitch_list);
         p->stitch_list = newList;
@@ -4065,6 +6903,9 @@ emb_pattern_center(EmbPattern* p)
         printf("ERROR: emb-pattern.c emb_pattern_center(), p argument is null\n");
         return;
     }
+    if (!emb_array_writable(p->stitch_list)) {
+        return;
+    }
     boundingRect = emb_pattern_bounds(p);
 
     moveLeft = (int)(boundingRect.x - boundingRect.w / 2.0);
@@ -4117,6 +6958,11 @@ emb_pattern_loadExternalColorFile(EmbPattern* p, const char* fileName)
 }
 
 /* Frees all memory allocated in the pattern (a p).
+ *
+ * The arrays live in the pattern's arena, so this releases its blocks
+ * without visiting the stitches or geometry. Only geometry whose point
+ * lists were allocated on the heap is walked. An arena shared with
+ * clones stays alive until the last of them is freed.
  */
 void
 emb_pattern_free(EmbPattern* p)
@@ -4128,6 +6974,7 @@ emb_pattern_free(EmbPattern* p)
     emb_array_free(p->stitch_list);
     emb_array_free(p->thread_list);
     emb_array_free(p->geometry);
+    emb_arena_free(p->arena);
     safe_free(p);
 }
 
@@ -4227,89 +7074,894 @@ emb_pattern_addPolygonAbs(EmbPattern* p, EmbPolygon obj)
         printf("ERROR: emb-pattern.c emb_pattern_addPolygonObjectAbs(), obj->pointList is empty\n");
         return;
     }
-
-    emb_array_addPolygon(p->geometry, obj);
+
+    emb_array_addPolygon(p->geometry, obj);
+}
+
+void
+emb_pattern_addPolylineObjectAbs(EmbPattern* p, EmbPolyline obj)
+{
+    if (!p) {
+        printf("ERROR: emb-pattern.c emb_pattern_addPolylineObjectAbs(), p argument is null\n");
+        return;
+    }
+    if (!obj.pointList) {
+        printf("ERROR: emb-pattern.c emb_pattern_addPolylineObjectAbs(), obj->pointList is empty\n");
+        return;
+    }
+    emb_array_addPolyline(p->geometry, obj);
+}
+
+/* Adds a rectangle object to pattern (a p) at the absolute position
+ * (a x,a y) with a width of (a w) and a height of (a h).
+ * Positive y is up. Units are in millimeters.
+ */
+void
+emb_pattern_addRectAbs(EmbPattern* p, EmbRect rect)
+{
+    if (!p) {
+        printf("ERROR: emb-pattern.c emb_pattern_addRectObjectAbs(), p argument is null\n");
+        return;
+    }
+    emb_array_addRect(p->geometry, rect);
+}
+
+/* . */
+void
+emb_pattern_end(EmbPattern *p)
+{
+    if (p->stitch_list->count == 0) {
+        return;
+    }
+    /* Check for an END stitch and add one if it is not present */
+    if (p->stitch_list->stitch[p->stitch_list->count-1].flags != END) {
+        emb_pattern_addStitchRel(p, 0, 0, END, 1);
+    }
+}
+
+/*
+ *
+ */
+/* Returns whether a a and a b name the same file. */
+static int
+emb_same_file(const char *a, const char *b)
+{
+#if defined(EMB_STREAM_MMAP)
+    struct stat sa, sb;
+    if (!stat(a, &sa) && !stat(b, &sb)) {
+        return sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+    }
+#endif
+    return !strcmp(a, b);
+}
+
+/* Converts a inf to a outf between two stitch only formats without
+ * loading the design, see emb_transcode_stitches().
+ */
+static int
+convert_stitches(EmbContext *ctx, const char *inf, int reader,
+    const char *outf, int writer)
+{
+    int result;
+    EmbStream *in, *out;
+
+    in = emb_stream_open(inf, "rb");
+    if (!in) {
+        printf("ERROR: Failed to open file with name: %s.\n", inf);
+        printf("ERROR: convert(), reading file was unsuccessful: %s\n", inf);
+        return 1;
+    }
+    out = emb_stream_open(outf, "wb");
+    if (!out) {
+        printf("Failed to open file with name: %s.", outf);
+        printf("ERROR: convert(), writing file %s was unsuccessful\n", outf);
+        emb_stream_close(in);
+        return 1;
+    }
+    result = emb_transcode_stitches_context(ctx, in, inf, reader, out, writer);
+    emb_stream_close(in);
+    if (emb_stream_close(out)) {
+        result = 0;
+    }
+    if (!result) {
+        printf("ERROR: convert(), transcoding %s to %s was unsuccessful\n",
+            inf, outf);
+        return 1;
+    }
+    return 0;
+}
+
+/* Converts the file a inf to a outf using the pattern a p, which should
+ * be empty. It is left holding the design, unless both formats are
+ * stitch only ones that can be transcoded a batch at a time.
+ */
+static int
+convert_pattern(EmbPattern *p, const char *inf, const char *outf)
+{
+    int reader, writer;
+
+    reader = emb_identify_format(inf);
+    writer = emb_identify_format(outf);
+    p->context->stitches = 0;
+
+    /* Writing over the input has to wait until it has all been read. */
+    if (emb_stitch_stream_supported(reader)
+        && emb_stitch_stream_supported(writer)
+        && !emb_same_file(inf, outf)) {
+        return convert_stitches(p->context, inf, reader, outf, writer);
+    }
+
+    if (!emb_pattern_read(p, inf, reader)) {
+        printf("ERROR: convert(), reading file was unsuccessful: %s\n", inf);
+        return 1;
+    }
+
+    if (formatTable[reader].type == EMBFORMAT_OBJECTONLY) {
+        if (formatTable[writer].type == EMBFORMAT_STITCHONLY) {
+            emb_pattern_movePolylinesTostitch_list(p);
+        }
+    }
+
+    if (!emb_pattern_write(p, outf, writer)) {
+        printf("ERROR: convert(), writing file %s was unsuccessful\n", outf);
+        return 1;
+    }
+    p->context->stitches = p->stitch_list->count;
+    return 0;
+}
+
+int
+convert(const char *inf, const char *outf)
+{
+    return convert_context(&emb_default_context, inf, outf);
+}
+
+/* Converts the file a inf to a outf with the state in a ctx, so threads
+ * with a context each can convert at the same time.
+ *
+ * Returns 0 on success, like convert().
+ */
+int
+convert_context(EmbContext *ctx, const char *inf, const char *outf)
+{
+    int result;
+    EmbPattern* p = emb_pattern_create_context(ctx);
+    if (!p) {
+        printf("ERROR: convert(), cannot allocate memory for p\n");
+        return 1;
+    }
+    result = convert_pattern(p, inf, outf);
+    emb_pattern_free(p);
+    return result;
+}
+
+/* Batch conversion.
+ *
+ * emb_convert_batch() converts many files to one format as a pipeline of
+ * stages: the input is loaded into memory, see loader.c, then the design
+ * is decoded, transformed, encoded in memory and written out. Files queue
+ * between the stages, so a worker waiting on the disk for one file does
+ * not hold up the decoding of another, and since the queues are bounded
+ * so is the number of files held in memory.
+ *
+ * Every worker runs whichever stage has work, looking from the last
+ * stage back, so files already in the pipeline finish before new ones
+ * start and the queues drain rather than deadlock, whatever the limits on
+ * the stages. With one worker, or without thread support, each file goes
+ * through every stage before the next one starts.
+ *
+ * An io_uring loader reads a group of files in one go, so with it the
+ * prefetch stage takes as many files as there is room for in the queue
+ * after it, up to EMB_LOADER_DEPTH, on a single worker.
+ *
+ * Decoded designs are held in patterns that have a context each and go
+ * back on a free list once encoded, so after the first few files the
+ * pipeline stops allocating patterns.
+ *
+ * The file list is sorted before it is sharded and shard i of n takes
+ * every nth file from the ith, so machines given the same corpus split
+ * it the same way without talking to each other.
+ */
+typedef struct EmbBatchFile_ {
+    char *input;
+    char *output;
+    int reader;
+    int result;            /* of convert(), so 0 is success */
+    long stitches;
+    double start;
+    double seconds;
+    EmbStream *stream;     /* the input, once prefetched */
+    EmbPattern *pattern;   /* the design, from decoding to encoding */
+    EmbStream *encoded;
+    EmbStream *colors;     /* the external color file, for formats with one */
+} EmbBatchFile;
+
+/* The files waiting for a stage, as a ring of indices. */
+typedef struct EmbBatchQueue_ {
+    int *items;
+    int head;
+    int count;
+    int arrivals;
+    double depth;          /* summed over the arrivals */
+} EmbBatchQueue;
+
+typedef struct EmbBatch_ {
+    EmbBatchFile *files;
+    int count;
+    int next;              /* the next file to prefetch */
+    int done;
+    int format;
+    int queue_size;
+    int stage_jobs[EMB_STAGES];
+    int running[EMB_STAGES];
+    EmbBatchQueue queue[EMB_STAGES];
+    EmbPattern **spare;    /* reset patterns for the decoder */
+    int n_spare;
+    int spare_size;
+    EmbBatchReport report;
+    EmbLoader *loader;
+    int group;             /* the most files prefetched at once */
+#if defined(EMB_THREADS)
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+#endif
+} EmbBatch;
+
+static const char *emb_stage_names[EMB_STAGES] = {
+    "prefetch", "decode", "transform", "encode", "write"
+};
+
+static const char *emb_loader_names[3] = {
+    "map", "pread", "io_uring"
+};
+
+static int
+emb_batch_compare(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* Adds a copy of the path a s to the list a files of a count entries
+ * and a size room. Returns 0 if it cannot allocate.
+ */
+static int
+emb_batch_add_path(char ***files, int *count, int *size, const char *s)
+{
+    char *path;
+    if (*count == *size) {
+        int size2 = EMB_MAX(2 * *size, 64);
+        char **files2 = (char**)realloc(*files, size2 * sizeof(char*));
+        if (!files2) {
+            return 0;
+        }
+        *files = files2;
+        *size = size2;
+    }
+    path = (char*)malloc(strlen(s) + 1);
+    if (!path) {
+        return 0;
+    }
+    strcpy(path, s);
+    (*files)[*count] = path;
+    (*count)++;
+    return 1;
+}
+
+/* Adds the files in the directory a dir that are in a format that can
+ * be read, other than the format a skip they are being converted to.
+ * Returns -1 if a dir is not a directory and 0 if it runs out of memory.
+ */
+static int
+emb_batch_add_directory(char ***files, int *count, int *size,
+    const char *dir, int skip)
+{
+#if defined(EMB_STREAM_MMAP)
+    DIR *d;
+    struct dirent *entry;
+    struct stat st;
+    char *path;
+    int result = 1;
+    if (stat(dir, &st) || !S_ISDIR(st.st_mode)) {
+        return -1;
+    }
+    d = opendir(dir);
+    if (!d) {
+        return -1;
+    }
+    while (result && (entry = readdir(d))) {
+        int format;
+        const char *dot = strrchr(entry->d_name, '.');
+        if (entry->d_name[0] == '.' || !dot || strlen(dot) > 4) {
+            continue;
+        }
+        format = emb_identify_format(entry->d_name);
+        if (format < 0 || format == skip
+            || formatTable[format].reader_state == ' ') {
+            continue;
+        }
+        path = (char*)malloc(strlen(dir) + strlen(entry->d_name) + 2);
+        if (!path) {
+            result = 0;
+            break;
+        }
+        strcpy(path, dir);
+        if (path[0] && path[strlen(path) - 1] != '/') {
+            strcat(path, "/");
+        }
+        strcat(path, entry->d_name);
+        if (!stat(path, &st) && S_ISREG(st.st_mode)) {
+            result = emb_batch_add_path(files, count, size, path);
+        }
+        safe_free(path);
+    }
+    closedir(d);
+    return result;
+#else
+    (void)files;
+    (void)count;
+    (void)size;
+    (void)dir;
+    (void)skip;
+    return -1;
+#endif
+}
+
+/* Returns the name a input has once converted to a format, in the same
+ * directory, or 0 if it cannot allocate.
+ */
+static char*
+emb_batch_output_name(const char *input, int format)
+{
+    const char *extension = formatTable[format].extension;
+    const char *slash = strrchr(input, '/');
+    const char *dot = strrchr(input, '.');
+    size_t length = strlen(input);
+    char *output;
+    if (dot && (!slash || dot > slash)) {
+        length = dot - input;
+    }
+    output = (char*)malloc(length + strlen(extension) + 1);
+    if (!output) {
+        return 0;
+    }
+    memcpy(output, input, length);
+    strcpy(output + length, extension);
+    return output;
+}
+
+static void
+emb_batch_lock(EmbBatch *batch)
+{
+#if defined(EMB_THREADS)
+    pthread_mutex_lock(&batch->lock);
+#else
+    (void)batch;
+#endif
+}
+
+static void
+emb_batch_unlock(EmbBatch *batch)
+{
+#if defined(EMB_THREADS)
+    pthread_mutex_unlock(&batch->lock);
+#else
+    (void)batch;
+#endif
+}
+
+/* Waits for another worker to change the state of a batch. Returns 0
+ * if there are no other workers to wait for.
+ */
+static int
+emb_batch_wait(EmbBatch *batch)
+{
+#if defined(EMB_THREADS)
+    pthread_cond_wait(&batch->changed, &batch->lock);
+    return 1;
+#else
+    (void)batch;
+    return 0;
+#endif
+}
+
+static void
+emb_batch_wake(EmbBatch *batch)
+{
+#if defined(EMB_THREADS)
+    pthread_cond_broadcast(&batch->changed);
+#else
+    (void)batch;
+#endif
+}
+
+/* Writes the contents of the memory stream a data to the file a
+ * fileName. Returns 0 on failure.
+ */
+static int
+emb_batch_save(const char *fileName, EmbStream *data)
+{
+    EmbStream *file = emb_stream_open(fileName, "wb");
+    int result;
+    if (!file) {
+        printf("Failed to open file with name: %s.", fileName);
+        return 0;
+    }
+    result = emb_fwrite(data->data, 1, data->length, file) == data->length;
+    if (emb_stream_close(file)) {
+        result = 0;
+    }
+    return result;
+}
+
+/* Takes the next files that a stage can work on, the later stages
+ * first, setting a items to their indices and a n to how many there
+ * are. Returns the stage, or -1 if none can start at the moment.
+ *
+ * A stage only starts a file if the queue after it has room for it once
+ * the files it is already working on have been added. Only the prefetch
+ * stage takes more than one file at a time.
+ */
+static int
+emb_batch_take(EmbBatch *batch, int *items, int *n)
+{
+    int i, s;
+    for (s = EMB_STAGES - 1; s >= 0; s--) {
+        EmbBatchQueue *in = batch->queue + s;
+        int room = batch->queue_size - batch->running[s];
+        if (batch->running[s] >= batch->stage_jobs[s]) {
+            continue;
+        }
+        if (s + 1 < EMB_STAGES) {
+            room -= batch->queue[s+1].count;
+            if (room <= 0) {
+                continue;
+            }
+        }
+        if (s == EMB_STAGE_PREFETCH) {
+            if (batch->next == batch->count) {
+                continue;
+            }
+            *n = EMB_MIN(EMB_MIN(room, batch->group),
+                batch->count - batch->next);
+            for (i = 0; i < *n; i++) {
+                items[i] = batch->next;
+                batch->next++;
+            }
+            batch->running[s] += *n;
+            return s;
+        }
+        if (in->count == 0) {
+            continue;
+        }
+        *n = 1;
+        items[0] = in->items[in->head];
+        in->head = (in->head + 1) % batch->queue_size;
+        in->count--;
+        if (s == EMB_STAGE_DECODE && batch->n_spare > 0) {
+            batch->n_spare--;
+            batch->files[items[0]].pattern = batch->spare[batch->n_spare];
+        }
+        batch->running[s]++;
+        return s;
+    }
+    return -1;
+}
+
+/* Queues the file a index for a stage. */
+static void
+emb_batch_put(EmbBatch *batch, int stage, int index)
+{
+    EmbBatchQueue *q = batch->queue + stage;
+    EmbStageReport *r = batch->report.stage + stage;
+    q->items[(q->head + q->count) % batch->queue_size] = index;
+    q->count++;
+    q->arrivals++;
+    q->depth += q->count;
+    r->max_depth = EMB_MAX(r->max_depth, q->count);
+}
+
+/* Loads the a n files at a items into memory, setting each of a results
+ * to 0 for a file that cannot be read and 1 otherwise.
+ */
+static void
+emb_batch_prefetch(EmbBatch *batch, const int *items, int n, int *results)
+{
+    char *names[EMB_LOADER_DEPTH];
+    EmbStream *streams[EMB_LOADER_DEPTH];
+    int i, k = 0;
+    for (i = 0; i < n; i++) {
+        EmbBatchFile *file = batch->files + items[i];
+        file->reader = emb_identify_format(file->input);
+        results[i] = file->reader >= 0;
+        if (results[i]) {
+            names[k] = file->input;
+            k++;
+        }
+        else {
+            printf("ERROR: convert(), unknown format of %s\n", file->input);
+        }
+    }
+    emb_loader_load(batch->loader, names, k, streams);
+    k = 0;
+    for (i = 0; i < n; i++) {
+        if (results[i]) {
+            batch->files[items[i]].stream = streams[k];
+            results[i] = streams[k] != 0;
+            k++;
+        }
+    }
+}
+
+/* Does the work of a stage other than the prefetch on a file, outside
+ * the lock. Returns 0 if the file cannot be converted.
+ */
+static int
+emb_batch_run(EmbBatch *batch, int stage, EmbBatchFile *file)
+{
+    EmbPattern *p = file->pattern;
+    int writer = batch->format;
+    int result = 1;
+    switch (stage) {
+    case EMB_STAGE_DECODE:
+        if (!p) {
+            p = emb_pattern_create_own_context();
+            if (!p) {
+                return 0;
+            }
+            file->pattern = p;
+        }
+        result = emb_pattern_read_stream(p, file->stream, file->input,
+            file->reader);
+        emb_stream_close(file->stream);
+        file->stream = 0;
+        if (!result) {
+            printf("ERROR: convert(), reading file was unsuccessful: %s\n",
+                file->input);
+        }
+        break;
+    case EMB_STAGE_TRANSFORM:
+        if (formatTable[file->reader].type == EMBFORMAT_OBJECTONLY
+            && formatTable[writer].type == EMBFORMAT_STITCHONLY) {
+            emb_pattern_movePolylinesTostitch_list(p);
+        }
+        break;
+    case EMB_STAGE_ENCODE:
+        file->encoded = emb_stream_buffer(EMB_STREAM_WRITE_SIZE);
+        result = file->encoded
+            && emb_pattern_write_stream(p, file->encoded, file->output, writer);
+        if (result && formatTable[writer].write_external_color_file) {
+            file->colors = emb_stream_buffer(0);
+            if (file->colors) {
+                emb_pattern_write_stream(p, file->colors, file->output,
+                    EMB_FORMAT_RGB);
+            }
+        }
+        file->stitches = p->stitch_list->count;
+        if (!result) {
+            printf("ERROR: convert(), writing file %s was unsuccessful\n",
+                file->output);
+        }
+        break;
+    case EMB_STAGE_WRITE:
+        result = emb_batch_save(file->output, file->encoded);
+        if (file->colors) {
+            char colors[1000];
+            size_t stub = strlen(file->output)
+                - strlen(formatTable[writer].extension);
+            strncpy(colors, file->output, 200);
+            colors[EMB_MIN(stub, 200)] = 0;
+            strcat(colors, ".rgb");
+            emb_batch_save(colors, file->colors);
+        }
+        if (!result) {
+            printf("ERROR: convert(), writing file %s was unsuccessful\n",
+                file->output);
+        }
+        break;
+    default:
+        break;
+    }
+    return result;
+}
+
+/* One worker of emb_convert_batch(), which runs stages until every file
+ * is through the pipeline.
+ */
+static void
+emb_batch_worker(void *data, int index)
+{
+    EmbBatch *batch = (EmbBatch*)data;
+    (void)index;
+    emb_batch_lock(batch);
+    while (batch->done < batch->count) {
+        int items[EMB_LOADER_DEPTH], results[EMB_LOADER_DEPTH];
+        EmbStageReport *r;
+        EmbPattern *spare = 0;
+        double start, end;
+        int i, n;
+        int stage = emb_batch_take(batch, items, &n);
+        if (stage < 0) {
+            if (!emb_batch_wait(batch)) {
+                break;
+            }
+            continue;
+        }
+        emb_batch_unlock(batch);
+
+        start = emb_wall_clock();
+        if (stage == EMB_STAGE_PREFETCH) {
+            for (i = 0; i < n; i++) {
+                batch->files[items[i]].start = start;
+            }
+            emb_batch_prefetch(batch, items, n, results);
+        }
+        else {
+            EmbBatchFile *file = batch->files + items[0];
+            results[0] = emb_batch_run(batch, stage, file);
+            if (file->pattern && (!results[0] || stage == EMB_STAGE_ENCODE)) {
+                spare = file->pattern;
+                file->pattern = 0;
+                if (!emb_pattern_reset(spare)) {
+                    emb_pattern_free_own_context(spare);
+                    spare = 0;
+                }
+            }
+        }
+        end = emb_wall_clock();
+        for (i = 0; i < n; i++) {
+            EmbBatchFile *file = batch->files + items[i];
+            if (!results[i] || stage == EMB_STAGE_WRITE) {
+                emb_stream_close(file->stream);
+                emb_stream_close(file->encoded);
+                emb_stream_close(file->colors);
+                file->stream = 0;
+                file->encoded = 0;
+                file->colors = 0;
+                file->result = !results[i];
+                file->seconds = end - file->start;
+            }
+        }
+
+        emb_batch_lock(batch);
+        r = batch->report.stage + stage;
+        r->files += n;
+        r->seconds += end - start;
+        batch->running[stage] -= n;
+        if (spare) {
+            if (batch->n_spare < batch->spare_size) {
+                batch->spare[batch->n_spare] = spare;
+                batch->n_spare++;
+            }
+            else {
+                emb_pattern_free_own_context(spare);
+            }
+        }
+        for (i = 0; i < n; i++) {
+            if (!results[i] || stage == EMB_STAGE_WRITE) {
+                batch->done++;
+            }
+            else {
+                emb_batch_put(batch, stage + 1, items[i]);
+            }
+        }
+        emb_batch_wake(batch);
+    }
+    emb_batch_unlock(batch);
 }
 
+/* Sets a options to convert every file on a worker per processor. */
 void
-emb_pattern_addPolylineObjectAbs(EmbPattern* p, EmbPolyline obj)
+emb_batch_options_init(EmbBatchOptions *options)
 {
-    if (!p) {
-        printf("ERROR: emb-pattern.c emb_pattern_addPolylineObjectAbs(), p argument is null\n");
-        return;
-    }
-    if (!obj.pointList) {
-        printf("ERROR: emb-pattern.c emb_pattern_addPolylineObjectAbs(), obj->pointList is empty\n");
-        return;
+    int s;
+    options->jobs = 0;
+    options->shard = 0;
+    options->shards = 1;
+    for (s = 0; s < EMB_STAGES; s++) {
+        options->stage_jobs[s] = 0;
     }
-    emb_array_addPolyline(p->geometry, obj);
+    options->queue_size = 0;
+    options->loader = EMB_LOADER_MAP;
 }
 
-/* Adds a rectangle object to pattern (a p) at the absolute position
- * (a x,a y) with a width of (a w) and a height of (a h).
- * Positive y is up. Units are in millimeters.
+/* Converts the files in a paths to a format, see
+ * emb_convert_batch_options(), on a jobs workers or one per processor
+ * if a jobs is 0 or less.
  */
-void
-emb_pattern_addRectAbs(EmbPattern* p, EmbRect rect)
-{
-    if (!p) {
-        printf("ERROR: emb-pattern.c emb_pattern_addRectObjectAbs(), p argument is null\n");
-        return;
-    }
-    emb_array_addRect(p->geometry, rect);
-}
-
-/* . */
-void
-emb_pattern_end(EmbPattern *p)
+int
+emb_convert_batch(char **paths, int count, int format, int jobs,
+    int shard, int shards, EmbBatchReport *report)
 {
-    if (p->stitch_list->count == 0) {
-        return;
-    }
-    /* Check for an END stitch and add one if it is not present */
-    if (p->stitch_list->stitch[p->stitch_list->count-1].flags != END) {
-        emb_pattern_addStitchRel(p, 0, 0, END, 1);
-    }
+    EmbBatchOptions options;
+    emb_batch_options_init(&options);
+    options.jobs = jobs;
+    options.shard = shard;
+    options.shards = shards;
+    return emb_convert_batch_options(paths, count, format, &options, report);
 }
 
-/*
+/* Converts the files in a paths to a format, with a directory standing
+ * for the files in it that can be read. The files are sorted and only
+ * those of the shard in a options are converted. Each output goes next
+ * to its input with the extension of a format.
  *
+ * The latency of each file, the throughput of the batch and the time
+ * spent in each stage are printed unless the output is quiet, and the
+ * totals go in a report if it is not null. Returns 1 if every file
+ * converted and 0 otherwise.
  */
 int
-convert(const char *inf, const char *outf)
-{
-    EmbPattern* p = 0;
-    int reader, writer;
-
-    reader = emb_identify_format(inf);
-    writer = emb_identify_format(outf);
-
-    p = emb_pattern_create();
-    if (!p) {
-        printf("ERROR: convert(), cannot allocate memory for p\n");
-        return 1;
+emb_convert_batch_options(char **paths, int count, int format,
+    const EmbBatchOptions *options, EmbBatchReport *report)
+{
+    EmbBatch batch;
+    char **files = 0;
+    int *items = 0;
+    int i, s, n = 0, size = 0, result = 1;
+    int jobs = options->jobs;
+    double start = emb_wall_clock();
+
+    if (format < 0 || format >= numberOfFormats
+        || formatTable[format].writer_state == ' ') {
+        printf("ERROR: emb_convert_batch(), cannot write format %d\n", format);
+        return 0;
+    }
+    if (options->shards < 1 || options->shard < 0
+        || options->shard >= options->shards) {
+        printf("ERROR: emb_convert_batch(), no shard %d of %d\n",
+            options->shard, options->shards);
+        return 0;
+    }
+    for (i = 0; i < count && result; i++) {
+        result = emb_batch_add_directory(&files, &n, &size, paths[i], format);
+        if (result < 0) {
+            result = emb_batch_add_path(&files, &n, &size, paths[i]);
+        }
+    }
+    if (!result) {
+        printf("ERROR: emb_convert_batch(), cannot allocate the file list\n");
+    }
+    if (n > 0) {
+        qsort(files, n, sizeof(char*), emb_batch_compare);
+    }
+
+    memset(&batch, 0, sizeof(EmbBatch));
+    batch.format = format;
+    batch.files = (EmbBatchFile*)calloc(EMB_MAX(n, 1), sizeof(EmbBatchFile));
+    if (!batch.files) {
+        printf("ERROR: emb_convert_batch(), cannot allocate the batch\n");
+        result = 0;
+    }
+    for (i = options->shard; i < n && result; i += options->shards) {
+        EmbBatchFile *file = batch.files + batch.count;
+        file->input = files[i];
+        file->output = emb_batch_output_name(files[i], format);
+        file->result = 1;
+        if (!file->output) {
+            printf("ERROR: emb_convert_batch(), cannot allocate the batch\n");
+            result = 0;
+            break;
+        }
+        batch.count++;
     }
 
-    if (!emb_pattern_read(p, inf, reader)) {
-        printf("ERROR: convert(), reading file was unsuccessful: %s\n", inf);
-        emb_pattern_free(p);
-        return 1;
+    if (jobs <= 0) {
+        jobs = emb_cpu_count();
+    }
+    jobs = EMB_MAX(EMB_MIN(jobs, batch.count), 1);
+    for (s = 0; s < EMB_STAGES; s++) {
+        batch.stage_jobs[s] = options->stage_jobs[s];
+        if (batch.stage_jobs[s] <= 0 || batch.stage_jobs[s] > jobs) {
+            batch.stage_jobs[s] = jobs;
+        }
+    }
+    batch.group = 1;
+    if (result) {
+        batch.loader = emb_loader_create(options->loader);
+        if (!batch.loader) {
+            result = 0;
+        }
+        else if (emb_loader_kind(batch.loader) == EMB_LOADER_IO_URING) {
+            batch.group = EMB_LOADER_DEPTH;
+            batch.stage_jobs[EMB_STAGE_PREFETCH] = 1;
+        }
+    }
+    batch.queue_size = options->queue_size;
+    if (batch.queue_size <= 0) {
+        batch.queue_size = EMB_MAX(2 * jobs, batch.group);
+    }
+    /* The most patterns in use at once: those being decoded or queued for
+     * the transform, those in it or queued for the encoder, and those
+     * being encoded.
+     */
+    batch.spare_size = 2 * batch.queue_size + jobs;
+    if (result) {
+        items = (int*)malloc(EMB_STAGES * batch.queue_size * sizeof(int));
+        batch.spare = (EmbPattern**)malloc(batch.spare_size * sizeof(EmbPattern*));
+        if (!items || !batch.spare) {
+            printf("ERROR: emb_convert_batch(), cannot allocate the queues\n");
+            result = 0;
+        }
     }
 
-    if (formatTable[reader].type == EMBFORMAT_OBJECTONLY) {
-        if (formatTable[writer].type == EMBFORMAT_STITCHONLY) {
-            emb_pattern_movePolylinesTostitch_list(p);
+    if (result) {
+        for (s = 0; s < EMB_STAGES; s++) {
+            batch.queue[s].items = items + s * batch.queue_size;
+        }
+#if defined(EMB_THREADS)
+        pthread_mutex_init(&batch.lock, 0);
+        pthread_cond_init(&batch.changed, 0);
+#endif
+        emb_parallel_for(emb_batch_worker, &batch, jobs, jobs);
+#if defined(EMB_THREADS)
+        pthread_cond_destroy(&batch.changed);
+        pthread_mutex_destroy(&batch.lock);
+#endif
+        for (i = 0; i < batch.n_spare; i++) {
+            emb_pattern_free_own_context(batch.spare[i]);
         }
     }
+    if (batch.loader) {
+        batch.report.loader = emb_loader_kind(batch.loader);
+        emb_loader_free(batch.loader);
+    }
 
-    if (!emb_pattern_write(p, outf, writer)) {
-        printf("ERROR: convert(), writing file %s was unsuccessful\n", outf);
-        emb_pattern_free(p);
-        return 1;
+    batch.report.files = batch.count;
+    for (i = 0; i < batch.count; i++) {
+        EmbBatchFile *file = batch.files + i;
+        if (file->result) {
+            batch.report.failed++;
+        }
+        else {
+            batch.report.stitches += file->stitches;
+        }
+        if (emb_verbose >= 0) {
+            if (file->result) {
+                printf("%s: failed after %.2f ms.\n", file->input,
+                    1000.0 * file->seconds);
+            }
+            else {
+                printf("%s -> %s: %.2f ms, %ld stitches.\n", file->input,
+                    file->output, 1000.0 * file->seconds, file->stitches);
+            }
+        }
+        safe_free(file->output);
+    }
+    for (s = 0; s < EMB_STAGES; s++) {
+        if (batch.queue[s].arrivals > 0) {
+            batch.report.stage[s].mean_depth =
+                batch.queue[s].depth / batch.queue[s].arrivals;
+        }
+    }
+    batch.report.seconds = emb_wall_clock() - start;
+    if (emb_verbose >= 0 && result) {
+        double seconds = EMB_MAX(batch.report.seconds, 1e-9);
+        int converted = batch.report.files - batch.report.failed;
+        printf("Converted %d of %d files on %d jobs in %.3f s: "
+            "%.1f files/s, %.0f stitches/s, loaded by %s.\n",
+            converted, batch.report.files, jobs, batch.report.seconds,
+            converted / seconds, batch.report.stitches / seconds,
+            emb_loader_names[batch.report.loader]);
+        for (s = 0; s < EMB_STAGES; s++) {
+            EmbStageReport *r = batch.report.stage + s;
+            printf("    %-9s %d jobs, %d files, %.2f ms busy, "
+                "queue %d at most and %.1f on average.\n",
+                emb_stage_names[s], batch.stage_jobs[s], r->files,
+                1000.0 * r->seconds, r->max_depth, r->mean_depth);
+        }
+    }
+    if (report) {
+        *report = batch.report;
     }
 
-    emb_pattern_free(p);
-    return 0;
+    for (i = 0; i < n; i++) {
+        safe_free(files[i]);
+    }
+    safe_free(files);
+    safe_free(items);
+    safe_free(batch.spare);
+    safe_free(batch.files);
+    return result && batch.report.failed == 0;
 }
 
 /* The Pattern Properties
@@ -4354,6 +8006,7 @@ emb_pattern_details(EmbPattern *pattern)
     int colors, num_stitches, real_stitches, jump_stitches, trim_stitches;
     int unknown_stitches;
     EmbRect bounds;
+    EmbStitchColumns c;
     float thread_usage;
     float minimum_length;
     float maximum_length;
@@ -4361,14 +8014,26 @@ emb_pattern_details(EmbPattern *pattern)
     // colors = emb_pattern_color_count(pattern);
     colors = 1;
     num_stitches = pattern->stitch_list->count;
-    real_stitches = emb_pattern_realStitches(pattern);
-    jump_stitches = emb_pattern_jumpStitches(pattern);
-    trim_stitches = emb_pattern_trimStitches(pattern);
     unknown_stitches = 0; // emb_pattern_unknownStitches(pattern);
     bounds = emb_pattern_bounds(pattern);
-    thread_usage = emb_total_thread_length(pattern);
     minimum_length = emb_pattern_shortest_stitch(pattern);
-    maximum_length = emb_pattern_longest_stitch(pattern);
+    /* The stitches are loaded into columns once for all the passes. */
+    if (emb_pattern_columns(pattern, &c)) {
+        real_stitches = c.count
+            - emb_stitch_columns_count(&c, JUMP | TRIM | END);
+        jump_stitches = emb_stitch_columns_count(&c, JUMP);
+        trim_stitches = emb_stitch_columns_count(&c, TRIM);
+        thread_usage = emb_stitch_columns_length(&c);
+        maximum_length = emb_stitch_columns_longest(&c);
+        emb_stitch_columns_free(&c);
+    }
+    else {
+        real_stitches = emb_pattern_realStitches(pattern);
+        jump_stitches = emb_pattern_jumpStitches(pattern);
+        trim_stitches = emb_pattern_trimStitches(pattern);
+        thread_usage = emb_total_thread_length(pattern);
+        maximum_length = emb_pattern_longest_stitch(pattern);
+    }
 
     /* Print Report */
     printf("Design Details\n");
@@ -4485,7 +8150,14 @@ emb_pattern_realStitches(EmbPattern *pattern)
 {
     int i;
     EmbArray *sts = pattern->stitch_list;
+    EmbStitchColumns c;
     int real_stitches = 0;
+    if (emb_pattern_columns(pattern, &c)) {
+        real_stitches = c.count
+            - emb_stitch_columns_count(&c, JUMP | TRIM | END);
+        emb_stitch_columns_free(&c);
+        return real_stitches;
+    }
     for (i = 0; i < sts->count; i++) {
         if (!(sts->stitch[i].flags & (JUMP | TRIM | END))) {
             real_stitches++;
@@ -4624,6 +8296,12 @@ emb_pattern_longest_stitch(EmbPattern *pattern)
     int i;
     EmbReal max_stitch = 0.0;
     EmbStitch prev_st = pattern->stitch_list->stitch[0];
+    EmbStitchColumns c;
+    if (emb_pattern_columns(pattern, &c)) {
+        max_stitch = emb_stitch_columns_longest(&c);
+        emb_stitch_columns_free(&c);
+        return max_stitch;
+    }
     for (i = 1; i < pattern->stitch_list->count; i++) {
         EmbStitch st = pattern->stitch_list->stitch[i];
         if ((prev_st.flags == NORMAL) && (st.flags == NORMAL)) {
@@ -4746,6 +8424,12 @@ emb_total_thread_length(EmbPattern *pattern)
     int i;
     double total = 0.0;
     EmbStitch prev_st = pattern->stitch_list->stitch[0];
+    EmbStitchColumns c;
+    if (emb_pattern_columns(pattern, &c)) {
+        total = emb_stitch_columns_length(&c);
+        emb_stitch_columns_free(&c);
+        return total;
+    }
     for (i = 1; i < pattern->stitch_list->count; i++) {
         EmbStitch st = pattern->stitch_list->stitch[i];
         /* Can't count first normal stitch. */
@@ -4780,6 +8464,475 @@ emb_total_thread_of_color(EmbPattern *pattern, int thread_index)
     return total;
 }
 
+/* Columnar stitch storage.
+ *
+ * An EmbStitch array interleaves the flags and color with the
+ * coordinates, so a pass that only needs x and y still drags all 16
+ * bytes of every stitch through the cache. EmbStitchColumns holds the
+ * same data as separate x, y and attribute columns, which lets the
+ * kernels below work on four stitches per instruction with SSE2 or
+ * NEON. The attribute column packs the flags into the low 8 bits and
+ * the color index into the bits above them.
+ *
+ * The columns are a view of a stitch list: load them, run the kernels
+ * and store them back if they were transformed. Code that wants an
+ * EmbStitch can read one through emb_stitch_columns_get().
+ * emb_pattern_bounds(), emb_total_thread_length(),
+ * emb_pattern_longest_stitch() and emb_pattern_realStitches() run on
+ * them, and emb_pattern_details() loads them once for all its passes.
+ */
+
+#define EMB_COLUMN_FLAGS          0xFF
+
+/* Grows the columns a c to hold at least a n stitches. */
+static int
+emb_stitch_columns_grow(EmbStitchColumns *c, int n)
+{
+    float *x, *y;
+    int32_t *attr;
+    if (n <= c->size) {
+        return 1;
+    }
+    n = EMB_MAX(n, 2*c->size);
+    x = (float*)realloc(c->x, n*sizeof(float));
+    if (!x) {
+        return 0;
+    }
+    c->x = x;
+    y = (float*)realloc(c->y, n*sizeof(float));
+    if (!y) {
+        return 0;
+    }
+    c->y = y;
+    attr = (int32_t*)realloc(c->attr, n*sizeof(int32_t));
+    if (!attr) {
+        return 0;
+    }
+    c->attr = attr;
+    c->size = n;
+    return 1;
+}
+
+/* Copies the stitches of a stitch_list into the columns a c, replacing
+ * their previous contents. The columns start zeroed, or are reused from
+ * an earlier call so repeated loads do not allocate.
+ */
+int
+emb_stitch_columns_load(EmbStitchColumns *c, const EmbArray *stitch_list)
+{
+    int i;
+    if (!c || !stitch_list) {
+        printf("ERROR: emb_stitch_columns_load(), argument is null\n");
+        return 0;
+    }
+    if (stitch_list->type != EMB_STITCH) {
+        printf("ERROR: emb_stitch_columns_load(), not a stitch list\n");
+        return 0;
+    }
+    if (!emb_stitch_columns_grow(c, stitch_list->count)) {
+        printf("ERROR: emb_stitch_columns_load(), cannot allocate columns\n");
+        return 0;
+    }
+    for (i = 0; i < stitch_list->count; i++) {
+        EmbStitch st = stitch_list->stitch[i];
+        c->x[i] = st.x;
+        c->y[i] = st.y;
+        c->attr[i] = (int32_t)(((uint32_t)st.color << 8)
+            | (st.flags & EMB_COLUMN_FLAGS));
+    }
+    c->count = stitch_list->count;
+    return 1;
+}
+
+/* Writes the columns a c back over the stitches of a stitch_list,
+ * resizing the list to match.
+ */
+int
+emb_stitch_columns_store(const EmbStitchColumns *c, EmbArray *stitch_list)
+{
+    int i;
+    if (!c || !stitch_list) {
+        printf("ERROR: emb_stitch_columns_store(), argument is null\n");
+        return 0;
+    }
+    if (!emb_array_writable(stitch_list)
+        || !emb_array_reserve(stitch_list, c->count)) {
+        printf("ERROR: emb_stitch_columns_store(), cannot allocate stitches\n");
+        return 0;
+    }
+    for (i = 0; i < c->count; i++) {
+        stitch_list->stitch[i] = emb_stitch_columns_get(c, i);
+    }
+    stitch_list->count = c->count;
+    return 1;
+}
+
+/* Returns stitch a i of the columns a c as an EmbStitch. */
+EmbStitch
+emb_stitch_columns_get(const EmbStitchColumns *c, int i)
+{
+    EmbStitch st;
+    st.x = c->x[i];
+    st.y = c->y[i];
+    st.flags = c->attr[i] & EMB_COLUMN_FLAGS;
+    st.color = c->attr[i] >> 8;
+    return st;
+}
+
+/* Releases the storage held by a c, which may be reused afterwards. */
+void
+emb_stitch_columns_free(EmbStitchColumns *c)
+{
+    if (!c) {
+        return;
+    }
+    safe_free(c->x);
+    safe_free(c->y);
+    safe_free(c->attr);
+    c->count = 0;
+    c->size = 0;
+}
+
+/* Finds the extents of the stitches in a c that are not trims, storing
+ * them as min x, min y, max x and max y in a extents. Returns 0 if
+ * there are none, leaving a extents alone.
+ */
+static int
+emb_stitch_columns_extents(const EmbStitchColumns *c, EmbReal *extents)
+{
+    float min_x = HUGE_VALF, min_y = HUGE_VALF;
+    float max_x = -HUGE_VALF, max_y = -HUGE_VALF;
+    int i = 0;
+
+#if defined(EMB_COLUMNS_SSE2)
+    {
+        const __m128i trim = _mm_set1_epi32(TRIM);
+        const __m128i zero = _mm_setzero_si128();
+        const __m128 pos_inf = _mm_set1_ps(HUGE_VALF);
+        const __m128 neg_inf = _mm_set1_ps(-HUGE_VALF);
+        __m128 lo_x = pos_inf, lo_y = pos_inf;
+        __m128 hi_x = neg_inf, hi_y = neg_inf;
+        float lanes[16];
+        int j;
+        for (; i + 4 <= c->count; i += 4) {
+            __m128 x = _mm_loadu_ps(c->x + i);
+            __m128 y = _mm_loadu_ps(c->y + i);
+            __m128i attr = _mm_loadu_si128((const __m128i*)(c->attr + i));
+            __m128 keep = _mm_castsi128_ps(
+                _mm_cmpeq_epi32(_mm_and_si128(attr, trim), zero));
+            lo_x = _mm_min_ps(lo_x, _mm_or_ps(_mm_and_ps(keep, x),
+                _mm_andnot_ps(keep, pos_inf)));
+            lo_y = _mm_min_ps(lo_y, _mm_or_ps(_mm_and_ps(keep, y),
+                _mm_andnot_ps(keep, pos_inf)));
+            hi_x = _mm_max_ps(hi_x, _mm_or_ps(_mm_and_ps(keep, x),
+                _mm_andnot_ps(keep, neg_inf)));
+            hi_y = _mm_max_ps(hi_y, _mm_or_ps(_mm_and_ps(keep, y),
+                _mm_andnot_ps(keep, neg_inf)));
+        }
+        _mm_storeu_ps(lanes, lo_x);
+        _mm_storeu_ps(lanes + 4, lo_y);
+        _mm_storeu_ps(lanes + 8, hi_x);
+        _mm_storeu_ps(lanes + 12, hi_y);
+        for (j = 0; j < 4; j++) {
+            min_x = EMB_MIN(min_x, lanes[j]);
+            min_y = EMB_MIN(min_y, lanes[4+j]);
+            max_x = EMB_MAX(max_x, lanes[8+j]);
+            max_y = EMB_MAX(max_y, lanes[12+j]);
+        }
+    }
+#elif defined(EMB_COLUMNS_NEON)
+    {
+        const int32x4_t trim = vdupq_n_s32(TRIM);
+        const float32x4_t pos_inf = vdupq_n_f32(HUGE_VALF);
+        const float32x4_t neg_inf = vdupq_n_f32(-HUGE_VALF);
+        float32x4_t lo_x = pos_inf, lo_y = pos_inf;
+        float32x4_t hi_x = neg_inf, hi_y = neg_inf;
+        for (; i + 4 <= c->count; i += 4) {
+            float32x4_t x = vld1q_f32(c->x + i);
+            float32x4_t y = vld1q_f32(c->y + i);
+            uint32x4_t trimmed = vtstq_s32(vld1q_s32(c->attr + i), trim);
+            lo_x = vminq_f32(lo_x, vbslq_f32(trimmed, pos_inf, x));
+            lo_y = vminq_f32(lo_y, vbslq_f32(trimmed, pos_inf, y));
+            hi_x = vmaxq_f32(hi_x, vbslq_f32(trimmed, neg_inf, x));
+            hi_y = vmaxq_f32(hi_y, vbslq_f32(trimmed, neg_inf, y));
+        }
+        min_x = vminvq_f32(lo_x);
+        min_y = vminvq_f32(lo_y);
+        max_x = vmaxvq_f32(hi_x);
+        max_y = vmaxvq_f32(hi_y);
+    }
+#endif
+    for (; i < c->count; i++) {
+        if (!(c->attr[i] & TRIM)) {
+            min_x = EMB_MIN(min_x, c->x[i]);
+            min_y = EMB_MIN(min_y, c->y[i]);
+            max_x = EMB_MAX(max_x, c->x[i]);
+            max_y = EMB_MAX(max_y, c->y[i]);
+        }
+    }
+    if (min_x > max_x) {
+        return 0;
+    }
+    extents[0] = min_x;
+    extents[1] = min_y;
+    extents[2] = max_x;
+    extents[3] = max_y;
+    return 1;
+}
+
+/* Bounding rectangle of the stitches in a c, ignoring trims as
+ * emb_pattern_bounds() does. An empty rectangle at the origin is
+ * returned when there is nothing to bound.
+ */
+EmbRect
+emb_stitch_columns_bounds(const EmbStitchColumns *c)
+{
+    EmbRect r;
+    EmbReal extents[4];
+    memset(&r, 0, sizeof(EmbRect));
+    if (!emb_stitch_columns_extents(c, extents)) {
+        return r;
+    }
+    r.x = extents[0];
+    r.y = extents[1];
+    r.w = extents[2] - extents[0];
+    r.h = extents[3] - extents[1];
+    return r;
+}
+
+/* Total length of the normal stitches in a c, matching
+ * emb_total_thread_length(). The vector lanes are summed in single
+ * precision and flushed into a double every EMB_COLUMN_BLOCK
+ * iterations so long patterns do not lose accuracy.
+ */
+#define EMB_COLUMN_BLOCK          256
+
+double
+emb_stitch_columns_length(const EmbStitchColumns *c)
+{
+    double total = 0.0;
+    int i = 1;
+
+    if (c->count < 2) {
+        return 0.0;
+    }
+#if defined(EMB_COLUMNS_SSE2)
+    {
+        const __m128i flag_bits = _mm_set1_epi32(EMB_COLUMN_FLAGS);
+        const __m128i zero = _mm_setzero_si128();
+        while (i + 4 <= c->count) {
+            __m128 acc = _mm_setzero_ps();
+            float lanes[4];
+            int block;
+            for (block = 0; block < EMB_COLUMN_BLOCK && i + 4 <= c->count;
+                block++, i += 4) {
+                __m128 dx = _mm_sub_ps(_mm_loadu_ps(c->x + i),
+                    _mm_loadu_ps(c->x + i - 1));
+                __m128 dy = _mm_sub_ps(_mm_loadu_ps(c->y + i),
+                    _mm_loadu_ps(c->y + i - 1));
+                __m128 d = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx, dx),
+                    _mm_mul_ps(dy, dy)));
+                __m128i attr = _mm_loadu_si128((const __m128i*)(c->attr + i));
+                __m128 normal = _mm_castsi128_ps(
+                    _mm_cmpeq_epi32(_mm_and_si128(attr, flag_bits), zero));
+                acc = _mm_add_ps(acc, _mm_and_ps(normal, d));
+            }
+            _mm_storeu_ps(lanes, acc);
+            total += (double)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        }
+    }
+#elif defined(EMB_COLUMNS_NEON)
+    {
+        const int32x4_t flag_bits = vdupq_n_s32(EMB_COLUMN_FLAGS);
+        while (i + 4 <= c->count) {
+            float32x4_t acc = vdupq_n_f32(0.0f);
+            int block;
+            for (block = 0; block < EMB_COLUMN_BLOCK && i + 4 <= c->count;
+                block++, i += 4) {
+                float32x4_t dx = vsubq_f32(vld1q_f32(c->x + i),
+                    vld1q_f32(c->x + i - 1));
+                float32x4_t dy = vsubq_f32(vld1q_f32(c->y + i),
+                    vld1q_f32(c->y + i - 1));
+                float32x4_t d = vsqrtq_f32(vaddq_f32(vmulq_f32(dx, dx),
+                    vmulq_f32(dy, dy)));
+                uint32x4_t flagged = vtstq_s32(vld1q_s32(c->attr + i),
+                    flag_bits);
+                acc = vaddq_f32(acc, vreinterpretq_f32_u32(vbicq_u32(
+                    vreinterpretq_u32_f32(d), flagged)));
+            }
+            total += vaddvq_f32(acc);
+        }
+    }
+#endif
+    for (; i < c->count; i++) {
+        if ((c->attr[i] & EMB_COLUMN_FLAGS) == NORMAL) {
+            float dx = c->x[i] - c->x[i-1];
+            float dy = c->y[i] - c->y[i-1];
+            total += sqrtf(dx*dx + dy*dy);
+        }
+    }
+    return total;
+}
+
+/* Length of the longest stitch in a c that runs between two normal
+ * stitches, matching emb_pattern_longest_stitch().
+ */
+EmbReal
+emb_stitch_columns_longest(const EmbStitchColumns *c)
+{
+    float longest = 0.0f;
+    int i = 1;
+
+    if (c->count < 2) {
+        return 0.0;
+    }
+#if defined(EMB_COLUMNS_SSE2)
+    {
+        const __m128i flag_bits = _mm_set1_epi32(EMB_COLUMN_FLAGS);
+        const __m128i zero = _mm_setzero_si128();
+        __m128 best = _mm_setzero_ps();
+        float lanes[4];
+        int j;
+        for (; i + 4 <= c->count; i += 4) {
+            __m128 dx = _mm_sub_ps(_mm_loadu_ps(c->x + i),
+                _mm_loadu_ps(c->x + i - 1));
+            __m128 dy = _mm_sub_ps(_mm_loadu_ps(c->y + i),
+                _mm_loadu_ps(c->y + i - 1));
+            __m128i pair = _mm_or_si128(
+                _mm_loadu_si128((const __m128i*)(c->attr + i)),
+                _mm_loadu_si128((const __m128i*)(c->attr + i - 1)));
+            __m128 normal = _mm_castsi128_ps(
+                _mm_cmpeq_epi32(_mm_and_si128(pair, flag_bits), zero));
+            __m128 d2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+            best = _mm_max_ps(best, _mm_and_ps(normal, d2));
+        }
+        _mm_storeu_ps(lanes, best);
+        for (j = 0; j < 4; j++) {
+            longest = EMB_MAX(longest, lanes[j]);
+        }
+    }
+#elif defined(EMB_COLUMNS_NEON)
+    {
+        const int32x4_t flag_bits = vdupq_n_s32(EMB_COLUMN_FLAGS);
+        float32x4_t best = vdupq_n_f32(0.0f);
+        for (; i + 4 <= c->count; i += 4) {
+            float32x4_t dx = vsubq_f32(vld1q_f32(c->x + i),
+                vld1q_f32(c->x + i - 1));
+            float32x4_t dy = vsubq_f32(vld1q_f32(c->y + i),
+                vld1q_f32(c->y + i - 1));
+            int32x4_t pair = vorrq_s32(vld1q_s32(c->attr + i),
+                vld1q_s32(c->attr + i - 1));
+            uint32x4_t flagged = vtstq_s32(pair, flag_bits);
+            float32x4_t d2 = vaddq_f32(vmulq_f32(dx, dx), vmulq_f32(dy, dy));
+            best = vmaxq_f32(best, vreinterpretq_f32_u32(vbicq_u32(
+                vreinterpretq_u32_f32(d2), flagged)));
+        }
+        longest = vmaxvq_f32(best);
+    }
+#endif
+    /* The vector loops compare squared lengths, so the square root is
+     * taken once at the end.
+     */
+    for (; i < c->count; i++) {
+        if (((c->attr[i] | c->attr[i-1]) & EMB_COLUMN_FLAGS) == NORMAL) {
+            float dx = c->x[i] - c->x[i-1];
+            float dy = c->y[i] - c->y[i-1];
+            longest = EMB_MAX(longest, dx*dx + dy*dy);
+        }
+    }
+    return sqrtf(longest);
+}
+
+/* Number of stitches in a c with any of the bits in a flag set, like
+ * emb_pattern_count_type(). Real stitches are the remainder:
+ *
+ *     c->count - emb_stitch_columns_count(c, JUMP | TRIM | END);
+ */
+int
+emb_stitch_columns_count(const EmbStitchColumns *c, int flag)
+{
+    int total = 0;
+    int i = 0;
+
+    flag &= EMB_COLUMN_FLAGS;
+#if defined(EMB_COLUMNS_SSE2)
+    {
+        const __m128i bits = _mm_set1_epi32(flag);
+        const __m128i zero = _mm_setzero_si128();
+        __m128i unset = _mm_setzero_si128();
+        int32_t lanes[4];
+        int unset_total = 0;
+        int start = i;
+        for (; i + 4 <= c->count; i += 4) {
+            __m128i attr = _mm_loadu_si128((const __m128i*)(c->attr + i));
+            /* Each lane is -1 when none of the bits are set. */
+            unset = _mm_sub_epi32(unset,
+                _mm_cmpeq_epi32(_mm_and_si128(attr, bits), zero));
+        }
+        _mm_storeu_si128((__m128i*)lanes, unset);
+        unset_total = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        total = (i - start) - unset_total;
+    }
+#elif defined(EMB_COLUMNS_NEON)
+    {
+        const int32x4_t bits = vdupq_n_s32(flag);
+        uint32x4_t set = vdupq_n_u32(0);
+        for (; i + 4 <= c->count; i += 4) {
+            /* Each lane is all ones when any of the bits are set. */
+            set = vsubq_u32(set, vtstq_s32(vld1q_s32(c->attr + i), bits));
+        }
+        total = (int)vaddvq_u32(set);
+    }
+#endif
+    for (; i < c->count; i++) {
+        if (c->attr[i] & flag) {
+            total++;
+        }
+    }
+    return total;
+}
+
+/* Scales the stitches in a c by (a scale_x, a scale_y) and then
+ * moves them by (a dx, a dy), in place.
+ */
+void
+emb_stitch_columns_transform(EmbStitchColumns *c, EmbReal scale_x,
+    EmbReal scale_y, EmbReal dx, EmbReal dy)
+{
+    int i = 0;
+#if defined(EMB_COLUMNS_SSE2)
+    {
+        const __m128 sx = _mm_set1_ps(scale_x);
+        const __m128 sy = _mm_set1_ps(scale_y);
+        const __m128 tx = _mm_set1_ps(dx);
+        const __m128 ty = _mm_set1_ps(dy);
+        for (; i + 4 <= c->count; i += 4) {
+            _mm_storeu_ps(c->x + i,
+                _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(c->x + i), sx), tx));
+            _mm_storeu_ps(c->y + i,
+                _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(c->y + i), sy), ty));
+        }
+    }
+#elif defined(EMB_COLUMNS_NEON)
+    {
+        const float32x4_t sx = vdupq_n_f32(scale_x);
+        const float32x4_t sy = vdupq_n_f32(scale_y);
+        const float32x4_t tx = vdupq_n_f32(dx);
+        const float32x4_t ty = vdupq_n_f32(dy);
+        for (; i + 4 <= c->count; i += 4) {
+            vst1q_f32(c->x + i, vaddq_f32(vmulq_f32(vld1q_f32(c->x + i), sx),
+                tx));
+            vst1q_f32(c->y + i, vaddq_f32(vmulq_f32(vld1q_f32(c->y + i), sy),
+                ty));
+        }
+    }
+#endif
+    for (; i < c->count; i++) {
+        c->x[i] = c->x[i]*scale_x + dx;
+        c->y[i] = c->y[i]*scale_y + dy;
+    }
+}
+
 /* TODO: test this. */
 char *
 emb_get_svg_token(char *svg, char token[MAX_STRING_LENGTH])
@@ -38,32 +38,31 @@ string_equal(char *a, const char *b)
     return (strncmp(a, b, MAX_STRING_LENGTH) == 0);
 }
 
-/* . */
+/* Parses up to a n numbers separated by commas or spaces from a line
+ * into a result. Returns how many there were, or -1 if there are more
+ * than a n.
+ */
 int
 parse_floats(const char *line, float result[], int n)
 {
-    char substring[MAX_STRING_LENGTH];
-    const char *c;
+    const char *c = line;
     int i = 0;
-    int pos = 0;
-    for (c=line; *c; c++) {
-        substring[pos] = *c;
-        if (*c == ',' || *c == ' ') {
-            substring[pos] = 0;
-            result[i] = atof(substring);
-            pos = 0;
-            i++;
-            if (i > n-1) {
-                return -1;
-            }
+    for (;;) {
+        const char *end = c;
+        while (*end && *end != ',' && *end != ' ') {
+            end++;
         }
-        else {
-            pos++;
+        result[i] = 0.0f;
+        emb_parse_real(c, end, &result[i]);
+        i++;
+        if (!*end) {
+            return i;
         }
+        if (i > n-1) {
+            return -1;
+        }
+        c = end + 1;
     }
-    substring[pos] = 0;
-    result[i] = atof(substring);
-    return i+1;
 }
 
 int
@@ -130,20 +129,20 @@ table_length(char *s[])
 unsigned char *
 load_file(char *fname)
 {
-    FILE *f = fopen(fname, "r");
+    EmbStream *f = emb_stream_open(fname, "r");
     if (!f) {
         printf("ERROR: Failed to open \"%s\".\n", fname);
         return NULL;
     }
-    fseek(f, 0, SEEK_END);
-    size_t length = ftell(f);
+    emb_fseek(f, 0, SEEK_END);
+    size_t length = emb_ftell(f);
     unsigned char *data = malloc(length+1);
-    fseek(f, 0, SEEK_SET);
+    emb_fseek(f, 0, SEEK_SET);
     if (!read_n_bytes(f, data, length)) {
-        fclose(f);
+        emb_stream_close(f);
         return NULL;
     }
-    fclose(f);
+    emb_stream_close(f);
     return data;
 }
 
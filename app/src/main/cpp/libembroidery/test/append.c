@@ -0,0 +1,111 @@
+/* Testing that stitches added in bulk match those added one at a time. */
+
+#include <string.h>
+
+#include "../src/embroidery.h"
+
+#define STITCHES 1000
+
+int compare_stitches(EmbPattern *a, EmbPattern *b);
+
+int
+main(void)
+{
+    EmbStitch st[STITCHES];
+    EmbPattern *p, *q, *r;
+    EmbStitchBatch batch;
+    int i, result;
+
+    /* A leading STOP and END are dropped, a second END is refused. */
+    for (i = 0; i < STITCHES; i++) {
+        st[i].x = (i % 17) * 0.3 - 2.0;
+        st[i].y = (i % 5) * 0.7 - 1.0;
+        st[i].flags = NORMAL;
+        st[i].color = 99;
+        if (i % 100 == 50) {
+            st[i].flags = STOP;
+        }
+        else if (i % 30 == 29) {
+            st[i].flags = TRIM;
+        }
+    }
+    st[0].flags = STOP;
+    st[1].flags = END;
+    st[STITCHES - 2].flags = END;
+    st[STITCHES - 1].flags = END;
+
+    p = emb_pattern_create();
+    q = emb_pattern_create();
+    r = emb_pattern_create();
+    for (i = 0; i < 3; i++) {
+        emb_pattern_addThread(p, black_thread);
+        emb_pattern_addThread(q, black_thread);
+        emb_pattern_addThread(r, black_thread);
+    }
+    for (i = 0; i < STITCHES; i++) {
+        emb_pattern_addStitchRel(p, st[i].x, st[i].y, st[i].flags, 1);
+    }
+    emb_pattern_append_stitches_rel(q, st, STITCHES);
+    emb_stitch_batch_init(&batch, r);
+    for (i = 0; i < STITCHES; i++) {
+        emb_stitch_batch_rel(&batch, st[i].x, st[i].y, st[i].flags);
+    }
+    emb_stitch_batch_flush(&batch);
+    result = compare_stitches(p, q);
+    if (!result) {
+        result = compare_stitches(p, r);
+    }
+    if (result) {
+        return result;
+    }
+    if (p->thread_list->count != q->thread_list->count
+        || p->currentColorIndex != q->currentColorIndex) {
+        return 3;
+    }
+    emb_pattern_free(p);
+    emb_pattern_free(q);
+    emb_pattern_free(r);
+
+    /* The same stitches at absolute positions. */
+    p = emb_pattern_create();
+    q = emb_pattern_create();
+    r = emb_pattern_create();
+    for (i = 0; i < STITCHES - 2; i++) {
+        emb_pattern_addStitchAbs(p, st[i].x, st[i].y, st[i].flags, 1);
+    }
+    emb_pattern_append_stitches_abs(q, st, STITCHES - 2);
+    emb_stitch_batch_init(&batch, r);
+    for (i = 0; i < STITCHES - 2; i++) {
+        emb_stitch_batch_abs(&batch, st[i].x, st[i].y, st[i].flags);
+    }
+    emb_stitch_batch_flush(&batch);
+    result = compare_stitches(p, q);
+    if (!result) {
+        result = compare_stitches(p, r);
+    }
+    emb_pattern_free(p);
+    emb_pattern_free(q);
+    emb_pattern_free(r);
+    return result ? 10 + result : 0;
+}
+
+int
+compare_stitches(EmbPattern *a, EmbPattern *b)
+{
+    int i;
+    if (a->stitch_list->count != b->stitch_list->count) {
+        printf("Added %d stitches one at a time and %d in bulk.\n",
+            a->stitch_list->count, b->stitch_list->count);
+        return 1;
+    }
+    for (i = 0; i < a->stitch_list->count; i++) {
+        EmbStitch s = a->stitch_list->stitch[i];
+        EmbStitch t = b->stitch_list->stitch[i];
+        if (s.x != t.x || s.y != t.y || s.flags != t.flags
+            || s.color != t.color) {
+            printf("Stitch %d differs.\n", i);
+            return 2;
+        }
+    }
+    return 0;
+}
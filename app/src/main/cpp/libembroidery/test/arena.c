@@ -0,0 +1,131 @@
+/* Testing the arena that backs a pattern's arrays, point lists and
+ * thread strings, and reusing patterns through a pool.
+ */
+
+#include <string.h>
+
+#include "../src/embroidery.h"
+
+int
+main(void)
+{
+    int i, j;
+    char *small, *grown;
+    EmbArena *arena = emb_arena_create(1024);
+    EmbPattern *p = emb_pattern_create();
+
+    /* The most recent allocation grows in place. */
+    small = (char*)emb_arena_alloc(arena, 32);
+    memset(small, 7, 32);
+    grown = (char*)emb_arena_realloc(arena, small, 32, 128);
+    if (grown != small || grown[31] != 7) {
+        puts("Arena did not grow the last allocation in place.");
+        return 1;
+    }
+    /* Large allocations move to their own block and keep their data. */
+    grown = (char*)emb_arena_realloc(arena, grown, 128, 100000);
+    if (!grown || grown[0] != 7) {
+        puts("Arena lost data when moving to a large block.");
+        return 2;
+    }
+    grown = (char*)emb_arena_realloc(arena, grown, 100000, 200000);
+    emb_arena_release(arena, grown, 200000);
+    emb_arena_free(arena);
+
+    /* Geometry built in the pattern's arena, plus one heap list. */
+    for (i = 0; i < 1000; i++) {
+        EmbPolyline line;
+        line.pointList = emb_vector_list_create_in(p->arena, 2);
+        line.flagList = 0;
+        line.lineType = 1;
+        line.color.r = 0;
+        line.color.g = 0;
+        line.color.b = 0;
+        for (j = 0; j < 20; j++) {
+            EmbVector v;
+            v.x = i;
+            v.y = j;
+            emb_vector_list_add(line.pointList, v);
+        }
+        emb_array_addPolyline(p->geometry, line);
+    }
+    if (p->geometry->heap_lists) {
+        puts("Arena lists were counted as heap lists.");
+        return 3;
+    }
+    {
+        EmbPolyline line;
+        line.pointList = emb_vector_list_create(4);
+        line.flagList = emb_id_list_create(4);
+        line.lineType = 1;
+        emb_array_addPolyline(p->geometry, line);
+    }
+    if (!p->geometry->heap_lists) {
+        puts("Heap lists were not noticed.");
+        return 4;
+    }
+    if (p->geometry->geometry[999].object.polyline.pointList->data[19].y != 19) {
+        puts("Point list contents were lost.");
+        return 5;
+    }
+
+    /* Thread strings are interned, so temporary buffers are safe. */
+    {
+        char name[20];
+        EmbThread t = jef_colors[2];
+        strcpy(name, "Navy");
+        t.description = name;
+        emb_pattern_addThread(p, t);
+        strcpy(name, "Overwritten");
+        emb_pattern_addThread(p, jef_colors[2]);
+        t.description = "Navy";
+        emb_pattern_addThread(p, t);
+        if (strcmp(p->thread_list->thread[0].description, "Navy")
+            || p->thread_list->thread[0].description
+                != p->thread_list->thread[2].description
+            || strcmp(p->thread_list->thread[1].catalogNumber, "001")) {
+            puts("Thread strings were not interned.");
+            return 6;
+        }
+    }
+
+    /* A reset pattern is empty but keeps its capacity, and the pool
+     * hands the same pattern back out.
+     */
+    {
+        EmbPatternPool *pool = emb_pattern_pool_create(2);
+        for (i = 0; i < 10000; i++) {
+            emb_pattern_addStitchAbs(p, i, i, NORMAL, 0);
+        }
+        emb_pattern_pool_put(pool, p);
+        if (p->stitch_list->count != 0 || p->geometry->count != 0
+            || p->thread_list->count != 0 || p->stitch_list->length < 10000) {
+            puts("Reset did not empty the pattern or lost its capacity.");
+            return 7;
+        }
+        if (emb_pattern_pool_get(pool) != p) {
+            puts("The pool did not reuse the pattern.");
+            return 8;
+        }
+        emb_pattern_pool_free(pool);
+    }
+
+    /* Patterns the pool makes share no context, with the default or
+     * with each other, and the pool frees their contexts. */
+    {
+        EmbPatternPool *pool = emb_pattern_pool_create(1);
+        EmbPattern *a = emb_pattern_pool_get(pool);
+        EmbPattern *b = emb_pattern_pool_get(pool);
+        if (!a || !b || a->context == emb_context_default()
+            || b->context == emb_context_default()
+            || a->context == b->context) {
+            puts("Pooled patterns share a context.");
+            return 9;
+        }
+        emb_pattern_pool_put(pool, a);
+        emb_pattern_pool_put(pool, b);
+        emb_pattern_pool_free(pool);
+    }
+    emb_pattern_free(p);
+    return 0;
+}
@@ -0,0 +1,100 @@
+/* Testing the growth, reservation, copying and sharing of EmbArray
+ * storage.
+ */
+
+#include <string.h>
+
+#include "../src/embroidery.h"
+
+int
+main(void)
+{
+    int i, length;
+    EmbStitch st;
+    EmbArray *a = emb_array_create(EMB_STITCH);
+
+    if (!emb_array_reserve(a, 5000)) {
+        puts("Failed to reserve stitches.");
+        return 1;
+    }
+    length = a->length;
+    st.flags = NORMAL;
+    st.color = 0;
+    for (i = 0; i < 5000; i++) {
+        st.x = i;
+        st.y = -i;
+        emb_array_addStitch(a, st);
+    }
+    if (a->length != length) {
+        puts("Reserved array was reallocated while filling it.");
+        return 2;
+    }
+    for (i = 0; i < 20000; i++) {
+        emb_array_addStitch(a, st);
+    }
+    if (a->count != 25000 || a->stitch[4999].x != 4999.0f) {
+        puts("Array contents were lost while growing.");
+        return 3;
+    }
+
+    /* Copies are independent of their source. */
+    {
+        EmbArray *b = emb_array_create(EMB_STITCH);
+        if (!emb_array_copy(b, a) || b->count != a->count
+            || b->stitch[4999].x != 4999.0f) {
+            puts("Array copy failed.");
+            return 4;
+        }
+        b->stitch[0].x = 1.0f;
+        if (a->stitch[0].x != 0.0f) {
+            puts("Array copy shares storage with its source.");
+            return 5;
+        }
+        emb_array_free(b);
+    }
+    emb_array_free(a);
+
+    /* Truncating below zero empties the array, point lists and all. */
+    {
+        EmbArray *g = emb_array_create(EMB_LINE);
+        EmbPolyline line;
+        memset(&line, 0, sizeof(line));
+        for (i = 0; i < 3; i++) {
+            line.pointList = emb_vector_list_create(4);
+            line.flagList = emb_id_list_create(4);
+            emb_array_addPolyline(g, line);
+        }
+        if (!emb_array_truncate(g, -1) || g->count != 0) {
+            puts("Array truncated below zero was not emptied.");
+            return 8;
+        }
+        emb_array_free(g);
+    }
+
+    /* Clones share storage until one of them is written to. */
+    {
+        EmbPattern *p = emb_pattern_create();
+        EmbPattern *clone;
+        for (i = 0; i < 100; i++) {
+            emb_pattern_addStitchAbs(p, i, i, NORMAL, 1);
+        }
+        clone = emb_pattern_clone(p);
+        if (clone->stitch_list->stitch != p->stitch_list->stitch) {
+            puts("Clone copied the stitches eagerly.");
+            return 6;
+        }
+        emb_pattern_flip(clone, 1, 0);
+        emb_pattern_addStitchAbs(p, 200, 200, NORMAL, 1);
+        if (clone->stitch_list->stitch == p->stitch_list->stitch
+            || p->stitch_list->stitch[51].x != 50.0f
+            || clone->stitch_list->stitch[51].x != -50.0f
+            || clone->stitch_list->count + 1 != p->stitch_list->count) {
+            puts("Clone and source were not separated on write.");
+            return 7;
+        }
+        emb_pattern_free(p);
+        emb_pattern_addStitchAbs(clone, 1, 1, NORMAL, 1);
+        emb_pattern_free(clone);
+    }
+    return 0;
+}
@@ -0,0 +1,165 @@
+/* Testing that a batch converts each file as convert() does alone,
+ * whatever the limits on its stages, and that its shards split the files
+ * between them.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/stat.h>
+
+#include "../src/embroidery.h"
+
+#define DIRECTORY "batch_test"
+#define FILES 9
+#define SHARDS 4
+
+int same_contents(const char *a, const char *b);
+int check_outputs(const char **extensions);
+
+int
+main(void)
+{
+    const int formats[3] = {EMB_FORMAT_PES, EMB_FORMAT_EXP, EMB_FORMAT_HUS};
+    const char *extensions[3] = {"pes", "exp", "hus"};
+    char *paths[1] = {DIRECTORY};
+    char input[100];
+    EmbBatchOptions options;
+    EmbBatchReport report;
+    EmbPattern *p;
+    FILE *f;
+    int i, j, files;
+
+    mkdir(DIRECTORY, 0755);
+    for (i = 0; i < FILES; i++) {
+        p = emb_pattern_create();
+        emb_pattern_addThread(p, black_thread);
+        emb_pattern_addThread(p, black_thread);
+        for (j = 0; j < 500 * (i + 1); j++) {
+            emb_pattern_addStitchAbs(p, 10 + (i + 1) * sin(j * 0.1), j * 0.02,
+                (j == 200) ? STOP : NORMAL, 1);
+        }
+        emb_pattern_end(p);
+        sprintf(input, DIRECTORY "/design%d.%s", i, extensions[i % 3]);
+        if (!emb_pattern_write(p, input, formats[i % 3])) {
+            return 1;
+        }
+        emb_pattern_free(p);
+    }
+    /* Files that are not designs are left alone. */
+    f = fopen(DIRECTORY "/notes.md", "w");
+    if (f) {
+        fputs("Not a design.\n", f);
+        fclose(f);
+    }
+
+    if (!emb_convert_batch(paths, 1, EMB_FORMAT_DST, 4, 0, 1, &report)) {
+        return 2;
+    }
+    if (report.files != FILES || report.failed || report.stitches <= 0) {
+        printf("Converted %d files with %d failures and %ld stitches.\n",
+            report.files, report.failed, report.stitches);
+        return 3;
+    }
+    if (!check_outputs(extensions)) {
+        return 4;
+    }
+
+    /* One file at a time in each stage, with no room to queue more. */
+    emb_batch_options_init(&options);
+    options.jobs = 4;
+    options.queue_size = 1;
+    for (i = 0; i < EMB_STAGES; i++) {
+        options.stage_jobs[i] = 1 + i % 2;
+    }
+    if (!emb_convert_batch_options(paths, 1, EMB_FORMAT_DST, &options,
+        &report)) {
+        return 5;
+    }
+    for (i = 0; i < EMB_STAGES; i++) {
+        if (report.stage[i].files != FILES || report.stage[i].max_depth > 1) {
+            printf("The %d stage saw %d files and queued %d.\n", i,
+                report.stage[i].files, report.stage[i].max_depth);
+            return 6;
+        }
+    }
+    if (!check_outputs(extensions)) {
+        return 7;
+    }
+
+    /* Reading the files a group at a time converts them the same. */
+    emb_batch_options_init(&options);
+    options.jobs = 3;
+    options.loader = EMB_LOADER_IO_URING;
+    if (!emb_convert_batch_options(paths, 1, EMB_FORMAT_DST, &options,
+        &report) || report.stage[EMB_STAGE_PREFETCH].files != FILES) {
+        return 11;
+    }
+    if (!check_outputs(extensions)) {
+        return 12;
+    }
+
+    /* Every file is in exactly one shard. */
+    emb_verbose = -1;
+    files = 0;
+    for (i = 0; i < SHARDS; i++) {
+        if (!emb_convert_batch(paths, 1, EMB_FORMAT_DST, 2, i, SHARDS,
+            &report)) {
+            return 8;
+        }
+        if (report.files != (FILES - i + SHARDS - 1) / SHARDS) {
+            printf("Shard %d has %d files.\n", i, report.files);
+            return 9;
+        }
+        files += report.files;
+    }
+    if (files != FILES
+        || emb_convert_batch(paths, 1, EMB_FORMAT_DST, 1, SHARDS, SHARDS, 0)) {
+        return 10;
+    }
+    emb_verbose = 0;
+    return 0;
+}
+
+/* Returns 1 if each output of the batch matches convert() alone. */
+int
+check_outputs(const char **extensions)
+{
+    char input[100], output[100];
+    int i;
+    for (i = 0; i < FILES; i++) {
+        sprintf(input, DIRECTORY "/design%d.%s", i, extensions[i % 3]);
+        sprintf(output, DIRECTORY "/design%d.dst", i);
+        if (convert(input, "batch_serial.dst")) {
+            return 0;
+        }
+        if (!same_contents(output, "batch_serial.dst")) {
+            printf("%s differs from the serial conversion.\n", output);
+            return 0;
+        }
+        remove(output);
+    }
+    return 1;
+}
+
+/* Returns 1 if the files a a and a b hold the same bytes. */
+int
+same_contents(const char *a, const char *b)
+{
+    FILE *fa = fopen(a, "rb");
+    FILE *fb = fopen(b, "rb");
+    int ca = 0, cb = 0;
+    if (fa && fb) {
+        do {
+            ca = fgetc(fa);
+            cb = fgetc(fb);
+        } while (ca == cb && ca != EOF);
+    }
+    if (fa) {
+        fclose(fa);
+    }
+    if (fb) {
+        fclose(fb);
+    }
+    return fa && fb && ca == cb;
+}
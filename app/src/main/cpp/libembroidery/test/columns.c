@@ -0,0 +1,113 @@
+/* Testing the columnar stitch kernels against the stitch list versions. */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/embroidery.h"
+
+int
+main(void)
+{
+    int i, real = 0;
+    double length = 0.0, longest = 0.0;
+    EmbRect r;
+    EmbStitchColumns c;
+    EmbPattern *p = emb_pattern_create();
+    EmbArray *sts = p->stitch_list;
+    const int flags[] = {NORMAL, NORMAL, NORMAL, JUMP, NORMAL, TRIM, STOP};
+    float min_x = 1.0e10, min_y = 1.0e10, max_x = -1.0e10, max_y = -1.0e10;
+
+    srand(7);
+    for (i = 0; i < 1003; i++) {
+        EmbStitch st;
+        st.x = (rand() % 2000) / 10.0f - 100.0f;
+        st.y = (rand() % 2000) / 10.0f - 100.0f;
+        st.flags = flags[rand() % 7];
+        st.color = i / 100;
+        emb_array_addStitch(sts, st);
+        if (i > 0 && st.flags == NORMAL) {
+            EmbStitch prev = sts->stitch[i-1];
+            double d = sqrt((st.x - prev.x)*(st.x - prev.x)
+                + (st.y - prev.y)*(st.y - prev.y));
+            length += d;
+            if (prev.flags == NORMAL) {
+                longest = EMB_MAX(longest, d);
+            }
+        }
+        if (!(st.flags & (JUMP | TRIM | END))) {
+            real++;
+        }
+        if (!(st.flags & TRIM)) {
+            min_x = EMB_MIN(min_x, st.x);
+            min_y = EMB_MIN(min_y, st.y);
+            max_x = EMB_MAX(max_x, st.x);
+            max_y = EMB_MAX(max_y, st.y);
+        }
+    }
+
+    memset(&c, 0, sizeof(EmbStitchColumns));
+    if (!emb_stitch_columns_load(&c, sts)) {
+        puts("Failed to load the columns.");
+        return 1;
+    }
+    for (i = 0; i < sts->count; i++) {
+        EmbStitch st = emb_stitch_columns_get(&c, i);
+        if (memcmp(&st, sts->stitch + i, sizeof(EmbStitch))) {
+            printf("Stitch %d differs after loading.\n", i);
+            return 2;
+        }
+    }
+
+    r = emb_stitch_columns_bounds(&c);
+    if (r.x != min_x || r.y != min_y
+        || r.w != max_x - min_x || r.h != max_y - min_y) {
+        puts("Bounds do not match.");
+        return 3;
+    }
+    if (fabs(emb_stitch_columns_length(&c) - length) > 1.0e-4 * length
+        || fabs(emb_total_thread_length(p) - length) > 1.0e-4 * length) {
+        printf("Length %f does not match %f.\n",
+            emb_stitch_columns_length(&c), length);
+        return 4;
+    }
+    if (fabs(emb_stitch_columns_longest(&c) - longest) > 1.0e-3
+        || fabs(emb_pattern_longest_stitch(p) - longest) > 1.0e-3) {
+        puts("Longest stitch does not match.");
+        return 5;
+    }
+    if (emb_stitch_columns_count(&c, TRIM | STOP)
+        != emb_pattern_count_type(p, TRIM | STOP)) {
+        puts("Stitch counts do not match.");
+        return 6;
+    }
+    if (c.count - emb_stitch_columns_count(&c, JUMP | TRIM | END) != real
+        || emb_pattern_realStitches(p) != real) {
+        puts("Real stitch counts do not match.");
+        return 7;
+    }
+    /* emb_pattern_bounds() keeps its layout of the largest x and y in
+     * x and y. */
+    r = emb_pattern_bounds(p);
+    if (r.x != max_x || r.y != max_y
+        || r.w != min_x - max_x || r.h != min_y - max_y) {
+        puts("Pattern bounds do not match.");
+        return 10;
+    }
+
+    emb_stitch_columns_transform(&c, 2.0, -1.0, 10.0, 5.0);
+    if (!emb_stitch_columns_store(&c, sts)) {
+        puts("Failed to store the columns.");
+        return 8;
+    }
+    if (sts->stitch[1002].x != c.x[1002]
+        || sts->stitch[1002].y != c.y[1002]
+        || sts->stitch[1002].color != 10) {
+        puts("Transformed stitches were not stored.");
+        return 9;
+    }
+
+    emb_stitch_columns_free(&c);
+    emb_pattern_free(p);
+    return 0;
+}
@@ -0,0 +1,69 @@
+/* Testing the N-way combination of patterns and its thread merging. */
+
+#include "../src/embroidery.h"
+
+int
+main(void)
+{
+    int i;
+    EmbPattern *patterns[3];
+    EmbPattern *out;
+
+    for (i = 0; i < 3; i++) {
+        patterns[i] = emb_pattern_create();
+        /* Every pattern has black, and the last one adds white. */
+        emb_pattern_addThread(patterns[i], black_thread);
+        emb_pattern_addStitchAbs(patterns[i], i, 0, NORMAL, 0);
+        if (i == 2) {
+            emb_pattern_addThread(patterns[i], jef_colors[2]);
+            emb_pattern_addStitchAbs(patterns[i], i, 1, STOP, 1);
+            emb_pattern_addStitchAbs(patterns[i], i, 2, NORMAL, 0);
+        }
+        emb_pattern_end(patterns[i]);
+    }
+
+    out = emb_pattern_combine_n(patterns, 3,
+        EMB_COMBINE_MERGE_THREADS | EMB_COMBINE_STRIP_ENDS);
+    if (!out) {
+        puts("Failed to combine the patterns.");
+        return 1;
+    }
+    if (out->thread_list->count != 2) {
+        printf("Expected 2 threads after merging, found %d.\n",
+            out->thread_list->count);
+        return 2;
+    }
+    if (out->stitch_list->count != patterns[0]->stitch_list->count
+        + patterns[1]->stitch_list->count
+        + patterns[2]->stitch_list->count - 2) {
+        puts("The END stitches of the first patterns were not dropped.");
+        return 3;
+    }
+    if (out->stitch_list->stitch[out->stitch_list->count - 2].color != 1) {
+        puts("Stitch colors were not remapped.");
+        return 4;
+    }
+    emb_pattern_free(out);
+
+    out = emb_pattern_combine_n(patterns, 3, 0);
+    if (out->thread_list->count != patterns[0]->thread_list->count
+        + patterns[1]->thread_list->count
+        + patterns[2]->thread_list->count) {
+        puts("Threads were merged without EMB_COMBINE_MERGE_THREADS.");
+        return 5;
+    }
+    emb_pattern_free(out);
+
+    out = patterns[1];
+    patterns[1] = 0;
+    if (emb_pattern_combine_n(patterns, 3, 0)) {
+        puts("A null pattern was combined.");
+        return 6;
+    }
+    patterns[1] = out;
+
+    for (i = 0; i < 3; i++) {
+        emb_pattern_free(patterns[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,125 @@
+/* Testing that threads with a context each convert the same as the
+ * default context does alone.
+ */
+
+#include <string.h>
+#include <math.h>
+
+#include "../src/embroidery.h"
+
+#define JOBS 8
+
+typedef struct Job_ {
+    EmbStream *input;
+    int format;
+    EmbStream *expected;
+    int result;
+} Job;
+
+int convert_in(EmbContext *ctx, EmbStream *input, int format, EmbStream *out);
+void run_job(void *data, int index);
+
+int
+main(void)
+{
+    const int formats[2] = {EMB_FORMAT_PES, EMB_FORMAT_HUS};
+    EmbStream *inputs[2], *expected[2];
+    Job jobs[JOBS];
+    EmbContext *a, *b;
+    EmbThread s, t;
+    EmbPattern *p;
+    int i;
+
+    /* Each context draws its own colors. */
+    a = emb_context_create();
+    b = emb_context_create();
+    if (!a || !b) {
+        return 1;
+    }
+    s = emb_context_random_thread(a);
+    emb_get_random_thread();
+    t = emb_context_random_thread(b);
+    if (embColor_distance(s.color, t.color) != 0) {
+        return 2;
+    }
+    emb_context_free(a);
+    emb_context_free(b);
+
+    p = emb_pattern_create();
+    emb_pattern_addThread(p, black_thread);
+    emb_pattern_addThread(p, black_thread);
+    for (i = 0; i < 2000; i++) {
+        emb_pattern_addStitchAbs(p, 10 + 10 * sin(i * 0.1), i * 0.02,
+            (i == 1000) ? STOP : NORMAL, 1);
+    }
+    emb_pattern_end(p);
+    for (i = 0; i < 2; i++) {
+        inputs[i] = emb_stream_buffer(0);
+        expected[i] = emb_stream_buffer(0);
+        if (!emb_pattern_write_stream(p, inputs[i], 0, formats[i])
+            || !convert_in(emb_context_default(), inputs[i], formats[i],
+                expected[i])) {
+            return 3;
+        }
+    }
+    emb_pattern_free(p);
+
+    for (i = 0; i < JOBS; i++) {
+        jobs[i].input = inputs[i % 2];
+        jobs[i].format = formats[i % 2];
+        jobs[i].expected = expected[i % 2];
+        jobs[i].result = 1;
+    }
+    emb_parallel_for(run_job, jobs, JOBS, 4);
+    for (i = 0; i < JOBS; i++) {
+        if (jobs[i].result) {
+            printf("Job %d failed with %d.\n", i, jobs[i].result);
+            return 10 + jobs[i].result;
+        }
+    }
+
+    for (i = 0; i < 2; i++) {
+        emb_stream_close(inputs[i]);
+        emb_stream_close(expected[i]);
+    }
+    return 0;
+}
+
+/* Reads a input in a format and writes it to a out as DST. */
+int
+convert_in(EmbContext *ctx, EmbStream *input, int format, EmbStream *out)
+{
+    int result;
+    EmbPattern *p = emb_pattern_create_context(ctx);
+    if (!p) {
+        return 0;
+    }
+    result = emb_pattern_read_memory(p, input->data, input->length, format)
+        && emb_pattern_write_stream(p, out, 0, EMB_FORMAT_DST);
+    emb_pattern_free(p);
+    return result;
+}
+
+void
+run_job(void *data, int index)
+{
+    Job *job = (Job *)data + index;
+    EmbContext *ctx = emb_context_create();
+    EmbStream *out = emb_stream_buffer(0);
+    if (!ctx || !out) {
+        job->result = 1;
+        return;
+    }
+    if (!convert_in(ctx, job->input, job->format, out)) {
+        job->result = 2;
+    }
+    else if (out->length != job->expected->length
+        || memcmp(out->data, job->expected->data, out->length)) {
+        job->result = 3;
+    }
+    else {
+        job->result = 0;
+    }
+    emb_stream_close(out);
+    emb_context_free(ctx);
+}
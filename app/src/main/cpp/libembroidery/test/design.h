@@ -0,0 +1,32 @@
+/* The design the tests write, read and convert. */
+
+#ifndef EMB_TEST_DESIGN_H__
+#define EMB_TEST_DESIGN_H__
+
+#include <math.h>
+
+#include "../src/embroidery.h"
+
+/* Returns a design of a stitches stitches in two threads, red then
+ * black, changing halfway through.
+ */
+static EmbPattern *
+design(int stitches)
+{
+    EmbThread red = {{255, 0, 0}, "red", "1"};
+    EmbPattern *p = emb_pattern_create();
+    int i;
+    if (!p) {
+        return 0;
+    }
+    emb_pattern_addThread(p, red);
+    emb_pattern_addThread(p, black_thread);
+    for (i = 0; i < stitches; i++) {
+        emb_pattern_addStitchAbs(p, 10 + 10 * sin(i * 0.1),
+            10 + 10 * cos(i * 0.013), (i == stitches / 2) ? STOP : NORMAL, 1);
+    }
+    emb_pattern_end(p);
+    return p;
+}
+
+#endif
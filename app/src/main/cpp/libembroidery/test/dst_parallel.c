@@ -0,0 +1,113 @@
+/* Testing the parallel DST decode against the record by record one. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../src/embroidery.h"
+
+#define RECORDS 300000
+
+int read_serial(EmbPattern *p, const unsigned char *data, size_t length);
+
+int
+main(void)
+{
+    unsigned char *data, *b;
+    long *ex, *ey, x = 0, y = 0;
+    size_t length = 512 + 3 * (RECORDS + 10);
+    EmbPattern *p = emb_pattern_create();
+    EmbPattern *q = emb_pattern_create();
+    int i;
+
+    data = (unsigned char *)malloc(length);
+    ex = (long *)malloc(RECORDS * sizeof(long));
+    ey = (long *)malloc(RECORDS * sizeof(long));
+    if (!data || !ex || !ey) {
+        return 1;
+    }
+    memset(data, ' ', 512);
+    memcpy(data, "LA:Test\r", 8);
+    b = data + 512;
+    /* Color changes ahead of the first stitch are dropped. */
+    for (i = 0; i < 3; i++) {
+        encode_tajima_ternary(b, 5, -5);
+        b[2] |= 0xC3;
+        b += 3;
+    }
+    srand(2);
+    for (i = 0; i < RECORDS; i++) {
+        int dx = rand() % 243 - 121, dy = rand() % 243 - 121;
+        x += dx;
+        y += dy;
+        ex[i] = x;
+        ey[i] = y;
+        encode_tajima_ternary(b, dx, dy);
+        b[2] |= 0x03;
+        if (i % 5000 == 4999) {
+            b[2] |= 0xC3;
+        }
+        else if (i % 77 == 76) {
+            b[2] |= 0x83;
+        }
+        b += 3;
+    }
+    /* The END stops the decode, whatever follows it. */
+    b[0] = 0;
+    b[1] = 0;
+    b[2] = 0xF3;
+    b += 3;
+    memset(b, 0x11, data + length - b);
+
+    if (!emb_pattern_read_memory(p, data, length, EMB_FORMAT_DST)
+        || !read_serial(q, data, length)) {
+        return 2;
+    }
+    if (p->stitch_list->count != q->stitch_list->count
+        || p->stitch_list->count != RECORDS + 2) {
+        printf("Read %d stitches in parallel and %d serially.\n",
+            p->stitch_list->count, q->stitch_list->count);
+        return 3;
+    }
+    /* Adding up each move drifts a little, the parallel sums do not. */
+    for (i = 0; i < p->stitch_list->count; i++) {
+        EmbStitch s = p->stitch_list->stitch[i];
+        EmbStitch t = q->stitch_list->stitch[i];
+        if (i > 0 && i <= RECORDS && (fabs(s.x - ex[i-1] / 10.0) > 0.001
+            || fabs(s.y - ey[i-1] / 10.0) > 0.001)) {
+            printf("Stitch %d is at %f %f.\n", i, s.x, s.y);
+            return 4;
+        }
+        if (s.flags != t.flags || s.color != t.color
+            || fabs(s.x - t.x) > 0.5 || fabs(s.y - t.y) > 0.5) {
+            printf("Stitch %d differs: %f %f %d %d against %f %f %d %d.\n",
+                i, s.x, s.y, s.flags, s.color, t.x, t.y, t.flags, t.color);
+            return 4;
+        }
+    }
+    if (p->thread_list->count != q->thread_list->count) {
+        return 5;
+    }
+
+    safe_free(data);
+    safe_free(ex);
+    safe_free(ey);
+    emb_pattern_free(p);
+    emb_pattern_free(q);
+    return 0;
+}
+
+/* Decodes one record at a time, as small files are. */
+int
+read_serial(EmbPattern *p, const unsigned char *data, size_t length)
+{
+    EmbStream *file = emb_stream_memory(data, length);
+    if (!file || !dstReadHeader(p, file)) {
+        return 0;
+    }
+    while (dstReadRecord(p, file)) {
+    }
+    emb_pattern_end(p);
+    emb_stream_close(file);
+    return 1;
+}
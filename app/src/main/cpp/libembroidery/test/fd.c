@@ -0,0 +1,93 @@
+/* Testing reading and writing through file descriptors. */
+
+#include "../src/embroidery.h"
+#include "design.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+
+int
+main(void)
+{
+    int fds[2], fd;
+    EmbPattern *p = design(200);
+    EmbPattern *q = design(200);
+    EmbPattern *r = design(200);
+    EmbPattern *from_pipe = emb_pattern_create();
+    EmbPattern *from_fd = emb_pattern_create();
+    EmbPattern *from_file = emb_pattern_create();
+
+    /* DST patches its header after the stitches, which a pipe cannot
+     * seek back to, so this also checks that output is gathered first. */
+    if (pipe(fds)) {
+        return 1;
+    }
+    if (!emb_pattern_write_fd(p, fds[1], EMB_FORMAT_DST)) {
+        return 2;
+    }
+    close(fds[1]);
+    if (!emb_pattern_read_fd(from_pipe, fds[0], EMB_FORMAT_DST)) {
+        return 3;
+    }
+    close(fds[0]);
+    if (!emb_pattern_write(q, "fd_test.dst", EMB_FORMAT_DST)
+        || !emb_pattern_read(from_file, "fd_test.dst", EMB_FORMAT_DST)) {
+        return 4;
+    }
+    if (from_pipe->stitch_list->count != from_file->stitch_list->count) {
+        printf("Read %d stitches from a pipe and %d from a file.\n",
+            from_pipe->stitch_list->count, from_file->stitch_list->count);
+        return 4;
+    }
+    emb_pattern_reset(from_file);
+
+    fd = open("fd_test.pes", O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (fd < 0) {
+        return 5;
+    }
+    if (!emb_pattern_write_fd(r, fd, EMB_FORMAT_PES)) {
+        return 6;
+    }
+    close(fd);
+    fd = open("fd_test.pes", O_RDONLY);
+    if (fd < 0 || !emb_pattern_read_fd(from_fd, fd, EMB_FORMAT_PES)) {
+        return 7;
+    }
+    close(fd);
+    if (!emb_pattern_read(from_file, "fd_test.pes", EMB_FORMAT_PES)) {
+        return 8;
+    }
+    if (from_fd->stitch_list->count != from_file->stitch_list->count) {
+        return 9;
+    }
+
+    /* A probe through a descriptor agrees with one by name. */
+    {
+        EmbProbe by_fd, by_name;
+        fd = open("fd_test.pes", O_RDONLY);
+        if (fd < 0 || !emb_pattern_probe_fd(fd, EMB_FORMAT_PES, &by_fd)
+            || !emb_pattern_probe("fd_test.pes", &by_name)
+            || by_fd.stitches != by_name.stitches
+            || by_fd.colors != by_name.colors
+            || by_fd.max_x != by_name.max_x) {
+            return 10;
+        }
+        close(fd);
+    }
+
+    emb_pattern_free(p);
+    emb_pattern_free(q);
+    emb_pattern_free(r);
+    emb_pattern_free(from_pipe);
+    emb_pattern_free(from_fd);
+    emb_pattern_free(from_file);
+    return 0;
+}
+#else
+int
+main(void)
+{
+    return 0;
+}
+#endif
@@ -0,0 +1,266 @@
+/* Testing that reads and writes stop at the limits of their context, say
+ * why, and leave designs within them alone.
+ */
+
+#include <string.h>
+#include <math.h>
+
+#include "../src/embroidery.h"
+#include "design.h"
+
+#define SHARED_READS 200
+
+typedef struct Shared_ {
+    EmbStream *input[2];
+    int expected[2];
+    int unexpected[2];
+} Shared;
+
+#define CANCEL_READS 10000
+
+typedef struct Cancel_ {
+    EmbStream *input;
+    EmbContext *context;
+    int cancel;
+    int reads;             /*! finished, before the one cancelled */
+    int stopped;
+    int stitches;          /*! read by the one cancelled */
+} Cancel;
+
+EmbStream *design_stream(int stitches, int format);
+int read_stopped(EmbContext *ctx, EmbStream *stream, int format);
+void read_shared(void *data, int index);
+void read_cancelled(void *data, int index);
+
+int
+main(void)
+{
+    const int formats[3] = {EMB_FORMAT_DST, EMB_FORMAT_EXP, EMB_FORMAT_PEC};
+    unsigned char hus[64];
+    EmbStream *stream, *out;
+    EmbContext *ctx;
+    EmbPattern *p;
+    Shared shared;
+    Cancel c;
+    int i, cancel = 0;
+
+    ctx = emb_context_create();
+    if (!ctx) {
+        return 1;
+    }
+    /* A design as large as the parallel DST decoder takes, and smaller
+     * ones through the batched readers. */
+    for (i = 0; i < 3; i++) {
+        stream = design_stream(i ? 20000 : 100000, formats[i]);
+        if (!stream) {
+            return 2;
+        }
+        emb_limits_init(&ctx->limits);
+        if (read_stopped(ctx, stream, formats[i]) != EMB_LIMIT_NONE) {
+            return 3;
+        }
+        ctx->limits.max_stitches = 5000;
+        if (read_stopped(ctx, stream, formats[i]) != EMB_LIMIT_STITCHES) {
+            printf("Format %d was not stopped at the stitch limit.\n",
+                formats[i]);
+            return 4;
+        }
+        emb_limits_init(&ctx->limits);
+        ctx->limits.max_bytes = 10000;
+        if (read_stopped(ctx, stream, formats[i]) != EMB_LIMIT_BYTES) {
+            return 5;
+        }
+        emb_limits_init(&ctx->limits);
+        ctx->limits.max_seconds = 1e-9;
+        ctx->limits.check_every = 1;
+        if (read_stopped(ctx, stream, formats[i]) != EMB_LIMIT_TIME) {
+            return 6;
+        }
+        emb_limits_init(&ctx->limits);
+        ctx->limits.cancel = &cancel;
+        cancel = 1;
+        if (read_stopped(ctx, stream, formats[i]) != EMB_LIMIT_CANCELLED) {
+            return 7;
+        }
+        cancel = 0;
+        emb_stream_close(stream);
+    }
+
+    /* A header claiming more stitches than allowed is refused before
+     * anything is allocated for them. */
+    memset(hus, 0, sizeof(hus));
+    emb_put_u32(hus, 0x00C8AF5B);
+    emb_put_u32(hus + 4, 0x7FFFFFFF);
+    emb_put_u32(hus + 20, 42);
+    emb_put_u32(hus + 24, 50);
+    emb_put_u32(hus + 28, 60);
+    stream = emb_stream_memory(hus, sizeof(hus));
+    emb_limits_init(&ctx->limits);
+    if (read_stopped(ctx, stream, EMB_FORMAT_HUS) != EMB_LIMIT_STITCHES) {
+        return 8;
+    }
+    emb_stream_close(stream);
+
+    /* Writes are held to the same limits. */
+    p = emb_pattern_create_context(ctx);
+    for (i = 0; i < 20000; i++) {
+        emb_pattern_addStitchAbs(p, 10 * sin(i * 0.1), i * 0.01, NORMAL, 1);
+    }
+    ctx->limits.max_stitches = 1000;
+    out = emb_stream_buffer(0);
+    if (emb_pattern_write_stream(p, out, 0, EMB_FORMAT_EXP)
+        || p->stopped != EMB_LIMIT_STITCHES) {
+        return 9;
+    }
+    emb_stream_close(out);
+    emb_limits_init(&ctx->limits);
+    ctx->limits.max_bytes = 1000000;
+    out = emb_stream_buffer(0);
+    if (emb_pattern_write_stream(p, out, 0, EMB_FORMAT_CSV)
+        || p->stopped != EMB_LIMIT_BYTES || out->length > 1000000) {
+        return 10;
+    }
+    emb_stream_close(out);
+    emb_limits_init(&ctx->limits);
+    out = emb_stream_buffer(0);
+    if (!emb_pattern_write_stream(p, out, 0, EMB_FORMAT_EXP)
+        || p->stopped != EMB_LIMIT_NONE) {
+        return 11;
+    }
+    emb_pattern_free(p);
+
+    /* As is transcoding, which never holds the whole design. */
+    stream = emb_stream_buffer(0);
+    emb_fseek(out, 0, SEEK_SET);
+    ctx->limits.max_stitches = 5000;
+    if (emb_transcode_stitches_context(ctx, out, 0, EMB_FORMAT_EXP, stream,
+            EMB_FORMAT_DST)
+        || out->stopped != EMB_LIMIT_STITCHES) {
+        return 12;
+    }
+    emb_stream_close(stream);
+    emb_stream_close(out);
+    emb_context_free(ctx);
+
+    /* Patterns sharing a context are each held to the limits alone, one
+     * stopping does not stop the other. */
+    shared.input[0] = design_stream(20000, EMB_FORMAT_EXP);
+    shared.input[1] = design_stream(9000, EMB_FORMAT_EXP);
+    shared.expected[0] = EMB_LIMIT_STITCHES;
+    shared.expected[1] = EMB_LIMIT_NONE;
+    emb_context_default()->limits.max_stitches = 10000;
+    emb_parallel_for(read_shared, &shared, 2, 2);
+    emb_limits_init(&emb_context_default()->limits);
+    if (shared.unexpected[0] || shared.unexpected[1]) {
+        printf("%d and %d of %d reads stopped unexpectedly.\n",
+            shared.unexpected[0], shared.unexpected[1], SHARED_READS);
+        return 13;
+    }
+    emb_stream_close(shared.input[0]);
+    emb_stream_close(shared.input[1]);
+
+    /* Cancelling from another thread stops a read under way. */
+    c.input = design_stream(100000, EMB_FORMAT_EXP);
+    c.context = emb_context_create();
+    c.context->limits.cancel = &c.cancel;
+    c.cancel = 0;
+    c.reads = 0;
+    c.stopped = EMB_LIMIT_NONE;
+    emb_parallel_for(read_cancelled, &c, 2, 2);
+    if (c.stopped != EMB_LIMIT_CANCELLED || c.reads < 2
+        || c.stitches >= 100000) {
+        printf("Read %d designs then %d stitches, stopped %d.\n",
+            c.reads, c.stitches, c.stopped);
+        return 14;
+    }
+    emb_stream_close(c.input);
+    emb_context_free(c.context);
+    return 0;
+}
+
+/* Reads the input of a data until a read is cancelled, as index 0, and
+ * cancels the reads once two have finished, as index 1.
+ */
+void
+read_cancelled(void *data, int index)
+{
+    Cancel *c = (Cancel*)data;
+    int i;
+    if (index == 1) {
+        while (__atomic_load_n(&c->reads, __ATOMIC_ACQUIRE) < 2) {
+        }
+        __atomic_store_n(&c->cancel, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    for (i = 0; i < CANCEL_READS && c->stopped == EMB_LIMIT_NONE; i++) {
+        EmbPattern *p = emb_pattern_create_context(c->context);
+        emb_pattern_read_memory(p, c->input->data, c->input->length,
+            EMB_FORMAT_EXP);
+        c->stopped = p->stopped;
+        c->stitches = p->stitch_list->count;
+        if (c->stopped == EMB_LIMIT_NONE) {
+            __atomic_add_fetch(&c->reads, 1, __ATOMIC_RELEASE);
+        }
+        emb_pattern_free(p);
+    }
+}
+
+/* Reads an input of a shared over and over with the default context,
+ * counting the reads that do not stop as expected.
+ */
+void
+read_shared(void *data, int index)
+{
+    Shared *shared = (Shared*)data;
+    EmbStream *stream = shared->input[index];
+    int i;
+    shared->unexpected[index] = 0;
+    for (i = 0; i < SHARED_READS; i++) {
+        EmbPattern *p = emb_pattern_create();
+        emb_pattern_read_memory(p, stream->data, stream->length,
+            EMB_FORMAT_EXP);
+        if (p->stopped != shared->expected[index]) {
+            shared->unexpected[index]++;
+        }
+        emb_pattern_free(p);
+    }
+}
+
+/* Returns a stream holding a design of a stitches stitches in a format. */
+EmbStream *
+design_stream(int stitches, int format)
+{
+    EmbPattern *p = design(stitches);
+    EmbStream *stream = emb_stream_buffer(0);
+    if (!emb_pattern_write_stream(p, stream, 0, format)) {
+        emb_stream_close(stream);
+        stream = 0;
+    }
+    emb_pattern_free(p);
+    return stream;
+}
+
+/* Reads a stream in a format with a ctx, returning why it stopped or
+ * EMB_LIMIT_NONE if it did not; -1 if it failed for another reason.
+ */
+int
+read_stopped(EmbContext *ctx, EmbStream *stream, int format)
+{
+    EmbPattern *p = emb_pattern_create_context(ctx);
+    int result, stopped;
+    if (!p) {
+        return -1;
+    }
+    result = emb_pattern_read_memory(p, stream->data, stream->length, format);
+    stopped = p->stopped;
+    if (result == (stopped != EMB_LIMIT_NONE)
+        || (ctx->limits.max_stitches > 0
+            && p->stitch_list->count > ctx->limits.max_stitches + 1)) {
+        printf("Read %d stitches of format %d, result %d, stopped %d.\n",
+            p->stitch_list->count, format, result, stopped);
+        emb_pattern_free(p);
+        return -1;
+    }
+    emb_pattern_free(p);
+    return stopped;
+}
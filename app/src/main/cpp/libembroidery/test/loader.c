@@ -0,0 +1,91 @@
+/* Testing that each kind of loader reads files as stdio does, including
+ * files larger than a buffer and files that are missing.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/embroidery.h"
+
+#define FILES 40
+
+int
+main(void)
+{
+    const int kinds[3] = {EMB_LOADER_MAP, EMB_LOADER_PREAD, EMB_LOADER_IO_URING};
+    char *names[FILES];
+    size_t sizes[FILES];
+    EmbStream *streams[FILES];
+    unsigned char *data;
+    int i, j, k;
+
+    data = (unsigned char *)malloc(3 * EMB_LOADER_BUFFER_SIZE);
+    if (!data) {
+        return 1;
+    }
+    srand(3);
+    for (i = 0; i < 3 * EMB_LOADER_BUFFER_SIZE; i++) {
+        data[i] = (unsigned char)rand();
+    }
+    for (i = 0; i < FILES; i++) {
+        FILE *f;
+        names[i] = (char *)malloc(32);
+        sprintf(names[i], "loader_test_%d.bin", i);
+        sizes[i] = (size_t)(i * 997);
+        if (i == 7) {
+            sizes[i] = EMB_LOADER_BUFFER_SIZE;
+        }
+        else if (i == 8) {
+            sizes[i] = 3 * EMB_LOADER_BUFFER_SIZE - 5;
+        }
+        if (i == 9) {
+            remove(names[i]);
+            continue;
+        }
+        f = fopen(names[i], "wb");
+        if (!f || fwrite(data, 1, sizes[i], f) != sizes[i]) {
+            return 2;
+        }
+        fclose(f);
+    }
+
+    for (k = 0; k < 3; k++) {
+        EmbLoader *loader = emb_loader_create(kinds[k]);
+        if (!loader) {
+            return 3;
+        }
+        printf("Loading with kind %d as kind %d.\n", kinds[k],
+            emb_loader_kind(loader));
+        if (emb_loader_load(loader, names, FILES, streams) != FILES - 1) {
+            return 4;
+        }
+        for (i = 0; i < FILES; i++) {
+            if (i == 9) {
+                if (streams[i]) {
+                    return 5;
+                }
+                continue;
+            }
+            if (!streams[i] || streams[i]->length != sizes[i]
+                || memcmp(streams[i]->data, data, sizes[i])) {
+                printf("File %d of %d bytes differs.\n", i, (int)sizes[i]);
+                return 6;
+            }
+            /* The readers decode from the start of the stream. */
+            for (j = 0; j < 3 && (size_t)j < sizes[i]; j++) {
+                if (emb_fgetc(streams[i]) != data[j]) {
+                    return 7;
+                }
+            }
+            emb_stream_close(streams[i]);
+        }
+        emb_loader_free(loader);
+    }
+
+    for (i = 0; i < FILES; i++) {
+        remove(names[i]);
+        safe_free(names[i]);
+    }
+    safe_free(data);
+    return 0;
+}
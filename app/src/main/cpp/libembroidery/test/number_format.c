@@ -0,0 +1,49 @@
+/* Testing the number formatting used by the text writers. */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/embroidery.h"
+
+int
+main(void)
+{
+    char buf[EMB_NUMBER_LENGTH], expected[64];
+    const double fixed[] = {0.0, -0.04, 0.05, 1.25, -2.5, 999999.95, 12.345};
+    int i, places;
+
+    for (i = 0; i < 7; i++) {
+        for (places = 0; places < 4; places++) {
+            emb_format_fixed(buf, fixed[i], places);
+            snprintf(expected, sizeof(expected), "%.*f", places, fixed[i]);
+            if (strcmp(buf, expected)) {
+                printf("Wrote %s rather than %s.\n", buf, expected);
+                return 1;
+            }
+        }
+    }
+
+    emb_format_real(buf, 1.5f);
+    if (strcmp(buf, "1.5")) {
+        return 2;
+    }
+    emb_format_real(buf, -20.0f);
+    if (strcmp(buf, "-20")) {
+        return 3;
+    }
+    srand(1);
+    for (i = 0; i < 100000; i++) {
+        EmbReal value = (EmbReal)(rand() - RAND_MAX / 2) / 1000.0f;
+        emb_format_real(buf, value);
+        if ((EmbReal)strtod(buf, 0) != value) {
+            printf("%s does not read back as %.9g.\n", buf, value);
+            return 4;
+        }
+    }
+
+    emb_format_int(buf, -1234567);
+    if (strcmp(buf, "-1234567")) {
+        return 5;
+    }
+    return 0;
+}
@@ -0,0 +1,145 @@
+/* Testing that a probe reads the counts and extents from the headers
+ * that have them, and otherwise finds what a full read would.
+ */
+
+#include <string.h>
+#include <math.h>
+
+#include "../src/embroidery.h"
+#include "design.h"
+
+int same_as_read(EmbStream *stream, int format, int source, int colors);
+int expect(const EmbProbe *probe, int source, int stitches, int colors,
+    EmbReal min_x, EmbReal min_y, EmbReal max_x, EmbReal max_y);
+
+int
+main(void)
+{
+    const int formats[4] = {EMB_FORMAT_EXP, EMB_FORMAT_PEC, EMB_FORMAT_PES,
+        EMB_FORMAT_CSV};
+    const int sources[4] = {EMB_PROBE_SCAN, EMB_PROBE_SCAN, EMB_PROBE_SCAN,
+        EMB_PROBE_DECODE};
+    const char *dst = "LA:a:b ST:1    \rST:    100\rCO:  2\r"
+        "+X:  150\r-X:   50\r+Y:  200\r-Y:   30\r";
+    unsigned char header[512 + 3];
+    EmbStream *stream;
+    EmbPattern *p;
+    EmbProbe probe;
+    int i;
+
+    /* A DST header has it all, labels with colons or not. */
+    memset(header, ' ', sizeof(header));
+    memcpy(header, dst, strlen(dst));
+    memcpy(header + 512, "\0\0\xF3", 3);
+    if (!emb_pattern_probe_memory(header, sizeof(header), EMB_FORMAT_DST,
+            &probe)
+        || !expect(&probe, EMB_PROBE_HEADER, 100, 3, -5.0, -3.0, 15.0, 20.0)) {
+        return 1;
+    }
+
+    /* So do the HUS and JEF headers. */
+    memset(header, 0, sizeof(header));
+    emb_put_u32(header, 0x00C8AF5B);
+    emb_put_u32(header + 4, 1000);
+    emb_put_u32(header + 8, 4);
+    emb_put_u32(header + 12, (120 << 16) | 250);
+    emb_put_u32(header + 16,
+        ((uint32_t)(-80 & 0xFFFF) << 16) | (-250 & 0xFFFF));
+    if (!emb_pattern_probe_memory(header, 20, EMB_FORMAT_HUS, &probe)
+        || !expect(&probe, EMB_PROBE_HEADER, 1000, 4, -25.0, -12.0, 25.0, 8.0)) {
+        return 2;
+    }
+    memset(header, 0, sizeof(header));
+    emb_put_u32(header + 0x18, 5);
+    emb_put_u32(header + 0x1C, 777);
+    emb_put_u32(header + 0x24, 300);
+    emb_put_u32(header + 0x28, 200);
+    emb_put_u32(header + 0x2C, 300);
+    emb_put_u32(header + 0x30, 100);
+    if (!emb_pattern_probe_memory(header, 0x34, EMB_FORMAT_JEF, &probe)
+        || !expect(&probe, EMB_PROBE_HEADER, 777, 5, -30.0, -10.0, 30.0, 20.0)) {
+        return 3;
+    }
+
+    p = design(3000);
+
+    /* A DST file whose header lost its fields is counted instead. */
+    stream = emb_stream_buffer(0);
+    if (!emb_pattern_write_stream(p, stream, 0, EMB_FORMAT_DST)) {
+        return 6;
+    }
+    memset(stream->data, ' ', 512);
+    if (!same_as_read(stream, EMB_FORMAT_DST, EMB_PROBE_SCAN, 2)) {
+        return 7;
+    }
+    emb_stream_close(stream);
+
+    /* As are formats without the counts in their header. */
+    for (i = 0; i < 4; i++) {
+        stream = emb_stream_buffer(0);
+        if (!emb_pattern_write_stream(p, stream, 0, formats[i])) {
+            return 4;
+        }
+        if (!same_as_read(stream, formats[i], sources[i], 2)) {
+            printf("Probing format %d differs from reading it.\n", formats[i]);
+            return 5;
+        }
+        emb_stream_close(stream);
+    }
+    emb_pattern_free(p);
+    return 0;
+}
+
+/* Returns 1 if a probe of a stream in a format comes from a source, finds
+ * a colors colors and matches the stitches read from it.
+ */
+int
+same_as_read(EmbStream *stream, int format, int source, int colors)
+{
+    EmbProbe probe;
+    EmbPattern *p;
+    EmbReal min_x, min_y, max_x, max_y;
+    int i, result;
+
+    p = emb_pattern_create();
+    if (!p || !emb_pattern_read_memory(p, stream->data, stream->length, format)
+        || !emb_pattern_probe_memory(stream->data, stream->length, format,
+            &probe)) {
+        return 0;
+    }
+    min_x = max_x = p->stitch_list->stitch[0].x;
+    min_y = max_y = p->stitch_list->stitch[0].y;
+    for (i = 1; i < p->stitch_list->count; i++) {
+        EmbStitch st = p->stitch_list->stitch[i];
+        min_x = EMB_MIN(min_x, st.x);
+        min_y = EMB_MIN(min_y, st.y);
+        max_x = EMB_MAX(max_x, st.x);
+        max_y = EMB_MAX(max_y, st.y);
+    }
+    result = expect(&probe, source, p->stitch_list->count, colors,
+        min_x, min_y, max_x, max_y);
+    emb_pattern_free(p);
+    return result;
+}
+
+/* Returns 1 if a probe holds what is expected of it. A read sums the
+ * moves of the stitches as EmbReal, so its extents drift a little from
+ * those a probe counts exactly.
+ */
+int
+expect(const EmbProbe *probe, int source, int stitches, int colors,
+    EmbReal min_x, EmbReal min_y, EmbReal max_x, EmbReal max_y)
+{
+    if (probe->source != source || probe->stitches != stitches
+        || probe->colors != colors
+        || fabs(probe->min_x - min_x) > 0.5 || fabs(probe->min_y - min_y) > 0.5
+        || fabs(probe->max_x - max_x) > 0.5 || fabs(probe->max_y - max_y) > 0.5) {
+        printf("Probed %d: %d stitches %d colors (%f %f) (%f %f), ",
+            probe->source, probe->stitches, probe->colors,
+            probe->min_x, probe->min_y, probe->max_x, probe->max_y);
+        printf("expected %d: %d stitches %d colors (%f %f) (%f %f).\n",
+            source, stitches, colors, min_x, min_y, max_x, max_y);
+        return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,122 @@
+/* Testing that reading from memory matches reading the same file. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../src/embroidery.h"
+
+int test_read_memory(int format);
+int test_read_100(void);
+
+int
+main(void)
+{
+    int formats[] = {EMB_FORMAT_DST, EMB_FORMAT_CSV, EMB_FORMAT_EXP};
+    int i;
+    for (i = 0; i < 3; i++) {
+        int result = test_read_memory(formats[i]);
+        if (result) {
+            printf("Failed for %s.\n", formatTable[formats[i]].extension);
+            return result;
+        }
+    }
+    return test_read_100();
+}
+
+/* A 100 file is read a 4 byte record at a time, up to a last record
+ * that ends where the buffer does.
+ */
+int
+test_read_100(void)
+{
+    const unsigned char records[12] = {
+        0x01, 0, 10, 20,
+        0x01, 0, 0x85, 3,
+        0x1F, 0, 0, 0
+    };
+    unsigned char *buffer = (unsigned char *)malloc(sizeof(records));
+    EmbPattern *p = emb_pattern_create();
+    EmbStitch st;
+    memcpy(buffer, records, sizeof(records));
+    if (!emb_pattern_read_memory(p, buffer, sizeof(records), EMB_FORMAT_100)
+        || p->stitch_list->count != 4) {
+        return 8;
+    }
+    st = p->stitch_list->stitch[2];
+    if (fabs(st.x - 0.5) > 0.001 || fabs(st.y - 2.3) > 0.001
+        || !(p->stitch_list->stitch[3].flags & END)) {
+        printf("Read (%f, %f) from the 100 file.\n", st.x, st.y);
+        return 9;
+    }
+    emb_pattern_free(p);
+    safe_free(buffer);
+    return 0;
+}
+
+int
+test_read_memory(int format)
+{
+    int i;
+    long length;
+    unsigned char *buffer;
+    EmbString fname;
+    EmbPattern *from_file, *from_memory;
+    FILE *f;
+    EmbPattern *p = emb_pattern_create();
+
+    emb_pattern_addThread(p, black_thread);
+    for (i = 0; i < 100; i++) {
+        emb_pattern_addStitchAbs(p, 10 + 10 * sin(i * 0.1), i * 0.2, NORMAL, 0);
+    }
+    emb_pattern_end(p);
+    sprintf(fname, "read_memory%s", formatTable[format].extension);
+    if (!emb_pattern_write(p, fname, format)) {
+        return 1;
+    }
+    emb_pattern_free(p);
+
+    f = fopen(fname, "rb");
+    if (!f) {
+        return 2;
+    }
+    fseek(f, 0, SEEK_END);
+    length = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    buffer = (unsigned char *)malloc(length);
+    if (fread(buffer, 1, length, f) != (size_t)length) {
+        return 3;
+    }
+    fclose(f);
+
+    from_file = emb_pattern_create();
+    from_memory = emb_pattern_create();
+    if (!emb_pattern_read(from_file, fname, format)) {
+        return 4;
+    }
+    if (!emb_pattern_read_memory(from_memory, buffer, length, format)) {
+        return 5;
+    }
+    if (from_file->stitch_list->count != from_memory->stitch_list->count) {
+        printf("Read %d stitches from the file and %d from memory.\n",
+            from_file->stitch_list->count, from_memory->stitch_list->count);
+        return 6;
+    }
+    for (i = 0; i < from_file->stitch_list->count; i++) {
+        EmbStitch a = from_file->stitch_list->stitch[i];
+        EmbStitch b = from_memory->stitch_list->stitch[i];
+        if (a.x != b.x || a.y != b.y || a.flags != b.flags) {
+            printf("Stitch %d differs between the file and memory.\n", i);
+            return 7;
+        }
+    }
+
+    /* A truncated buffer must fail or stop early, not read past the end. */
+    emb_pattern_reset(from_memory);
+    emb_pattern_read_memory(from_memory, buffer, length / 2, format);
+
+    emb_pattern_free(from_file);
+    emb_pattern_free(from_memory);
+    safe_free(buffer);
+    return 0;
+}
@@ -0,0 +1,128 @@
+/* Testing that readers fill in only the parts of a design asked for in
+ * the read options of a pattern, and the same parts as a full read.
+ */
+
+#include <string.h>
+
+#include "../src/embroidery.h"
+#include "design.h"
+
+int read_counts(EmbStream *stream, int format, EmbReadOptions options,
+    int *stitches, int *threads);
+
+int
+main(void)
+{
+    const int formats[5] = {EMB_FORMAT_PES, EMB_FORMAT_PEC, EMB_FORMAT_EXP,
+        EMB_FORMAT_HUS, EMB_FORMAT_DST};
+    /* Stitch only formats get their threads from the stitches, and the
+     * stitches can call for more threads than the file lists. */
+    const int colors[5] = {1, 1, 0, 1, 0};
+    EmbStream *stream, *pes;
+    EmbPattern *p, *q;
+    int i, stitches, threads, s, t, pecstart;
+
+    for (i = 0; i < 5; i++) {
+        p = design(1000);
+        stream = emb_stream_buffer(0);
+        if (!emb_pattern_write_stream(p, stream, 0, formats[i])
+            || !read_counts(stream, formats[i], EMB_READ_ALL, &stitches,
+                &threads)) {
+            return 1;
+        }
+        if (!read_counts(stream, formats[i], EMB_READ_STITCHES, &s, &t)
+            || s != stitches || t != 0) {
+            printf("Format %d read %d stitches and %d threads, not %d and 0.\n",
+                formats[i], s, t, stitches);
+            return 2;
+        }
+        if (!read_counts(stream, formats[i], EMB_READ_THREADS, &s, &t)
+            || s != 0 || (colors[i] ? (t <= 0 || t > threads) : t)) {
+            printf("Format %d read %d stitches and %d threads.\n",
+                formats[i], s, t);
+            return 3;
+        }
+        emb_stream_close(stream);
+        emb_pattern_free(p);
+    }
+
+    /* The descriptions of PES0040 and later are metadata. The PEC
+     * section of a written file goes after a PES0040 header naming it. */
+    p = design(1000);
+    stream = emb_stream_buffer(0);
+    pes = emb_stream_buffer(0);
+    if (!emb_pattern_write_stream(p, stream, 0, EMB_FORMAT_PES)) {
+        return 4;
+    }
+    if (!read_counts(stream, EMB_FORMAT_PES, EMB_READ_ALL, &stitches,
+            &threads)) {
+        return 4;
+    }
+    pecstart = (int)emb_get_u32(stream->data + 8);
+    emb_fwrite("#PES0040", 1, 8, pes);
+    emb_write_i32(pes, 16 + 8 + 4);
+    emb_write_i32(pes, 0);
+    emb_fputc(7, pes);
+    emb_fwrite("Options", 1, 7, pes);
+    fpad(pes, 0, 4);
+    emb_fwrite(stream->data + pecstart, 1, stream->length - pecstart, pes);
+    for (i = 0; i < 2; i++) {
+        q = emb_pattern_create();
+        q->read_options = i ? EMB_READ_ALL : EMB_READ_ALL & ~EMB_READ_METADATA;
+        if (!emb_pattern_read_memory(q, pes->data, pes->length, EMB_FORMAT_PES)
+            || strcmp(q->design_name, i ? "Options" : "")
+            || q->stitch_list->count != stitches) {
+            printf("Read the name \"%s\" and %d stitches from PES0040.\n",
+                q->design_name, q->stitch_list->count);
+            return 5;
+        }
+        emb_pattern_free(q);
+    }
+    emb_stream_close(pes);
+    emb_stream_close(stream);
+    emb_pattern_free(p);
+
+    /* The colors of a DST file are in a file beside it. */
+    p = design(1000);
+    if (!emb_pattern_write(p, "read_options.rgb", EMB_FORMAT_RGB)
+        || !emb_pattern_write(p, "read_options.dst", EMB_FORMAT_DST)) {
+        return 6;
+    }
+    for (i = 0; i < 2; i++) {
+        q = emb_pattern_create();
+        q->read_options = i ? EMB_READ_ALL : EMB_READ_STITCHES;
+        if (!emb_pattern_read(q, "read_options.dst", EMB_FORMAT_DST)
+            || q->thread_list->count != (i ? 2 : 0)) {
+            printf("Read %d threads from beside the DST file.\n",
+                q->thread_list->count);
+            return 7;
+        }
+        emb_pattern_free(q);
+    }
+    remove("read_options.dst");
+    remove("read_options.rgb");
+    emb_pattern_free(p);
+    return 0;
+}
+
+/* Reads a stream in a format with a options, giving the number of
+ * stitches and threads read.
+ */
+int
+read_counts(EmbStream *stream, int format, EmbReadOptions options,
+    int *stitches, int *threads)
+{
+    EmbPattern *p = emb_pattern_create();
+    if (!p) {
+        return 0;
+    }
+    p->read_options = options;
+    if (!emb_pattern_read_memory(p, stream->data, stream->length, format)) {
+        emb_pattern_free(p);
+        return 0;
+    }
+    *stitches = p->stitch_list->count;
+    *threads = p->thread_list->count;
+    emb_pattern_free(p);
+    return 1;
+}
@@ -0,0 +1,96 @@
+/* Testing the stream cursor reads on memory and stdio backings. */
+
+#include <string.h>
+
+#include "../src/embroidery.h"
+
+static const unsigned char data[] = {
+    0x34, 0x12, 0x78, 0x56, 0x34, 0x12, 0x12, 0x34, 0xFF, 0xFE,
+    'a', 'b', '\r', '\n', 'c', '\r', 'd', '\n', 'e'
+};
+
+int test_stream(EmbStream *stream);
+
+int
+main(void)
+{
+    int result;
+    FILE *f;
+    EmbStream *stream = emb_stream_memory(data, sizeof(data));
+    result = test_stream(stream);
+    if (result) {
+        return result;
+    }
+    /* A read-only stream past its (empty) write buffer refuses writes. */
+    if (emb_fwrite("x", 1, 1, stream) != 0
+        || !(stream->flags & EMB_STREAM_ERROR)) {
+        return 11;
+    }
+    emb_stream_close(stream);
+
+    f = fopen("stream.bin", "wb");
+    if (!f) {
+        return 20;
+    }
+    fwrite(data, 1, sizeof(data), f);
+    fclose(f);
+    /* Mapped, or loaded when mapping is not available. */
+    stream = emb_stream_open("stream.bin", "rb");
+    if (!stream || stream->file) {
+        return 21;
+    }
+    result = test_stream(stream);
+    emb_stream_close(stream);
+    if (result) {
+        return 20 + result;
+    }
+    /* Opening for update keeps a stdio stream, the slow path. */
+    stream = emb_stream_open("stream.bin", "rb+");
+    if (!stream || !stream->file) {
+        return 40;
+    }
+    result = test_stream(stream);
+    emb_stream_close(stream);
+    if (result) {
+        return 40 + result;
+    }
+    return 0;
+}
+
+int
+test_stream(EmbStream *stream)
+{
+    char line[10];
+    if (emb_read_u16(stream) != 0x1234) {
+        return 1;
+    }
+    if (emb_read_u32(stream) != 0x12345678) {
+        return 2;
+    }
+    if (emb_read_u16be(stream) != 0x1234) {
+        return 3;
+    }
+    if (emb_read_i16(stream) != -257) {
+        return 4;
+    }
+    if (emb_readline(stream, line, 10) != 2 || strcmp(line, "ab")) {
+        return 5;
+    }
+    if (emb_readline(stream, line, 10) != 1 || strcmp(line, "c")) {
+        return 6;
+    }
+    if (emb_readline(stream, line, 10) != 1 || strcmp(line, "d")) {
+        return 7;
+    }
+    if (emb_fgetc(stream) != 'e' || emb_feof(stream)) {
+        return 8;
+    }
+    if (emb_stream_take(stream, 2) || !emb_feof(stream)) {
+        return 9;
+    }
+    emb_fseek(stream, 0, SEEK_SET);
+    if (emb_feof(stream) || emb_fgetc(stream) != 0x34) {
+        return 10;
+    }
+    return 0;
+}
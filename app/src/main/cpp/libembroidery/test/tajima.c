@@ -0,0 +1,189 @@
+/* Testing the Tajima ternary codec against the bit by bit version it
+ * replaced, and timing the two.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/embroidery.h"
+
+#define RECORDS 100003
+#define ROUNDS 50
+
+void cascade_encode(unsigned char b[3], int x, int y);
+void cascade_decode(const unsigned char b[3], int *x, int *y);
+double seconds(clock_t start);
+
+int
+main(void)
+{
+    unsigned char b[3], c[3];
+    unsigned char *records;
+    int16_t *xs, *ys;
+    int x, y, u, v, i, round;
+    long sum = 0;
+    clock_t start;
+    double cascade, table, batch;
+
+    for (x = -121; x <= 121; x++) {
+        for (y = -121; y <= 121; y++) {
+            cascade_encode(b, x, y);
+            if (!encode_tajima_ternary(c, x, y) || memcmp(b, c, 3)) {
+                printf("Encoding %d %d differs.\n", x, y);
+                return 1;
+            }
+        }
+    }
+    for (i = 0; i < 0x1000000; i++) {
+        b[0] = (unsigned char)i;
+        b[1] = (unsigned char)(i >> 8);
+        b[2] = (unsigned char)(i >> 16);
+        cascade_decode(b, &x, &y);
+        decode_tajima_ternary(b, &u, &v);
+        if (x != u || y != v) {
+            printf("Decoding %02x %02x %02x differs.\n", b[0], b[1], b[2]);
+            return 2;
+        }
+    }
+
+    records = (unsigned char *)malloc(3 * RECORDS);
+    xs = (int16_t *)malloc(RECORDS * sizeof(int16_t));
+    ys = (int16_t *)malloc(RECORDS * sizeof(int16_t));
+    if (!records || !xs || !ys) {
+        return 3;
+    }
+    srand(1);
+    for (i = 0; i < 3 * RECORDS; i++) {
+        records[i] = (unsigned char)rand();
+    }
+    decode_tajima_records(records, RECORDS, xs, ys);
+    for (i = 0; i < RECORDS; i++) {
+        cascade_decode(records + 3*i, &x, &y);
+        if (xs[i] != x || ys[i] != y) {
+            printf("Record %d decodes differently in a batch.\n", i);
+            return 4;
+        }
+    }
+
+    start = clock();
+    for (round = 0; round < ROUNDS; round++) {
+        for (i = 0; i < RECORDS; i++) {
+            cascade_decode(records + 3*i, &x, &y);
+            sum += x + y;
+        }
+    }
+    cascade = seconds(start);
+    start = clock();
+    for (round = 0; round < ROUNDS; round++) {
+        for (i = 0; i < RECORDS; i++) {
+            decode_tajima_ternary(records + 3*i, &x, &y);
+            sum -= x + y;
+        }
+    }
+    table = seconds(start);
+    start = clock();
+    for (round = 0; round < ROUNDS; round++) {
+        decode_tajima_records(records, RECORDS, xs, ys);
+        sum += xs[round] + ys[round];
+    }
+    batch = seconds(start);
+    printf("Decoding %d records: %.2f ms bitwise, %.2f ms by table, "
+        "%.2f ms batched (%ld).\n", RECORDS * ROUNDS,
+        1000.0 * cascade, 1000.0 * table, 1000.0 * batch, sum);
+
+    start = clock();
+    for (round = 0; round < ROUNDS; round++) {
+        for (i = 0; i < RECORDS; i++) {
+            cascade_encode(b, xs[i], ys[i]);
+            sum += b[0] ^ b[1] ^ b[2];
+        }
+    }
+    cascade = seconds(start);
+    start = clock();
+    for (round = 0; round < ROUNDS; round++) {
+        for (i = 0; i < RECORDS; i++) {
+            encode_tajima_ternary(b, xs[i], ys[i]);
+            sum -= b[0] ^ b[1] ^ b[2];
+        }
+    }
+    table = seconds(start);
+    printf("Encoding %d moves: %.2f ms by cascade, %.2f ms by table (%ld).\n",
+        RECORDS * ROUNDS, 1000.0 * cascade, 1000.0 * table, sum);
+
+    safe_free(records);
+    safe_free(xs);
+    safe_free(ys);
+    return 0;
+}
+
+double
+seconds(clock_t start)
+{
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+/* The encoder as it was before the tables, a branch per digit. */
+void
+cascade_encode(unsigned char b[3], int x, int y)
+{
+    const int weight[5] = {81, 27, 9, 3, 1};
+    const int byte[5] = {2, 1, 0, 1, 0};
+    const unsigned char x_bits[5][2] = {
+        {0x04, 0x08}, {0x04, 0x08}, {0x04, 0x08}, {0x01, 0x02}, {0x01, 0x02}
+    };
+    const unsigned char y_bits[5][2] = {
+        {0x20, 0x10}, {0x20, 0x10}, {0x20, 0x10}, {0x80, 0x40}, {0x80, 0x40}
+    };
+    int i;
+    b[0] = 0;
+    b[1] = 0;
+    b[2] = 0;
+    for (i = 0; i < 5; i++) {
+        int half = weight[i] / 2 + 1;
+        if (x >= half) {
+            b[byte[i]] |= x_bits[i][0];
+            x -= weight[i];
+        }
+        if (x <= -half) {
+            b[byte[i]] |= x_bits[i][1];
+            x += weight[i];
+        }
+        if (y >= half) {
+            b[byte[i]] |= y_bits[i][0];
+            y -= weight[i];
+        }
+        if (y <= -half) {
+            b[byte[i]] |= y_bits[i][1];
+            y += weight[i];
+        }
+    }
+}
+
+/* The decoder as it was before the tables, a test per bit. */
+void
+cascade_decode(const unsigned char b[3], int *x, int *y)
+{
+    *x = 0;
+    *y = 0;
+    if (b[0] & 0x01) *x += 1;
+    if (b[0] & 0x02) *x -= 1;
+    if (b[0] & 0x04) *x += 9;
+    if (b[0] & 0x08) *x -= 9;
+    if (b[0] & 0x80) *y += 1;
+    if (b[0] & 0x40) *y -= 1;
+    if (b[0] & 0x20) *y += 9;
+    if (b[0] & 0x10) *y -= 9;
+    if (b[1] & 0x01) *x += 3;
+    if (b[1] & 0x02) *x -= 3;
+    if (b[1] & 0x04) *x += 27;
+    if (b[1] & 0x08) *x -= 27;
+    if (b[1] & 0x80) *y += 3;
+    if (b[1] & 0x40) *y -= 3;
+    if (b[1] & 0x20) *y += 27;
+    if (b[1] & 0x10) *y -= 27;
+    if (b[2] & 0x04) *x += 81;
+    if (b[2] & 0x08) *x -= 81;
+    if (b[2] & 0x20) *y += 81;
+    if (b[2] & 0x10) *y -= 81;
+}
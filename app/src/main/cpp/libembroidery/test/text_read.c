@@ -0,0 +1,80 @@
+/* Testing the bulk readers of the text formats. */
+
+#include <string.h>
+#include <math.h>
+
+#include "../src/embroidery.h"
+#include "design.h"
+
+int compare_stitches(EmbPattern *a, EmbPattern *b, double tolerance);
+
+int
+main(void)
+{
+    const char *text = " -12.5e1,7";
+    EmbReal value = 0.0f;
+    EmbPattern *p, *q;
+    int result;
+
+    if (emb_parse_real(text, text + strlen(text), &value) != text + 8
+        || value != -125.0f) {
+        return 1;
+    }
+    if (emb_parse_real(text + 8, text + strlen(text), &value) != text + 8) {
+        return 2;
+    }
+
+    /* Several megabytes of CSV, so the stitches are parsed in chunks. */
+    p = design(150000);
+    if (!emb_pattern_write(p, "text_read.csv", EMB_FORMAT_CSV)) {
+        return 3;
+    }
+    q = emb_pattern_create();
+    if (!emb_pattern_read(q, "text_read.csv", EMB_FORMAT_CSV)) {
+        return 4;
+    }
+    result = compare_stitches(p, q, 0.0);
+    emb_pattern_free(p);
+    emb_pattern_free(q);
+    if (result) {
+        return 4 + result;
+    }
+
+    p = design(1000);
+    if (!emb_pattern_write(p, "text_read.txt", EMB_FORMAT_TXT)) {
+        return 10;
+    }
+    q = emb_pattern_create();
+    if (!emb_pattern_read(q, "text_read.txt", EMB_FORMAT_TXT)) {
+        return 11;
+    }
+    result = compare_stitches(p, q, 0.051);
+    emb_pattern_free(p);
+    emb_pattern_free(q);
+    if (result) {
+        return 11 + result;
+    }
+    return 0;
+}
+
+int
+compare_stitches(EmbPattern *a, EmbPattern *b, double tolerance)
+{
+    int i;
+    /* Reading adds a home stitch ahead of the one that was written. */
+    if (a->stitch_list->count + 1 != b->stitch_list->count) {
+        printf("Wrote %d stitches and read %d.\n",
+            a->stitch_list->count, b->stitch_list->count);
+        return 1;
+    }
+    for (i = 0; i < a->stitch_list->count; i++) {
+        EmbStitch s = a->stitch_list->stitch[i];
+        EmbStitch t = b->stitch_list->stitch[i + 1];
+        if (fabs(s.x - t.x) > tolerance || fabs(s.y - t.y) > tolerance
+            || s.flags != t.flags) {
+            printf("Stitch %d differs.\n", i);
+            return 2;
+        }
+    }
+    return 0;
+}
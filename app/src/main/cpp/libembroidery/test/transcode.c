@@ -0,0 +1,103 @@
+/* Testing that stitch streaming gives the same files as a full conversion. */
+
+#include <string.h>
+
+#include "../src/embroidery.h"
+#include "design.h"
+
+void add_moves(EmbPattern *p);
+int compare_paths(const char *fname, int from, int to);
+
+int
+main(void)
+{
+    const int formats[2] = {EMB_FORMAT_DST, EMB_FORMAT_EXP};
+    const char *names[2] = {"transcode.dst", "transcode.exp"};
+    EmbPattern *p;
+    int i, j, result;
+
+    for (i = 0; i < 2; i++) {
+        p = design(20000);
+        add_moves(p);
+        if (!emb_pattern_write(p, names[i], formats[i])) {
+            return 1;
+        }
+        emb_pattern_free(p);
+    }
+    for (i = 0; i < 2; i++) {
+        for (j = 0; j < 2; j++) {
+            result = compare_paths(names[i], formats[i], formats[j]);
+            if (result) {
+                printf("Transcoding %s to format %d differs.\n", names[i],
+                    formats[j]);
+                return 10 * (2 * i + j + 1) + result;
+            }
+        }
+    }
+
+    if (convert("transcode.dst", "transcode_out.exp")) {
+        return 2;
+    }
+    p = emb_pattern_create();
+    if (!emb_pattern_read(p, "transcode_out.exp", EMB_FORMAT_EXP)
+        || p->stitch_list->count < 3 * EMB_STITCH_BATCH) {
+        return 3;
+    }
+    emb_pattern_free(p);
+    return 0;
+}
+
+/* Adds jumps long enough to be split and trims to a p, so that several
+ * batches of stitches hold each kind.
+ */
+void
+add_moves(EmbPattern *p)
+{
+    int i;
+    for (i = 0; i < p->stitch_list->count; i++) {
+        EmbStitch *st = p->stitch_list->stitch + i;
+        if (st->flags != NORMAL) {
+            continue;
+        }
+        if (i % 700 == 699) {
+            st->flags = JUMP;
+            st->x += 15.0;
+        }
+        else if (i % 900 == 899) {
+            st->flags = TRIM;
+        }
+    }
+}
+
+int
+compare_paths(const char *fname, int from, int to)
+{
+    int result = 0;
+    EmbPattern *p = emb_pattern_create();
+    EmbStream *full = emb_stream_buffer(0);
+    EmbStream *streamed = emb_stream_buffer(0);
+    EmbStream *in = emb_stream_open(fname, "rb");
+
+    if (!emb_pattern_read(p, fname, from)
+        || !emb_pattern_write_stream(p, full, 0, to)) {
+        result = 1;
+    }
+    else if (!in || !emb_transcode_stitches(in, fname, from, streamed, to)) {
+        result = 2;
+    }
+    else if (full->length != streamed->length) {
+        printf("Wrote %d bytes in full and %d streamed.\n",
+            (int)full->length, (int)streamed->length);
+        result = 3;
+    }
+    else if (memcmp(full->data, streamed->data, full->length)) {
+        result = 4;
+    }
+    if (in) {
+        emb_stream_close(in);
+    }
+    emb_stream_close(full);
+    emb_stream_close(streamed);
+    emb_pattern_free(p);
+    return result;
+}
@@ -0,0 +1,142 @@
+/* Testing that buffered file output matches output gathered in memory. */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/embroidery.h"
+#include "design.h"
+
+void write_steps(EmbStream *stream);
+int compare_file(const char *fname, EmbStream *memory);
+
+int
+main(void)
+{
+    int i, result;
+    EmbStream *file, *memory;
+    EmbPattern *p, *q;
+    FILE *f;
+
+    /* Seeks back across more than one buffer, as header patching does. */
+    file = emb_stream_open("writer.bin", "wb");
+    memory = emb_stream_buffer(0);
+    if (!file || !memory || !file->data) {
+        return 1;
+    }
+    write_steps(file);
+    write_steps(memory);
+    if (emb_ftell(file) != emb_ftell(memory)) {
+        return 2;
+    }
+    if (emb_stream_close(file)) {
+        return 3;
+    }
+    result = compare_file("writer.bin", memory);
+    emb_stream_close(memory);
+    if (result) {
+        return 3 + result;
+    }
+
+    /* A DST file large enough to flush several times. */
+    p = design(60000);
+    q = design(60000);
+    memory = emb_stream_buffer(0);
+    if (!emb_pattern_write_stream(p, memory, 0, EMB_FORMAT_DST)
+        || !emb_pattern_write(q, "writer.dst", EMB_FORMAT_DST)) {
+        return 10;
+    }
+    result = compare_file("writer.dst", memory);
+    emb_stream_close(memory);
+    emb_pattern_free(p);
+    emb_pattern_free(q);
+    if (result) {
+        return 10 + result;
+    }
+
+    /* Writers fix up, split and flip a clone, not the caller's pattern. */
+    p = emb_pattern_create();
+    q = emb_pattern_create();
+    for (i = 0; i < 10; i++) {
+        emb_pattern_addStitchAbs(p, 10.0 * i * i, 5.0 * i, i ? NORMAL : JUMP, 0);
+        emb_pattern_addStitchAbs(q, 10.0 * i * i, 5.0 * i, i ? NORMAL : JUMP, 0);
+    }
+    for (i = 0; i < numberOfFormats; i++) {
+        if (formatTable[i].writer_state == ' ') {
+            continue;
+        }
+        memory = emb_stream_buffer(0);
+        emb_pattern_write_stream(p, memory, 0, i);
+        emb_stream_close(memory);
+        if (p->stitch_list->count != q->stitch_list->count
+            || memcmp(p->stitch_list->stitch, q->stitch_list->stitch,
+                q->stitch_list->count * sizeof(EmbStitch))) {
+            printf("Writing %s changed the pattern.\n",
+                formatTable[i].extension);
+            return 15;
+        }
+    }
+    emb_pattern_free(p);
+    emb_pattern_free(q);
+
+    /* A design small enough to sit in the buffer only fails to be
+     * written when it is flushed on close. */
+    f = fopen("/dev/full", "wb");
+    if (f) {
+        fclose(f);
+        p = emb_pattern_create();
+        emb_pattern_addStitchAbs(p, 1.0, 2.0, NORMAL, 0);
+        emb_pattern_addStitchAbs(p, 3.0, 4.0, NORMAL, 0);
+        if (emb_pattern_write(p, "/dev/full", EMB_FORMAT_EXP)) {
+            return 20;
+        }
+        emb_pattern_free(p);
+    }
+    return 0;
+}
+
+void
+write_steps(EmbStream *stream)
+{
+    int i;
+    long end;
+    fpad(stream, 0, 16);
+    for (i = 0; i < 100000; i++) {
+        emb_write_u32be(stream, (uint32_t)i);
+        emb_fputc(i & 0xFF, stream);
+    }
+    end = emb_ftell(stream);
+    emb_fseek(stream, 4, SEEK_SET);
+    emb_write_u32(stream, (uint32_t)end);
+    emb_fseek(stream, end - 2, SEEK_SET);
+    emb_write_i16(stream, -2);
+    emb_fseek(stream, 0, SEEK_END);
+    emb_fprintf(stream, "%s %ld\n", "end", end);
+    fpad(stream, 'x', 70000);
+    emb_fseek(stream, -10, SEEK_CUR);
+    emb_write_u16be(stream, 0x1234);
+}
+
+int
+compare_file(const char *fname, EmbStream *memory)
+{
+    int result = 0;
+    size_t length;
+    unsigned char *buffer;
+    FILE *f = fopen(fname, "rb");
+    if (!f) {
+        return 1;
+    }
+    buffer = (unsigned char *)malloc(memory->length + 1);
+    length = fread(buffer, 1, memory->length + 1, f);
+    fclose(f);
+    if (length != memory->length) {
+        printf("Wrote %d bytes to the file and %d to memory.\n",
+            (int)length, (int)memory->length);
+        result = 2;
+    }
+    else if (memcmp(buffer, memory->data, length)) {
+        result = 3;
+    }
+    safe_free(buffer);
+    return result;
+}
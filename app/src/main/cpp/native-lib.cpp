@@ -6,6 +6,7 @@
 extern "C" {
 #include "embroidery.h"
 }
+#include "pattern_pool.h"
 
 #define LOG_TAG "NativeLib"
 #define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
@@ -30,7 +31,7 @@ Java_com_example_embviewer_jni_NativeLib_convertEmbToDst(
     const char* inPath  = env->GetStringUTFChars(inputPath, nullptr);
     const char* outPath = env->GetStringUTFChars(outputPath, nullptr);
 
-    EmbPattern* pattern = emb_pattern_create();
+    EmbPattern* pattern = acquire_pattern();
     if (!pattern) {
         env->ReleaseStringUTFChars(inputPath, inPath);
         env->ReleaseStringUTFChars(outputPath, outPath);
@@ -39,7 +40,7 @@ Java_com_example_embviewer_jni_NativeLib_convertEmbToDst(
 
     if (!emb_pattern_read(pattern, inPath, 0)) {
         LOGE("Failed to read: %s", inPath);
-        emb_pattern_free(pattern);
+        release_pattern(pattern);
         env->ReleaseStringUTFChars(inputPath, inPath);
         env->ReleaseStringUTFChars(outputPath, outPath);
         return JNI_FALSE;
@@ -47,13 +48,13 @@ Java_com_example_embviewer_jni_NativeLib_convertEmbToDst(
 
     if (!emb_pattern_write(pattern, outPath, 0)) {
         LOGE("Failed to write: %s", outPath);
-        emb_pattern_free(pattern);
+        release_pattern(pattern);
         env->ReleaseStringUTFChars(inputPath, inPath);
         env->ReleaseStringUTFChars(outputPath, outPath);
         return JNI_FALSE;
     }
 
-    emb_pattern_free(pattern);
+    release_pattern(pattern);
     env->ReleaseStringUTFChars(inputPath, inPath);
     env->ReleaseStringUTFChars(outputPath, outPath);
 
@@ -61,6 +62,101 @@ Java_com_example_embviewer_jni_NativeLib_convertEmbToDst(
     return JNI_TRUE;
 }
 
+/* --- JNI: convertBufferToDst --- */
+/* Reads the design straight out of a direct ByteBuffer, so the caller
+ * does not have to copy a content:// stream to a temporary file first. */
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_example_embviewer_jni_NativeLib_convertBufferToDst(
+        JNIEnv* env, jobject,
+        jobject input, jint length, jint format, jstring outputPath) {
+
+    if (!input || !outputPath || length < 0) return JNI_FALSE;
+
+    void* data = env->GetDirectBufferAddress(input);
+    jlong capacity = env->GetDirectBufferCapacity(input);
+    if (!data || capacity < length) {
+        LOGE("convertBufferToDst needs a direct buffer of %d bytes", length);
+        return JNI_FALSE;
+    }
+
+    EmbPattern* pattern = acquire_pattern();
+    if (!pattern) return JNI_FALSE;
+
+    if (!emb_pattern_read_memory(pattern, data, (size_t)length, format)) {
+        LOGE("Failed to read %d bytes as format %d", length, format);
+        release_pattern(pattern);
+        return JNI_FALSE;
+    }
+
+    const char* outPath = env->GetStringUTFChars(outputPath, nullptr);
+    jboolean ok = emb_pattern_write(pattern, outPath, EMB_FORMAT_DST) ? JNI_TRUE : JNI_FALSE;
+    if (!ok) LOGE("Failed to write: %s", outPath);
+
+    release_pattern(pattern);
+    env->ReleaseStringUTFChars(outputPath, outPath);
+    return ok;
+}
+
+/* --- JNI: convertFdToDst --- */
+/* Converts between two open descriptors, such as those of a SAF
+ * ParcelFileDescriptor, without intermediate files. Both stay open. */
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_example_embviewer_jni_NativeLib_convertFdToDst(
+        JNIEnv*, jobject,
+        jint inputFd, jint format, jint outputFd) {
+
+    EmbPattern* pattern = acquire_pattern();
+    if (!pattern) return JNI_FALSE;
+
+    if (!emb_pattern_read_fd(pattern, inputFd, format)) {
+        LOGE("Failed to read fd %d as format %d", inputFd, format);
+        release_pattern(pattern);
+        return JNI_FALSE;
+    }
+    if (!emb_pattern_write_fd(pattern, outputFd, EMB_FORMAT_DST)) {
+        LOGE("Failed to write fd %d", outputFd);
+        release_pattern(pattern);
+        return JNI_FALSE;
+    }
+    release_pattern(pattern);
+    return JNI_TRUE;
+}
+
+/* --- JNI: formatForName --- */
+extern "C" JNIEXPORT jint JNICALL
+Java_com_example_embviewer_jni_NativeLib_formatForName(
+        JNIEnv* env, jobject,
+        jstring fileName) {
+
+    if (!fileName) return -1;
+    const char* name = env->GetStringUTFChars(fileName, nullptr);
+    int format = emb_identify_format(name);
+    env->ReleaseStringUTFChars(fileName, name);
+    return format;
+}
+
+/* --- JNI: metadataFd --- */
+/* Reports the counts and size from the header where the format has
+ * them, without decoding the stitches. */
+extern "C" JNIEXPORT jstring JNICALL
+Java_com_example_embviewer_jni_NativeLib_metadataFd(
+        JNIEnv* env, jobject,
+        jint fd, jint format) {
+
+    EmbProbe probe;
+    if (!emb_pattern_probe_fd(fd, format, &probe)) {
+        return env->NewStringUTF("Error: read failed");
+    }
+
+    char buf[256];
+    snprintf(buf, sizeof(buf),
+             "Stitches: %d\nThreads: %d\nSize: %.1f x %.1f mm",
+             probe.stitches, probe.colors,
+             probe.max_x - probe.min_x, probe.max_y - probe.min_y);
+
+    return env->NewStringUTF(buf);
+}
+
 /* --- JNI: metadata --- */
 extern "C" JNIEXPORT jstring JNICALL
 Java_com_example_embviewer_jni_NativeLib_metadata(
@@ -70,26 +166,18 @@ Java_com_example_embviewer_jni_NativeLib_metadata(
     if (!filePath) return env->NewStringUTF("Error: path null");
     const char* path = env->GetStringUTFChars(filePath, nullptr);
 
-    EmbPattern* pattern = emb_pattern_create();
-    if (!pattern) {
-        env->ReleaseStringUTFChars(filePath, path);
-        return env->NewStringUTF("Error: create failed");
-    }
-    if (!emb_pattern_read(pattern, path, 0)) {
-        emb_pattern_free(pattern);
+    EmbProbe probe;
+    if (!emb_pattern_probe(path, &probe)) {
         env->ReleaseStringUTFChars(filePath, path);
         return env->NewStringUTF("Error: read failed");
     }
 
-    int stitches = stitch_count(pattern);
-    int threads  = thread_count(pattern);
-
     char buf[256];
     snprintf(buf, sizeof(buf),
-             "File: %s\nStitches: %d\nThreads: %d",
-             path, stitches, threads);
+             "File: %s\nStitches: %d\nThreads: %d\nSize: %.1f x %.1f mm",
+             path, probe.stitches, probe.colors,
+             probe.max_x - probe.min_x, probe.max_y - probe.min_y);
 
-    emb_pattern_free(pattern);
     env->ReleaseStringUTFChars(filePath, path);
 
     return env->NewStringUTF(buf);
@@ -104,13 +192,13 @@ Java_com_example_embviewer_jni_NativeLib_stitches(
     if (!filePath) return nullptr;
     const char* path = env->GetStringUTFChars(filePath, nullptr);
 
-    EmbPattern* pattern = emb_pattern_create();
+    EmbPattern* pattern = acquire_pattern();
     if (!pattern) {
         env->ReleaseStringUTFChars(filePath, path);
         return nullptr;
     }
     if (!emb_pattern_read(pattern, path, 0)) {
-        emb_pattern_free(pattern);
+        release_pattern(pattern);
         env->ReleaseStringUTFChars(filePath, path);
         return nullptr;
     }
@@ -118,7 +206,7 @@ Java_com_example_embviewer_jni_NativeLib_stitches(
     int count = stitch_count(pattern);
     jfloatArray arr = env->NewFloatArray(count * 2);
     if (!arr) {
-        emb_pattern_free(pattern);
+        release_pattern(pattern);
         env->ReleaseStringUTFChars(filePath, path);
         return nullptr;
     }
@@ -135,7 +223,7 @@ Java_com_example_embviewer_jni_NativeLib_stitches(
 
     env->SetFloatArrayRegion(arr, 0, count * 2, coords.data());
 
-    emb_pattern_free(pattern);
+    release_pattern(pattern);
     env->ReleaseStringUTFChars(filePath, path);
 
     return arr;
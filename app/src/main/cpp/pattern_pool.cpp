@@ -0,0 +1,17 @@
+#include <mutex>
+
+#include "pattern_pool.h"
+
+static std::mutex pattern_pool_mutex;
+static EmbPatternPool* pattern_pool = nullptr;
+
+EmbPattern* acquire_pattern() {
+    std::lock_guard<std::mutex> lock(pattern_pool_mutex);
+    if (!pattern_pool) pattern_pool = emb_pattern_pool_create(4);
+    return emb_pattern_pool_get(pattern_pool);
+}
+
+void release_pattern(EmbPattern* p) {
+    std::lock_guard<std::mutex> lock(pattern_pool_mutex);
+    emb_pattern_pool_put(pattern_pool, p);
+}
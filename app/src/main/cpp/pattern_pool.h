@@ -0,0 +1,12 @@
+#pragma once
+
+extern "C" {
+#include "embroidery.h"
+}
+
+/* Patterns are taken from a pool and reset when they are given back,
+ * so repeated calls reuse their memory instead of allocating. One pool
+ * is shared by all of the JNI entry points. Each pattern has a context
+ * of its own, so conversions on different threads share no state. */
+EmbPattern* acquire_pattern();
+void release_pattern(EmbPattern* p);
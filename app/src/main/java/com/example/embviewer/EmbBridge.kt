@@ -10,7 +10,7 @@ data class EmbMetadata(
 
 object EmbBridge {
     init {
-        System.loadLibrary("emb_jni")
+        System.loadLibrary("embroidery-converter")
     }
     external fun convertEmbToDst(inputPath: String, outputPath: String): Int
     external fun readMetadata(inputPath: String): EmbMetadata?
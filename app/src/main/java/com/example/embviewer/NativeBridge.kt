@@ -1,7 +1,7 @@
 package com.example.embviewer
 
 object ativeBridge {
-    init { System.loadLibrary("embbridge") }
+    init { System.loadLibrary("embroidery-converter") }
     external fun convertEmbToDst(inputPath: String, outputPath: String): Int
     external fun getDesignMetadata(inputPath: String): DesignMetadata?
 }
@@ -1,11 +1,17 @@
 package com.example.embviewer.jni
 
+import java.nio.ByteBuffer
+
 object NativeLib {
     init {
         System.loadLibrary("embroidery-converter") // ✅ must match add_library in CMakeLists.txt
     }
 
     external fun convertEmbToDst(inPath: String, outPath: String): Boolean
+    external fun convertBufferToDst(input: ByteBuffer, length: Int, format: Int, outPath: String): Boolean
+    external fun convertFdToDst(inFd: Int, format: Int, outFd: Int): Boolean
+    external fun formatForName(fileName: String): Int
+    external fun metadataFd(fd: Int, format: Int): String?
     external fun metadata(inPath: String): String?
     external fun stitches(inPath: String): FloatArray?
 }
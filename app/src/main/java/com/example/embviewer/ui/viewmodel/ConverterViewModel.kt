@@ -2,6 +2,8 @@ package com.example.embviewer.ui.viewmodel
 
 import android.content.Context
 import android.net.Uri
+import android.os.ParcelFileDescriptor
+import android.provider.OpenableColumns
 import androidx.compose.runtime.getValue
 import androidx.compose.runtime.mutableStateOf
 import androidx.compose.runtime.setValue
@@ -12,7 +14,6 @@ import kotlinx.coroutines.Dispatchers
 import kotlinx.coroutines.launch
 import kotlinx.coroutines.withContext
 import java.io.File
-import java.io.FileOutputStream
 import java.text.SimpleDateFormat
 import java.util.Date
 import java.util.Locale
@@ -42,26 +43,31 @@ class ConverterViewModel : ViewModel() {
             conversionState = ConversionState.Converting
 
             try {
+                val format = withContext(Dispatchers.IO) { formatOf(context, uri) }
+                if (format == null) {
+                    conversionState = ConversionState.Error("Unsupported format")
+                    return@launch
+                }
+
                 val result = withContext(Dispatchers.IO) {
-                    val inputStream = context.contentResolver.openInputStream(uri)
                     val timeStamp = SimpleDateFormat("yyyyMMdd_HHmmss", Locale.getDefault()).format(Date())
-                    val inputFile = File.createTempFile("temp_emb_$timeStamp", ".emb", context.cacheDir)
-
-                    inputStream?.use { input ->
-                        FileOutputStream(inputFile).use { output ->
-                            input.copyTo(output)
-                        }
-                    }
-
                     val outputFile = File.createTempFile("converted_$timeStamp", ".dst", context.cacheDir)
 
-                    val success = NativeLib.convertEmbToDst(
-                        inputFile.absolutePath,
-                        outputFile.absolutePath
-                    )
+                    // The native side reads and writes the descriptors directly,
+                    // so the input is never copied to a temporary file.
+                    val success = context.contentResolver.openFileDescriptor(uri, "r")?.use { input ->
+                        ParcelFileDescriptor.open(
+                            outputFile,
+                            ParcelFileDescriptor.MODE_WRITE_ONLY or ParcelFileDescriptor.MODE_TRUNCATE
+                        ).use { output ->
+                            NativeLib.convertFdToDst(input.fd, format, output.fd)
+                        }
+                    } ?: false
 
                     if (success) {
-                        val metadata = NativeLib.metadata(inputFile.absolutePath) ?: "No metadata"
+                        val metadata = context.contentResolver.openFileDescriptor(uri, "r")?.use {
+                            NativeLib.metadataFd(it.fd, format)
+                        } ?: "No metadata"
                         Pair(outputFile.absolutePath, metadata)
                     } else null
                 }
@@ -77,6 +83,18 @@ class ConverterViewModel : ViewModel() {
         }
     }
 
+    // Picks the reader from the document's display name, or null when the
+    // name is missing or not one of the supported formats.
+    private fun formatOf(context: Context, uri: Uri): Int? {
+        val name = context.contentResolver.query(
+            uri, arrayOf(OpenableColumns.DISPLAY_NAME), null, null, null
+        )?.use { cursor ->
+            if (cursor.moveToFirst()) cursor.getString(0) else null
+        }
+        val format = name?.let { NativeLib.formatForName(it) } ?: -1
+        return if (format >= 0) format else null
+    }
+
     fun resetState() {
         conversionState = ConversionState.Idle
         selectedFileUri = null